@@ -0,0 +1,1938 @@
+/*
+ * cache.c - 샤드 단위로 잠기는 프록시 응답 캐시
+ *
+ * 구조
+ * - 키 해시의 상위 비트로 샤드를, 하위 비트로 샤드 색인(swiss.h)의 첫 그룹을 고른다
+ * - 샤드 mutex는 쓰기 쪽(삽입, 제거, 교체)만 잡는다
+ * - 조회는 잠금 없이 색인 그룹의 7비트 태그를 SSE2로 한 번에 비교하고 태그가 맞은
+ *   엔트리의 키만 본다. 쓰기 쪽은 엔트리를 완성한 뒤 release 저장으로 게시한다
+ * - 떼어낸 엔트리는 epoch_retire로 넘겨, 그 순간 읽고 있던 워커가
+ *   모두 cache_read_end를 지난 뒤에 해제된다. 읽기 구간 밖까지 쓰려고 cache_hold로
+ *   붙잡은 엔트리는 마지막 cache_release 때 해제된다
+ * - 제거 정책 메타데이터는 샤드마다 고정 크기 칸 배열(slots)에 모여 있다.
+ *   칸 하나는 16바이트(엔트리 포인터, freq, 큐 번호, 이웃 칸 번호)라서
+ *   시곗바늘이나 FIFO 스윕이 엔트리 본체를 건드리지 않고 배열만 훑는다
+ * - 적중은 칸의 freq 바이트만 올린다 (이미 상한이면 쓰지도 않음)
+ * - 전체 사용량(cache_used)은 원자 카운터로 관리하여
+ *   어느 샤드에 넣든 MAX_CACHE_SIZE를 넘지 않도록 먼저 예약한 뒤 삽입
+ * - 예산이 부족하면 샤드를 돌아가며 정책대로 하나씩 제거 (샤드 잠금은 한 번에 하나만 잡음)
+ * - 원 서버별 몫을 정했으면 전체 예산보다 먼저 호스트 몫을 예약하고, 모자라면
+ *   그 호스트의 엔트리만 골라 제거 (샤드 칸 배열/큐를 훑어 호스트가 같은 칸을 찾음)
+ * - 신선도는 삽입 때 절대 시각(expires) 하나로 계산해 두고, 조회는 현재 시각과 비교만 함
+ * - TinyLFU 승인: 자리를 비워야 들어갈 수 있는 객체는 정책이 고른 희생자보다
+ *   요청 빈도 추정값(sketch.c)이 클 때만 들어감. 지면 희생자를 그대로 두고 삽입을 거절
+ * - 디스크 계층이 켜져 있으면 정책이 제거한 엔트리는 유예 기간 뒤 해제 대신
+ *   demote 큐로 가고, 전용 스레드가 disk_put 한 뒤 해제 (워커는 디스크 쓰기를 기다리지 않음)
+ * - 큰 객체의 조각은 키만 다른 보통 엔트리라서 칸, 큐, 승인, 몫을 그대로 씀
+ */
+#include <stddef.h>
+#include "cache.h"
+#include "snapshot.h"
+#include "sketch.h"
+#include "radix.h"
+#include "swiss.h"
+
+#define SLOT_NIL 0xffff           // 칸 번호 없음
+#define CACHE_GHOST 1024          // 샤드당 S3-FIFO ghost 해시 개수
+#define CACHE_MAXTHREADS 256      // 통계 슬롯 개수
+#define S3_FREQ_MAX 3             // S3-FIFO freq 상한 (2비트)
+#define DEMOTE_QMAX (8UL << 20)   // 디스크로 내려보내려고 쌓아 둘 수 있는 최대 바이트
+#define ADMIT_ANY (-1)            // 승인 검사 없이 제거 (후보 빈도 대신 넘김)
+#define INDEX_COST (2 * (sizeof(void *) + 1))  // 엔트리 하나가 샤드 색인에서 차지하는 몫 (칸 둘: 항목 + 제어 바이트)
+
+enum { EVICT_REJECT = -1, EVICT_EMPTY = 0, EVICT_DONE = 1 };   // 제거 시도 결과
+
+enum { Q_NONE, Q_SMALL, Q_MAIN };
+
+/* 제거 정책 메타데이터 칸 */
+typedef struct {
+  cache_entry_t *e;                         // NULL이면 빈 칸
+  atomic_uchar freq;                        // 적중 카운터 (CLOCK은 0/1)
+  unsigned char queue;                      // S3-FIFO에서 속한 큐
+  unsigned short prev, next;                // 큐 이웃 (빈 칸이면 next가 free list)
+} cache_slot_t;
+
+/* 칸 번호로 엮은 FIFO (head가 가장 최근) */
+typedef struct {
+  unsigned short head, tail;
+  int n;
+  size_t bytes;
+} slot_queue_t;
+
+typedef struct {
+  pthread_mutex_t mutex;                    // 쓰기 쪽 보호용
+  _Atomic(swiss_table_t *) index;          // 키 색인 (잠금 없이 읽힘, 재구성하면 바뀜)
+  cache_slot_t slots[CACHE_SHARD_SLOTS];    // 정책 메타데이터
+  unsigned short free_head;                 // 빈 칸 리스트
+  int count;                                // 사용 중인 칸 수
+  size_t bytes;                             // 샤드에 든 엔트리 바이트
+  int hand;                                 // CLOCK 시곗바늘
+  slot_queue_t small, main;                 // S3-FIFO 큐
+  unsigned long ghost[CACHE_GHOST];         // S3-FIFO ghost (키 해시 링)
+  int ghost_pos;
+  cache_flight_t *flights;                  // 이 샤드 키에 대해 진행 중인 원 서버 요청
+} __attribute__((aligned(64))) cache_shard_t;
+
+/* 스레드별 통계: 자기 캐시 라인에만 쓰므로 공유 라인 RMW가 없음 */
+typedef struct {
+  atomic_ulong hits, misses, stale, revalidated, inserts, evictions, collapsed;
+  atomic_ulong disk_hits, demotions, warm_hits, admitted, rejected, purged;
+  atomic_ulong seg_hits, seg_fills;
+} __attribute__((aligned(64))) cache_tstats_t;
+
+#define STAT_INC(field) do {                                                 \
+    cache_tstats_t *_t = stats_me();                                         \
+    atomic_store_explicit(&_t->field,                                        \
+        atomic_load_explicit(&_t->field, memory_order_relaxed) + 1,          \
+        memory_order_relaxed);                                               \
+  } while (0)
+
+static cache_shard_t shards[CACHE_NSHARDS];
+static atomic_size_t cache_used;            // 예산에 반영된 전체 바이트
+static int cache_policy = CACHE_POLICY_S3FIFO;
+static int cache_admission = CACHE_ADMIT_TINYLFU;
+static long error_ttl = CACHE_ERROR_TTL;     // 만료 정보 없는 404 / 410의 수명
+static int key_sort_query;                   // 키에서 쿼리 매개변수를 이름순으로 정렬
+static char key_strip[MAXLINE];              // 키에서 뺄 쿼리 매개변수 이름 (쉼표 구분)
+
+/* Vary 표 칸: 원 키 하나의 명세와 변형 목록 (phash가 0이면 빈 칸)
+ * phash만 잠금 없이 먼저 보고, 나머지는 vary_mutex 아래에서 읽고 씀 */
+typedef struct {
+  atomic_ulong phash;
+  char spec[CACHE_VARY_LEN];
+  unsigned long variants[CACHE_VARIANTS_MAX];   // 변형 키 해시 (들어온 순서, 고리)
+  int nvariants, next;
+} vary_slot_t;
+
+static vary_slot_t vary_table[CACHE_VARY_SLOTS];
+static pthread_mutex_t vary_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* 원 서버 몫 표 칸 (hash가 0이면 빈 칸, 0번은 표가 찼을 때 나머지 호스트가 함께 씀)
+ * hash는 host를 다 쓴 뒤 release로 게시하고 칸은 비우지 않으므로 조회는 잠금 없음 */
+typedef struct {
+  atomic_ulong hash;
+  char host[CACHE_HOST_LEN];
+  size_t quota;                             // RAM 캐시에서 쓸 수 있는 최대 바이트
+  atomic_size_t used;                       // 예산에 반영된 바이트
+} __attribute__((aligned(64))) cache_origin_t;
+
+static cache_origin_t origins[CACHE_ORIGINS];
+static pthread_mutex_t origins_mutex = PTHREAD_MUTEX_INITIALIZER;   // 칸 차지
+static size_t default_quota = MAX_CACHE_SIZE;  // 몫을 따로 정하지 않은 호스트의 몫 ("*")
+static int quotas_on;                        // 몫을 하나라도 정했으면 1
+static atomic_uint seg_gens;                 // 조각 캐시 세대 (0은 조각이 아님을 뜻하므로 건너뜀)
+
+static cache_tstats_t tstats[CACHE_MAXTHREADS];
+static atomic_int ntstats;
+static __thread cache_tstats_t *my_stats;
+
+/* demote 큐: 디스크로 내려보낼 엔트리 (넘치면 그냥 해제) */
+static struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t items;
+  cache_entry_t *head, *tail;               // dnext로 엮음
+  size_t bytes;
+} dq = { .mutex = PTHREAD_MUTEX_INITIALIZER, .items = PTHREAD_COND_INITIALIZER };
+
+static cache_tstats_t *stats_me(void) {
+  if (!my_stats)
+    my_stats = &tstats[atomic_fetch_add(&ntstats, 1) % CACHE_MAXTHREADS];
+  return my_stats;
+}
+
+/* FNV-1a 64비트 해시 (키 앞부분 len바이트) */
+#define FNV_OFFSET 1469598103934665603UL
+#define FNV_PRIME 1099511628211UL
+
+static unsigned long hash_bytes(const char *key, size_t len) {
+  unsigned long h = FNV_OFFSET;
+  for (const unsigned char *p = (const unsigned char *)key; len--; p++) {
+    h ^= *p;
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+static cache_shard_t *shard_of(unsigned long hash) {
+  return &shards[(hash >> 56) % CACHE_NSHARDS];
+}
+
+/* 엔트리를 디스크 레코드 모양으로 펼침 (o의 포인터는 e 안을 가리킴) */
+static void entry_obj(const cache_entry_t *e, disk_obj_t *o) {
+  o->hash = e->hash;
+  o->key = e->key;
+  o->etag = e->etag;
+  o->last_mod = e->last_mod;
+  o->data = e->data;
+  o->hdr_len = e->hdr_len;
+  o->len = e->len;
+  o->expires = atomic_load_explicit(&e->expires, memory_order_relaxed);
+  o->born = atomic_load_explicit(&e->born, memory_order_relaxed);
+  o->swr = e->swr;
+  o->sie = e->sie;
+  o->must_revalidate = e->must_revalidate;
+}
+
+/* 정책이 제거한 엔트리를 demote 큐에 넣음
+ * 반환값: 넣었으면 1 (해제는 demote 스레드가 함), 디스크 계층이 없거나 큐가 꽉 찼으면 0
+ */
+static int demote_push(cache_entry_t *e) {
+  if (!disk_enabled()) return 0;
+  pthread_mutex_lock(&dq.mutex);
+  if (dq.bytes + e->size > DEMOTE_QMAX) {
+    pthread_mutex_unlock(&dq.mutex);
+    return 0;
+  }
+  e->dnext = NULL;
+  if (dq.tail) dq.tail->dnext = e;
+  else dq.head = e;
+  dq.tail = e;
+  dq.bytes += e->size;
+  pthread_cond_signal(&dq.items);
+  pthread_mutex_unlock(&dq.mutex);
+  return 1;
+}
+
+static void unreserve(int origin, size_t size);
+
+/* 엔트리는 [cache_entry_t | 응답 | 키 | 검증자] 한 블록으로 슬랩에서 할당
+ * - 예산은 블록을 실제로 돌려줄 때 돌려줌 (limbo나 demote 큐, cache_hold에 붙잡혀 있는
+ *   동안은 계속 차지)
+ */
+static void entry_release(cache_entry_t *e) {
+  if (e->demote && !e->on_disk && !e->ram_only && demote_push(e)) return;
+  unreserve(e->origin, e->size);
+  slab_free(e, e->alloc);
+}
+
+/* 유예 기간이 지남: 캐시가 든 참조를 놓음 (붙잡은 쪽이 없으면 바로 해제) */
+static void entry_free(epoch_node_t *node) {
+  cache_entry_t *e = (cache_entry_t *)((char *)node - offsetof(cache_entry_t, retire));
+  if (atomic_fetch_sub_explicit(&e->refs, 1, memory_order_acq_rel) == 1) entry_release(e);
+}
+
+/* demote 스레드: 큐에서 꺼내 디스크 계층에 쓰고 해제 */
+static void *demote_thread(void *vargp) {
+  cache_entry_t *e;
+  disk_obj_t o;
+
+  pthread_detach(pthread_self());
+  while (1) {
+    pthread_mutex_lock(&dq.mutex);
+    while (!dq.head) pthread_cond_wait(&dq.items, &dq.mutex);
+    e = dq.head;
+    if ((dq.head = e->dnext) == NULL) dq.tail = NULL;
+    dq.bytes -= e->size;
+    pthread_mutex_unlock(&dq.mutex);
+
+    entry_obj(e, &o);
+    if (disk_put(&o)) STAT_INC(demotions);
+    unreserve(e->origin, e->size);
+    slab_free(e, e->alloc);
+  }
+  return NULL;
+}
+
+/********************************
+ * 칸 큐 조작 (샤드 mutex를 잡은 상태에서 호출)
+ ********************************/
+static void queue_push_head(cache_shard_t *s, slot_queue_t *q, int i, int qid) {
+  cache_slot_t *c = &s->slots[i];
+  c->queue = qid;
+  c->prev = SLOT_NIL;
+  c->next = q->head;
+  if (q->head != SLOT_NIL) s->slots[q->head].prev = i; else q->tail = i;
+  q->head = i;
+  q->n++;
+  q->bytes += c->e->size;
+}
+
+static void queue_unlink(cache_shard_t *s, slot_queue_t *q, int i) {
+  cache_slot_t *c = &s->slots[i];
+  if (c->prev != SLOT_NIL) s->slots[c->prev].next = c->next; else q->head = c->next;
+  if (c->next != SLOT_NIL) s->slots[c->next].prev = c->prev; else q->tail = c->prev;
+  c->queue = Q_NONE;
+  c->prev = c->next = SLOT_NIL;
+  q->n--;
+  q->bytes -= c->e->size;
+}
+
+static slot_queue_t *queue_of(cache_shard_t *s, int i) {
+  switch (s->slots[i].queue) {
+  case Q_SMALL: return &s->small;
+  case Q_MAIN: return &s->main;
+  default: return NULL;
+  }
+}
+
+/* S3-FIFO ghost: 최근 S에서 쫓겨난 키 해시의 링 */
+static void ghost_add(cache_shard_t *s, unsigned long h) {
+  s->ghost[s->ghost_pos] = h;
+  s->ghost_pos = (s->ghost_pos + 1) % CACHE_GHOST;
+}
+
+static int ghost_take(cache_shard_t *s, unsigned long h) {
+  for (int i = 0; i < CACHE_GHOST; i++) {
+    if (s->ghost[i] == h) {
+      s->ghost[i] = 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* 예약했던 size 바이트를 전체 예산과 호스트 몫에 돌려줌 */
+static void unreserve(int origin, size_t size) {
+  atomic_fetch_sub(&cache_used, size);
+  if (quotas_on) atomic_fetch_sub(&origins[origin].used, size);
+}
+
+static unsigned long entry_hash(const void *item) {
+  return ((const cache_entry_t *)item)->hash;
+}
+
+/* 샤드 색인에서 키 조회 (key가 NULL이면 해시만 비교)
+ * 잠금 없이 부르면 에포크 안에서, 아니면 샤드 mutex를 잡고 부름
+ * 반환값: 엔트리, 없으면 NULL (pos가 NULL이 아니면 색인 칸 번호) */
+static cache_entry_t *index_find(cache_shard_t *s, unsigned long h, const char *key, size_t *pos) {
+  swiss_probe_t p;
+  cache_entry_t *e;
+
+  swiss_probe(atomic_load_explicit(&s->index, memory_order_acquire), h, &p);
+  while ((e = swiss_next(&p)) != NULL) {
+    if (e->hash == h && (!key || !strcmp(e->key, key))) {
+      if (pos) *pos = p.pos;
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/* 엔트리를 샤드 색인과 칸 배열, 키 색인에서 떼어내 회수에 넘김 (예산은 entry_free가 돌려줌, 샤드 mutex를 잡은 상태에서 호출)
+ * - 지운 칸이 쌓였으면 색인을 재구성해 새 표를 게시 (옛 표는 에포크로 회수)
+ * - 메모리 해제는 에포크 유예 기간 뒤로 미룸
+ */
+static void entry_remove(cache_shard_t *s, cache_entry_t *e) {
+  swiss_table_t *t = atomic_load_explicit(&s->index, memory_order_relaxed), *nt;
+  slot_queue_t *q;
+  size_t pos;
+  int i = e->slot;
+
+  if (swiss_find_item(t, e->hash, e, &pos)) swiss_erase(t, pos);
+  if ((nt = swiss_compact(t, entry_hash)) != t)
+    atomic_store_explicit(&s->index, nt, memory_order_release);
+
+  if ((q = queue_of(s, i)) != NULL) queue_unlink(s, q, i);
+  s->slots[i].e = NULL;
+  atomic_store_explicit(&s->slots[i].freq, 0, memory_order_relaxed);
+  s->slots[i].next = s->free_head;
+  s->free_head = i;
+  s->count--;
+  s->bytes -= e->size;
+  radix_del(e->key, RADIX_RAM);
+
+  epoch_retire(&e->retire, entry_free);
+}
+
+/********************************
+ * 제거 정책 (샤드 mutex를 잡은 상태에서 호출)
+ * - cand: 자리를 원하는 객체의 빈도 추정값, ADMIT_ANY면 승인 검사 없음
+ * - 반환값: EVICT_DONE 하나 제거, EVICT_EMPTY 비울 것이 없음,
+ *   EVICT_REJECT 희생자가 후보보다 자주 쓰여 그대로 둠
+ ********************************/
+
+/* TinyLFU: 후보가 희생자보다 자주 요청되었을 때만 희생자를 내보냄 */
+static int admit(int cand, const cache_entry_t *victim) {
+  int ok = cand == ADMIT_ANY || cand > sketch_estimate(victim->hash);
+  if (cand != ADMIT_ANY) {
+    if (ok) STAT_INC(admitted);
+    else STAT_INC(rejected);
+  }
+  return ok;
+}
+
+/* CLOCK: 시곗바늘이 칸 배열을 순서대로 돌며 freq가 켜진 칸은 끄고 지나감
+ * (거절하면 바늘은 희생자에 멈춰 있음) */
+static int clock_evict(cache_shard_t *s, int cand) {
+  if (s->count == 0) return EVICT_EMPTY;
+  while (1) {
+    cache_slot_t *c = &s->slots[s->hand];
+    if (c->e && !atomic_load_explicit(&c->freq, memory_order_relaxed)) {
+      if (!admit(cand, c->e)) return EVICT_REJECT;
+      s->hand = (s->hand + 1) % CACHE_SHARD_SLOTS;
+      c->e->demote = 1;
+      entry_remove(s, c->e);
+      return EVICT_DONE;
+    }
+    if (c->e) atomic_store_explicit(&c->freq, 0, memory_order_relaxed);
+    s->hand = (s->hand + 1) % CACHE_SHARD_SLOTS;
+  }
+}
+
+/* S3-FIFO
+ * - S가 샤드 바이트의 10%를 넘으면(또는 M이 비었으면) S 꼬리부터:
+ *   한 번이라도 적중했으면 M으로 승격, 아니면 ghost에 해시를 남기고 제거
+ * - 아니면 M 꼬리부터: freq가 남아 있으면 하나 깎고 M head로, 0이면 제거
+ * - 거절하면 희생자는 큐 꼬리에 그대로 둠
+ */
+static int s3fifo_evict(cache_shard_t *s, int cand) {
+  while (s->small.n + s->main.n > 0) {
+    if (s->small.n > 0 && (s->small.bytes * 10 >= s->bytes || s->main.n == 0)) {
+      int i = s->small.tail;
+      cache_slot_t *c = &s->slots[i];
+      if (atomic_load_explicit(&c->freq, memory_order_relaxed)) {
+        queue_unlink(s, &s->small, i);
+        atomic_store_explicit(&c->freq, 0, memory_order_relaxed);
+        queue_push_head(s, &s->main, i, Q_MAIN);
+        continue;
+      }
+      if (!admit(cand, c->e)) return EVICT_REJECT;
+      ghost_add(s, c->e->hash);
+      c->e->demote = 1;
+      entry_remove(s, c->e);
+      return EVICT_DONE;
+    } else {
+      int i = s->main.tail;
+      cache_slot_t *c = &s->slots[i];
+      unsigned char f = atomic_load_explicit(&c->freq, memory_order_relaxed);
+      if (f) {
+        queue_unlink(s, &s->main, i);
+        atomic_store_explicit(&c->freq, f - 1, memory_order_relaxed);
+        queue_push_head(s, &s->main, i, Q_MAIN);
+        continue;
+      }
+      if (!admit(cand, c->e)) return EVICT_REJECT;
+      c->e->demote = 1;
+      entry_remove(s, c->e);
+      return EVICT_DONE;
+    }
+  }
+  return EVICT_EMPTY;
+}
+
+static int policy_evict(cache_shard_t *s, int cand) {
+  int n = cache_policy == CACHE_POLICY_CLOCK ? clock_evict(s, cand) : s3fifo_evict(s, cand);
+  if (n == EVICT_DONE) STAT_INC(evictions);
+  return n;
+}
+
+/* start 샤드부터 돌면서 정책대로 하나를 제거
+ * 반환값: EVICT_DONE, 캐시가 비어 있으면 EVICT_EMPTY, 승인 거절이면 EVICT_REJECT
+ */
+static int evict_one(int start, int cand) {
+  for (int i = 0; i < CACHE_NSHARDS; i++) {
+    cache_shard_t *s = &shards[(start + i) % CACHE_NSHARDS];
+    pthread_mutex_lock(&s->mutex);
+    int n = policy_evict(s, cand);
+    pthread_mutex_unlock(&s->mutex);
+    if (n != EVICT_EMPTY) return n;
+  }
+  return EVICT_EMPTY;
+}
+
+/* size 바이트를 예산에서 예약, 모자라면 제거를 반복
+ * - cand: 승인 검사에 쓸 후보 빈도 (ADMIT_ANY면 검사 없음)
+ * - 제거한 엔트리는 유예 기간이 지나 해제될 때 예산을 돌려주므로, 비울 것이 없으면
+ *   limbo를 한 번 회수해 보고 그래도 모자라면 실패 (읽기 구간을 오래 잡은 워커가 있으면
+ *   해제될 때까지 새 삽입이 예산을 넘지 않음)
+ * 반환값: 예약 성공 1, 비울 것이 없거나 승인 거절이면 0
+ */
+static int reserve(size_t size, int start, int cand) {
+  size_t cur = atomic_load(&cache_used), before;
+  int r;
+
+  while (1) {
+    if (cur + size <= MAX_CACHE_SIZE) {
+      if (atomic_compare_exchange_weak(&cache_used, &cur, cur + size)) return 1;
+      continue;                                  // 실패 시 cur가 갱신됨
+    }
+    if ((r = evict_one(start, cand)) != EVICT_DONE) {
+      if (r == EVICT_REJECT) return 0;
+      before = cur;
+      epoch_collect();
+      if ((cur = atomic_load(&cache_used)) >= before) return 0;
+      continue;
+    }
+    cur = atomic_load(&cache_used);
+  }
+}
+
+/********************************
+ * 원 서버별 몫
+ ********************************/
+
+/* host[0..len)의 몫 표 칸 번호 (없으면 quota로 새로 차지, set이면 있는 칸의 몫도 바꿈)
+ * 표가 찼거나 호스트가 너무 길면 0 */
+static int origin_slot(const char *host, size_t len, size_t quota, int set) {
+  unsigned long h = hash_bytes(host, len), cur;
+  int i, n;
+
+  if (!h) h = 1;
+  if (len >= CACHE_HOST_LEN) return 0;
+  for (n = 0, i = 1 + h % (CACHE_ORIGINS - 1); n < CACHE_ORIGINS - 1; ) {
+    cur = atomic_load_explicit(&origins[i].hash, memory_order_acquire);
+    if (cur == h && !strncmp(origins[i].host, host, len) && !origins[i].host[len]) {
+      if (set) origins[i].quota = quota;
+      return i;
+    }
+    if (cur == 0) {
+      pthread_mutex_lock(&origins_mutex);
+      if (atomic_load_explicit(&origins[i].hash, memory_order_relaxed) == 0) {
+        memcpy(origins[i].host, host, len);
+        origins[i].host[len] = '\0';
+        origins[i].quota = quota;
+        atomic_store_explicit(&origins[i].hash, h, memory_order_release);
+        pthread_mutex_unlock(&origins_mutex);
+        return i;
+      }
+      pthread_mutex_unlock(&origins_mutex);
+      continue;                                  // 그새 누가 차지함: 같은 칸을 다시 봄
+    }
+    n++;
+    i = 1 + i % (CACHE_ORIGINS - 1);
+  }
+  return 0;
+}
+
+/* 키가 속한 호스트의 몫 표 칸 번호 (몫을 쓰지 않으면 0) */
+static int origin_of(const char *key) {
+  return quotas_on ? origin_slot(key, strcspn(key, "/\n"), default_quota, 0) : 0;
+}
+
+/* 샤드 s에서 호스트 o의 엔트리 하나를 정책 순서대로 골라 제거 (샤드 mutex를 잡은 상태에서 호출)
+ * - S3-FIFO는 S, M 꼬리부터, CLOCK은 시곗바늘부터 훑어 적중 기록이 없는 첫 엔트리를,
+ *   모두 적중한 적이 있으면 가장 먼저 만난 엔트리를 고름
+ * - 다른 호스트 칸의 freq나 큐 위치는 건드리지 않음
+ */
+static int origin_evict(cache_shard_t *s, int o, int cand) {
+  cache_entry_t *victim = NULL, *any = NULL, *e;
+  int i, n;
+
+  if (cache_policy == CACHE_POLICY_S3FIFO) {
+    slot_queue_t *qs[2] = { &s->small, &s->main };
+    for (n = 0; n < 2 && !victim; n++) {
+      for (i = qs[n]->tail; i != SLOT_NIL && !victim; i = s->slots[i].prev) {
+        if ((e = s->slots[i].e)->origin != o) continue;
+        if (!any) any = e;
+        if (!atomic_load_explicit(&s->slots[i].freq, memory_order_relaxed)) victim = e;
+      }
+    }
+  } else {
+    for (n = 0, i = s->hand; n < CACHE_SHARD_SLOTS && !victim; n++, i = (i + 1) % CACHE_SHARD_SLOTS) {
+      if (!(e = s->slots[i].e) || e->origin != o) continue;
+      if (!any) any = e;
+      if (!atomic_load_explicit(&s->slots[i].freq, memory_order_relaxed)) victim = e;
+    }
+  }
+  if (!victim && !(victim = any)) return EVICT_EMPTY;
+  if (!admit(cand, victim)) return EVICT_REJECT;
+  if (s->slots[victim->slot].queue == Q_SMALL) ghost_add(s, victim->hash);
+  victim->demote = 1;
+  entry_remove(s, victim);
+  STAT_INC(evictions);
+  return EVICT_DONE;
+}
+
+/* start 샤드부터 돌며 호스트 o의 엔트리 하나를 제거 (반환값은 evict_one과 같음) */
+static int origin_evict_one(int o, int start, int cand) {
+  for (int i = 0; i < CACHE_NSHARDS; i++) {
+    cache_shard_t *s = &shards[(start + i) % CACHE_NSHARDS];
+    pthread_mutex_lock(&s->mutex);
+    int n = origin_evict(s, o, cand);
+    pthread_mutex_unlock(&s->mutex);
+    if (n != EVICT_EMPTY) return n;
+  }
+  return EVICT_EMPTY;
+}
+
+/* size 바이트를 호스트 o의 몫에서 예약, 모자라면 그 호스트의 엔트리를 제거
+ * 반환값: 예약 성공 1 (몫을 쓰지 않으면 항상 1), 실패 0
+ */
+static int quota_reserve(int o, size_t size, int start, int cand) {
+  cache_origin_t *g = &origins[o];
+  size_t cur, before;
+  int r;
+
+  if (!quotas_on) return 1;
+  if (size > g->quota) return 0;
+  cur = atomic_load(&g->used);
+  while (1) {
+    if (cur + size <= g->quota) {
+      if (atomic_compare_exchange_weak(&g->used, &cur, cur + size)) return 1;
+      continue;
+    }
+    if ((r = origin_evict_one(o, start, cand)) != EVICT_DONE) {
+      if (r == EVICT_REJECT) return 0;
+      before = cur;                              // reserve와 같이 limbo를 한 번 회수해 봄
+      epoch_collect();
+      if ((cur = atomic_load(&g->used)) >= before) return 0;
+      continue;
+    }
+    cur = atomic_load(&g->used);
+  }
+}
+
+/* 호스트의 몫 설정 (cache_init 전에, 워커를 만들기 전에 호출)
+ * - host는 키와 같은 모양으로 맞춤: 소문자, 기본 포트 ":80"은 뺌. "*"면 기본 몫
+ * 반환값: 성공 0, 호스트 표가 찼거나 너무 길면 -1
+ */
+int cache_set_quota(const char *host, size_t bytes) {
+  char h[CACHE_HOST_LEN];
+  size_t len = strlen(host);
+
+  if (bytes > MAX_CACHE_SIZE) bytes = MAX_CACHE_SIZE;
+  quotas_on = 1;
+  if (!strcmp(host, "*")) {
+    default_quota = origins[0].quota = bytes;
+    return 0;
+  }
+  if (len >= sizeof(h)) return -1;
+  for (size_t i = 0; i <= len; i++) h[i] = tolower((unsigned char)host[i]);
+  if (len > 3 && !strcmp(h + len - 3, ":80")) h[len -= 3] = '\0';
+  return origin_slot(h, len, bytes, 1) ? 0 : -1;
+}
+
+/* 몫 표 칸 i의 사용량 (비동기 시그널 안전: 잠금 없이 읽기만 함)
+ * 반환값: 쓰는 칸이면 1 (0번 칸의 host는 "*") */
+int cache_origin_stat(int i, const char **host, size_t *used, size_t *quota) {
+  if (!quotas_on || i < 0 || i >= CACHE_ORIGINS) return 0;
+  if (i > 0 && !atomic_load_explicit(&origins[i].hash, memory_order_acquire)) return 0;
+  *host = i ? origins[i].host : "*";
+  *used = atomic_load_explicit(&origins[i].used, memory_order_relaxed);
+  *quota = origins[i].quota;
+  return 1;
+}
+
+void cache_init(int policy, int admission) {
+  cache_policy = policy;
+  cache_admission = admission;
+  for (int i = 0; i < CACHE_NSHARDS; i++) {
+    cache_shard_t *s = &shards[i];
+    pthread_mutex_init(&s->mutex, NULL);
+    atomic_init(&s->index, swiss_new(CACHE_INDEX_SLOTS));
+    for (int c = 0; c < CACHE_SHARD_SLOTS; c++) {
+      s->slots[c].e = NULL;
+      atomic_init(&s->slots[c].freq, 0);
+      s->slots[c].queue = Q_NONE;
+      s->slots[c].prev = SLOT_NIL;
+      s->slots[c].next = (c + 1 < CACHE_SHARD_SLOTS) ? c + 1 : SLOT_NIL;
+    }
+    s->free_head = 0;
+    s->count = 0;
+    s->bytes = 0;
+    s->hand = 0;
+    s->small = s->main = (slot_queue_t){ SLOT_NIL, SLOT_NIL, 0, 0 };
+    memset(s->ghost, 0, sizeof(s->ghost));
+    s->ghost_pos = 0;
+    s->flights = NULL;
+  }
+  atomic_store(&cache_used, 0);
+  origins[0].quota = default_quota;
+  if (disk_enabled()) {
+    pthread_t tid;
+    pthread_create(&tid, NULL, demote_thread, NULL);
+  }
+}
+
+/* 정책 이름 -> 상수, 모르는 이름이면 -1 */
+int cache_policy_parse(const char *name) {
+  if (!strcasecmp(name, "clock")) return CACHE_POLICY_CLOCK;
+  if (!strcasecmp(name, "s3fifo") || !strcasecmp(name, "s3-fifo")) return CACHE_POLICY_S3FIFO;
+  return -1;
+}
+
+const char *cache_policy_name(void) {
+  return cache_policy == CACHE_POLICY_CLOCK ? "clock" : "s3fifo";
+}
+
+/* 승인 정책 이름 -> 상수, 모르는 이름이면 -1 */
+int cache_admission_parse(const char *name) {
+  if (!strcasecmp(name, "none")) return CACHE_ADMIT_ALL;
+  if (!strcasecmp(name, "tinylfu")) return CACHE_ADMIT_TINYLFU;
+  return -1;
+}
+
+const char *cache_admission_name(void) {
+  return cache_admission == CACHE_ADMIT_TINYLFU ? "tinylfu" : "none";
+}
+
+/* 요청 한 번을 빈도 sketch에 기록 (doit에서 캐시를 조회하는 요청마다) */
+void cache_record(const cache_key_t *key) {
+  if (cache_admission == CACHE_ADMIT_TINYLFU) sketch_record(key->hash);
+}
+
+/* 키 정규화 설정 (시작할 때 한 번)
+ * - sort_query: 쿼리 매개변수를 이름순으로 정렬
+ * - strip: 뺄 매개변수 이름을 쉼표로 구분 ("utm_*"처럼 끝이 *면 접두사로 비교), NULL이면 없음
+ */
+void cache_key_config(int sort_query, const char *strip) {
+  key_sort_query = sort_query;
+  snprintf(key_strip, sizeof(key_strip), "%s", strip ? strip : "");
+}
+
+/* 정규화한 키를 쓰면서 해시도 같이 갱신 (버퍼가 차면 더 쓰지 않음) */
+static void key_put(cache_key_t *k, size_t *len, char c) {
+  if (*len >= MAXLINE - 1) return;
+  k->str[(*len)++] = c;
+  k->hash = (k->hash ^ (unsigned char)c) * FNV_PRIME;
+}
+
+static int hexval(char c) {
+  return isdigit((unsigned char)c) ? c - '0' : tolower((unsigned char)c) - 'a' + 10;
+}
+
+/* p의 글자 하나(또는 %XX 하나)를 정규화해서 쓰고 다음 위치를 반환
+ * - %XX가 비예약 문자(ALPHA DIGIT - . _ ~)면 그 글자로 풀고, 아니면 대문자 16진수로 */
+static const char *key_put_pct(cache_key_t *k, size_t *len, const char *p) {
+  if (p[0] == '%' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2])) {
+    char c = (char)(hexval(p[1]) * 16 + hexval(p[2]));
+    if (isalnum((unsigned char)c) || strchr("-._~", c)) {
+      key_put(k, len, c);
+    } else {
+      key_put(k, len, '%');
+      key_put(k, len, toupper((unsigned char)p[1]));
+      key_put(k, len, toupper((unsigned char)p[2]));
+    }
+    return p + 3;
+  }
+  key_put(k, len, *p);
+  return p + 1;
+}
+
+/* 쿼리 매개변수 p(길이 n)에서 이름 부분 길이 */
+static size_t param_name_len(const char *p, size_t n) {
+  size_t nlen = strcspn(p, "=");
+  return nlen < n ? nlen : n;
+}
+
+/* 쿼리 매개변수 p(길이 n)가 -Q 목록에 있는지 */
+static int key_stripped(const char *p, size_t n) {
+  size_t nlen = param_name_len(p, n);
+  const char *s = key_strip, *e;
+
+  for (; *s; s = *e ? e + 1 : e) {
+    size_t slen = (e = s + strcspn(s, ",")) - s;
+    if (slen && s[slen - 1] == '*' ? nlen >= slen - 1 && !strncmp(p, s, slen - 1)
+                                   : nlen == slen && !strncmp(p, s, slen))
+      return 1;
+  }
+  return 0;
+}
+
+/* 쿼리 매개변수 이름 비교 (정렬용, 원문 바이트 순)
+ * 값은 보지 않으므로 이름이 같은 매개변수는 원래 순서를 지킴 */
+static int param_cmp(const char *a, size_t an, const char *b, size_t bn) {
+  int c;
+
+  an = param_name_len(a, an);
+  bn = param_name_len(b, bn);
+  c = memcmp(a, b, an < bn ? an : bn);
+  return c ? c : (an > bn) - (an < bn);
+}
+
+/* parse_uri 결과로 정규화한 캐시 키와 해시를 만듦 (규칙은 cache.h 참고) */
+void cache_make_key(cache_key_t *key, const char *hostname, const char *port, const char *path) {
+  struct { const char *p; size_t n; } q[CACHE_KEY_QUERY_MAX];
+  const char *p;
+  size_t len = 0, base;
+  int nq = 0;
+
+  key->vary[0] = '\0';
+  key->hash = FNV_OFFSET;
+  for (p = hostname; *p; p++) key_put(key, &len, tolower((unsigned char)*p));
+  for (p = port; *p == '0' && p[1]; p++)
+    ;
+  if (*p && strcmp(p, "80")) {
+    key_put(key, &len, ':');
+    for (; *p; p++) key_put(key, &len, *p);
+  }
+
+  /* 경로: 세그먼트 하나를 쓴 뒤 "."이면 되돌리고, ".."이면 앞 세그먼트까지 지움
+   * 마지막 세그먼트가 점 세그먼트면 디렉터리를 가리키도록 '/'를 남김 */
+  base = len;
+  for (p = path; *p == '/'; ) {
+    size_t mark = len, seg;
+    unsigned long hmark = key->hash;
+
+    key_put(key, &len, '/');
+    for (p++; *p && *p != '/' && *p != '?' && *p != '#'; )
+      p = key_put_pct(key, &len, p);
+    seg = len - mark - 1;
+    if (seg == 1 && key->str[mark + 1] == '.') {
+      len = mark;
+      key->hash = hmark;
+    }
+    else if (seg == 2 && key->str[mark + 1] == '.' && key->str[mark + 2] == '.') {
+      for (len = mark; len > base && key->str[len - 1] != '/'; len--)
+        ;
+      if (len > base) len--;
+      key->hash = hash_bytes(key->str, len);
+    }
+    else continue;
+    if (*p != '/') key_put(key, &len, '/');
+  }
+  if (len == base) key_put(key, &len, '/');
+
+  /* 쿼리: 정렬도 제거도 하지 않으면 글자 단위로 정규화만 */
+  if (*p == '?' && !key_sort_query && !key_strip[0]) {
+    while (*p && *p != '#') p = key_put_pct(key, &len, p);
+  }
+  else if (*p == '?') {
+    for (p++; *p && *p != '#'; ) {
+      size_t n = nq == CACHE_KEY_QUERY_MAX - 1 ? strcspn(p, "#") : strcspn(p, "&#");
+      if (n && !key_stripped(p, n)) {
+        int i = nq++;
+        /* 삽입 정렬 (매개변수는 보통 몇 개뿐) */
+        for (; key_sort_query && i > 0 && param_cmp(q[i - 1].p, q[i - 1].n, p, n) > 0; i--)
+          q[i] = q[i - 1];
+        q[i].p = p;
+        q[i].n = n;
+      }
+      p += n;
+      if (*p == '&') p++;
+    }
+    for (int i = 0; i < nq; i++) {
+      key_put(key, &len, i ? '&' : '?');
+      for (p = q[i].p; p < q[i].p + q[i].n; )
+        p = key_put_pct(key, &len, p);
+    }
+  }
+  key->str[len] = '\0';
+  key->plen = len;
+  key->phash = key->hash;
+}
+
+/* 보관한 요청 헤더 hdrs에서 name(콜론 없이, 길이 nlen) 줄의 값을 찾음
+ * 반환값: 값 시작 (앞 공백 없음, *vlen에 CRLF 앞까지 길이), 없으면 NULL */
+static const char *request_value(const char *hdrs, const char *name, size_t nlen, size_t *vlen) {
+  const char *line, *eol, *v;
+
+  for (line = hdrs; *line; line = eol) {
+    eol = strchr(line, '\n');
+    eol = eol ? eol + 1 : line + strlen(line);
+    if (strncasecmp(line, name, nlen) || line[nlen] != ':') continue;
+    v = line + nlen + 1;
+    v += strspn(v, " \t");
+    for (*vlen = strcspn(v, "\r\n"); *vlen > 0 && (v[*vlen - 1] == ' ' || v[*vlen - 1] == '\t'); (*vlen)--)
+      ;
+    return v;
+  }
+  return NULL;
+}
+
+/* Accept-Encoding 값을 묶음 이름으로 (q=0인 코딩은 받지 않는 것으로 봄) */
+static const char *encoding_bucket(const char *v, size_t n) {
+  const char *end = v + n;
+  int br = 0, gzip = 0;
+
+  while (v < end) {
+    size_t tlen, plen;
+    const char *q;
+
+    v += strspn(v, " \t,");
+    if (v >= end) break;
+    for (plen = 0; v + plen < end && v[plen] != ','; plen++)
+      ;
+    tlen = strcspn(v, " \t;,");
+    if (tlen > plen) tlen = plen;
+    q = memchr(v, ';', plen);
+    if (!(q && (q = strstr(q, "q=")) && q < v + plen && strtod(q + 2, NULL) == 0)) {
+      if ((tlen == 2 && !strncasecmp(v, "br", 2)) || (tlen == 1 && *v == '*')) br = gzip = 1;
+      else if ((tlen == 4 && !strncasecmp(v, "gzip", 4)) || (tlen == 6 && !strncasecmp(v, "x-gzip", 6)))
+        gzip = 1;
+    }
+    v += plen;
+  }
+  return br ? "br" : gzip ? "gzip" : "identity";
+}
+
+/* 원 키에 Vary 명세가 있으면 요청 헤더 값들로 변형 키를 만듦
+ * - 헤더마다 '\n' 뒤에 정규화한 값을 붙이고 해시는 원 키 해시에서 이어서 계산
+ * 반환값: 변형 키로 바꿨으면 1, 명세가 없어 원 키 그대로면 0
+ */
+int cache_vary_key(cache_key_t *key, const char *hdrs) {
+  vary_slot_t *t = &vary_table[key->phash % CACHE_VARY_SLOTS];
+  const char *name, *v;
+  size_t len = key->plen, nlen, vlen;
+
+  key->vary[0] = '\0';
+  if (atomic_load_explicit(&t->phash, memory_order_acquire) != key->phash) return 0;
+  pthread_mutex_lock(&vary_mutex);
+  if (atomic_load_explicit(&t->phash, memory_order_relaxed) == key->phash) strcpy(key->vary, t->spec);
+  pthread_mutex_unlock(&vary_mutex);
+  if (!key->vary[0]) return 0;
+
+  for (name = key->vary; *name; name += nlen + (name[nlen] == ',')) {
+    nlen = strcspn(name, ",");
+    key_put(key, &len, '\n');
+    v = request_value(hdrs, name, nlen, &vlen);
+    if (nlen == 15 && !strncmp(name, "accept-encoding", 15)) {
+      for (const char *b = encoding_bucket(v ? v : "", v ? vlen : 0); *b; b++) key_put(key, &len, *b);
+    }
+    else if (v && !(nlen == 10 && !strncmp(name, "user-agent", 10))) {
+      for (const char *e = v + vlen; v < e; v++) {
+        if (*v == ' ' || *v == '\t') {
+          if (v[-1] != ' ' && v[-1] != '\t') key_put(key, &len, ' ');
+        }
+        else key_put(key, &len, tolower((unsigned char)*v));
+      }
+    }
+  }
+  key->str[len] = '\0';
+  return 1;
+}
+
+/* 응답에서 본 Vary 명세가 요청 키의 명세와 다를 때 원 키의 명세를 바꿈
+ * - 빈 명세나 "*"면 원 키를 표에서 지움 (원 키 그대로 캐시하거나 아예 캐시하지 않음)
+ */
+void cache_vary_learn(const cache_key_t *key, const char *vary) {
+  vary_slot_t *t = &vary_table[key->phash % CACHE_VARY_SLOTS];
+
+  pthread_mutex_lock(&vary_mutex);
+  if (vary[0] && strcmp(vary, "*")) {
+    strcpy(t->spec, vary);
+    t->nvariants = t->next = 0;
+    atomic_store_explicit(&t->phash, key->phash, memory_order_release);
+  }
+  else if (atomic_load_explicit(&t->phash, memory_order_relaxed) == key->phash) {
+    atomic_store_explicit(&t->phash, 0, memory_order_release);
+  }
+  pthread_mutex_unlock(&vary_mutex);
+}
+
+/* 변형 키로 삽입한 뒤 원 키의 변형 목록에 올림
+ * 반환값: 목록이 차서 밀려난 변형의 해시 (없으면 0)
+ */
+static unsigned long vary_register(const cache_key_t *key) {
+  vary_slot_t *t = &vary_table[key->phash % CACHE_VARY_SLOTS];
+  unsigned long old = 0;
+  int i;
+
+  pthread_mutex_lock(&vary_mutex);
+  if (atomic_load_explicit(&t->phash, memory_order_relaxed) == key->phash && !strcmp(t->spec, key->vary)) {
+    for (i = 0; i < t->nvariants && t->variants[i] != key->hash; i++)
+      ;
+    if (i == t->nvariants) {
+      if (t->nvariants < CACHE_VARIANTS_MAX) {
+        t->variants[t->nvariants++] = key->hash;
+      } else {
+        old = t->variants[t->next];
+        t->variants[t->next] = key->hash;
+        t->next = (t->next + 1) % CACHE_VARIANTS_MAX;
+      }
+    }
+  }
+  pthread_mutex_unlock(&vary_mutex);
+  return old;
+}
+
+/* 읽기 구간: 이 사이에서 얻은 엔트리 포인터는 해제되지 않음 */
+void cache_read_begin(void) {
+  epoch_enter();
+}
+
+void cache_read_end(void) {
+  epoch_exit();
+}
+
+/* 엔트리를 읽기 구간 밖에서도 쓰도록 붙잡음 (cache_read_begin/cache_read_end 사이에서 호출)
+ * - 느린 클라이언트에 큰 응답을 보내는 동안 읽기 구간을 잡고 있지 않도록, 그 엔트리만
+ *   붙잡아 두고 cache_release로 놓음. 그사이 제거되어도 메모리(와 예산)가 남음
+ * 반환값: 붙잡았으면 1, 디스크 레코드를 보여 주는 임시 엔트리(slot이 -1)라 못 붙잡으면 0
+ */
+int cache_hold(cache_entry_t *e) {
+  if (e->slot < 0) return 0;
+  atomic_fetch_add_explicit(&e->refs, 1, memory_order_relaxed);  // 유예 기간 안이라 아직 1 이상
+  return 1;
+}
+
+/* cache_hold로 붙잡은 엔트리를 놓음 (읽기 구간 밖에서 불러도 됨) */
+void cache_release(cache_entry_t *e) {
+  if (atomic_fetch_sub_explicit(&e->refs, 1, memory_order_acq_rel) == 1) entry_release(e);
+}
+
+static cache_entry_t *insert_entry(const disk_obj_t *o, int promote, int on_disk,
+                                   unsigned int seg_gen, size_t seg_total);
+
+/* RAM에 올리지 못한 디스크/스냅샷 레코드를 엔트리 모양으로 보여 주는 스레드별 임시 엔트리 */
+static __thread cache_entry_t view_entry;
+
+static cache_entry_t *entry_view(const disk_obj_t *o, int on_disk) {
+  cache_entry_t *e = &view_entry;
+
+  e->hash = o->hash;
+  e->slot = -1;
+  e->key = (char *)o->key;
+  e->data = (char *)o->data;
+  e->hdr_len = o->hdr_len;
+  e->len = o->len;
+  atomic_store_explicit(&e->expires, o->expires, memory_order_relaxed);
+  atomic_store_explicit(&e->born, o->born, memory_order_relaxed);
+  e->swr = o->swr;
+  e->sie = o->sie;
+  e->must_revalidate = o->must_revalidate;
+  e->etag = (char *)o->etag;
+  e->last_mod = (char *)o->last_mod;
+  e->on_disk = on_disk;
+  return e;
+}
+
+/* RAM 샤드에서 키 조회 (적중하면 칸의 freq를 올림) */
+static cache_entry_t *ram_lookup(unsigned long h, const char *key) {
+  cache_shard_t *s = shard_of(h);
+  cache_entry_t *e = index_find(s, h, key, NULL);
+
+  if (e) {
+    cache_slot_t *c = &s->slots[e->slot];
+    unsigned char max = cache_policy == CACHE_POLICY_CLOCK ? 1 : S3_FREQ_MAX;
+    unsigned char f = atomic_load_explicit(&c->freq, memory_order_relaxed);
+    if (f < max && c->e == e)
+      atomic_store_explicit(&c->freq, f + 1, memory_order_relaxed);
+  }
+  return e;
+}
+
+/* 키로 엔트리 조회 (cache_read_begin/cache_read_end 사이에서 호출)
+ * - 잠금도, 공유 라인에 대한 원자적 RMW도 없음
+ * - 적중하면 칸의 freq만 올림. 상한이면 쓰지 않아 캐시 라인을 더럽히지 않음
+ *   (칸이 이미 다른 엔트리에 재사용되었으면 건드리지 않음)
+ * - RAM에 없으면 디스크 계층, 그다음 웜 재시작 스냅샷을 찾아 보고,
+ *   MAX_OBJECT_SIZE 이하면 RAM으로 올림. 그보다 크면(또는 예산이 없으면)
+ *   매핑을 가리키는 임시 엔트리를 돌려줌
+ * - 만료된 엔트리도 돌려줌 (재검증에 검증자가 필요). 신선한지는 cache_fresh로 확인
+ * - 없으면 NULL
+ */
+cache_entry_t *cache_lookup(const cache_key_t *k) {
+  const char *key = k->str;
+  unsigned long h = k->hash;
+  cache_entry_t *e = ram_lookup(h, key);
+  disk_obj_t o;
+
+  if (!e && disk_get(h, key, &o)) {
+    STAT_INC(disk_hits);
+    if (o.len > MAX_OBJECT_SIZE || (e = insert_entry(&o, 1, 1, 0, 0)) == NULL)
+      e = entry_view(&o, 1);
+  }
+  if (!e && snapshot_get(h, key, &o)) {
+    STAT_INC(warm_hits);
+    if ((e = insert_entry(&o, 1, 0, 0, 0)) != NULL) snapshot_forget(h);
+    else e = entry_view(&o, 0);
+  }
+  if (!e) {
+    STAT_INC(misses);
+    return NULL;
+  }
+  if (cache_fresh(e)) STAT_INC(hits);
+  else STAT_INC(stale);
+  return e;
+}
+
+/* 엔트리가 아직 신선한지 */
+int cache_fresh(const cache_entry_t *e) {
+  return time(NULL) < atomic_load_explicit(&e->expires, memory_order_relaxed);
+}
+
+/* 만료되었지만 stale-while-revalidate 구간 안이라 그대로 보내도 되는지 */
+int cache_stale_usable(const cache_entry_t *e) {
+  return !e->must_revalidate &&
+         time(NULL) < atomic_load_explicit(&e->expires, memory_order_relaxed) + e->swr;
+}
+
+/* 원 서버 오류 시 만료된 사본으로 대신 응답해도 되는지
+ * - dflt: 응답에 stale-if-error가 없을 때 쓰는 프록시 설정값 (초)
+ */
+int cache_stale_if_error(const cache_entry_t *e, long dflt) {
+  long window = e->sie >= 0 ? e->sie : dflt;
+  return !e->must_revalidate &&
+         time(NULL) < atomic_load_explicit(&e->expires, memory_order_relaxed) + window;
+}
+
+/* Age 헤더 값: 원 서버가 응답을 만든 뒤 지난 초 */
+long cache_age(const cache_entry_t *e) {
+  long age = (long)(time(NULL) - atomic_load_explicit(&e->born, memory_order_relaxed));
+  return age > 0 ? age : 0;
+}
+
+/* 재검증용 검증자를 v로 복사 (읽기 구간 안에서 호출) */
+void cache_get_validators(const cache_entry_t *e, cache_validators_t *v) {
+  v->etag[0] = v->last_mod[0] = '\0';
+  if (e->etag) strcpy(v->etag, e->etag);
+  if (e->last_mod) strcpy(v->last_mod, e->last_mod);
+}
+
+/* 응답을 받은 now 시점의 나이: 원 서버가 준 Age와 Date로 본 나이 중 큰 값 */
+static time_t meta_age(const cache_meta_t *m, time_t now) {
+  time_t age;
+
+  if (!m) return 0;
+  age = (m->date && now > m->date) ? now - m->date : 0;
+  return m->age > age ? m->age : age;
+}
+
+/* 응답을 받은 now 시점 기준 만료 시각 (RFC 9111 4.2)
+ * - meta가 NULL이면 CACHE_DEFAULT_TTL
+ * - 이미 먹은 나이(meta_age)는 수명에서 뺌
+ */
+static time_t meta_expires(const cache_meta_t *m, time_t now) {
+  time_t date, lifetime;
+
+  if (!m) return now + CACHE_DEFAULT_TTL;
+  date = m->date ? m->date : now;
+  if (m->no_cache) lifetime = 0;
+  else if (m->s_maxage >= 0) lifetime = m->s_maxage;
+  else if (m->max_age >= 0) lifetime = m->max_age;
+  else if (m->has_expires) lifetime = m->expires > date ? m->expires - date : 0;
+  else if (m->status == 404 || m->status == 410) lifetime = error_ttl;   // 오류 응답은 휴리스틱 대신
+  else if (m->last_modified && m->last_modified < date) {
+    lifetime = (date - m->last_modified) / CACHE_LM_FACTOR;
+    if (lifetime > CACHE_HEURISTIC_MAX) lifetime = CACHE_HEURISTIC_MAX;
+  }
+  else lifetime = CACHE_DEFAULT_TTL;
+
+  return now + lifetime - meta_age(m, now);
+}
+
+/* 엔트리를 만들어 샤드에 게시 (cache_insert와 디스크/스냅샷에서 올릴 때 공용)
+ * - 같은 키가 이미 있으면 새 응답으로 교체 (칸, 큐 위치, freq는 이어받음)
+ *   단 promote(아래 계층에서 올림)면 그 사이 RAM에 들어온 쪽이 더 새것이므로 그것을 돌려줌
+ * - on_disk: 디스크 계층에 같은 사본이 있음 (제거될 때 다시 내려보내지 않음)
+ * - seg_gen이 0이 아니면 조각 캐시의 목록(seg_total > 0)이나 조각 (RAM에만 둠)
+ * - 예산을 확보하지 못하거나 승인 검사에서 지면 NULL
+ * - 샤드의 칸이 모두 찼으면 그 샤드에서 정책대로 하나를 비움
+ */
+static cache_entry_t *insert_entry(const disk_obj_t *o, int promote, int on_disk,
+                                   unsigned int seg_gen, size_t seg_total) {
+  unsigned long h = o->hash;
+  cache_shard_t *s = shard_of(h);
+  size_t klen = strlen(o->key);
+  size_t elen = o->etag ? strlen(o->etag) + 1 : 0;
+  size_t llen = o->last_mod ? strlen(o->last_mod) + 1 : 0;
+  size_t alloc = sizeof(cache_entry_t) + o->len + klen + 1 + elen + llen;
+  /* 예산은 실제로 차지하는 바이트: 슬랩 블록 크기 + 정책 칸 + 샤드 색인 칸 + 키 색인 노드 */
+  size_t size = slab_usable(alloc) + sizeof(cache_slot_t) + INDEX_COST + radix_footprint(klen);
+  cache_entry_t *e, *old;
+  size_t pos;
+  int i, cand = cache_admission == CACHE_ADMIT_TINYLFU ? sketch_estimate(h) : ADMIT_ANY;
+  int origin = origin_of(o->key);
+
+  /* 이미 있는 키의 교체는 자리를 새로 얻는 것이 아니므로 승인 검사 없음 */
+  epoch_enter();
+  if (index_find(s, h, o->key, NULL)) cand = ADMIT_ANY;
+  epoch_exit();
+  if (!quota_reserve(origin, size, (int)(s - shards), cand)) return NULL;
+  if (!reserve(size, (int)(s - shards), cand)) {
+    if (quotas_on) atomic_fetch_sub(&origins[origin].used, size);
+    return NULL;
+  }
+
+  if ((e = slab_alloc(alloc)) == NULL) {
+    unreserve(origin, size);
+    return NULL;
+  }
+  memset(e, 0, sizeof(*e));
+  e->data = (char *)(e + 1);
+  e->key = e->data + o->len;
+  memcpy(e->data, o->data, o->len);
+  memcpy(e->key, o->key, klen + 1);
+  if (elen) e->etag = memcpy(e->key + klen + 1, o->etag, elen);
+  if (llen) e->last_mod = memcpy(e->key + klen + 1 + elen, o->last_mod, llen);
+  atomic_init(&e->refs, 1);
+  atomic_init(&e->expires, o->expires);
+  atomic_init(&e->born, o->born);
+  e->swr = o->swr;
+  e->sie = o->sie;
+  e->must_revalidate = o->must_revalidate;
+  e->on_disk = on_disk;
+  e->ram_only = seg_gen != 0;
+  e->seg_gen = seg_gen;
+  e->seg_total = seg_total;
+  e->origin = origin;
+  e->hash = h;
+  e->alloc = alloc;
+  e->size = size;
+  e->hdr_len = o->hdr_len;
+  e->len = o->len;
+
+  pthread_mutex_lock(&s->mutex);
+  old = index_find(s, h, o->key, &pos);
+
+  if (old && promote) {
+    pthread_mutex_unlock(&s->mutex);
+    unreserve(origin, size);
+    slab_free(e, alloc);
+    return old;
+  }
+  if (old) {
+    /* 교체: 같은 칸을 물려받고 색인의 old 자리에 e를 넣음 */
+    slot_queue_t *q;
+    i = old->slot;
+    if ((q = queue_of(s, i)) != NULL) q->bytes += size - old->size;
+    s->bytes += size - old->size;
+    s->slots[i].e = e;
+    e->slot = i;
+    swiss_set(atomic_load_explicit(&s->index, memory_order_relaxed), pos, e);
+    epoch_retire(&old->retire, entry_free);
+  } else {
+    if (s->free_head == SLOT_NIL && policy_evict(s, cand) != EVICT_DONE) {   // 칸 부족
+      pthread_mutex_unlock(&s->mutex);
+      unreserve(origin, size);
+      slab_free(e, alloc);
+      return NULL;
+    }
+    i = s->free_head;
+    s->free_head = s->slots[i].next;
+    s->slots[i].e = e;
+    atomic_store_explicit(&s->slots[i].freq, 0, memory_order_relaxed);
+    e->slot = i;
+    s->count++;
+    s->bytes += size;
+    if (cache_policy == CACHE_POLICY_S3FIFO) {
+      if (ghost_take(s, h)) queue_push_head(s, &s->main, i, Q_MAIN);
+      else queue_push_head(s, &s->small, i, Q_SMALL);
+    }
+    radix_add(e->key, h, RADIX_RAM);
+    /* 엔트리 내용을 모두 채운 뒤 release 저장으로 게시 */
+    swiss_insert(atomic_load_explicit(&s->index, memory_order_relaxed), h, e);
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return e;
+}
+
+/* RAM에 남은 key의 엔트리를 내림 (디스크에 더 새 사본을 넣은 뒤, PURGE)
+ * key가 NULL이면 해시만으로 찾음 (Vary 변형 목록에서 밀려난 변형)
+ * 반환값: 내렸으면 1 */
+static int entry_drop(unsigned long h, const char *key) {
+  cache_shard_t *s = shard_of(h);
+  cache_entry_t *e;
+
+  pthread_mutex_lock(&s->mutex);
+  if ((e = index_find(s, h, key, NULL)) != NULL) entry_remove(s, e);
+  pthread_mutex_unlock(&s->mutex);
+  return e != NULL;
+}
+
+/* 헤더 영역에서 Age 줄을 찾음
+ * 반환값: 줄 시작 오프셋, 없으면 0 (*n에 CRLF까지 줄 길이)
+ */
+static size_t age_line(const char *data, size_t hdr_len, size_t *n) {
+  const char *end = data + hdr_len, *line = memchr(data, '\n', hdr_len), *eol;
+
+  for (line = line ? line + 1 : end; line < end; line = eol) {
+    eol = memchr(line, '\n', end - line);
+    eol = eol ? eol + 1 : end;
+    if (!strncasecmp(line, "Age:", 4)) {
+      *n = eol - line;
+      return line - data;
+    }
+  }
+  return 0;
+}
+
+/* 응답(seg_gen이 0이 아니면 조각 캐시의 목록)을 캐시에 삽입 (cache_insert 참고) */
+static int insert_response(const cache_key_t *k, const char *data, size_t hdr_len, size_t len,
+                           const cache_meta_t *meta, unsigned int seg_gen, size_t seg_total) {
+  const char *key = k->str;
+  time_t now = time(NULL);
+  disk_obj_t o;
+  char *copy = NULL;
+  size_t off, n;
+  unsigned long old;
+  int ok = 1;
+
+  /* 원 서버가 보낸 Age 줄은 빼고 저장 (나이는 born에 반영되고, 적중 때 새 Age를 끼움) */
+  if ((off = age_line(data, hdr_len, &n)) > 0) {
+    if ((copy = malloc(len - n)) == NULL) return 0;
+    memcpy(copy, data, off);
+    memcpy(copy + off, data + off + n, len - off - n);
+    data = copy;
+    hdr_len -= n;
+    len -= n;
+  }
+
+  o.hash = k->hash;
+  o.key = key;
+  o.etag = (meta && meta->val.etag[0]) ? meta->val.etag : NULL;
+  o.last_mod = (meta && meta->val.last_mod[0]) ? meta->val.last_mod : NULL;
+  o.data = data;
+  o.hdr_len = hdr_len;
+  o.len = len;
+  o.expires = meta_expires(meta, now);
+  o.born = now - meta_age(meta, now);
+  o.swr = meta ? meta->swr : 0;
+  o.sie = meta ? meta->sie : -1;
+  o.must_revalidate = meta ? meta->must_revalidate : 0;
+
+  snapshot_forget(o.hash);
+  if (len > MAX_OBJECT_SIZE) {
+    if ((ok = disk_put(&o)) != 0) entry_drop(o.hash, key);
+  } else {
+    ok = insert_entry(&o, 0, 0, seg_gen, seg_total) != NULL;
+  }
+  free(copy);
+  if (!ok) return 0;
+  if (k->vary[0] && (old = vary_register(k)) != 0) entry_drop(old, NULL);
+  STAT_INC(inserts);
+  return 1;
+}
+
+/* 응답을 캐시에 삽입
+ * - 같은 키가 이미 있으면 새 응답으로 교체
+ * - MAX_OBJECT_SIZE를 넘는 객체는 디스크 계층이 있으면 디스크에만 넣고, 없으면 거절
+ *   (채움 버퍼 한도를 넘는 객체는 채우는 동안 조각 캐시로 들어감: cache_fill_headers)
+ * - 예산을 확보하지 못하면 넣지 않음
+ * - meta: 응답 헤더에서 뽑은 신선도/검증자 정보 (NULL이면 기본 수명, 검증자 없음)
+ * 반환값: 삽입 1, 거절 0
+ */
+int cache_insert(const cache_key_t *k, const char *data, size_t hdr_len, size_t len,
+                 const cache_meta_t *meta) {
+  return insert_response(k, data, hdr_len, len, meta, 0, 0);
+}
+
+/* 304 재검증 결과 반영: 본문은 그대로 두고 새 헤더 기준으로 만료 시각만 갱신
+ * 반환값: 엔트리가 아직 있어 갱신했으면 1, 그 사이 제거되었으면 0
+ */
+int cache_refresh(const cache_key_t *k, const cache_meta_t *meta) {
+  const char *key = k->str;
+  unsigned long h = k->hash;
+  cache_shard_t *s = shard_of(h);
+  cache_entry_t *e;
+  time_t now = time(NULL), expires = meta_expires(meta, now), born = now - meta_age(meta, now);
+  int found = 0;
+
+  epoch_enter();
+  if ((e = index_find(s, h, key, NULL)) != NULL) {
+    atomic_store_explicit(&e->expires, expires, memory_order_relaxed);
+    atomic_store_explicit(&e->born, born, memory_order_relaxed);
+    found = 1;
+  }
+  /* 디스크 사본도 같이 갱신 (RAM에 없는 큰 객체는 디스크에만 있음) */
+  if (!e || e->on_disk)
+    found |= disk_refresh(h, key, expires, born);
+  epoch_exit();
+  if (found) STAT_INC(revalidated);
+  return found;
+}
+
+/********************************
+ * 조각 캐시
+ ********************************/
+
+/* 원 키 key의 세대 gen, idx번 조각 키를 buf(MAXLINE)에 만들고 해시를 *h에
+ * 반환값: 키가 MAXLINE에 들어가면 1 */
+static int segment_key(const char *key, unsigned int gen, size_t idx, char *buf, unsigned long *h) {
+  int n = snprintf(buf, MAXLINE, "%s" CACHE_SEG_TAG "%u.%zu", key, gen, idx);
+
+  if (n < 0 || n >= MAXLINE) return 0;
+  *h = hash_bytes(buf, n);
+  return 1;
+}
+
+/* 조각 하나를 RAM에 넣음 (record면 승인 정책용 빈도도 기록)
+ * 반환값: 삽입 1, 거절 0 */
+static int segment_put(const char *key, unsigned int gen, size_t idx, const char *data, size_t len,
+                       time_t expires, time_t born, int record) {
+  char skey[MAXLINE];
+  disk_obj_t o;
+
+  if (!segment_key(key, gen, idx, skey, &o.hash)) return 0;
+  if (record && cache_admission == CACHE_ADMIT_TINYLFU) sketch_record(o.hash);
+  o.key = skey;
+  o.etag = o.last_mod = NULL;
+  o.data = data;
+  o.hdr_len = 0;
+  o.len = len;
+  o.expires = expires;
+  o.born = born;
+  o.swr = 0;
+  o.sie = -1;
+  o.must_revalidate = 0;
+  return insert_entry(&o, 0, 0, gen, 0) != NULL;
+}
+
+/* 목록 사본 mf의 idx번 조각 조회 (cache_read_begin/cache_read_end 사이에서 호출)
+ * - 조각 요청도 빈도 sketch에 기록해 자주 보는 조각이 승인 검사에서 이기게 함
+ * 반환값: 조각 엔트리 (data가 곧 본문 조각), 없으면 NULL
+ */
+cache_entry_t *cache_segment(const cache_manifest_t *mf, size_t idx) {
+  char key[MAXLINE];
+  unsigned long h;
+  size_t want;
+  cache_entry_t *e;
+
+  if (idx >= (mf->seg_total + CACHE_SEGMENT_SIZE - 1) / CACHE_SEGMENT_SIZE ||
+      !segment_key(mf->key, mf->seg_gen, idx, key, &h))
+    return NULL;
+  if (cache_admission == CACHE_ADMIT_TINYLFU) sketch_record(h);
+  want = mf->seg_total - idx * CACHE_SEGMENT_SIZE;
+  if (want > CACHE_SEGMENT_SIZE) want = CACHE_SEGMENT_SIZE;
+  if ((e = ram_lookup(h, key)) == NULL || e->len != want) return NULL;
+  STAT_INC(seg_hits);
+  return e;
+}
+
+/* 목록 m의 조각 조회와 빈칸 채우기에 쓸 값을 mf에 복사 (cache_read_begin/cache_read_end 사이에서 호출) */
+void cache_manifest_get(const cache_entry_t *m, cache_manifest_t *mf) {
+  snprintf(mf->key, sizeof(mf->key), "%s", m->key);
+  mf->hash = m->hash;
+  mf->seg_gen = m->seg_gen;
+  mf->seg_total = m->seg_total;
+  mf->expires = atomic_load_explicit(&m->expires, memory_order_relaxed);
+  mf->born = atomic_load_explicit(&m->born, memory_order_relaxed);
+  cache_get_validators(m, &mf->val);
+}
+
+/* 원 서버에서 Range로 받은 목록 mf의 idx번 조각을 넣음
+ * 반환값: 삽입 1, 거절 0 */
+int cache_segment_insert(const cache_manifest_t *mf, size_t idx, const char *data, size_t len) {
+  if (!segment_put(mf->key, mf->seg_gen, idx, data, len, mf->expires, mf->born, 0))
+    return 0;
+  STAT_INC(seg_fills);
+  return 1;
+}
+
+/* 원 서버의 표현이 바뀌어 빈칸을 채울 수 없는 목록을 내림 (다음 요청이 새로 받음)
+ * - 그사이 새 응답으로 바뀐 목록(세대가 다름)은 그대로 둠
+ */
+void cache_segment_drop(const cache_manifest_t *mf) {
+  cache_shard_t *s = shard_of(mf->hash);
+  cache_entry_t *e;
+
+  pthread_mutex_lock(&s->mutex);
+  if ((e = index_find(s, mf->hash, mf->key, NULL)) != NULL && e->seg_gen == mf->seg_gen)
+    entry_remove(s, e);
+  pthread_mutex_unlock(&s->mutex);
+}
+
+/* PURGE: 키(prefix면 그 키로 시작하는 모든 키)를 모든 계층에서 지움
+ * - 키 색인(radix.c)에서 맞는 키만 모아 오므로 캐시 전체를 훑지 않고,
+ *   트리 잠금은 모으는 동안만 잡음. 지우기는 평소 제거처럼 샤드 / 디스크 색인 잠금으로 함
+ * - 원 키를 지우면 그 Vary 변형과 조각도 같이 지움
+ * - 조회는 잠금 없이 계속되며, 지우기 전에 잡은 엔트리는 에포크 회수로 안전하게 마저 전송됨
+ * 반환값: 지운 키 수
+ */
+int cache_purge(const cache_key_t *k, int prefix) {
+  radix_match_t *m;
+  int n = radix_match(k->str, !prefix, &m);
+
+  for (int i = 0; i < n; i++) {
+    entry_drop(m[i].hash, m[i].key);
+    disk_remove(m[i].hash, m[i].key);
+    snapshot_forget(m[i].hash);
+    radix_del(m[i].key, RADIX_SNAP);
+    STAT_INC(purged);
+  }
+  radix_match_free(m, n);
+  return n;
+}
+
+/* 모든 엔트리를 잠금 없이 훑으며 fn 호출
+ * - 스냅샷을 쓰는 fork 자식처럼 다른 스레드가 캐시를 바꾸지 않을 때만 사용
+ * - 잠금도 할당도 하지 않음
+ * - 조각 캐시의 목록과 조각은 건너뜀 (RAM에만 둠)
+ */
+void cache_foreach(void (*fn)(const disk_obj_t *, void *), void *arg) {
+  disk_obj_t o;
+
+  for (int i = 0; i < CACHE_NSHARDS; i++) {
+    swiss_table_t *t = atomic_load_explicit(&shards[i].index, memory_order_acquire);
+    for (size_t pos = 0; pos < swiss_slots(t); pos++) {
+      cache_entry_t *e = swiss_at(t, pos);
+      if (!e || e->ram_only) continue;
+      entry_obj(e, &o);
+      fn(&o, arg);
+    }
+  }
+}
+
+size_t cache_bytes(void) {
+  return atomic_load(&cache_used);
+}
+
+/* 스레드별 카운터를 모두 더해 반환 (비동기 시그널 안전: 읽기만 함) */
+void cache_get_stats(cache_stats_t *st) {
+  int n = atomic_load(&ntstats);
+  if (n > CACHE_MAXTHREADS) n = CACHE_MAXTHREADS;
+  memset(st, 0, sizeof(*st));
+  for (int i = 0; i < n; i++) {
+    st->hits += atomic_load_explicit(&tstats[i].hits, memory_order_relaxed);
+    st->misses += atomic_load_explicit(&tstats[i].misses, memory_order_relaxed);
+    st->stale += atomic_load_explicit(&tstats[i].stale, memory_order_relaxed);
+    st->revalidated += atomic_load_explicit(&tstats[i].revalidated, memory_order_relaxed);
+    st->inserts += atomic_load_explicit(&tstats[i].inserts, memory_order_relaxed);
+    st->evictions += atomic_load_explicit(&tstats[i].evictions, memory_order_relaxed);
+    st->collapsed += atomic_load_explicit(&tstats[i].collapsed, memory_order_relaxed);
+    st->disk_hits += atomic_load_explicit(&tstats[i].disk_hits, memory_order_relaxed);
+    st->demotions += atomic_load_explicit(&tstats[i].demotions, memory_order_relaxed);
+    st->warm_hits += atomic_load_explicit(&tstats[i].warm_hits, memory_order_relaxed);
+    st->admitted += atomic_load_explicit(&tstats[i].admitted, memory_order_relaxed);
+    st->rejected += atomic_load_explicit(&tstats[i].rejected, memory_order_relaxed);
+    st->purged += atomic_load_explicit(&tstats[i].purged, memory_order_relaxed);
+    st->seg_hits += atomic_load_explicit(&tstats[i].seg_hits, memory_order_relaxed);
+    st->seg_fills += atomic_load_explicit(&tstats[i].seg_fills, memory_order_relaxed);
+  }
+}
+
+/********************************
+ * Collapsed forwarding
+ ********************************/
+
+/* 미스 직후 호출: 같은 키의 진행 중 요청에 합류하거나 새로 leader가 됨
+ * - 샤드 mutex 안에서 캐시와 flight 리스트를 함께 확인하므로,
+ *   leader가 삽입 후 flight를 내리는 사이에 와도 둘 중 하나는 반드시 보임
+ * - 만료된 엔트리는 없는 것으로 보고 leader가 재검증을 맡음
+ * 반환값
+ * - FLIGHT_HIT: 그 사이 캐시에 들어옴, 다시 조회하면 됨 (*fp = NULL)
+ * - FLIGHT_LEADER: 원 서버에서 가져온 뒤 cache_flight_end 호출 책임
+ * - FLIGHT_FOLLOWER: cache_flight_wait 후 cache_flight_release 호출 책임
+ */
+int cache_flight_begin(const cache_key_t *k, cache_flight_t **fp) {
+  const char *key = k->str;
+  unsigned long h = k->hash;
+  cache_shard_t *s = shard_of(h);
+  cache_entry_t *e;
+  cache_flight_t *f;
+
+  *fp = NULL;
+  pthread_mutex_lock(&s->mutex);
+  if ((e = index_find(s, h, key, NULL)) != NULL && cache_fresh(e)) {
+    pthread_mutex_unlock(&s->mutex);
+    return FLIGHT_HIT;
+  }
+  for (f = s->flights; f; f = f->next) {
+    if (f->hash == h && !strcmp(f->key, key)) {
+      pthread_mutex_lock(&f->mutex);
+      f->refcnt++;
+      pthread_mutex_unlock(&f->mutex);
+      pthread_mutex_unlock(&s->mutex);
+      *fp = f;
+      return FLIGHT_FOLLOWER;
+    }
+  }
+  f = calloc(1, sizeof(*f));
+  f->hash = h;
+  f->key = strdup(key);
+  pthread_mutex_init(&f->mutex, NULL);
+  pthread_cond_init(&f->cond, NULL);
+  f->state = FLIGHT_PENDING;
+  f->refcnt = 1;
+  cache_fill_init(&f->fill);
+  f->fill.flight = f;
+  f->next = s->flights;
+  s->flights = f;
+  pthread_mutex_unlock(&s->mutex);
+  *fp = f;
+  return FLIGHT_LEADER;
+}
+
+/* 상태가 바뀜: 블로킹 follower와 이벤트 루프 follower를 깨움 (flight mutex 아래에서) */
+static void flight_signal(cache_flight_t *f) {
+  cache_flight_watch_t *w;
+
+  pthread_cond_broadcast(&f->cond);
+  for (w = f->watchers; w; w = w->next)
+    w->fn(w);
+}
+
+/* follower: 스트리밍을 시작할 수 있거나 leader가 끝날 때까지 대기 (최대 CACHE_FLIGHT_TIMEOUT초)
+ * 반환값
+ * - FLIGHT_STREAM: 헤더가 끝났고 길이(fill.total)를 아니 cache_flight_read로 따라 읽기
+ * - FLIGHT_DONE: 캐시에 들어갔으니 다시 조회
+ * - 그 외(FLIGHT_FAILED, 시간 초과)는 직접 원 서버로
+ */
+int cache_flight_wait(cache_flight_t *f) {
+  struct timespec deadline;
+  int state, rc = 0;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += CACHE_FLIGHT_TIMEOUT;
+
+  pthread_mutex_lock(&f->mutex);
+  while (f->state == FLIGHT_PENDING && f->fill.total == 0 && rc != ETIMEDOUT)
+    rc = pthread_cond_timedwait(&f->cond, &f->mutex, &deadline);
+  state = f->state;
+  if (state == FLIGHT_PENDING && f->fill.total > 0) state = FLIGHT_STREAM;
+  pthread_mutex_unlock(&f->mutex);
+  if (state == FLIGHT_DONE || state == FLIGHT_STREAM) STAT_INC(collapsed);
+  return state == FLIGHT_PENDING ? FLIGHT_ERROR : state;   // leader가 멈춰 있으면 원 서버 지연으로 봄
+}
+
+/* follower: 채움 버퍼에서 off 이후의 바이트를 읽음
+ * - 아직 쓰이지 않았으면 leader가 더 채우거나 끝낼 때까지 대기 (쓰기 경계에서 cond 대기)
+ * - *p는 fill.buf 안을 가리키며, flight 참조를 쥐고 있는 동안 유효
+ * 반환값: 읽을 수 있는 바이트 수, 다 읽었으면 0, leader 실패나 시간 초과면 -1
+ */
+long cache_flight_read(cache_flight_t *f, size_t off, const char **p) {
+  struct timespec deadline;
+  long n;
+  int rc = 0;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += CACHE_FLIGHT_TIMEOUT;
+
+  pthread_mutex_lock(&f->mutex);
+  while (f->fill.len <= off && off < f->fill.total &&
+         f->state == FLIGHT_PENDING && rc != ETIMEDOUT)
+    rc = pthread_cond_timedwait(&f->cond, &f->mutex, &deadline);
+  if (f->fill.len > off)
+    n = (long)(f->fill.len - off);
+  else
+    n = (off >= f->fill.total) ? 0 : -1;
+  *p = f->fill.buf + off;
+  pthread_mutex_unlock(&f->mutex);
+  return n;
+}
+
+/* cache_flight_wait의 기다리지 않는 판 (이벤트 루프 follower)
+ * 반환값: 아직 기다려야 하면 FLIGHT_PENDING, 아니면 cache_flight_wait와 같음
+ */
+int cache_flight_poll(cache_flight_t *f) {
+  int state;
+
+  pthread_mutex_lock(&f->mutex);
+  state = f->state;
+  if (state == FLIGHT_PENDING && f->fill.total > 0) state = FLIGHT_STREAM;
+  pthread_mutex_unlock(&f->mutex);
+  if (state == FLIGHT_DONE || state == FLIGHT_STREAM) STAT_INC(collapsed);
+  return state;
+}
+
+/* cache_flight_read의 기다리지 않는 판
+ * 반환값: 읽을 수 있는 바이트 수, 다 읽었으면 0, 아직 없으면 CACHE_FLIGHT_AGAIN, leader 실패면 -1
+ */
+long cache_flight_peek(cache_flight_t *f, size_t off, const char **p) {
+  long n;
+
+  pthread_mutex_lock(&f->mutex);
+  if (f->fill.len > off)
+    n = (long)(f->fill.len - off);
+  else if (off >= f->fill.total)
+    n = 0;
+  else
+    n = f->state == FLIGHT_PENDING ? CACHE_FLIGHT_AGAIN : -1;
+  *p = f->fill.buf + off;
+  pthread_mutex_unlock(&f->mutex);
+  return n;
+}
+
+/* 이벤트 루프 follower의 알림 등록 / 해제 (follower 참조를 쥔 동안만)
+ * - 해제가 돌아온 뒤에는 w->fn이 불리지 않음
+ */
+void cache_flight_watch(cache_flight_t *f, cache_flight_watch_t *w) {
+  pthread_mutex_lock(&f->mutex);
+  w->next = f->watchers;
+  f->watchers = w;
+  pthread_mutex_unlock(&f->mutex);
+}
+
+void cache_flight_unwatch(cache_flight_t *f, cache_flight_watch_t *w) {
+  cache_flight_watch_t **pp;
+
+  pthread_mutex_lock(&f->mutex);
+  for (pp = &f->watchers; *pp && *pp != w; pp = &(*pp)->next)
+    ;
+  if (*pp) *pp = w->next;
+  pthread_mutex_unlock(&f->mutex);
+}
+
+/* leader: 결과를 알리고 flight를 샤드에서 내림
+ * - state: FLIGHT_DONE이면 캐시에 넣었음 (follower는 캐시에서 응답),
+ *   FLIGHT_FAILED면 캐시 불가 (follower는 각자 원 서버로),
+ *   FLIGHT_ERROR면 원 서버 오류 (follower는 만료된 사본을 먼저 시도)
+ * - 반드시 cache_insert 이후에 호출해야 새로 오는 요청이 틈에 빠지지 않음
+ */
+void cache_flight_end(cache_flight_t *f, int state) {
+  cache_shard_t *s = shard_of(f->hash);
+  cache_flight_t **pp;
+
+  pthread_mutex_lock(&s->mutex);
+  for (pp = &s->flights; *pp != f; pp = &(*pp)->next)
+    ;
+  *pp = f->next;
+  pthread_mutex_unlock(&s->mutex);
+
+  pthread_mutex_lock(&f->mutex);
+  f->state = state;
+  flight_signal(f);
+  pthread_mutex_unlock(&f->mutex);
+  cache_flight_release(f);
+}
+
+/* flight 참조 반납, 마지막이면 해제 */
+void cache_flight_release(cache_flight_t *f) {
+  int last;
+
+  pthread_mutex_lock(&f->mutex);
+  last = (--f->refcnt == 0);
+  pthread_mutex_unlock(&f->mutex);
+  if (last) {
+    pthread_mutex_destroy(&f->mutex);
+    pthread_cond_destroy(&f->cond);
+    cache_fill_free(&f->fill);
+    free(f->key);
+    free(f);
+  }
+}
+
+/********************************
+ * 응답 헤더 해석 (relay_response의 헤더 루프에서 사용)
+ ********************************/
+void cache_meta_init(cache_meta_t *m) {
+  memset(m, 0, sizeof(*m));
+  m->status = 200;
+  m->max_age = m->s_maxage = m->sie = -1;
+}
+
+/* 만료 정보 없는 404 / 410 응답의 수명 (0이면 명시적 만료 정보가 있을 때만 캐시에서 씀) */
+void cache_set_error_ttl(long sec) {
+  error_ttl = sec;
+}
+
+/* 캐시에 넣는 상태 코드: 200과, 없는 자원을 알리는 404 / 410 (negative caching) */
+int cache_status_storable(int status) {
+  return status == 200 || status == 404 || status == 410;
+}
+
+/* IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT") -> time_t, 실패하면 0 */
+static time_t parse_http_date(const char *s) {
+  static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  char mon[4];
+  const char *m;
+  struct tm tm;
+
+  memset(&tm, 0, sizeof(tm));
+  if (sscanf(s, "%*[^,], %d %3s %d %d:%d:%d", &tm.tm_mday, mon, &tm.tm_year,
+             &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+    return 0;
+  if (strlen(mon) != 3 || (m = strstr(months, mon)) == NULL || (m - months) % 3) return 0;
+  tm.tm_mon = (int)(m - months) / 3;
+  tm.tm_year -= 1900;
+  return timegm(&tm);
+}
+
+/* "Name: value\r\n"에서 값만 앞뒤 공백 없이 dst로 복사 (잘리면 빈 문자열) */
+static void header_value(char *dst, size_t size, const char *line) {
+  const char *v = strchr(line, ':') + 1;
+  size_t n;
+
+  while (*v == ' ' || *v == '\t') v++;
+  n = strcspn(v, "\r\n");
+  while (n > 0 && (v[n - 1] == ' ' || v[n - 1] == '\t')) n--;
+  if (n >= size) n = 0;
+  memcpy(dst, v, n);
+  dst[n] = '\0';
+}
+
+/* Cache-Control 지시자 목록 해석 (모르는 지시자는 무시) */
+static void parse_cache_control(cache_meta_t *m, const char *v) {
+  while (*v) {
+    v += strspn(v, " \t,");
+    if (!strncasecmp(v, "max-age=", 8)) m->max_age = strtol(v + 8, NULL, 10);
+    else if (!strncasecmp(v, "s-maxage=", 9)) m->s_maxage = strtol(v + 9, NULL, 10);
+    else if (!strncasecmp(v, "stale-while-revalidate=", 23)) m->swr = strtol(v + 23, NULL, 10);
+    else if (!strncasecmp(v, "stale-if-error=", 15)) m->sie = strtol(v + 15, NULL, 10);
+    else if (!strncasecmp(v, "must-revalidate", 15)) m->must_revalidate = 1;
+    else if (!strncasecmp(v, "proxy-revalidate", 16)) m->must_revalidate = 1;
+    else if (!strncasecmp(v, "no-store", 8)) m->no_store = 1;
+    else if (!strncasecmp(v, "no-cache", 8)) m->no_cache = 1;
+    else if (!strncasecmp(v, "private", 7)) m->private_ = 1;
+    v += strcspn(v, ",");
+  }
+}
+
+/* Vary 목록을 소문자, 쉼표 구분 명세로 모음 (여러 줄이면 이어 붙임)
+ * "*"가 있거나 명세가 CACHE_VARY_LEN을 넘으면 "*" */
+static void parse_vary(cache_meta_t *m, const char *v) {
+  size_t len = strlen(m->vary), n;
+
+  while (*v && strcmp(m->vary, "*")) {
+    v += strspn(v, " \t,");
+    if (!(n = strcspn(v, " \t,"))) break;
+    if ((n == 1 && *v == '*') || len + n + 1 >= CACHE_VARY_LEN) {
+      strcpy(m->vary, "*");
+      break;
+    }
+    if (len) m->vary[len++] = ',';
+    for (size_t i = 0; i < n; i++) m->vary[len++] = tolower((unsigned char)v[i]);
+    m->vary[len] = '\0';
+    v += n;
+  }
+}
+
+/* 응답 헤더 한 줄을 보고 해당하는 필드를 채움 */
+void cache_meta_header(cache_meta_t *m, const char *line) {
+  char v[MAXLINE];
+
+  if (!strchr(line, ':')) return;
+  header_value(v, sizeof(v), line);
+  if (!strncasecmp(line, "Cache-Control:", 14)) parse_cache_control(m, v);
+  else if (!strncasecmp(line, "Date:", 5)) m->date = parse_http_date(v);
+  else if (!strncasecmp(line, "Age:", 4)) m->age = strtol(v, NULL, 10);
+  else if (!strncasecmp(line, "Expires:", 8)) {
+    m->has_expires = 1;
+    m->expires = parse_http_date(v);        // 해석 못 하면 0 = 이미 만료
+  }
+  else if (!strncasecmp(line, "Last-Modified:", 14)) {
+    m->last_modified = parse_http_date(v);
+    if (strlen(v) < CACHE_VALIDATOR_LEN) strcpy(m->val.last_mod, v);
+  }
+  else if (!strncasecmp(line, "ETag:", 5)) {
+    if (strlen(v) < CACHE_VALIDATOR_LEN) strcpy(m->val.etag, v);
+  }
+  else if (!strncasecmp(line, "Vary:", 5)) parse_vary(m, v);
+}
+
+/* 공유 캐시에 저장해도 되는 응답인지 */
+int cache_meta_storable(const cache_meta_t *m) {
+  return !m->no_store && !m->private_ && strcmp(m->vary, "*");
+}
+
+/********************************
+ * 채움 버퍼 (relay_response에서 사용)
+ ********************************/
+void cache_fill_init(cache_fill_t *f) {
+  f->buf = NULL;
+  f->cap = 0;
+  f->limit = disk_enabled() ? DISK_MAX_OBJECT : MAX_OBJECT_SIZE;
+  f->len = 0;
+  f->hdr_len = 0;
+  f->total = 0;
+  f->ok = 1;
+  f->vary = NULL;
+  f->key = NULL;
+  f->seg_total = 0;
+  f->seg_gen = 0;
+  f->seg_off = 0;
+  f->flight = NULL;
+  cache_meta_init(&f->meta);
+}
+
+/* 조각 캐시로 넘어감: 세대를 정하고 헤더만 든 목록을 넣음
+ * - buf에는 헤더 뒤에 채우는 조각 하나만 두므로 그만큼만 잡음
+ * - follower는 total이 0이라 스트리밍하지 않고 leader가 끝날 때까지 기다림
+ */
+static void segment_begin(cache_fill_t *f, size_t body) {
+  unsigned int gen;
+  char *p;
+
+  while ((gen = atomic_fetch_add(&seg_gens, 1) + 1) == 0)
+    ;
+  if (f->cap < f->len + CACHE_SEGMENT_SIZE) {
+    if ((p = realloc(f->buf, f->len + CACHE_SEGMENT_SIZE)) == NULL) {
+      f->ok = 0;
+      return;
+    }
+    f->buf = p;
+    f->cap = f->len + CACHE_SEGMENT_SIZE;
+  }
+  if (!insert_response(f->key, f->buf, f->len, f->len, &f->meta, gen, body)) {
+    f->ok = 0;
+    return;
+  }
+  f->seg_total = body;
+  f->seg_gen = gen;
+  f->seg_off = 0;
+}
+
+/* 조각 캐시: 헤더 뒤에 본문을 모으다가 조각이 차면(마지막은 본문 끝에서) 넣고 비움
+ * (승인되지 않은 조각은 빈칸으로 남고 다음 적중 때 Range로 채움) */
+static void segment_append(cache_fill_t *f, const char *p, size_t n) {
+  time_t now = time(NULL);
+
+  while (n > 0) {
+    size_t have = f->len - f->hdr_len, want = f->seg_total - f->seg_off, take;
+    if (want > CACHE_SEGMENT_SIZE) want = CACHE_SEGMENT_SIZE;
+    if (want == 0) {                          // Content-Length보다 많이 옴
+      f->ok = 0;
+      return;
+    }
+    take = want - have < n ? want - have : n;
+    memcpy(f->buf + f->len, p, take);
+    f->len += take;
+    p += take;
+    n -= take;
+    if (have + take == want) {
+      segment_put(f->key->str, f->seg_gen, f->seg_off / CACHE_SEGMENT_SIZE, f->buf + f->hdr_len,
+                  want, meta_expires(&f->meta, now), now - meta_age(&f->meta, now), 1);
+      f->seg_off += want;
+      f->len = f->hdr_len;
+    }
+  }
+}
+
+/* flight에 속한 버퍼면 길이를 mutex 아래에서 늘리고 쓰기 경계에서 기다리는 follower를 깨움
+ * (memcpy는 아직 아무도 읽지 않는 len 뒤쪽에 하므로 잠금 밖에서)
+ * - 처음에는 MAX_OBJECT_SIZE를 잡고, 디스크 계층에 넣을 큰 응답이면 두 배씩 키움.
+ *   키우는 것은 total이 정해지기 전(follower가 아직 buf를 읽지 않을 때)뿐
+ */
+void cache_fill_append(cache_fill_t *f, const void *buf, size_t n) {
+  if (!f || !f->ok) return;
+  if (f->seg_total) {
+    segment_append(f, buf, n);
+    return;
+  }
+  if (f->len + n > f->limit || (f->total && f->len + n > f->total)) {   // 객체 한도 초과: 캐시 포기
+    f->ok = 0;
+    return;
+  }
+  if (f->len + n > f->cap) {
+    size_t cap = f->cap ? f->cap : MAX_OBJECT_SIZE;
+    char *p;
+    while (cap < f->len + n) cap *= 2;
+    if (cap > f->limit) cap = f->limit;
+    if ((p = realloc(f->buf, cap)) == NULL) {
+      f->ok = 0;
+      return;
+    }
+    f->buf = p;
+    f->cap = cap;
+  }
+  memcpy(f->buf + f->len, buf, n);
+  if (!f->flight) {
+    f->len += n;
+    return;
+  }
+  pthread_mutex_lock(&f->flight->mutex);
+  f->len += n;
+  flight_signal(f->flight);
+  pthread_mutex_unlock(&f->flight->mutex);
+}
+
+/* 헤더 영역이 끝났음을 기록
+ * - content_len: Content-Length 값, 없으면 -1
+ * - 캐시 가능한 응답이고 완성될 길이가 한도 안이면 total을 정해 follower가 스트리밍 시작
+ * - 한도를 넘는 200 응답이면 조각 캐시로 넘어감 (목록 삽입은 샤드 mutex를 잡으므로
+ *   flight mutex 밖에서: cache_flight_begin과 잠금 순서를 맞춤)
+ */
+void cache_fill_headers(cache_fill_t *f, long content_len) {
+  if (!f || !f->ok) return;
+  if (content_len > 0 && f->len + content_len > f->limit && f->key && f->meta.status == 200)
+    segment_begin(f, content_len);
+  if (!f->ok) return;
+  if (f->flight) pthread_mutex_lock(&f->flight->mutex);
+  f->hdr_len = f->len;
+  if (content_len >= 0 && f->hdr_len + content_len <= f->limit) {
+    size_t total = f->hdr_len + content_len;
+    char *p;
+    if (total > f->cap && (p = realloc(f->buf, total)) != NULL) {   // 이후로 buf를 옮기지 않도록
+      f->buf = p;
+      f->cap = total;
+    }
+    if (total <= f->cap) f->total = total;
+  }
+  if (f->flight) {
+    flight_signal(f->flight);
+    pthread_mutex_unlock(&f->flight->mutex);
+  }
+}
+
+/* 304를 삼킨 뒤 같은 fill로 조건 없이 다시 받기 전에 호출 (버퍼에는 아무것도 들어가지 않았음) */
+void cache_fill_reset(cache_fill_t *f) {
+  f->ok = 1;
+  cache_meta_init(&f->meta);
+}
+
+void cache_fill_free(cache_fill_t *f) {
+  free(f->buf);
+  f->buf = NULL;
+  f->cap = 0;
+}
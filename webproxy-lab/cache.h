@@ -0,0 +1,358 @@
+/*
+ * cache.h - 프록시 응답 캐시 인터페이스
+ *
+ * 캐시는 (hostname, port, path) 키를 해시하여 CACHE_NSHARDS개의 샤드로 나눈다.
+ * 각 샤드는 자기 mutex, 키 색인(swiss.h의 열린 주소법 표), 제거 정책용 메타데이터 배열을 가지므로
+ * 서로 다른 샤드에 대한 삽입/제거는 서로를 직렬화하지 않는다.
+ * 전체 바이트 예산(MAX_CACHE_SIZE)만 원자 카운터 하나로 공유한다.
+ *
+ * 조회는 잠금을 잡지 않는다. cache_read_begin/cache_read_end 사이에서
+ * cache_lookup으로 얻은 엔트리는 그 사이에 제거되더라도 에포크 회수(epoch.c)
+ * 덕분에 cache_read_end 전까지 해제되지 않으므로 그대로 전송해도 안전하다.
+ *
+ * 디스크 계층(disk.c)을 켜면 RAM은 그 앞단이 된다.
+ * - RAM에서 제거된 엔트리는 해제 대신 디스크로 내려보내고(demote),
+ *   RAM 미스는 디스크를 찾아 보고 있으면 RAM으로 다시 올린다(promote)
+ * - MAX_OBJECT_SIZE를 넘는 응답(DISK_MAX_OBJECT까지)은 디스크에만 넣고,
+ *   적중하면 세그먼트 매핑에서 바로 전송한다
+ * 그보다 큰 응답(디스크 계층이 없으면 MAX_OBJECT_SIZE를 넘는 응답)은 RAM에 조각으로 나눠 넣는다.
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdatomic.h>
+#include "csapp.h"
+#include "epoch.h"
+#include "slab.h"
+#include "disk.h"
+
+/* Recommended max cache and object sizes
+ * 과제에서 권장하는 전체 캐시 최대 크기와 단일 객체 최대 크기 상수
+ * - MAX_CACHE_SIZE: 캐시 전체 용량 한도
+ * - MAX_OBJECT_SIZE: 한 개의 응답 객체에 대해 캐시 가능한 최대 크기
+ */
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+#define CACHE_NSHARDS 16          // 독립적으로 잠기는 샤드 개수
+#define CACHE_SHARD_SLOTS 1024    // 샤드 하나가 담을 수 있는 최대 엔트리 수
+#define CACHE_INDEX_SLOTS (2 * CACHE_SHARD_SLOTS)  // 샤드 색인 표의 칸 수 (채움률 1/2 이하)
+
+/* 신선도 (RFC 9111)
+ * - 수명은 s-maxage > max-age > Expires - Date 순으로 정하고,
+ *   셋 다 없으면 휴리스틱: Last-Modified가 있으면 (Date - Last-Modified)의 1/10
+ *   (최대 하루), 그것도 없으면 CACHE_DEFAULT_TTL
+ * - 만료된 엔트리는 버리지 않고 ETag/Last-Modified로 조건부 재검증,
+ *   304가 오면 본문을 다시 받지 않고 만료 시각만 갱신
+ * - stale-while-revalidate=N이 있으면 만료 후 N초까지는 만료된 사본을 바로 보내고
+ *   재검증은 갱신 전용 스레드가 뒤에서 함
+ * - 원 서버가 죽었거나 느리면 stale-if-error 구간(응답의 지시자, 없으면 프록시 설정값)
+ *   안의 만료된 사본으로 대신 응답
+ * - must-revalidate / proxy-revalidate면 만료된 사본은 어떤 경우에도 보내지 않음
+ * - 200 외에 404 / 410도 캐시함 (negative caching). 만료 정보가 없으면
+ *   휴리스틱 대신 짧은 오류 수명(cache_set_error_ttl)을 씀
+ */
+#define CACHE_DEFAULT_TTL 300     // 만료 정보가 전혀 없는 응답의 수명 (초)
+#define CACHE_LM_FACTOR 10        // Last-Modified 휴리스틱 분모
+#define CACHE_HEURISTIC_MAX 86400 // 휴리스틱 수명 상한 (초)
+#define CACHE_ERROR_TTL 60        // 만료 정보가 없는 404 / 410 응답의 기본 수명 (초, -n error=로 조정)
+#define CACHE_VALIDATOR_LEN 128   // 저장하는 ETag / Last-Modified 값의 최대 길이
+
+/* 제거 정책 (시작할 때 -e 옵션으로 선택)
+ * - CLOCK: 적중 시 비트 하나를 켜고, 시곗바늘이 메타데이터 배열을 돌며
+ *          켜진 비트는 끄고 꺼진 칸을 제거
+ * - S3-FIFO: 작은 FIFO(S, 약 10%)로 한 번 보고 마는 객체를 걸러내고
+ *          두 번 이상 본 객체만 메인 FIFO(M)로 올림. S에서 쫓겨난 키는
+ *          ghost에 해시만 남겨 두었다가 다시 오면 곧장 M으로 넣음
+ * 어느 쪽이든 적중 경로는 칸의 freq 바이트만 건드린다.
+ */
+enum { CACHE_POLICY_CLOCK, CACHE_POLICY_S3FIFO };
+
+/* 승인 정책 (시작할 때 -a 옵션으로 선택)
+ * - none: 자리가 없으면 무조건 제거하고 넣음
+ * - tinylfu: doit이 요청마다 키를 빈도 sketch(sketch.h)에 기록해 두고,
+ *   제거가 필요한 삽입은 후보의 빈도 추정값이 희생자보다 클 때만 받아들임.
+ *   크롤러의 한 번짜리 URL이 자주 쓰이는 객체를 밀어내지 못함
+ */
+enum { CACHE_ADMIT_ALL, CACHE_ADMIT_TINYLFU };
+
+/* 캐시 키 정규화 (cache_make_key)
+ * - 호스트는 소문자로, 기본 포트(80)는 빼고, 그 외 포트는 앞의 0을 지움
+ *   (스킴은 parse_uri가 대소문자 없이 "http://"만 받아 떼어 내므로 키에 남지 않음)
+ * - 경로의 "." / ".." 세그먼트를 풀고(RFC 3986 5.2.4), %XX는 비예약 문자면 글자로,
+ *   아니면 16진수를 대문자로 맞춤. '#' 뒤는 버림
+ * - 설정하면 쿼리 매개변수를 이름순으로 정렬하고(-q), 추적용 매개변수를 뺌(-Q)
+ * 입력을 한 번 훑으며 키 버퍼에 바로 쓰고 해시도 같이 계산한다 (힙 할당 없음).
+ * 앞 세그먼트를 지우는 ".."를 만났을 때만 남은 앞부분을 다시 해시한다.
+ */
+#define CACHE_KEY_QUERY_MAX 64    // 정렬/제거할 때 나눠 보는 쿼리 매개변수 수 (넘는 부분은 그대로)
+
+/* Vary 변형 (cache_vary_key)
+ * - 원 서버가 Vary를 보낸 원 키는 Vary 표에 헤더 이름 목록(명세)을 기억해 두고,
+ *   이후 요청은 그 헤더 값들을 정규화해 원 키 뒤에 '\n'으로 이어 붙인 변형 키로 캐시를 씀
+ *   (해시는 원 키 해시에서 이어서 계산)
+ * - Accept-Encoding은 br / gzip / identity 세 묶음으로, User-Agent는 프록시가 고정값으로
+ *   바꿔 보내므로 빈 값으로, 그 외 헤더는 소문자로 바꾸고 공백을 줄여서 씀
+ * - 명세를 처음 알게 된 응답(또는 명세가 바뀐 응답)은 어느 변형인지 몰라 캐시하지 않음
+ * - 원 키 하나에 변형은 CACHE_VARIANTS_MAX개까지, 넘으면 가장 오래된 변형을 RAM에서 내림
+ * - "Vary: *"나 너무 긴 목록은 캐시하지 않음
+ */
+#define CACHE_VARY_SLOTS 1024     // Vary 명세를 기억하는 원 키 수 (직접 사상, 충돌하면 덮어씀)
+#define CACHE_VARY_LEN 128        // 명세(소문자 헤더 이름, 쉼표 구분) 최대 길이
+#define CACHE_VARIANTS_MAX 4      // 원 키 하나에 둘 수 있는 변형 수
+
+/* 원 서버별 몫 (cache_set_quota)
+ * - 엔트리 크기는 실제 차지하는 바이트로 센다: 슬랩 블록(엔트리 헤더, 키, 검증자, 응답
+ *   헤더와 본문, 크기 클래스 올림) + 정책 칸 + 키 색인(radix) 노드 상한
+ * - 호스트(키의 첫 '/' 앞, 포트 포함)마다 RAM 캐시에서 쓰는 바이트를 세고,
+ *   몫을 넘을 삽입은 그 호스트의 엔트리만 정책 순서대로 내보내 자리를 만듦.
+ *   한 원 서버가 아무리 많이 요청해도 다른 원 서버의 엔트리를 밀어내지 못함
+ * - 몫은 바이트나 MAX_CACHE_SIZE에 대한 비율(가중치)로 주며, "*"는 따로 정하지 않은
+ *   호스트 각각의 몫. 몫을 하나도 정하지 않으면 세지도 않음
+ * - 호스트 표는 CACHE_ORIGINS칸이고 칸은 비우지 않는다. 표가 차면 나머지 호스트는
+ *   0번 칸 하나를 "*" 몫으로 함께 씀
+ */
+#define CACHE_ORIGINS 256         // 사용량을 따로 세는 호스트 수
+#define CACHE_HOST_LEN 128        // 호스트 표에 넣을 수 있는 "host[:port]" 최대 길이
+
+/* 조각 캐시 (큰 객체)
+ * - 채움 버퍼 한도를 넘는 200 응답(Content-Length가 있음)은 통째로 넣지 않고,
+ *   헤더만 든 목록 엔트리(seg_total = 본문 길이)를 원 키에 두고 본문은
+ *   CACHE_SEGMENT_SIZE 조각마다 "키\n#seg<세대>.<번호>" 키의 엔트리로 넣음
+ * - 조각은 보통 엔트리처럼 따로 승인 / 제거되므로 자주 보는 앞부분만 남고 안 보는 뒷부분은
+ *   빠짐 (조각 조회도 빈도 sketch에 기록)
+ * - 적중하면 있는 조각은 캐시에서 보내고, 빠진 조각이 이어진 구간은 원 서버에
+ *   Range(+ 검증자가 있으면 If-Range)로 받아 보내면서 다시 채움
+ * - 세대는 목록을 넣을 때마다 새로 붙으므로 새 응답이 옛 조각과 섞이지 않음.
+ *   옛 조각은 더 적중하지 않아 정책이 먼저 내보내고, PURGE는 원 키와 함께 지움
+ * - 목록과 조각은 RAM에만 둠 (디스크로 내려보내지 않고 스냅샷에도 쓰지 않음)
+ */
+#define CACHE_SEGMENT_SIZE 65536  // 조각 하나의 본문 바이트 (마지막 조각만 짧을 수 있음)
+#define CACHE_SEG_TAG "\n#seg"    // 원 키 뒤에 붙는 조각 키 표시
+
+typedef struct {
+  char str[MAXLINE];                // 정규화한 "host[:port]/path[?query]" (+ 변형 값들)
+  unsigned long hash;               // str의 FNV-1a 해시
+  size_t plen;                      // 원 키 길이 (변형 값 앞까지)
+  unsigned long phash;              // 원 키 해시 (Vary 표 조회용)
+  char vary[CACHE_VARY_LEN];        // 변형 키를 만든 Vary 명세, 원 키면 빈 문자열
+} cache_key_t;
+
+/* 조건부 재검증에 쓰는 검증자 (빈 문자열이면 없음) */
+typedef struct {
+  char etag[CACHE_VALIDATOR_LEN];           // ETag 원문 -> If-None-Match
+  char last_mod[CACHE_VALIDATOR_LEN];       // Last-Modified 원문 -> If-Modified-Since
+} cache_validators_t;
+
+/* 응답 헤더에서 뽑은 캐시 관련 정보 (relay_response의 헤더 루프에서 한 줄씩 채움) */
+typedef struct {
+  int status;                       // 응답 상태 코드 (relay_response가 채움)
+  long max_age, s_maxage;           // Cache-Control 값, 없으면 -1
+  long swr;                         // stale-while-revalidate 값, 없으면 0
+  long sie;                         // stale-if-error 값, 없으면 -1
+  int must_revalidate;              // must-revalidate 또는 proxy-revalidate
+  int no_store, private_, no_cache; // Cache-Control 지시자
+  long age;                         // Age 헤더, 없으면 0
+  time_t date, expires, last_modified;  // 없으면 0 (잘못된 Expires는 이미 만료로 봄)
+  int has_expires;
+  char vary[CACHE_VARY_LEN];        // Vary 명세 (소문자, 쉼표 구분), 없으면 빈 문자열, 캐시 불가면 "*"
+  cache_validators_t val;
+} cache_meta_t;
+
+/* 캐시 엔트리
+ * - data에는 원 서버가 보낸 응답(상태줄 + 헤더 + 빈 줄 + 본문)을 그대로 저장
+ * - hdr_len은 빈 줄까지 포함한 헤더 영역 길이, HEAD 요청은 여기까지만 전송
+ * - 조각 캐시의 목록(seg_total > 0)은 헤더 영역만 들고 본문은 조각 엔트리에 있음
+ * - 게시된 뒤에는 key/data/검증자가 바뀌지 않음 (교체는 새 엔트리로)
+ * - expires만 304 재검증 때 제자리에서 갱신하므로 원자 변수
+ * - slot은 샤드 메타데이터 배열에서 이 엔트리가 차지한 칸 (수명 동안 고정)
+ *   디스크에만 있는 큰 객체는 slot이 -1인 스레드별 임시 엔트리로 돌려주며,
+ *   data가 세그먼트 매핑을 가리킴 (같은 스레드의 다음 조회나 cache_read_end까지 유효)
+ * - refs는 캐시가 든 참조 1과 cache_hold 수. 유예 기간이 지나고 0이 되면 해제
+ */
+typedef struct cache_entry {
+  struct cache_entry *dnext;        // demote 큐 연결
+  unsigned long hash;               // 키 해시
+  size_t alloc;                     // 슬랩에 요청한 크기 (엔트리 + 응답 + 키)
+  size_t size;                      // 예산에 반영되는 크기 (슬랩 클래스 크기 + 색인 메타데이터)
+  int slot;                         // 메타데이터 칸 번호
+  epoch_node_t retire;              // 제거 후 에포크 회수용
+  atomic_int refs;                  // 캐시의 참조 1 + cache_hold 수
+  char *key;                        // "host:port/path"
+  char *data;                       // 응답 바이트
+  size_t hdr_len;                   // 헤더 영역 길이
+  size_t len;                       // 응답 전체 길이
+  _Atomic(time_t) expires;          // 이 시각 전까지 신선
+  _Atomic(time_t) born;             // 원 서버에서 만들어진 시각 추정 (Age 계산용)
+  long swr;                         // 만료 후 이 초 동안은 뒤에서 갱신하며 만료된 사본으로 응답
+  long sie;                         // 원 서버 오류 시 만료 후 이 초까지 사본으로 응답 (-1이면 기본값)
+  int must_revalidate;              // 만료된 사본 사용 금지
+  char *etag;                       // 검증자, 없으면 NULL
+  char *last_mod;
+  unsigned char demote;             // 정책이 제거함: 해제할 때 디스크로 내려보냄
+  unsigned char on_disk;            // 같은 내용이 디스크에도 있음 (다시 내려보낼 필요 없음)
+  unsigned short origin;            // 원 서버 몫 표의 칸 번호 (몫을 쓰지 않으면 0)
+  unsigned char ram_only;           // 조각 캐시의 목록이나 조각: 디스크 / 스냅샷에 쓰지 않음
+  unsigned int seg_gen;             // 목록이나 조각의 세대
+  size_t seg_total;                 // 목록이면 본문 길이 (data에는 헤더만 있음), 아니면 0
+} cache_entry_t;
+
+/* 조각 캐시 목록의 사본 (cache_manifest_get)
+ * - 조각 조회와 빈칸 채우기는 목록 엔트리 대신 이 사본으로 함. 원 서버를 기다리는 동안
+ *   읽기 구간을 잡고 있으면 그동안 제거된 엔트리를 회수하지 못하므로, 사본만 들고 구간을
+ *   나갔다가 돌아와서 조각을 다시 찾음 (조각 키는 세대로 구분되므로 목록이 그사이 내려가도 맞음)
+ */
+typedef struct {
+  char key[MAXLINE];
+  unsigned long hash;
+  unsigned int seg_gen;
+  size_t seg_total;
+  time_t expires, born;             // 채운 조각에 물려줌
+  cache_validators_t val;           // If-Range와 Range를 무시한 200 비교용
+} cache_manifest_t;
+
+/* 응답 중계 중 캐시에 넣을 바이트를 모으는 버퍼
+ * - limit(MAX_OBJECT_SIZE, 디스크 계층이 있으면 DISK_MAX_OBJECT)를 넘으면
+ *   ok가 0이 되고 더 이상 복사하지 않음
+ * - 헤더에서 이미 한도를 넘는 길이를 알면 조각 캐시로 넘어가, 조각이 찰 때마다 넣고 비움
+ * - flight에 속한 버퍼면 follower가 채워지는 중에 읽어 가므로, total이 정해질 때
+ *   total만큼 할당해 두고 그 뒤로는 buf를 옮기지 않음. len/hdr_len/total은 flight mutex 아래에서 갱신
+ */
+typedef struct {
+  char *buf;                        // 모은 응답 바이트 (지연 할당)
+  size_t cap;                       // buf 할당 크기
+  size_t limit;                     // 모을 수 있는 최대 길이
+  size_t len;                       // 현재까지 모은 길이
+  size_t hdr_len;                   // 헤더 영역 길이 (헤더가 끝나야 설정됨)
+  size_t total;                     // 완성될 응답 길이, 미리 알 수 없거나 캐시 불가면 0
+  int ok;                           // 캐시에 넣어도 되는지 여부
+  cache_meta_t meta;                // 응답 헤더의 캐시 관련 정보
+  const char *vary;                 // 요청 키를 만든 Vary 명세 (응답의 Vary와 다르면 캐시하지 않음)
+  const cache_key_t *key;           // 요청 키 (조각 캐시로 넘어가면 목록과 조각을 넣을 때 씀)
+  size_t seg_total;                 // 조각 캐시로 넘어갔으면 본문 길이 (buf에는 헤더 뒤에 채우는 조각만)
+  unsigned int seg_gen;             // 조각 캐시 세대
+  size_t seg_off;                   // 조각으로 넘긴 본문 바이트
+  struct cache_flight *flight;      // 이 버퍼를 같이 읽는 flight (없으면 NULL)
+} cache_fill_t;
+
+/* 기다리지 않고 flight를 따라가는 follower(이벤트 루프)가 받는 알림
+ * - leader가 바이트를 붙이거나 헤더를 끝내거나 flight를 끝낼 때마다 flight mutex 아래에서
+ *   fn을 부름. fn은 잠금을 더 잡지 말고 follower의 루프를 깨우기만 할 것
+ */
+typedef struct cache_flight_watch {
+  struct cache_flight_watch *next;
+  void (*fn)(struct cache_flight_watch *w);
+} cache_flight_watch_t;
+
+/* 진행 중인 원 서버 요청 (collapsed forwarding)
+ * - 같은 키에 대한 미스가 동시에 여러 개 오면 첫 번째만 원 서버로 가고(leader),
+ *   나머지(follower)는 leader의 채움 버퍼(fill)를 따라 읽으며 응답
+ * - 길이를 미리 알 수 있는 200 응답이면 헤더가 끝나는 즉시 follower도 스트리밍을
+ *   시작하고, 아니면 leader가 끝날 때까지 기다렸다가 캐시에서 응답
+ * - 블로킹 follower는 cond로, 이벤트 루프 follower는 watchers의 알림으로 깨어남
+ * - 샤드의 flight 리스트에 매달려 있으며, 참조 카운트가 0이 되면 fill과 함께 해제
+ */
+typedef struct cache_flight {
+  struct cache_flight *next;        // 샤드 flight 리스트 (샤드 mutex로 보호)
+  unsigned long hash;               // 키 해시
+  char *key;                        // 키 사본
+  pthread_mutex_t mutex;            // 아래 필드 보호
+  pthread_cond_t cond;              // 상태 변화 알림
+  int state;                        // FLIGHT_PENDING / DONE / FAILED / ERROR (STREAM은 저장하지 않음)
+  int refcnt;                       // leader 1 + 기다리는 follower 수
+  cache_flight_watch_t *watchers;   // 알림을 받을 이벤트 루프 follower
+  cache_fill_t fill;                // leader가 채우고 follower가 따라 읽는 응답
+} cache_flight_t;
+
+/* flight 상태 / 대기 결과
+ * - PENDING: leader가 아직 가져오는 중
+ * - DONE: 캐시에 들어감 (follower는 캐시에서 응답)
+ * - FAILED: 응답이 캐시 불가 (follower는 각자 원 서버로)
+ * - ERROR: 원 서버 연결 실패나 시간 초과, 삼킨 5xx (follower는 만료된 사본이나 502).
+ *   follower가 기다리다 leader가 멈춰 시간이 다 돼도 ERROR
+ * - STREAM: 대기 결과로만 씀. 아직 PENDING이지만 leader가 fill.total을 정했으므로
+ *   follower가 fill을 따라 읽으며 스트리밍해도 됨 (serve_from_flight, conn_follow)
+ */
+enum { FLIGHT_PENDING, FLIGHT_DONE, FLIGHT_FAILED, FLIGHT_ERROR, FLIGHT_STREAM };
+enum { FLIGHT_HIT, FLIGHT_LEADER, FLIGHT_FOLLOWER };            // cache_flight_begin 결과
+
+#define CACHE_FLIGHT_TIMEOUT 30   // follower가 leader의 다음 바이트를 기다리는 최대 초
+#define CACHE_FLIGHT_AGAIN (-2)   // cache_flight_peek: leader가 아직 채우지 않음
+
+/* 통계 (스레드별 카운터의 합) */
+typedef struct {
+  unsigned long hits, misses;       // 조회 결과
+  unsigned long stale;              // 만료된 엔트리를 찾은 조회
+  unsigned long revalidated;        // 304로 본문 없이 갱신한 재검증
+  unsigned long inserts;            // 삽입 성공
+  unsigned long evictions;          // 예산/칸 부족으로 제거한 엔트리
+  unsigned long collapsed;          // leader를 기다려 원 서버 요청을 생략한 follower
+  unsigned long disk_hits;          // RAM 미스 중 디스크 계층에서 찾은 조회
+  unsigned long demotions;          // RAM에서 제거되어 디스크로 내려간 엔트리
+  unsigned long warm_hits;          // RAM/디스크 미스 중 웜 재시작 스냅샷에서 찾은 조회
+  unsigned long admitted;           // 승인 검사에서 희생자를 이긴 삽입
+  unsigned long rejected;           // 승인 검사에서 져서 거절한 삽입
+  unsigned long purged;             // PURGE로 지운 키
+  unsigned long seg_hits;           // 캐시에서 보낸 조각
+  unsigned long seg_fills;          // 빈칸이라 원 서버에서 Range로 받아 채운 조각
+} cache_stats_t;
+
+/* 캐시 본체 */
+void cache_init(int policy, int admission);
+int cache_policy_parse(const char *name);
+const char *cache_policy_name(void);
+int cache_admission_parse(const char *name);
+const char *cache_admission_name(void);
+void cache_key_config(int sort_query, const char *strip);
+int cache_set_quota(const char *host, size_t bytes);
+int cache_origin_stat(int i, const char **host, size_t *used, size_t *quota);
+void cache_make_key(cache_key_t *key, const char *hostname, const char *port, const char *path);
+int cache_vary_key(cache_key_t *key, const char *hdrs);
+void cache_vary_learn(const cache_key_t *key, const char *vary);
+void cache_record(const cache_key_t *key);
+void cache_read_begin(void);
+void cache_read_end(void);
+int cache_hold(cache_entry_t *e);
+void cache_release(cache_entry_t *e);
+cache_entry_t *cache_lookup(const cache_key_t *key);
+int cache_fresh(const cache_entry_t *e);
+int cache_stale_usable(const cache_entry_t *e);
+int cache_stale_if_error(const cache_entry_t *e, long dflt);
+long cache_age(const cache_entry_t *e);
+void cache_get_validators(const cache_entry_t *e, cache_validators_t *v);
+int cache_insert(const cache_key_t *key, const char *data, size_t hdr_len, size_t len,
+                 const cache_meta_t *meta);
+int cache_refresh(const cache_key_t *key, const cache_meta_t *meta);
+int cache_purge(const cache_key_t *key, int prefix);
+void cache_manifest_get(const cache_entry_t *m, cache_manifest_t *mf);
+cache_entry_t *cache_segment(const cache_manifest_t *mf, size_t idx);
+int cache_segment_insert(const cache_manifest_t *mf, size_t idx, const char *data, size_t len);
+void cache_segment_drop(const cache_manifest_t *mf);
+size_t cache_bytes(void);
+void cache_foreach(void (*fn)(const disk_obj_t *, void *), void *arg);
+int cache_flight_begin(const cache_key_t *key, cache_flight_t **fp);
+int cache_flight_wait(cache_flight_t *f);
+long cache_flight_read(cache_flight_t *f, size_t off, const char **p);
+int cache_flight_poll(cache_flight_t *f);
+long cache_flight_peek(cache_flight_t *f, size_t off, const char **p);
+void cache_flight_watch(cache_flight_t *f, cache_flight_watch_t *w);
+void cache_flight_unwatch(cache_flight_t *f, cache_flight_watch_t *w);
+void cache_flight_end(cache_flight_t *f, int state);
+void cache_flight_release(cache_flight_t *f);
+void cache_get_stats(cache_stats_t *st);
+
+/* 응답 헤더 해석 */
+void cache_set_error_ttl(long sec);
+int cache_status_storable(int status);
+void cache_meta_init(cache_meta_t *m);
+void cache_meta_header(cache_meta_t *m, const char *line);
+int cache_meta_storable(const cache_meta_t *m);
+
+/* 채움 버퍼 */
+void cache_fill_init(cache_fill_t *f);
+void cache_fill_append(cache_fill_t *f, const void *buf, size_t n);
+void cache_fill_headers(cache_fill_t *f, long content_len);
+void cache_fill_reset(cache_fill_t *f);
+void cache_fill_free(cache_fill_t *f);
+
+#endif /* __CACHE_H__ */
@@ -0,0 +1,325 @@
+/*
+ * cachebench.c - 캐시 적중 경로 경합 벤치마크
+ *
+ * 캐시를 적중 대상 객체로 채운 뒤, 스레드 수를 1, 2, 4, ... 로 늘려가며
+ * 일정 시간 동안 cache_lookup 적중을 반복하고 초당 적중 수를 출력한다.
+ * 비교용으로 같은 조회를 전역 mutex 하나로 감싼 경우도 함께 잰다.
+ * (잠금 없는 경로는 코어 수까지 거의 선형으로 늘어나야 하고,
+ *  mutex 경로는 스레드가 늘어도 제자리이거나 떨어지는 것이 정상)
+ *
+ * -r를 주면 대신 적중률 비교 모드로 동작한다. Zipf 분포의 인기 객체 요청 사이에
+ * 한 번만 요청되는 스캔 요청을 섞어 재생하면서, 미스마다 삽입하고
+ * 제거 정책 x 승인 정책(none, tinylfu) 조합별 적중률을 출력한다.
+ *
+ * -i를 주면 샤드 색인 조회 지연 비교 모드로 동작한다. 샤드 하나에 드는 키 수
+ * (64 ~ CACHE_SHARD_SLOTS)마다 같은 키 집합을 샤드 색인(swiss.h)과 체인 해시
+ * (예전 색인처럼 버킷 64개, 그리고 키 수만큼의 버킷)에 넣고 단일 스레드로
+ * 적중 / 미스 조회 한 번의 평균 ns를 출력한다.
+ *
+ * 사용법: ./cachebench [-e clock|s3fifo] [-t maxthreads] [-s seconds] [-k keys] [-r] [-i]
+ */
+#include <getopt.h>
+#include <stdatomic.h>
+#include "csapp.h"
+#include "cache.h"
+#include "swiss.h"
+
+#define OBJ_SIZE 2048                      // 벤치마크 객체 하나의 응답 크기
+
+typedef struct {
+  unsigned long ops;                       // 이 스레드가 수행한 적중 수
+  unsigned long sink;                      // 최적화 방지용 누적값
+  unsigned int seed;
+  int locked;                              // 1이면 조회를 전역 mutex로 감쌈
+} __attribute__((aligned(64))) worker_t;
+
+static int nkeys = 256;
+static cache_key_t *keys;
+static atomic_int stop;
+static pthread_mutex_t big_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* 적중률 비교 모드: policy/admission으로 trace를 재생하고 적중률(%)을 반환 */
+static double replay(int policy, int admission, int nreq, int universe) {
+  double *cdf = malloc(sizeof(double) * universe), sum = 0, acc = 0;
+  static char obj[MAX_OBJECT_SIZE];
+  unsigned int x = 88172645u, scan = 0;
+  unsigned long hits = 0;
+  char path[32];
+  cache_key_t key;
+
+  for (int i = 0; i < universe; i++) sum += 1.0 / pow(i + 1, 0.9);   // Zipf(0.9)
+  for (int i = 0; i < universe; i++) {
+    acc += 1.0 / pow(i + 1, 0.9) / sum;
+    cdf[i] = acc;
+  }
+  memcpy(obj, "HTTP/1.0 200 OK\r\n\r\n", 19);
+  cache_init(policy, admission);
+
+  for (int r = 0; r < nreq; r++) {
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    if (x % 5 == 0) {                                   // 20%는 한 번만 오는 스캔 요청
+      snprintf(path, sizeof(path), "/%u", scan++);
+      cache_make_key(&key, "scan.local", "80", path);
+    } else {
+      double u = (double)(x >> 8) / (double)(1u << 24);
+      int lo = 0, hi = universe - 1;
+      while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cdf[mid] < u) lo = mid + 1; else hi = mid;
+      }
+      snprintf(path, sizeof(path), "/%d", lo);
+      cache_make_key(&key, "hot.local", "80", path);
+    }
+    cache_record(&key);
+    cache_read_begin();
+    int hit = cache_lookup(&key) != NULL;
+    cache_read_end();
+    if (hit) {
+      hits++;
+    } else {
+      size_t h = 0;
+      for (char *p = path; *p; p++) h = h * 31 + *p;
+      cache_insert(&key, obj, 19, 1024 + h % (16 * 1024), NULL);  // 1 ~ 17 KiB
+    }
+  }
+  free(cdf);
+  return 100.0 * hits / nreq;
+}
+
+/* 색인 비교 모드의 항목: 캐시 엔트리처럼 해시와 키를 한 블록에 둠 */
+typedef struct bench_item {
+  struct bench_item *next;                 // 체인 해시용
+  unsigned long hash;
+  char key[];
+} bench_item_t;
+
+#define INDEX_LOOKUPS (1 << 20)            // 한 번 잴 때의 조회 수
+
+static unsigned long fnv(const char *s) {
+  unsigned long h = 1469598103934665603UL;
+  for (; *s; s++) h = (h ^ (unsigned char)*s) * 1099511628211UL;
+  return h;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bench_item_t *chain_find(bench_item_t **b, size_t nb, unsigned long h, const char *key) {
+  for (bench_item_t *it = b[h % nb]; it; it = it->next)
+    if (it->hash == h && !strcmp(it->key, key)) return it;
+  return NULL;
+}
+
+static bench_item_t *swiss_find(const swiss_table_t *t, unsigned long h, const char *key) {
+  swiss_probe_t p;
+  bench_item_t *it;
+
+  swiss_probe(t, h, &p);
+  while ((it = swiss_next(&p)) != NULL)
+    if (it->hash == h && !strcmp(it->key, key)) return it;
+  return NULL;
+}
+
+/* 조회 순서 order[0..INDEX_LOOKUPS)로 찾아 조회 한 번의 평균 ns를 반환
+ * nb가 0이면 Swiss table, 아니면 버킷 nb개 체인 해시 */
+static double index_run(const swiss_table_t *t, bench_item_t **b, size_t nb,
+                        bench_item_t **probe, const int *order, unsigned long *sink) {
+  double t0 = now_ns();
+
+  for (int i = 0; i < INDEX_LOOKUPS; i++) {
+    bench_item_t *q = probe[order[i]], *it;
+    it = nb ? chain_find(b, nb, q->hash, q->key) : swiss_find(t, q->hash, q->key);
+    *sink += it != NULL;
+  }
+  return (now_ns() - t0) / INDEX_LOOKUPS;
+}
+
+/* 샤드 키 수별로 Swiss table과 체인 해시의 적중 / 미스 조회 지연을 출력 */
+static void index_bench(void) {
+  int counts[] = { 64, 256, CACHE_SHARD_SLOTS };
+  int *order = malloc(sizeof(int) * INDEX_LOOKUPS);
+  unsigned int x = 2463534242u;
+  unsigned long sink = 0;
+
+  printf("shard index lookup, %d lookups per run, ns/lookup (hit / miss)\n", INDEX_LOOKUPS);
+  printf("%6s %17s %17s %17s\n", "keys", "swiss", "chain(64)", "chain(keys)");
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    int n = counts[c];
+    bench_item_t **items = malloc(sizeof(*items) * n), **misses = malloc(sizeof(*misses) * n);
+    bench_item_t **b64 = calloc(64, sizeof(*b64)), **bn = calloc(n, sizeof(*bn));
+    swiss_table_t *t = swiss_new(CACHE_INDEX_SLOTS);
+    double r[3][2];
+
+    /* 실제 캐시 키 모양("host:port/path", 40바이트 안팎), 넣는 순서는 섞음 */
+    for (int i = 0; i < n; i++) {
+      char key[MAXLINE];
+      int len;
+      for (int k = 0; k < 2; k++) {
+        len = snprintf(key, sizeof(key), "static.bench.local:80/assets/%s/%08d.js",
+                       k ? "gone" : "img", i);
+        bench_item_t *it = malloc(sizeof(*it) + len + 1);
+        memcpy(it->key, key, len + 1);
+        it->hash = fnv(key);
+        (k ? misses : items)[i] = it;
+      }
+    }
+    for (int i = n - 1; i > 0; i--) {
+      int j = x % (unsigned int)(i + 1);
+      bench_item_t *tmp = items[i];
+      x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+      items[i] = items[j];
+      items[j] = tmp;
+    }
+    for (int i = 0; i < n; i++) {
+      bench_item_t *it = items[i];
+      swiss_insert(t, it->hash, it);
+      it->next = b64[it->hash % 64];
+      b64[it->hash % 64] = it;
+    }
+    for (int i = 0; i < INDEX_LOOKUPS; i++) {
+      x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+      order[i] = x % n;
+    }
+    for (int k = 0; k < 2; k++) {
+      bench_item_t **probe = k ? misses : items;
+      r[0][k] = index_run(t, NULL, 0, probe, order, &sink);
+      r[1][k] = index_run(NULL, b64, 64, probe, order, &sink);
+    }
+    /* 키 수만큼 버킷을 둔 체인 (항목의 next를 다시 엮음) */
+    for (int i = 0; i < n; i++) {
+      bench_item_t *it = items[i];
+      it->next = bn[it->hash % n];
+      bn[it->hash % n] = it;
+    }
+    for (int k = 0; k < 2; k++)
+      r[2][k] = index_run(NULL, bn, n, k ? misses : items, order, &sink);
+
+    printf("%6d", n);
+    for (int v = 0; v < 3; v++) printf("   %6.1f / %6.1f", r[v][0], r[v][1]);
+    printf("\n");
+    for (int i = 0; i < n; i++) {
+      free(items[i]);
+      free(misses[i]);
+    }
+    free(items); free(misses); free(b64); free(bn);
+    swiss_free(t);
+  }
+  if (sink == 42) printf("\n");                  // 조회가 최적화로 사라지지 않게
+  free(order);
+}
+
+static void *bench_thread(void *vargp) {
+  worker_t *w = vargp;
+  unsigned int x = w->seed;
+
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;           // xorshift32
+    const cache_key_t *key = &keys[x % nkeys];
+
+    if (w->locked) pthread_mutex_lock(&big_lock);
+    cache_read_begin();
+    cache_entry_t *e = cache_lookup(key);
+    if (e) w->sink += (unsigned char)e->data[e->len - 1];
+    cache_read_end();
+    if (w->locked) pthread_mutex_unlock(&big_lock);
+    w->ops++;
+  }
+  return NULL;
+}
+
+/* nthreads개 스레드로 seconds초 동안 돌려 초당 적중 수를 반환 */
+static double run(int nthreads, int seconds, int locked) {
+  pthread_t tids[nthreads];
+  worker_t *ws = calloc(nthreads, sizeof(worker_t));
+  unsigned long total = 0;
+
+  atomic_store(&stop, 0);
+  for (int i = 0; i < nthreads; i++) {
+    ws[i].seed = 2463534242u + i * 7919u;
+    ws[i].locked = locked;
+    pthread_create(&tids[i], NULL, bench_thread, &ws[i]);
+  }
+  sleep(seconds);
+  atomic_store(&stop, 1);
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(tids[i], NULL);
+    total += ws[i].ops;
+  }
+  free(ws);
+  return (double)total / seconds;
+}
+
+int main(int argc, char **argv) {
+  int maxthreads = (int)sysconf(_SC_NPROCESSORS_ONLN), seconds = 1, c;
+  int policy = CACHE_POLICY_S3FIFO, ratio = 0, index_mode = 0;
+  char obj[OBJ_SIZE];
+
+  while ((c = getopt(argc, argv, "e:t:s:k:ri")) != -1) {
+    switch (c) {
+    case 'e': policy = cache_policy_parse(optarg); break;
+    case 't': maxthreads = atoi(optarg); break;
+    case 's': seconds = atoi(optarg); break;
+    case 'k': nkeys = atoi(optarg); break;
+    case 'r': ratio = 1; break;
+    case 'i': index_mode = 1; break;
+    default:
+      fprintf(stderr, "usage: %s [-e clock|s3fifo] [-t maxthreads] [-s seconds] [-k keys] [-r] [-i]\n",
+              argv[0]);
+      exit(1);
+    }
+  }
+  if (maxthreads < 1) maxthreads = 1;
+  if (policy < 0) policy = CACHE_POLICY_S3FIFO;
+
+  if (index_mode) {
+    index_bench();
+    exit(0);
+  }
+  if (ratio) {
+    /* 정책마다 새 프로세스에서 재생하여 서로의 캐시 상태가 섞이지 않게 함 */
+    int policies[] = { CACHE_POLICY_CLOCK, CACHE_POLICY_S3FIFO };
+    const char *names[] = { "clock", "s3fifo" };
+    printf("zipf(0.9) over 20000 objects + 20%% one-hit scan, 500000 requests\n");
+    for (int i = 0; i < 4; i++) {
+      int admission = i % 2 ? CACHE_ADMIT_TINYLFU : CACHE_ADMIT_ALL;
+      fflush(stdout);
+      if (Fork() == 0) {
+        printf("%8s + %-7s hit ratio %6.2f%%\n", names[i / 2], admission ? "tinylfu" : "none",
+               replay(policies[i / 2], admission, 500000, 20000));
+        exit(0);
+      }
+      Wait(NULL);
+    }
+    exit(0);
+  }
+
+  /* 캐시 예산 안에 모두 들어가도록 키 개수를 제한하고 채움 */
+  if ((size_t)nkeys * (OBJ_SIZE + 64) > MAX_CACHE_SIZE)
+    nkeys = MAX_CACHE_SIZE / (OBJ_SIZE + 64);
+  cache_init(policy, CACHE_ADMIT_ALL);
+  keys = calloc(nkeys, sizeof(*keys));
+  memset(obj, 'x', sizeof(obj));
+  int hlen = snprintf(obj, sizeof(obj), "HTTP/1.0 200 OK\r\nContent-length: %d\r\n\r\n", 0);
+  for (int i = 0; i < nkeys; i++) {
+    char path[32];
+    snprintf(path, sizeof(path), "/obj/%d", i);
+    cache_make_key(&keys[i], "bench.local", "80", path);
+    cache_insert(&keys[i], obj, hlen, sizeof(obj), NULL);
+  }
+
+  printf("policy=%s, keys=%d, %d s per run, cache=%zu bytes\n",
+         cache_policy_name(), nkeys, seconds, cache_bytes());
+  printf("%8s %16s %8s %16s %8s\n", "threads", "lock-free hit/s", "scale", "mutex hit/s", "scale");
+  double base_free = 0, base_lock = 0;
+  for (int t = 1; ; t = (t * 2 > maxthreads) ? maxthreads : t * 2) {  // 마지막은 maxthreads
+    double f = run(t, seconds, 0);
+    double l = run(t, seconds, 1);
+    if (t == 1) { base_free = f; base_lock = l; }
+    printf("%8d %16.0f %7.2fx %16.0f %7.2fx\n", t, f, f / base_free, l, l / base_lock);
+    if (t >= maxthreads) break;
+  }
+  exit(0);
+}
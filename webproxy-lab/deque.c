@@ -0,0 +1,86 @@
+/*
+ * deque.c - Chase-Lev 작업 훔치기 덱 구현
+ *
+ * 메모리 순서는 Lê 외(2013)의 C11 버전을 따름
+ * - 넣기: 슬롯을 쓰고 release fence 뒤에 bottom을 올림 (꺼내는 쪽이 bottom을 보면 슬롯도 보임)
+ * - 꺼내기: top을 읽고 seq_cst fence 뒤에 bottom을 읽음, 슬롯을 읽은 뒤 top을 CAS로 전진
+ */
+#include <stddef.h>
+#include "csapp.h"
+#include "deque.h"
+
+static deque_array_t *array_new(long size) {
+  deque_array_t *a = Malloc(sizeof(deque_array_t) + size * sizeof(a->slot[0]));
+
+  a->mask = size - 1;
+  return a;
+}
+
+static void array_free(epoch_node_t *node) {
+  Free((deque_array_t *)((char *)node - offsetof(deque_array_t, retire)));
+}
+
+/* size는 처음 배열 크기 (2의 거듭제곱, 차면 두 배씩 커짐) */
+void deque_init(deque_t *d, long size) {
+  atomic_init(&d->top, 0);
+  atomic_init(&d->bottom, 0);
+  atomic_init(&d->array, array_new(size));
+}
+
+/* 배열을 두 배로 (주인만 부름)
+ * - [t, b) 구간을 같은 번호 자리에 옮기므로, 옛 배열에서 슬롯을 읽던 꺼내는 쪽도 같은 항목을 봄
+ */
+static deque_array_t *deque_grow(deque_t *d, deque_array_t *a, long t, long b) {
+  deque_array_t *n = array_new((a->mask + 1) * 2);
+
+  for (long i = t; i < b; i++)
+    atomic_store_explicit(&n->slot[i & n->mask],
+                          atomic_load_explicit(&a->slot[i & a->mask], memory_order_relaxed),
+                          memory_order_relaxed);
+  atomic_store_explicit(&d->array, n, memory_order_release);
+  epoch_retire(&a->retire, array_free);
+  return n;
+}
+
+/* 뒤에 넣음 (주인만 부름) */
+void deque_push(deque_t *d, void *item) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&d->top, memory_order_acquire);
+  deque_array_t *a = atomic_load_explicit(&d->array, memory_order_relaxed);
+
+  if (b - t > a->mask) a = deque_grow(d, a, t, b);
+  atomic_store_explicit(&a->slot[b & a->mask], item, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+/* 앞에서 하나 꺼냄 (아무 스레드나)
+ * 반환값: 꺼낸 항목, 비었으면 NULL, 다른 스레드와의 경쟁에서 지면 DEQUE_ABORT
+ */
+void *deque_steal(deque_t *d) {
+  long t = atomic_load_explicit(&d->top, memory_order_acquire);
+  long b;
+  deque_array_t *a;
+  void *item;
+
+  atomic_thread_fence(memory_order_seq_cst);
+  b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+  if (t >= b) return NULL;
+
+  epoch_enter();                                  // 주인이 배열을 키워도 옛 배열이 남아 있도록
+  a = atomic_load_explicit(&d->array, memory_order_acquire);
+  item = atomic_load_explicit(&a->slot[t & a->mask], memory_order_relaxed);
+  epoch_exit();
+  if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst,
+                                               memory_order_relaxed))
+    return DEQUE_ABORT;
+  return item;
+}
+
+/* 들어 있는 항목 수 (다른 스레드가 보는 값은 근사치) */
+long deque_size(deque_t *d) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+  return b > t ? b - t : 0;
+}
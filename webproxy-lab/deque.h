@@ -0,0 +1,40 @@
+/*
+ * deque.h - Chase-Lev 작업 훔치기 덱
+ *
+ * 주인 스레드 하나가 bottom 쪽으로 넣고, 아무 스레드나 top 쪽에서 꺼낸다(훔친다).
+ * - 넣기는 잠금도 원자적 read-modify-write도 없이 bottom 저장 한 번으로 끝난다
+ * - 꺼내기는 top에 대한 CAS 하나로 다른 꺼내는 쪽과 경쟁한다. 지면 DEQUE_ABORT를
+ *   돌려주는데, 그 항목은 다른 스레드가 가져갔어도 뒤에 항목이 더 남아 있을 수 있으므로
+ *   비었다고 보면 안 되고 같은 덱을 다시 꺼내 봐야 한다 (비었을 때만 NULL)
+ * - 배열이 차면 주인이 두 배로 키우고, 옛 배열은 훔치는 쪽이 아직 읽고 있을 수 있으므로
+ *   epoch_retire로 넘긴다
+ * - top에서 꺼내므로 넣은 순서대로 나온다 (주인이 bottom에서 꺼내는 pop은 쓰지 않아 없음)
+ * 참고: Chase & Lev, "Dynamic Circular Work-Stealing Deque" (2005),
+ *       Lê 외, "Correct and Efficient Work-Stealing for Weak Memory Models" (2013)
+ */
+#ifndef __DEQUE_H__
+#define __DEQUE_H__
+
+#include <stdatomic.h>
+#include "epoch.h"
+
+#define DEQUE_ABORT ((void *)1)     // deque_steal: 경쟁에서 짐 (항목은 정렬된 포인터라 겹치지 않음)
+
+typedef struct deque_array {
+  epoch_node_t retire;              // 키우고 남은 옛 배열을 회수할 때
+  long mask;                        // 크기 - 1 (크기는 2의 거듭제곱)
+  _Atomic(void *) slot[];
+} deque_array_t;
+
+typedef struct {
+  atomic_long top __attribute__((aligned(64)));     // 꺼내는 쪽들이 CAS로 전진
+  atomic_long bottom __attribute__((aligned(64)));  // 주인만 씀
+  _Atomic(deque_array_t *) array;
+} deque_t;
+
+void deque_init(deque_t *d, long size);
+void deque_push(deque_t *d, void *item);
+void *deque_steal(deque_t *d);
+long deque_size(deque_t *d);
+
+#endif /* __DEQUE_H__ */
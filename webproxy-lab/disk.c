@@ -0,0 +1,528 @@
+/*
+ * disk.c - 캐시 2차 계층 (추가 전용 세그먼트 로그) 구현
+ *
+ * 구성
+ * - 세그먼트: dir/seg-<순번>.log 파일. 만들 때 DISK_SEG_SIZE로 늘리고 통째로
+ *   PROT_READ mmap. 쓰기는 pwritev로 하며 페이지 캐시를 공유하므로 매핑에 바로 보임
+ * - 쓰기 위치(active 세그먼트)는 log_mutex 하나로 보호. 레코드를 끝까지 쓴 뒤에
+ *   색인에 올리므로 색인에서 찾은 레코드는 항상 완성되어 있음
+ * - 색인: 키 해시 상위 비트로 고른 샤드마다 mutex와 체인 해시 테이블.
+ *   노드는 (해시, 세그먼트, 오프셋, 크기)뿐이라 RAM 사용량이 객체 수에만 비례
+ *   색인에 올리고 지울 때 키 색인(radix.c)의 디스크 비트도 같은 mutex 안에서 바꿈
+ * - 세그먼트마다 색인이 가리키는 바이트(live)를 세어 두고, 빈 세그먼트가
+ *   DISK_FREE_RESERVE개 이하로 줄면 compactor가 하나를 골라 회수
+ *   - live 비율이 DISK_COMPACT_LIVE% 이하면 살아 있는 레코드만 active로 옮김
+ *   - 그보다 많이 살아 있으면 가장 오래된 세그먼트를 버림 (로그 전체가 FIFO 캐시)
+ *   - 회수한 세그먼트는 색인에서 빠진 뒤 에포크 유예 기간이 지나야 munmap/unlink
+ * - compactor가 레코드를 옮길 자리가 없어지지 않도록, 일반 쓰기는 마지막
+ *   DISK_FREE_RESERVE개의 빈 세그먼트를 쓰지 못함 (그때는 쓰기를 포기)
+ */
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include "csapp.h"
+#include "epoch.h"
+#include "disk.h"
+#include "radix.h"
+
+#define DISK_FREE_RESERVE 1                 // compactor 몫으로 남겨 두는 빈 세그먼트 수
+#define DISK_COMPACT_LIVE 50                // 이 비율(%) 이하로 살아 있으면 옮겨 담아 회수
+
+enum { SEG_FREE, SEG_ACTIVE, SEG_SEALED, SEG_RETIRED };
+
+typedef struct {
+  int state;                                // SEG_*
+  int fd;
+  char *map;                                // 세그먼트 전체 읽기 전용 매핑
+  unsigned long seq;                        // 만든 순서 (파일 이름, FIFO 기준)
+  size_t used;                              // 쓴 바이트 (log_mutex 아래에서 증가)
+  atomic_size_t live;                       // 색인이 가리키는 레코드 바이트
+  epoch_node_t retire;                      // 회수 후 munmap을 미루는 데 씀
+} disk_seg_t;
+
+typedef struct disk_idx {
+  struct disk_idx *next;
+  unsigned long hash;
+  int seg;
+  unsigned int off, size;
+} disk_idx_t;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  disk_idx_t *buckets[DISK_NBUCKETS];
+  unsigned long n;                          // 노드 수
+} __attribute__((aligned(64))) disk_shard_t;
+
+static char disk_dir[MAXLINE / 2];
+static int enabled;
+static int nsegs;                           // 용량에 해당하는 세그먼트 수
+static disk_seg_t segs[DISK_MAXSEGS];
+static disk_shard_t shards[DISK_NSHARDS];
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;  // 아래 필드와 세그먼트 상태
+static pthread_cond_t compact_cond = PTHREAD_COND_INITIALIZER;
+static int active = -1;                     // 쓰는 중인 세그먼트
+static int nfree, nretired;                 // 빈 세그먼트 수, 유예 기간을 기다리는 세그먼트 수
+static unsigned long next_seq;
+
+static atomic_ulong ncompactions, ndropped;
+
+static size_t align8(size_t n) {
+  return (n + 7) & ~(size_t)7;
+}
+
+static void seg_path(char *buf, unsigned long seq) {
+  snprintf(buf, MAXLINE, "%s/seg-%08lu.log", disk_dir, seq);
+}
+
+/********************************
+ * 색인
+ ********************************/
+static disk_shard_t *shard_of(unsigned long hash) {
+  return &shards[(hash >> 56) % DISK_NSHARDS];
+}
+
+/* hash를 (seg, off)로 가리키게 함. 옛 위치의 live는 줄임
+ * 키 색인(radix.c)에도 디스크가 key를 들고 있다고 기록 */
+static void index_set(unsigned long hash, const char *key, int seg, unsigned int off,
+                      unsigned int size) {
+  disk_shard_t *sh = shard_of(hash);
+  disk_idx_t **b = &sh->buckets[hash % DISK_NBUCKETS], *n;
+
+  pthread_mutex_lock(&sh->mutex);
+  for (n = *b; n && n->hash != hash; n = n->next)
+    ;
+  if (n) {
+    atomic_fetch_sub(&segs[n->seg].live, n->size);
+  } else {
+    n = Malloc(sizeof(*n));
+    n->hash = hash;
+    n->next = *b;
+    *b = n;
+    sh->n++;
+  }
+  n->seg = seg;
+  n->off = off;
+  n->size = size;
+  atomic_fetch_add(&segs[seg].live, size);
+  radix_add(key, hash, RADIX_DISK);
+  pthread_mutex_unlock(&sh->mutex);
+}
+
+/* hash가 아직 (seg, off)를 가리키면 (to, to_off)로 옮기거나(to >= 0) 지움(to < 0)
+ * - 지우면 키 색인에서도 디스크 비트를 뺌 (key는 그 레코드의 키)
+ * 반환값: 바꿨으면 1, 그 사이 새 레코드가 들어와 있으면 0
+ */
+static int index_move(unsigned long hash, const char *key, int seg, unsigned int off,
+                      int to, unsigned int to_off) {
+  disk_shard_t *sh = shard_of(hash);
+  disk_idx_t **pp = &sh->buckets[hash % DISK_NBUCKETS], *n;
+
+  pthread_mutex_lock(&sh->mutex);
+  while ((n = *pp) != NULL && n->hash != hash) pp = &n->next;
+  if (!n || n->seg != seg || n->off != off) {
+    pthread_mutex_unlock(&sh->mutex);
+    return 0;
+  }
+  atomic_fetch_sub(&segs[seg].live, n->size);
+  if (to >= 0) {
+    n->seg = to;
+    n->off = to_off;
+    atomic_fetch_add(&segs[to].live, n->size);
+  } else {
+    *pp = n->next;
+    sh->n--;
+    Free(n);
+    radix_del(key, RADIX_DISK);
+  }
+  pthread_mutex_unlock(&sh->mutex);
+  return 1;
+}
+
+/* hash의 현재 위치 (없으면 0) */
+static int index_find(unsigned long hash, int *seg, unsigned int *off) {
+  disk_shard_t *sh = shard_of(hash);
+  disk_idx_t *n;
+
+  pthread_mutex_lock(&sh->mutex);
+  for (n = sh->buckets[hash % DISK_NBUCKETS]; n && n->hash != hash; n = n->next)
+    ;
+  if (n) {
+    *seg = n->seg;
+    *off = n->off;
+  }
+  pthread_mutex_unlock(&sh->mutex);
+  return n != NULL;
+}
+
+/********************************
+ * 세그먼트 (log_mutex를 잡은 상태에서 호출)
+ ********************************/
+
+/* 빈 칸 i에 새 세그먼트 파일을 만들고 매핑 */
+static int seg_create(int i) {
+  disk_seg_t *s = &segs[i];
+  char path[MAXLINE];
+  int fd;
+  char *map;
+
+  seg_path(path, next_seq);
+  if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) return -1;
+  if (ftruncate(fd, DISK_SEG_SIZE) < 0 ||
+      (map = mmap(NULL, DISK_SEG_SIZE, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    unlink(path);
+    return -1;
+  }
+  s->fd = fd;
+  s->map = map;
+  s->seq = next_seq++;
+  s->used = 0;
+  atomic_store(&s->live, 0);
+  s->state = SEG_ACTIVE;
+  nfree--;
+  return 0;
+}
+
+/* active 세그먼트에 size 바이트 자리를 잡음
+ * - 자리가 없으면 active를 봉인하고 빈 칸에 새 세그먼트를 엶
+ * - compactor가 아니면 마지막 DISK_FREE_RESERVE개의 빈 칸은 쓰지 않음
+ * 반환값: 세그먼트 번호 (*off에 오프셋), 자리가 없으면 -1
+ */
+static int log_reserve(size_t size, int for_compactor, unsigned int *off) {
+  int i;
+
+  if (active < 0 || segs[active].used + size > DISK_SEG_SIZE) {
+    if (nfree <= (for_compactor ? 0 : DISK_FREE_RESERVE)) {
+      pthread_cond_signal(&compact_cond);
+      return -1;
+    }
+    for (i = 0; i < nsegs && segs[i].state != SEG_FREE; i++)
+      ;
+    if (seg_create(i) < 0) return -1;
+    if (active >= 0) segs[active].state = SEG_SEALED;
+    active = i;
+  }
+  *off = (unsigned int)segs[active].used;
+  segs[active].used += size;
+  if (nfree + nretired <= DISK_FREE_RESERVE) pthread_cond_signal(&compact_cond);
+  return active;
+}
+
+/* 쓰기 실패한 세그먼트는 뒤에 더 쓰지 않도록 봉인 (스캔이 구멍에서 멈추므로) */
+static void log_seal_active(void) {
+  if (active >= 0) {
+    segs[active].state = SEG_SEALED;
+    active = -1;
+  }
+}
+
+/* 유예 기간이 지난 세그먼트를 닫고 파일을 지움 (epoch_retire 콜백) */
+static void seg_free(epoch_node_t *node) {
+  disk_seg_t *s = (disk_seg_t *)((char *)node - offsetof(disk_seg_t, retire));
+  char path[MAXLINE];
+
+  munmap(s->map, DISK_SEG_SIZE);
+  close(s->fd);
+  seg_path(path, s->seq);
+  unlink(path);
+
+  pthread_mutex_lock(&log_mutex);
+  s->state = SEG_FREE;
+  nretired--;
+  nfree++;
+  pthread_mutex_unlock(&log_mutex);
+}
+
+/********************************
+ * compactor
+ ********************************/
+
+/* 회수할 세그먼트 고르기: live가 가장 적은 봉인 세그먼트가 충분히 비었으면 그것을
+ * 옮겨 담고(*copy = 1), 아니면 가장 오래된 봉인 세그먼트를 버림(*copy = 0)
+ */
+static int pick_victim(int *copy) {
+  int i, emptiest = -1, oldest = -1;
+
+  for (i = 0; i < nsegs; i++) {
+    if (segs[i].state != SEG_SEALED) continue;
+    if (emptiest < 0 || atomic_load(&segs[i].live) < atomic_load(&segs[emptiest].live))
+      emptiest = i;
+    if (oldest < 0 || segs[i].seq < segs[oldest].seq) oldest = i;
+  }
+  if (emptiest >= 0 &&
+      atomic_load(&segs[emptiest].live) * 100 <= segs[emptiest].used * DISK_COMPACT_LIVE) {
+    *copy = 1;
+    return emptiest;
+  }
+  *copy = 0;
+  return oldest;
+}
+
+/* 세그먼트 i의 레코드를 훑으며 살아 있는 것은 옮기거나(copy) 색인에서 지우고 회수 */
+static void compact(int i, int copy) {
+  disk_seg_t *s = &segs[i];
+  size_t off = 0;
+
+  while (off + sizeof(disk_rec_t) <= s->used) {
+    disk_rec_t *rec = (disk_rec_t *)(s->map + off);
+    int seg, to = -1;
+    unsigned int cur, to_off = 0;
+
+    if (rec->magic != DISK_MAGIC || rec->size == 0) break;
+    if (index_find(rec->hash, &seg, &cur) && seg == i && cur == off) {
+      if (copy) {
+        pthread_mutex_lock(&log_mutex);
+        if ((to = log_reserve(rec->size, 1, &to_off)) >= 0 &&
+            pwrite(segs[to].fd, rec, rec->size, to_off) != (ssize_t)rec->size) {
+          log_seal_active();
+          to = -1;
+        }
+        pthread_mutex_unlock(&log_mutex);
+      }
+      index_move(rec->hash, (const char *)(rec + 1), i, (unsigned int)off, to, to_off);
+    }
+    off += rec->size;
+  }
+
+  pthread_mutex_lock(&log_mutex);
+  s->state = SEG_RETIRED;
+  nretired++;
+  pthread_mutex_unlock(&log_mutex);
+  epoch_retire(&s->retire, seg_free);
+  atomic_fetch_add(copy ? &ncompactions : &ndropped, 1);
+}
+
+/* 빈 세그먼트가 모자라면 깨어나 회수, 1초마다 유예 기간이 지난 세그먼트 정리 */
+static void *compactor(void *vargp) {
+  struct timespec ts;
+  int victim, copy, pending;
+
+  pthread_detach(pthread_self());
+  while (1) {
+    pthread_mutex_lock(&log_mutex);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 1;
+    pthread_cond_timedwait(&compact_cond, &log_mutex, &ts);
+    while (nfree + nretired <= DISK_FREE_RESERVE && (victim = pick_victim(&copy)) >= 0) {
+      segs[victim].state = SEG_RETIRED;     // 다시 뽑히지 않게 (compact가 nretired에 반영)
+      pthread_mutex_unlock(&log_mutex);
+      compact(victim, copy);
+      pthread_mutex_lock(&log_mutex);
+    }
+    pthread_mutex_unlock(&log_mutex);
+
+    /* 회수한 세그먼트는 에포크가 두 번 전진해야 비므로, 그동안 쓰기가 막히지 않게
+     * 짧게 쉬며 재촉 (읽기 구간이 길게 걸린 워커가 있으면 다음 주기로 넘김) */
+    for (int i = 0; i < 100; i++) {
+      epoch_collect();
+      pthread_mutex_lock(&log_mutex);
+      pending = nretired;
+      pthread_mutex_unlock(&log_mutex);
+      if (!pending) break;
+      usleep(1000);
+    }
+  }
+  return NULL;
+}
+
+/********************************
+ * 공개 함수
+ ********************************/
+
+/* dir 아래에 capacity 바이트짜리 디스크 계층을 준비 (이전 세그먼트 파일은 지움)
+ * 반환값: 성공 0, 실패 -1
+ */
+int disk_init(const char *dir, size_t capacity) {
+  DIR *d;
+  struct dirent *de;
+  char path[MAXLINE];
+  pthread_t tid;
+
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST) return -1;
+  if ((d = opendir(dir)) == NULL) return -1;
+  snprintf(disk_dir, sizeof(disk_dir), "%s", dir);
+  while ((de = readdir(d)) != NULL) {
+    if (!strncmp(de->d_name, "seg-", 4) && strstr(de->d_name, ".log")) {
+      snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+      unlink(path);
+    }
+  }
+  closedir(d);
+
+  nsegs = (int)(capacity / DISK_SEG_SIZE);
+  if (nsegs < DISK_FREE_RESERVE + 2) nsegs = DISK_FREE_RESERVE + 2;
+  if (nsegs > DISK_MAXSEGS) nsegs = DISK_MAXSEGS;
+  nfree = nsegs;
+  for (int i = 0; i < DISK_NSHARDS; i++) pthread_mutex_init(&shards[i].mutex, NULL);
+  enabled = 1;
+  pthread_create(&tid, NULL, compactor, NULL);
+  return 0;
+}
+
+int disk_enabled(void) {
+  return enabled;
+}
+
+/********************************
+ * 레코드 인코딩 (스냅샷 파일도 같은 형식)
+ ********************************/
+
+/* o를 레코드로 쓰기 위한 iovec 준비 (rec는 호출자가 준 헤더 자리)
+ * - 할당하지 않으므로 fork한 자식 프로세스에서도 호출 가능
+ * 반환값: iov 개수 (DISK_REC_IOV), 키가 너무 길면 0
+ */
+int disk_rec_iov(const disk_obj_t *o, disk_rec_t *rec, struct iovec *iov) {
+  static const char pad[8];
+  size_t klen = strlen(o->key) + 1;
+  size_t elen = o->etag ? strlen(o->etag) + 1 : 0;
+  size_t llen = o->last_mod ? strlen(o->last_mod) + 1 : 0;
+  size_t head = sizeof(disk_rec_t) + klen + elen + llen;
+  size_t size = align8(head + o->len);
+
+  if (klen > UINT16_MAX || elen > UINT16_MAX || llen > UINT16_MAX || size > UINT32_MAX) return 0;
+  rec->magic = DISK_MAGIC;
+  rec->size = (uint32_t)size;
+  rec->hash = o->hash;
+  rec->expires = o->expires;
+  rec->born = o->born;
+  rec->swr = (int32_t)o->swr;
+  rec->sie = (int32_t)o->sie;
+  rec->hdr_len = (uint32_t)o->hdr_len;
+  rec->len = (uint32_t)o->len;
+  rec->klen = (uint16_t)klen;
+  rec->elen = (uint16_t)elen;
+  rec->llen = (uint16_t)llen;
+  rec->must_revalidate = (uint16_t)o->must_revalidate;
+  iov[0] = (struct iovec){ rec, sizeof(*rec) };
+  iov[1] = (struct iovec){ (void *)o->key, klen };
+  iov[2] = (struct iovec){ (void *)o->etag, elen };
+  iov[3] = (struct iovec){ (void *)o->last_mod, llen };
+  iov[4] = (struct iovec){ (void *)o->data, o->len };
+  iov[5] = (struct iovec){ (void *)pad, size - head - o->len };
+  return DISK_REC_IOV;
+}
+
+/* p에 있는 레코드를 o로 펼침 (포인터는 p 안을 가리킴)
+ * - avail: p 뒤로 읽어도 되는 바이트 수. 길이 필드가 그 밖을 가리키면 손상으로 봄
+ * 반환값: 레코드 크기, 레코드가 아니거나 손상되었으면 0
+ */
+size_t disk_rec_decode(const char *p, size_t avail, disk_obj_t *o) {
+  const disk_rec_t *rec = (const disk_rec_t *)p;
+  const char *s = p + sizeof(*rec);
+
+  if (avail < sizeof(*rec) || rec->magic != DISK_MAGIC || rec->size > avail ||
+      sizeof(*rec) + (size_t)rec->klen + rec->elen + rec->llen + rec->len > rec->size ||
+      rec->hdr_len > rec->len || rec->klen == 0 || s[rec->klen - 1] != '\0' ||
+      (rec->elen && s[rec->klen + rec->elen - 1] != '\0') ||
+      (rec->llen && s[rec->klen + rec->elen + rec->llen - 1] != '\0'))
+    return 0;
+
+  o->hash = rec->hash;
+  o->key = s;
+  s += rec->klen;
+  o->etag = rec->elen ? s : NULL;
+  s += rec->elen;
+  o->last_mod = rec->llen ? s : NULL;
+  s += rec->llen;
+  o->data = s;
+  o->hdr_len = rec->hdr_len;
+  o->len = rec->len;
+  o->expires = rec->expires;
+  o->born = rec->born;
+  o->swr = rec->swr;
+  o->sie = rec->sie;
+  o->must_revalidate = rec->must_revalidate;
+  return rec->size;
+}
+
+/* 객체를 로그 끝에 덧붙이고 색인에 올림 (같은 키의 옛 레코드는 쓰레기가 됨)
+ * 반환값: 성공 1, 디스크 계층이 꺼졌거나 자리가 없거나 쓰기 실패면 0
+ */
+int disk_put(const disk_obj_t *o) {
+  disk_rec_t rec;
+  struct iovec iov[DISK_REC_IOV];
+  unsigned int off;
+  int seg;
+
+  if (!enabled || o->len > DISK_MAX_OBJECT || !disk_rec_iov(o, &rec, iov)) return 0;
+
+  pthread_mutex_lock(&log_mutex);
+  if ((seg = log_reserve(rec.size, 0, &off)) >= 0 &&
+      pwritev(segs[seg].fd, iov, DISK_REC_IOV, off) != (ssize_t)rec.size) {
+    log_seal_active();
+    seg = -1;
+  }
+  pthread_mutex_unlock(&log_mutex);
+
+  if (seg < 0) return 0;
+  index_set(o->hash, o->key, seg, off, rec.size);
+  return 1;
+}
+
+/* 키로 레코드 조회 (epoch_enter/exit 사이에서 호출)
+ * - 찾으면 o의 포인터들이 세그먼트 매핑 안을 가리킴 (epoch_exit 전까지 유효)
+ * 반환값: 적중 1, 미스 0
+ */
+int disk_get(unsigned long hash, const char *key, disk_obj_t *o) {
+  int seg;
+  unsigned int off;
+
+  if (!enabled || !index_find(hash, &seg, &off)) return 0;
+  return disk_rec_decode(segs[seg].map + off, segs[seg].used - off, o) &&
+         o->hash == hash && !strcmp(o->key, key);
+}
+
+/* 304 재검증 결과를 레코드 헤더에 제자리 반영 (epoch_enter/exit 사이에서 호출)
+ * 반환값: 레코드가 있어 갱신했으면 1
+ */
+int disk_refresh(unsigned long hash, const char *key, time_t expires, time_t born) {
+  disk_obj_t o;
+  int64_t t[2] = { expires, born };
+  int seg;
+  unsigned int off;
+
+  if (!disk_get(hash, key, &o) || !index_find(hash, &seg, &off)) return 0;
+  return pwrite(segs[seg].fd, t, sizeof(t), off + offsetof(disk_rec_t, expires)) == sizeof(t);
+}
+
+/* 키의 레코드를 색인에서 지움 (PURGE). 레코드 자리는 쓰레기가 되어 compactor가 회수
+ * 반환값: 지웠으면 1
+ */
+int disk_remove(unsigned long hash, const char *key) {
+  disk_shard_t *sh = shard_of(hash);
+  disk_idx_t **pp = &sh->buckets[hash % DISK_NBUCKETS], *n;
+  disk_obj_t o;
+  int found = 0;
+
+  if (!enabled) return 0;
+  pthread_mutex_lock(&sh->mutex);
+  while ((n = *pp) != NULL && n->hash != hash) pp = &n->next;
+  /* 색인이 가리키는 동안 세그먼트는 회수되지 않으므로 잠금 안에서 키를 비교해도 됨 */
+  if (n && disk_rec_decode(segs[n->seg].map + n->off, segs[n->seg].used - n->off, &o) &&
+      !strcmp(o.key, key)) {
+    atomic_fetch_sub(&segs[n->seg].live, n->size);
+    *pp = n->next;
+    sh->n--;
+    Free(n);
+    radix_del(key, RADIX_DISK);
+    found = 1;
+  }
+  pthread_mutex_unlock(&sh->mutex);
+  return found;
+}
+
+/* 통계 (비동기 시그널 안전: 잠금 없이 읽기만 하므로 값이 서로 약간 어긋날 수 있음) */
+void disk_get_stats(disk_stats_t *st) {
+  memset(st, 0, sizeof(*st));
+  if (!enabled) return;
+  for (int i = 0; i < nsegs; i++) {
+    if (segs[i].state == SEG_FREE) continue;
+    st->segments++;
+    st->used += segs[i].used;
+    st->live += atomic_load(&segs[i].live);
+  }
+  for (int i = 0; i < DISK_NSHARDS; i++) st->objects += shards[i].n;
+  st->compactions = atomic_load(&ncompactions);
+  st->dropped = atomic_load(&ndropped);
+}
@@ -0,0 +1,80 @@
+/*
+ * disk.h - 캐시 2차 계층: 로컬 디스크의 추가 전용(log-structured) 세그먼트 로그
+ *
+ * - 객체는 고정 크기 세그먼트 파일(DISK_SEG_SIZE)에 레코드로 덧붙여 쓰고,
+ *   세그먼트는 통째로 읽기 전용 mmap 해 두어 적중하면 매핑에서 바로 전송한다
+ * - 메모리에는 키 해시 -> (세그먼트, 오프셋) 색인만 둔다 (객체당 수십 바이트)
+ *   키 원문은 레코드에 있으므로 적중 시 레코드에서 비교한다
+ * - 같은 키를 다시 쓰면 새 레코드가 색인을 차지하고 옛 레코드는 쓰레기가 된다
+ * - 백그라운드 compactor가 쓰레기가 많은 세그먼트의 살아 있는 레코드를 앞으로 옮기고
+ *   세그먼트를 회수한다. 대부분 살아 있으면 가장 오래된 세그먼트를 통째로 버린다 (FIFO)
+ * - 회수한 세그먼트의 munmap은 에포크 회수로 미루므로, epoch_enter/exit
+ *   (cache_read_begin/end) 사이에서 얻은 레코드 포인터는 그동안 유효하다
+ */
+#ifndef __DISK_H__
+#define __DISK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#define DISK_SEG_SIZE (64UL << 20)        // 세그먼트 파일 크기
+#define DISK_MAX_OBJECT (16UL << 20)      // 디스크 계층에 넣을 수 있는 최대 응답 크기
+#define DISK_MAXSEGS 1024                 // 세그먼트 표 크기 (용량 상한 64 GiB)
+#define DISK_NSHARDS 16                   // 색인 샤드 개수
+#define DISK_NBUCKETS 4096                // 색인 샤드 하나의 해시 버킷 개수
+#define DISK_DEFAULT_MB 1024              // 기본 용량 (MiB)
+
+/* 디스크 레코드 헤더: 뒤에 키, ETag, Last-Modified (각각 NUL 포함), 응답 바이트가 이어짐
+ * (스냅샷 파일도 같은 레코드를 이어 붙인 형식)
+ */
+typedef struct {
+  uint32_t magic;
+  uint32_t size;                    // 헤더 포함 레코드 전체 크기 (8바이트 정렬)
+  uint64_t hash;
+  int64_t expires, born;
+  int32_t swr, sie;
+  uint32_t hdr_len, len;
+  uint16_t klen, elen, llen;        // 문자열 길이 (NUL 포함, 없으면 0)
+  uint16_t must_revalidate;
+} disk_rec_t;
+
+#define DISK_MAGIC 0x4b534944u      // 레코드 시작 표시 ("DISK")
+#define DISK_REC_IOV 6              // disk_rec_iov가 채우는 iovec 개수
+
+/* 디스크 레코드 한 개를 펼친 모습
+ * - disk_put에는 넣을 내용을, disk_get에서는 매핑 안을 가리키는 포인터로 돌려받음
+ * - etag/last_mod는 없으면 NULL
+ */
+typedef struct {
+  unsigned long hash;               // 키 해시 (cache.c와 같은 FNV-1a)
+  const char *key;
+  const char *etag, *last_mod;      // 검증자
+  const char *data;                 // 응답 바이트 (상태줄 + 헤더 + 빈 줄 + 본문)
+  size_t hdr_len, len;
+  time_t expires, born;             // 신선도 (cache_entry_t와 같은 의미)
+  long swr, sie;
+  int must_revalidate;
+} disk_obj_t;
+
+/* 통계 */
+typedef struct {
+  unsigned long segments;           // 사용 중인 세그먼트 수
+  unsigned long objects;            // 색인에 있는 객체 수
+  size_t used, live;                // 세그먼트에 쓴 바이트 / 그중 색인이 가리키는 바이트
+  unsigned long compactions;        // 살아 있는 레코드를 옮기고 회수한 세그먼트 수
+  unsigned long dropped;            // 통째로 버린 세그먼트 수
+} disk_stats_t;
+
+int disk_init(const char *dir, size_t capacity);
+int disk_enabled(void);
+int disk_put(const disk_obj_t *o);
+int disk_get(unsigned long hash, const char *key, disk_obj_t *o);
+int disk_refresh(unsigned long hash, const char *key, time_t expires, time_t born);
+int disk_remove(unsigned long hash, const char *key);
+void disk_get_stats(disk_stats_t *st);
+int disk_rec_iov(const disk_obj_t *o, disk_rec_t *rec, struct iovec *iov);
+size_t disk_rec_decode(const char *p, size_t avail, disk_obj_t *o);
+
+#endif /* __DISK_H__ */
@@ -0,0 +1,133 @@
+/*
+ * epoch.c - 에포크 기반 메모리 회수 구현
+ *
+ * 규칙
+ * - 전역 에포크 g는 1부터 시작 (0은 "임계구역 밖"을 뜻함)
+ * - 읽기 스레드는 들어갈 때 자기 슬롯에 g를 기록
+ * - 등록된 모든 활성 슬롯이 현재 g를 기록하고 있으면 g를 g+1로 전진
+ * - 에포크 e에 retire된 노드는 g >= e + 2가 되면 아무도 참조할 수 없으므로 해제
+ * - limbo 리스트와 전진 시도는 쓰기 쪽 경로에서만 일어나므로 mutex로 보호
+ */
+#include <stdatomic.h>
+#include "csapp.h"
+#include "epoch.h"
+
+/* 스레드별 에포크 슬롯
+ * - 캐시 라인 하나를 통째로 차지하여 다른 스레드 슬롯과 false sharing 없음
+ */
+typedef struct {
+  atomic_ulong local;                       // 0: 임계구역 밖, 그 외: 진입 시 에포크
+  atomic_int used;                          // 스레드가 점유 중인지
+} __attribute__((aligned(64))) epoch_slot_t;
+
+static epoch_slot_t slots[EPOCH_MAXTHREADS];
+static atomic_int nslots;                   // 한 번이라도 쓰인 슬롯 개수 (스캔 범위)
+static atomic_ulong global_epoch = 1;
+
+static pthread_mutex_t limbo_mutex = PTHREAD_MUTEX_INITIALIZER;
+static epoch_node_t *limbo_head, *limbo_tail;   // retire 순서(= 에포크 오름차순)
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slot_key;              // 스레드 종료 시 슬롯 반납용
+
+static __thread epoch_slot_t *my_slot;      // 현재 스레드의 슬롯
+static __thread int my_depth;               // 중첩 진입 깊이
+
+static void slot_release(void *arg) {
+  epoch_slot_t *s = arg;
+  atomic_store(&s->local, 0);
+  atomic_store(&s->used, 0);
+}
+
+static void make_key(void) {
+  pthread_key_create(&slot_key, slot_release);
+}
+
+/* 현재 스레드에 빈 슬롯 하나를 배정 (스레드당 최초 1회) */
+static epoch_slot_t *slot_register(void) {
+  pthread_once(&key_once, make_key);
+  for (int i = 0; i < EPOCH_MAXTHREADS; i++) {
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&slots[i].used, &expected, 1)) {
+      int n = atomic_load(&nslots);
+      while (n < i + 1 && !atomic_compare_exchange_weak(&nslots, &n, i + 1))
+        ;
+      pthread_setspecific(slot_key, &slots[i]);
+      return &slots[i];
+    }
+  }
+  app_error("epoch: too many threads");
+  return NULL;
+}
+
+/* 읽기 임계구역 진입
+ * - 자기 슬롯에 현재 에포크를 기록하고 full fence
+ *   (이후의 포인터 읽기가 기록보다 앞서 보이지 않도록)
+ */
+void epoch_enter(void) {
+  if (my_depth++ > 0) return;
+  if (!my_slot) my_slot = slot_register();
+  atomic_store_explicit(&my_slot->local,
+                        atomic_load_explicit(&global_epoch, memory_order_relaxed),
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+/* 읽기 임계구역 탈출 */
+void epoch_exit(void) {
+  if (--my_depth > 0) return;
+  atomic_store_explicit(&my_slot->local, 0, memory_order_release);
+}
+
+/* 모든 활성 스레드가 현재 에포크에 있으면 전역 에포크를 하나 전진
+ * 반환값: 전진 후(또는 실패 시 현재)의 전역 에포크
+ */
+static unsigned long try_advance(void) {
+  unsigned long g = atomic_load(&global_epoch);
+  int n = atomic_load(&nslots);
+
+  for (int i = 0; i < n; i++) {
+    unsigned long l = atomic_load(&slots[i].local);
+    if (l != 0 && l != g) return g;          // 이전 에포크에 머무는 읽기 스레드 존재
+  }
+  if (atomic_compare_exchange_strong(&global_epoch, &g, g + 1)) return g + 1;
+  return g;                                  // 다른 스레드가 먼저 전진시킴
+}
+
+/* 노드를 limbo에 넣고, 가능한 만큼 회수 */
+void epoch_retire(epoch_node_t *node, void (*free_fn)(epoch_node_t *)) {
+  node->free_fn = free_fn;
+  node->next = NULL;
+
+  pthread_mutex_lock(&limbo_mutex);
+  node->epoch = atomic_load(&global_epoch);
+  if (limbo_tail) limbo_tail->next = node; else limbo_head = node;
+  limbo_tail = node;
+  pthread_mutex_unlock(&limbo_mutex);
+
+  epoch_collect();
+}
+
+/* 유예 기간이 지난 limbo 노드들을 해제
+ * - 해제 함수는 limbo 잠금 밖에서 호출
+ */
+void epoch_collect(void) {
+  epoch_node_t *done = NULL, **donep = &done;
+  unsigned long g = try_advance();
+
+  pthread_mutex_lock(&limbo_mutex);
+  while (limbo_head && limbo_head->epoch + 2 <= g) {
+    *donep = limbo_head;
+    donep = &limbo_head->next;
+    limbo_head = limbo_head->next;
+  }
+  *donep = NULL;
+  if (!limbo_head) limbo_tail = NULL;
+  pthread_mutex_unlock(&limbo_mutex);
+
+  while (done) {
+    epoch_node_t *next = done->next;
+    done->free_fn(done);
+    done = next;
+  }
+}
@@ -0,0 +1,30 @@
+/*
+ * epoch.h - 에포크 기반 메모리 회수 (EBR)
+ *
+ * 읽기 쪽은 잠금 없이 공유 자료구조를 순회하고, 쓰기 쪽은 노드를 떼어낸 뒤
+ * epoch_retire로 넘긴다. 떼어낸 시점에 읽고 있던 스레드가 모두 임계구역을
+ * 벗어난 것이 확인되면(전역 에포크가 2번 전진하면) 노드를 해제한다.
+ *
+ * 읽기 쪽 비용
+ * - epoch_enter: 자기 전용 캐시 라인에 현재 에포크를 쓰고 fence 한 번
+ * - epoch_exit : 자기 전용 캐시 라인에 0을 씀
+ * - 공유 라인에 대한 원자적 read-modify-write는 없음 (최초 등록 1회 제외)
+ */
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#define EPOCH_MAXTHREADS 256      // 동시에 등록 가능한 스레드 수
+
+/* 회수 대기 노드: 회수할 객체에 내장해서 사용 */
+typedef struct epoch_node {
+  struct epoch_node *next;                  // limbo 리스트 연결
+  unsigned long epoch;                      // 떼어낸 시점의 전역 에포크
+  void (*free_fn)(struct epoch_node *);     // 유예 기간 후 호출할 해제 함수
+} epoch_node_t;
+
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(epoch_node_t *node, void (*free_fn)(epoch_node_t *));
+void epoch_collect(void);
+
+#endif /* __EPOCH_H__ */
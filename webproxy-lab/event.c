@@ -0,0 +1,346 @@
+/*
+ * event.c - 이벤트 루프 구현 (epoll / io_uring)
+ *
+ * CPU 고정(pthread_setaffinity_np)에 _GNU_SOURCE가 필요한데, 그러면 netdb.h의 gai_error가
+ * csapp.h의 것과 겹치므로 이 파일은 csapp.h 없이 표준 헤더만 씀
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "event.h"
+#include "uring.h"
+
+/* io_uring 완료의 user_data
+ * - 작업(event_op_t)은 포인터에 1을 더함
+ * - 처리기(event_handler_t)는 포인터의 1~2번 비트에 등록 세대를 넣음 (8바이트 정렬이라 빔)
+ * - 0은 등록 해제 / 취소 요청 자체의 완료라 버림
+ */
+#define RING_OP 1ULL
+#define RING_GEN(h) ((unsigned long long)((h)->gen & 3) << 1)
+
+static void event_error(const char *msg) {
+  fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+  exit(0);
+}
+
+/* 루프 생성
+ * - EVENT_URING은 링과 제공 버퍼 링을 만듦. 커널이 지원하지 않으면(5.19 미만, seccomp로
+ *   막힘 등) -1을 돌려주므로 부르는 쪽이 EVENT_EPOLL로 다시 부름
+ * 반환값: 성공 0, 실패 -1
+ */
+int event_loop_init(event_loop_t *l, int backend) {
+  int saved;
+
+  l->backend = backend;
+  l->epfd = -1;
+  l->ring = NULL;
+  l->after = NULL;
+  l->arg = NULL;
+  l->wakefd = -1;
+  l->wake = NULL;
+  if (backend == EVENT_EPOLL)
+    return (l->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ? -1 : 0;
+
+  if ((l->ring = malloc(sizeof(uring_t))) == NULL) return -1;
+  if (uring_init(l->ring, EVENT_RING_ENTRIES) < 0) {
+    saved = errno;
+    free(l->ring);
+    l->ring = NULL;
+    errno = saved;
+    return -1;
+  }
+  if (uring_bufs_init(l->ring, EVENT_RING_BUFS, EVENT_RING_BUF) < 0) {
+    saved = errno;
+    uring_free(l->ring);
+    free(l->ring);
+    l->ring = NULL;
+    errno = saved;
+    return -1;
+  }
+  return 0;
+}
+
+/* 처리기의 fd에 다중 샷 poll을 검 (epoll 에지 트리거와 같은 이벤트) */
+static void ring_poll(event_loop_t *l, event_handler_t *h) {
+  struct io_uring_sqe *sqe = uring_sqe(l->ring);
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = h->fd;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+  sqe->user_data = (uintptr_t)h | RING_GEN(h);
+  h->busy++;
+}
+
+/* 완료 하나를 처리
+ * - 작업: 끝난 완료(MORE 없음)면 busy를 줄이고 done, 받은 제공 버퍼는 done 뒤에 돌려줌
+ * - 처리기: 지금 세대의 poll이면 이벤트를 넘김. 커널이 다중 샷을 스스로 끝냈으면(CQ가
+ *   찼을 때 등) 아직 등록 중인 fd에 다시 검
+ */
+static void ring_complete(event_loop_t *l, unsigned long long data, int res, unsigned flags) {
+  int more = flags & IORING_CQE_F_MORE;
+  event_handler_t *h;
+  event_op_t *op;
+  char *buf;
+
+  if (data == 0) return;
+  if (data & RING_OP) {
+    op = (event_op_t *)(uintptr_t)(data & ~RING_OP);
+    buf = uring_buf(l->ring, flags);
+    if (!more) op->busy--;
+    op->done(op, res, buf);
+    if (buf) uring_buf_put(l->ring, flags >> IORING_CQE_BUFFER_SHIFT);
+    return;
+  }
+  h = (event_handler_t *)(uintptr_t)(data & ~7ULL);
+  if (!more) h->busy--;
+  if ((data & 6) != RING_GEN(h)) return;           // 이미 푼 등록의 늦은 완료
+  if (res > 0) h->fn(h, res);
+  if (!more && res >= 0 && h->fd >= 0 && (data & 6) == RING_GEN(h)) ring_poll(l, h);
+}
+
+/* io_uring 루프: 쌓인 SQE를 제출하면서 완료를 기다리고, 온 완료를 모두 처리 */
+static void ring_run(event_loop_t *l) {
+  uring_t *r = l->ring;
+  struct io_uring_cqe *cqe;
+  unsigned long long data;
+  unsigned flags;
+  int res;
+
+  uring_register_ring(r);
+  while (1) {
+    if (uring_enter(r, 1, EVENT_TICK_MS) < 0 && errno != ETIME && errno != EINTR &&
+        errno != EBUSY && errno != EAGAIN)
+      event_error("io_uring_enter error");
+    while ((cqe = uring_cqe(r)) != NULL) {
+      data = cqe->user_data;                      // 처리 중에 새 완료가 와도 되도록 먼저 자리를 돌려줌
+      res = cqe->res;
+      flags = cqe->flags;
+      uring_cqe_seen(r);
+      ring_complete(l, data, res, flags);
+    }
+    if (l->after) l->after(l, time(NULL));
+  }
+}
+
+/* 이벤트를 기다려 처리기를 부르는 일을 끝없이 반복 (루프 스레드 본체) */
+void event_loop_run(event_loop_t *l) {
+  struct epoll_event ev[EVENT_BATCH];
+  int n;
+
+  if (l->backend == EVENT_URING) {
+    ring_run(l);
+    return;
+  }
+  while (1) {
+    if ((n = epoll_wait(l->epfd, ev, EVENT_BATCH, EVENT_TICK_MS)) < 0) {
+      if (errno == EINTR) continue;
+      event_error("epoll_wait error");
+    }
+    for (int i = 0; i < n; i++) {
+      event_handler_t *h = ev[i].data.ptr;
+      h->fn(h, ev[i].events);
+    }
+    if (l->after) l->after(l, time(NULL));
+  }
+}
+
+/* fd를 읽기 / 쓰기 / 끊김 에지 트리거로 등록 (fd는 논블로킹이어야 함)
+ * 반환값: 성공 0, 실패 -1 */
+int event_add(event_loop_t *l, int fd, event_handler_t *h) {
+  struct epoll_event ev;
+
+  h->fd = fd;
+  if (l->backend == EVENT_URING) {
+    ring_poll(l, h);
+    return 0;
+  }
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.ptr = h;
+  return epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* fd 등록 해제 (닫기 전에 부르거나, 블로킹 처리로 넘길 때, 이미 풀었으면 아무것도 안 함)
+ * - io_uring은 poll 제거를 제출만 하고 세대를 바꿔 남은 완료를 버림.
+ *   poll이 fd를 잡고 있으므로 닫아도 소켓은 제거가 끝날 때 놓임
+ */
+void event_del(event_loop_t *l, event_handler_t *h) {
+  struct io_uring_sqe *sqe;
+
+  if (h->fd < 0) return;
+  if (l->backend == EVENT_URING) {
+    sqe = uring_sqe(l->ring);
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)h | RING_GEN(h);
+    h->gen++;
+  } else {
+    epoll_ctl(l->epfd, EPOLL_CTL_DEL, h->fd, NULL);
+  }
+  h->fd = -1;
+}
+
+static void wake_event(event_handler_t *h, unsigned int events) {
+  event_loop_t *l = (event_loop_t *)((char *)h - offsetof(event_loop_t, wev));
+  uint64_t n;
+
+  if (read(l->wakefd, &n, sizeof(n)) == sizeof(n)) l->wake(l);   // 0으로 되돌려 다음 에지를 받음
+}
+
+/* 다른 스레드가 루프를 깨울 수 있게 eventfd를 등록 (루프를 돌리기 전에 호출)
+ * - event_wake가 몇 번 불렸든 루프 스레드에서 fn이 한 번 이상 불림.
+ *   넘길 일은 부르는 쪽이 자기 잠금 아래 목록에 두고 fn이 한꺼번에 가져감
+ * 반환값: 성공 0, 실패 -1 */
+int event_wake_init(event_loop_t *l, void (*fn)(event_loop_t *l)) {
+  if ((l->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) return -1;
+  l->wake = fn;
+  l->wev.fn = wake_event;
+  return event_add(l, l->wakefd, &l->wev);
+}
+
+/* 루프를 깨움 (아무 스레드에서나) */
+void event_wake(event_loop_t *l) {
+  uint64_t one = 1;
+
+  while (write(l->wakefd, &one, sizeof(one)) < 0 && errno == EINTR)
+    ;
+}
+
+/* fd의 O_NONBLOCK을 켜거나 끔
+ * 반환값: 성공 0, 실패 -1 */
+int event_nonblock(int fd, int on) {
+  int flags = fcntl(fd, F_GETFL, 0);
+
+  if (flags < 0) return -1;
+  flags = on ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+  return fcntl(fd, F_SETFL, flags);
+}
+
+/* 이 프로세스가 쓸 수 있는 CPU 수 (taskset / cpuset 제한 반영) */
+int event_cpus(void) {
+  cpu_set_t set;
+
+  if (sched_getaffinity(0, sizeof(set), &set) < 0) return 1;
+  return CPU_COUNT(&set);
+}
+
+/* 부르는 스레드를 쓸 수 있는 CPU 중 n번째(넘으면 돌아감)에 고정
+ * 반환값: 성공 0, 실패 -1 (고정하지 않고 그대로 돌아도 됨)
+ */
+int event_pin(int n) {
+  cpu_set_t allowed, set;
+  int cpu, count;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0 || (count = CPU_COUNT(&allowed)) == 0)
+    return -1;
+  n %= count;
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, &allowed) && n-- == 0) break;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0 : -1;
+}
+
+/* 리스닝 소켓에 다중 샷 accept를 검 (io_uring 전용)
+ * - 처음 부를 때 리스닝 소켓을 고정 파일 0번으로 등록 (안 되면 fd 그대로)
+ * - 수락한 소켓은 처음부터 논블로킹. 완료마다 done(res = 새 fd 또는 -errno)
+ * - 커널이 다중 샷을 끝내면(op->busy가 0) 부르는 쪽이 다시 검
+ * 반환값: 성공 0, 실패 -1
+ */
+int event_accept(event_loop_t *l, int fd, event_op_t *op) {
+  uring_t *r = l->ring;
+  struct io_uring_sqe *sqe;
+  int fixed;
+
+  if (l->backend != EVENT_URING) return -1;
+  fixed = r->nfiles > 0 || uring_register_files(r, &fd, 1) == 0;
+  sqe = uring_sqe(r);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fixed ? 0 : fd;
+  sqe->flags = fixed ? IOSQE_FIXED_FILE : 0;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = (uintptr_t)op | RING_OP;
+  op->busy++;
+  return 0;
+}
+
+/* 제공 버퍼로 한 번 받음 (io_uring 전용)
+ * - 데이터가 올 때까지 버퍼를 잡지 않음. done의 buf에 받은 바이트,
+ *   버퍼가 다 나가 있으면 res가 -ENOBUFS (event_recv_into로 다시)
+ */
+void event_recv(event_loop_t *l, int fd, event_op_t *op) {
+  struct io_uring_sqe *sqe = uring_sqe(l->ring);
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BGID;
+  sqe->len = EVENT_RING_BUF;
+  sqe->user_data = (uintptr_t)op | RING_OP;
+  op->busy++;
+}
+
+/* 부르는 쪽 버퍼로 한 번 받음 (io_uring 전용, done의 buf는 NULL) */
+void event_recv_into(event_loop_t *l, int fd, void *buf, size_t len, event_op_t *op) {
+  struct io_uring_sqe *sqe = uring_sqe(l->ring);
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->user_data = (uintptr_t)op | RING_OP;
+  op->busy++;
+}
+
+/* from에서 정확히 len바이트를 받아 그대로 to로 보냄 (io_uring 전용)
+ * - 둘을 연결해 한 번에 제출하므로 받은 데이터가 사용자 공간을 거쳐 send를 다시
+ *   제출할 필요가 없음. buf는 두 완료가 다 올 때까지 그대로 둬야 함
+ * - recv가 len보다 적게 끝나면(끊김, 오류, 취소) send는 -ECANCELED로 끝나므로
+ *   받은 만큼은 부르는 쪽이 직접 보냄
+ */
+void event_recv_send(event_loop_t *l, int from, int to, void *buf, size_t len,
+                     event_op_t *rop, event_op_t *sop) {
+  struct io_uring_sqe *sqe;
+
+  uring_reserve(l->ring, 2);
+  sqe = uring_sqe(l->ring);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = from;
+  sqe->flags = IOSQE_IO_LINK;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->msg_flags = MSG_WAITALL;
+  sqe->user_data = (uintptr_t)rop | RING_OP;
+  rop->busy++;
+
+  sqe = uring_sqe(l->ring);
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = to;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+  sqe->user_data = (uintptr_t)sop | RING_OP;
+  sop->busy++;
+}
+
+/* 진행 중인 작업을 취소 (완료는 -ECANCELED 등으로 나중에 옴) */
+void event_cancel(event_loop_t *l, event_op_t *op) {
+  struct io_uring_sqe *sqe;
+
+  if (l->backend != EVENT_URING || op->busy == 0) return;
+  sqe = uring_sqe(l->ring);
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = (uintptr_t)op | RING_OP;
+}
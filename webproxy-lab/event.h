@@ -0,0 +1,82 @@
+/*
+ * event.h - 에지 트리거 이벤트 루프 (epoll 또는 io_uring)
+ *
+ * 루프 하나는 스레드 하나가 돌리며 epoll 인스턴스나 io_uring 링 하나를 가진다.
+ * - 소켓은 논블로킹으로 만들어 읽기 / 쓰기 / 끊김 에지 트리거로 한 번만 등록한다.
+ *   에지 트리거라 관심 집합을 바꿀 일이 없고, 처리기는 EAGAIN이 날 때까지 읽고 쓴다
+ * - 등록한 fd마다 처리기(event_handler_t)를 넘기면 이벤트가 오면 그 fn을 부른다.
+ *   처리기는 보통 연결 구조체에 내장하고 offsetof로 연결을 되찾는다
+ * - 한 번의 대기 결과를 다 처리하면 after 훅을 부른다. 같은 묶음 안에서 해제한
+ *   연결을 뒤이은 이벤트가 가리킬 수 있으므로, 연결 해제는 여기까지 미룬다
+ * - 루프를 코어마다 하나씩 두면 event_pin으로 루프 스레드를 코어에 고정한다
+ * - 다른 스레드가 루프에 일을 넘길 때는 event_wake로 깨우고, 루프 스레드에서 wake 훅이 불린다
+ *
+ * io_uring 백엔드 (EVENT_URING)
+ * - 등록은 다중 샷 poll이라 epoll과 같은 처리기를 그대로 쓴다. 루프 스레드만 부를 수 있다
+ * - 그 위에 완료 기반 작업(event_op_t)을 더 쓸 수 있다: 다중 샷 accept, 제공 버퍼 recv,
+ *   recv에 send를 이은 작업. 커널이 입출력까지 끝낸 뒤 done을 부르므로 readiness 알림,
+ *   read, write가 따로 드는 시스템 호출이 묶음마다 enter 한 번으로 준다
+ * - 처리기와 작업의 busy는 아직 올 완료 수다. 등록을 풀거나 취소해도 완료는 나중에 오므로
+ *   busy가 0이 될 때까지 구조체를 해제하면 안 된다
+ * - 커널이 io_uring을 지원하지 않으면 event_loop_init이 실패하므로 epoll로 다시 만든다
+ */
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include <stddef.h>
+#include <time.h>
+
+#define EVENT_BATCH 64            // epoll_wait 한 번에 받는 최대 이벤트 수
+#define EVENT_TICK_MS 1000        // 이벤트가 없어도 after 훅을 부르는 간격 (마감 검사용)
+#define EVENT_RING_ENTRIES 256    // io_uring 제출 큐 크기
+#define EVENT_RING_BUFS 64        // 루프마다 제공 버퍼 수 (2의 거듭제곱)
+#define EVENT_RING_BUF (16 * 1024)  // 제공 버퍼 하나의 크기
+
+enum { EVENT_EPOLL, EVENT_URING };
+
+typedef struct event_handler {
+  void (*fn)(struct event_handler *h, unsigned int events);
+  int fd;                           // 등록한 fd (풀었으면 -1)
+  int busy;                         // io_uring: 아직 올 poll 완료 수
+  unsigned gen;                     // io_uring: 등록을 풀 때마다 늘려 앞선 poll의 완료를 버림
+} event_handler_t;
+
+/* 완료 기반 작업 (io_uring 전용)
+ * - done의 res는 시스템 호출 반환값과 같고 실패면 -errno
+ * - buf는 제공 버퍼 recv가 받은 바이트 (done이 돌아오면 바로 커널에 돌려주므로 복사해 둘 것)
+ */
+typedef struct event_op {
+  void (*done)(struct event_op *op, int res, char *buf);
+  int busy;                         // 아직 올 완료 수 (다중 샷이면 끝날 때까지 1)
+} event_op_t;
+
+typedef struct event_loop {
+  int backend;                      // EVENT_EPOLL / EVENT_URING
+  int epfd;
+  struct uring *ring;
+  void (*after)(struct event_loop *l, time_t now);  // 묶음 처리 뒤 (없으면 NULL)
+  void *arg;                                        // 훅이 쓰는 루프별 상태
+  int wakefd;                                       // event_wake용 eventfd (없으면 -1)
+  event_handler_t wev;
+  void (*wake)(struct event_loop *l);               // event_wake 뒤 루프 스레드에서
+} event_loop_t;
+
+int event_loop_init(event_loop_t *l, int backend);
+void event_loop_run(event_loop_t *l);
+int event_add(event_loop_t *l, int fd, event_handler_t *h);
+void event_del(event_loop_t *l, event_handler_t *h);
+int event_wake_init(event_loop_t *l, void (*fn)(event_loop_t *l));
+void event_wake(event_loop_t *l);
+int event_nonblock(int fd, int on);
+int event_cpus(void);
+int event_pin(int n);
+
+/* io_uring 전용 작업 (event.c 참고) */
+int event_accept(event_loop_t *l, int fd, event_op_t *op);
+void event_recv(event_loop_t *l, int fd, event_op_t *op);
+void event_recv_into(event_loop_t *l, int fd, void *buf, size_t len, event_op_t *op);
+void event_recv_send(event_loop_t *l, int from, int to, void *buf, size_t len,
+                     event_op_t *rop, event_op_t *sop);
+void event_cancel(event_loop_t *l, event_op_t *op);
+
+#endif /* __EVENT_H__ */
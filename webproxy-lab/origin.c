@@ -0,0 +1,69 @@
+/*
+ * origin.c - 원 서버별 실패 기억 구현
+ */
+#include <stdatomic.h>
+#include "csapp.h"
+#include "origin.h"
+
+/* 칸 하나: hash가 0이면 빈 칸, state는 (실패 만료 시각 << 8) | 종류 */
+typedef struct {
+  atomic_ulong hash;
+  atomic_ulong state;
+} origin_slot_t;
+
+static origin_slot_t slots[ORIGIN_SLOTS];
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static long ttls[] = { 0, ORIGIN_DNS_TTL, ORIGIN_CONNECT_TTL };
+
+/* "host:port"의 FNV-1a 해시 (호스트는 대소문자 무시, 0은 빈 칸 표시라 피함) */
+static unsigned long origin_hash(const char *host, const char *port) {
+  unsigned long h = 1469598103934665603UL;
+  const char *p;
+
+  for (p = host; *p; p++) h = (h ^ (unsigned char)tolower((unsigned char)*p)) * 1099511628211UL;
+  h = (h ^ ':') * 1099511628211UL;
+  for (p = port; *p; p++) h = (h ^ (unsigned char)*p) * 1099511628211UL;
+  return h ? h : 1;
+}
+
+/* 실패 종류별 TTL 설정 (0이면 그 종류는 기억하지 않음) */
+void origin_set_ttl(int cls, long sec) {
+  if (cls > ORIGIN_OK && cls <= ORIGIN_CONNECT) ttls[cls] = sec;
+}
+
+/* 아직 기억 중인 실패가 있으면 그 종류, 없으면 ORIGIN_OK */
+int origin_failed(const char *host, const char *port) {
+  unsigned long h = origin_hash(host, port), st;
+  origin_slot_t *s = &slots[h % ORIGIN_SLOTS];
+
+  if (atomic_load_explicit(&s->hash, memory_order_acquire) != h) return ORIGIN_OK;
+  st = atomic_load_explicit(&s->state, memory_order_acquire);
+  if (atomic_load_explicit(&s->hash, memory_order_acquire) != h) return ORIGIN_OK;
+  return (time_t)(st >> 8) > time(NULL) ? (int)(st & 0xff) : ORIGIN_OK;
+}
+
+/* 연결 시도 실패를 기록 */
+void origin_fail(const char *host, const char *port, int cls) {
+  unsigned long h = origin_hash(host, port);
+  origin_slot_t *s = &slots[h % ORIGIN_SLOTS];
+
+  if (cls <= ORIGIN_OK || cls > ORIGIN_CONNECT || ttls[cls] <= 0) return;
+  pthread_mutex_lock(&mutex);
+  atomic_store_explicit(&s->hash, 0, memory_order_release);      // 읽는 쪽이 섞인 값을 못 쓰게
+  atomic_store_explicit(&s->state, ((unsigned long)(time(NULL) + ttls[cls]) << 8) | cls,
+                        memory_order_release);
+  atomic_store_explicit(&s->hash, h, memory_order_release);
+  pthread_mutex_unlock(&mutex);
+}
+
+/* 연결에 성공하면 실패 기록을 지움 (기록이 없으면 잠금도 잡지 않음) */
+void origin_ok(const char *host, const char *port) {
+  unsigned long h = origin_hash(host, port);
+  origin_slot_t *s = &slots[h % ORIGIN_SLOTS];
+
+  if (atomic_load_explicit(&s->hash, memory_order_relaxed) != h) return;
+  pthread_mutex_lock(&mutex);
+  if (atomic_load_explicit(&s->hash, memory_order_relaxed) == h)
+    atomic_store_explicit(&s->hash, 0, memory_order_release);
+  pthread_mutex_unlock(&mutex);
+}
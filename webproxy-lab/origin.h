@@ -0,0 +1,28 @@
+/*
+ * origin.h - 원 서버별 상태 (실패 기억)
+ *
+ * 죽은 원 서버나 풀리지 않는 호스트 이름은 요청마다 getaddrinfo + connect를
+ * 다시 시도하느라 워커를 몇 초씩 붙잡는다. 실패한 (host, port)를 종류별 짧은
+ * TTL 동안 기억해 두고, 그동안의 요청은 원 서버에 가지 않고 바로 응답한다.
+ *
+ * - 표는 (host, port) 해시로 직접 사상하는 고정 크기 배열 (충돌하면 덮어씀)
+ * - 조회는 잠금 없이 해시 -> 값 -> 해시 순으로 읽어 쓰는 중인 칸을 걸러내고,
+ *   기록과 지우기만 mutex를 잡는다
+ * - 연결에 성공하면 그 원 서버의 실패 기록을 지운다
+ */
+#ifndef __ORIGIN_H__
+#define __ORIGIN_H__
+
+#define ORIGIN_SLOTS 1024               // 실패를 기억하는 원 서버 수
+#define ORIGIN_DNS_TTL 30               // 이름 풀이 실패 기본 TTL (초)
+#define ORIGIN_CONNECT_TTL 5            // 연결 실패(거절, 도달 불가) 기본 TTL (초)
+
+/* 실패 종류 (open_clientfd 반환값에서 나눔) */
+enum { ORIGIN_OK, ORIGIN_DNS, ORIGIN_CONNECT };
+
+void origin_set_ttl(int cls, long sec);
+int origin_failed(const char *host, const char *port);
+void origin_fail(const char *host, const char *port, int cls);
+void origin_ok(const char *host, const char *port);
+
+#endif /* __ORIGIN_H__ */
@@ -1,48 +1,277 @@
 #include <stdio.h>
+#include <sys/epoll.h>
 #include "csapp.h"
+#include "cache.h"
+#include "snapshot.h"
+#include "origin.h"
+#include "event.h"
+#include "deque.h"
+
+/* MAX_CACHE_SIZE, MAX_OBJECT_SIZE는 캐시 모듈(cache.h)에서 정의하고 사용 */
+#define NLOOPS_MAX 64             // 이벤트 루프 최대 수 (기본은 쓸 수 있는 코어마다 하나)
+#define REACTOR_BUF (64 * 1024)   // 루프별 읽기 버퍼 (클라이언트 요청, 원 서버 응답)
+#define REACTOR_SPARE 64          // 루프가 다시 쓰려고 쥐고 있는 연결 구조체 최대 수
+#define NTHREADS 4                // 블로킹 처리로 넘긴 요청을 맡는 워커 수
+#define WORK_DEQUE 64             // 워커 덱 처음 크기 (차면 두 배씩)
+#define CONN_OUT_HIGH (64 * 1024) // 클라이언트로 못 보낸 바이트가 이만큼 쌓이면 원 서버 읽기를 멈춤
+#define CONN_HIT_COPY (64 * 1024) // 캐시 적중에서 못 보낸 본문을 out에 복사하는 한도 (넘으면 엔트리를 붙잡음)
+#define RING_CHUNK (32 * 1024)    // io_uring: recv→send 한 쌍이 옮기는 최대 본문 바이트 (연결별 버퍼)
+#define REQ_MAX (MAXBUF + 4 * MAXLINE)  // 원 서버로 보내는 요청 (요청 라인 + 헤더) 최대 길이
+#define REFRESH_QMAX 64           // 백그라운드 갱신 대기열 최대 길이
+#define NRESOLVERS 4              // 원 서버 이름 풀이(getaddrinfo)를 맡는 스레드 수
+
+/* relay_response 동작 플래그 */
+#define RELAY_REVALIDATE 1        // 304를 클라이언트로 보내지 않음 (캐시 재검증 중)
+#define RELAY_STALE_IF_ERROR 2    // 5xx를 클라이언트로 보내지 않음 (대신 보낼 사본이 있음)
+
+#define RANGE_MAX 16              // 한 요청에서 받는 최대 구간 수 (넘으면 Range를 무시하고 전체 응답)
+#define RESP_IOV 64               // 캐시 응답 하나를 모아 보내는 iovec 수 (넘치면 나눠 보냄)
+
+/* 캐시에서 보낼 응답 조각 모음 (엔트리 바이트는 복사하지 않고 가리키기만 함) */
+typedef struct {
+  struct iovec v[RESP_IOV];
+  int n;
+  int dead;                       // 클라이언트에 쓰기가 실패함 (이후 조각은 버림)
+} resp_iov_t;
+
+/* Range 요청의 구간 하나 (본문 기준 바이트 위치, last 포함) */
+typedef struct {
+  size_t first, last;
+} byte_range_t;
+
+/* 조각 캐시의 빈칸을 채울 때 갈 원 서버 (요청의 host, port, path) */
+typedef struct {
+  char *hostname, *port, *path;
+} upstream_t;
+
+/* 응답 중계 상태 (relay_input에 받은 바이트를 넣으면 이어서 진행) */
+enum { RELAY_STATUS, RELAY_HEADERS, RELAY_LENGTH, RELAY_EOF, RELAY_CHUNK_SIZE, RELAY_CHUNK_DATA,
+       RELAY_CHUNK_CRLF, RELAY_TRAILER, RELAY_DONE };
+
+typedef struct {
+  int state;
+  int flags;                        // RELAY_REVALIDATE / RELAY_STALE_IF_ERROR
+  int status;                       // 상태 코드 (상태줄을 못 읽었으면 0)
+  int swallow;                      // 클라이언트로 보내지 않는 응답 (304 재검증, 대신할 사본이 있는 5xx)
+  int chunked;
+  long content_len;                 // Content-Length 값, 없으면 -1
+  long togo;                        // 지금 본문 / 청크에서 남은 바이트
+  cache_fill_t *fill;               // 캐시에 넣을 바이트 (없으면 NULL)
+  void (*emit)(void *arg, const void *p, size_t n);  // 클라이언트로 보냄 (NULL이면 버림)
+  void *arg;
+  char line[MAXLINE];               // 모으는 중인 줄
+  size_t llen;
+} relay_t;
+
+/* 클라이언트 요청 (이벤트 루프가 읽어 두고 블로킹 처리로 넘길 때도 그대로 씀) */
+typedef struct {
+  char line[MAXLINE];               // 요청 라인
+  char hdrs[MAXBUF];                // 요청 헤더 (빈 줄 제외, read_request_headers와 같은 모양)
+  int recorded;                     // 이벤트 루프가 이미 cache_record 함
+} request_t;
+
+/* 연결 상태
+ * - REQUEST: 요청을 읽는 중, RESOLVE: 원 서버 이름 풀이를 기다리는 중,
+ *   FOLLOW: 같은 키를 가져오는 leader의 응답을 따라 보내는 중,
+ *   CONNECT: 원 서버 연결 중, FORWARD: 요청을 보내는 중,
+ *   RELAY: 응답을 중계하는 중, FLUSH: 남은 응답을 클라이언트로 보내고 닫음
+ * - OFFLOAD: 블로킹 처리로 넘김, CLOSED: 닫음 (둘 다 묶음 끝에서 넘기거나 해제)
+ */
+enum { CONN_REQUEST, CONN_RESOLVE, CONN_FOLLOW, CONN_CONNECT, CONN_FORWARD, CONN_RELAY, CONN_FLUSH, CONN_OFFLOAD, CONN_CLOSED };
+
+/* 블로킹 처리로 넘길 때 이어서 할 일 */
+enum { OFFLOAD_REQUEST, OFFLOAD_ORIGIN_ERROR };
+
+struct reactor;
 
-/* Recommended max cache and object sizes
- * 과제에서 권장하는 전체 캐시 최대 크기와 단일 객체 최대 크기 상수
- * - MAX_CACHE_SIZE: 캐시 전체 용량 한도
- * - MAX_OBJECT_SIZE: 한 개의 응답 객체에 대해 캐시 가능한 최대 크기
- * 본 코드는 아직 캐시를 구현하지 않았지만, 상수는 유지
+/* 클라이언트 연결 하나 (이벤트 루프 스레드 하나가 소유)
+ * - 루프가 구조체를 다시 쓰므로 conn_reset이 지우는 앞부분(state까지)과
+ *   쓰기 전에 채우는 큰 버퍼들로 나눔. out 버퍼는 다시 쓸 때도 그대로 둠
  */
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
-#define NTHREADS 4
-#define SBUFSIZE 16
+typedef struct conn {
+  struct conn *next, *prev;         // 루프의 원 서버 대기 목록 (마감 검사)
+  struct conn *done_next;           // 묶음 끝에 넘기거나 해제할 연결 (해제한 뒤에는 여분 목록)
+  struct conn *post_next;           // 이름 풀이 대기열, 풀이가 끝나 루프로 돌려보낸 목록
+  struct reactor *rx;               // 소유한 루프
+  event_handler_t cev, sev;         // 클라이언트 / 원 서버 소켓 처리기
+  event_op_t rop, lrecv, lsend;     // io_uring: 원 서버 recv, 이어 붙인 recv→send 한 쌍
+  size_t chunk_len;                 // io_uring: 한 쌍이 옮기는 바이트
+  int burst;                        // io_uring: 지난 recv가 버퍼를 채움 (더 쌓여 있을 것)
+  int nobufs;                       // io_uring: 제공 버퍼가 다 나가 있음 (chunk로 받음)
+  int offload;                      // OFFLOAD일 때 이어서 할 일
+  int clientfd, serverfd;
+  time_t active;                    // 원 서버 쪽이 마지막으로 진행한 시각
+  size_t hlen;                      // rq.hdrs에 모은 길이
+  int got_line;                     // 요청 라인을 읽었음
+  int is_get, served, revalidate, timed_out, client_dead;
+  cache_flight_t *flight;
+  cache_fill_t *fill;
+  struct addrinfo *addrs, *next_addr;   // 원 서버 주소 목록과 다음에 시도할 주소
+  char *req;                        // 원 서버로 보낼 요청
+  size_t req_len, req_off;
+  size_t out_len, out_off;          // out에 쌓인 바이트와 보낸 위치
+  cache_entry_t *hit;               // out 다음에 보낼 본문이 든 붙잡은 엔트리 (cache_hold)
+  const char *hit_p;                // hit에서 아직 못 보낸 본문과 길이
+  size_t hit_len;
+  cache_flight_watch_t fw;          // FOLLOW: leader가 진행하면 루프로 돌려보냄
+  size_t follow_off, follow_end;    // FOLLOW: 보낸 위치와 보낼 끝 (끝이 0이면 아직 스트리밍 전)
+  int follow_full;                  // FOLLOW: 클라이언트 소켓이 차서 기다리는 중
+  int post_pending;                 // 루프의 posted 목록에 들어 있음 (post_mutex로 보호)
+  int state;                        // (여기까지 conn_reset이 0으로)
+  char *out;                        // 클라이언트로 아직 못 보낸 바이트
+  size_t out_cap;
+  char *chunk;                      // io_uring: recv→send 버퍼 (RING_CHUNK, 필요할 때 만들고 그대로 둠)
+  char method[8], hostname[MAXLINE], port[16], path[MAXLINE];
+  request_t rq;
+  cache_key_t key;
+  cache_validators_t stale;         // 만료된 엔트리의 검증자 (재검증용)
+  cache_fill_t local;
+  relay_t relay;                    // 요청을 읽는 동안은 줄 버퍼만 빌려 씀
+} conn_t;
+
+/* 이벤트 루프 하나 (코어 하나에 고정한 스레드 하나가 소유)
+ * - 자기 SO_REUSEPORT 리스닝 소켓에서 직접 수락하므로 연결은 처음부터 끝까지
+ *   이 스레드 안에서만 다룸 (블로킹 워커로 넘기는 드문 경로만 예외)
+ */
+typedef struct reactor {
+  event_loop_t loop;
+  int listenfd;                     // 이 루프의 리스닝 소켓
+  event_handler_t lev;              // 리스닝 소켓 처리기
+  event_op_t aop;                   // io_uring: 다중 샷 accept
+  int accept_retry;                 // io_uring: accept가 실패로 끝남 (다음 마감 검사 때 다시 검)
+  int cpu;                          // 고정할 코어 순번
+  int next_worker;                  // 블로킹 처리로 넘길 때 다음 차례 워커
+  conn_t *waiting;                  // 원 서버를 기다리는 연결 (마감 검사)
+  conn_t *done;                     // 묶음 끝에 넘기거나 해제할 연결
+  conn_t *draining;                 // io_uring: 닫았지만 아직 올 완료가 남은 연결
+  pthread_mutex_t post_mutex;       // posted 보호 (resolver 스레드가 넣음)
+  conn_t *posted;                   // 다른 스레드가 돌려보낸 연결 (이름 풀이 끝, leader 진행)
+  conn_t *spare;                    // 다시 쓸 연결 구조체 (done_next로 엮음)
+  int nspare;
+  time_t swept;                     // 마지막 마감 검사 시각
+  char buf[REACTOR_BUF];            // 읽기 버퍼 (스레드 하나만 쓰므로 공유)
+} reactor_t;
+
+/* 워커 몫 덱 하나 (넣는 루프 하나만 씀)
+ * - 통계도 넣는 루프만 쓰므로 다른 루프와 캐시 라인을 다투지 않음
+ */
+typedef struct {
+  deque_t dq;
+  long pushed;              // 넣은 연결 수
+  long max_depth;           // 넣을 때 본 최대 대기 수
+} work_queue_t;
 
+/* 워커별 통계 (그 워커만 씀) */
+typedef struct {
+  long ran;                 // 꺼내 처리한 연결 수
+  long stolen;              // 그중 다른 워커 몫에서 훔친 수
+} __attribute__((aligned(64))) worker_stat_t;
+
+/* 블로킹 처리 작업 스케줄러 (이벤트 루프가 넘긴 연결, 넣는 쪽은 기다리지 않음)
+ * - 워커마다 루프 수만큼 Chase-Lev 덱을 둠 (q[워커 * nloops + 루프]). 덱마다 넣는 쪽이
+ *   루프 하나뿐이라 넣기는 잠금 없이 끝나고, 워커는 top을 CAS로 가져감
+ * - 루프는 워커를 돌아가며 골라 넣고, 워커는 자기 몫부터 보고 비었으면 다른 워커 몫을 훔침
+ * - 할 일이 없는 워커만 mutex / cond로 잠들고, 넣는 쪽은 잠든 워커가 있을 때만 mutex를 잡음
+ */
 typedef struct {
-  int *buf;                 // 연결 파일디스크립터(connfd) 저장 배열
-  int front;                // 꺼낼 위치 (dequeue index)
-  int rear;                 // 넣을 위치 (enqueue index)
-  int n;                    // 버퍼 전체 크기
-
-  pthread_mutex_t mutex;    // 큐 접근 동기화용
-  pthread_cond_t slots;     // 빈 슬롯 발생 시 signal
-  pthread_cond_t items;     // 아이템 도착 시 signal
+  work_queue_t *q;          // NTHREADS * nloops개
+  int nloops;
+  worker_stat_t stat[NTHREADS];
+  atomic_int idle;          // 잠들었거나 잠들려는 워커 수
+
+  pthread_mutex_t mutex;    // 잠들기 / 깨우기용
+  pthread_cond_t items;     // 잠든 워커가 있을 때 연결 도착 시 signal
 } sbuf_t;
 
+/* stale-while-revalidate 백그라운드 갱신 작업 (키당 하나만 대기/처리) */
+typedef struct refresh_job {
+  struct refresh_job *next;
+  cache_key_t key;                  // 캐시 키 (중복 검사용)
+  char hdrs[MAXLINE];               // 변형 키면 Vary에 든 요청 헤더 줄 (원 서버에 같은 변형을 요청)
+  char hostname[MAXLINE], port[16], path[MAXLINE];
+  cache_validators_t val;           // 만료된 사본의 검증자
+} refresh_job_t;
+
+typedef struct {
+  refresh_job_t *head, *tail;       // 대기 중인 작업 (FIFO)
+  refresh_job_t *busy;              // 갱신 스레드가 처리 중인 작업
+  int n;                            // 대기 중인 작업 수
+
+  pthread_mutex_t mutex;
+  pthread_cond_t items;             // 작업 도착 시 signal
+} refresh_queue_t;
+
+/* 원 서버 이름 풀이 대기열 (루프가 넣고 resolver 스레드가 꺼냄, post_next로 엮음) */
+typedef struct {
+  conn_t *head, *tail;
+  pthread_mutex_t mutex;
+  pthread_cond_t items;             // 작업 도착 시 signal
+} resolve_queue_t;
+
 
 /* 프록시의 핵심 함수 프로토타입 선언
- * - doit: 클라이언트 1개 연결에 대한 전체 요청-응답 처리
+ * - doit: 이벤트 루프가 읽어 둔 요청 하나를 블로킹으로 처리 (루프에서 끝내지 않는 경로)
+ * - conn_*: 이벤트 루프의 연결 상태 기계 (요청 읽기, 캐시 적중, 원 서버 연결 / 전달 / 중계)
+ * - listen_event / accept_done / reactor_run: 루프마다 가진 SO_REUSEPORT 리스닝 소켓에서
+ *   수락 (epoll / io_uring 다중 샷), 루프 실행
+ * - serve_from_cache: 신선한 캐시 적중 시 저장된 응답을 클라이언트로 전송
+ * - send_ranges: 요청에 Range가 있으면 캐시된 본문에서 잘라 206 / 416으로 응답
+ * - send_entry: 캐시 엔트리를 Age(와 추가 헤더)를 끼워 writev 한 번으로 전송
+ * - send_segmented: 조각 캐시에 든 큰 객체를 조각을 이어 붙여 전송 (빈칸은 원 서버에서 Range로)
+ * - serve_from_flight: 다른 워커가 받아 오는 중인 응답을 따라 읽으며 전송
+ * - serve_stale_on_error: 원 서버 오류 시 stale-if-error 구간 안의 사본으로 대신 응답
+ * - set_origin_deadline / origin_error: 원 서버 응답 마감 설정과 연결 실패/시간 초과 처리
+ * - purge: 관리 클라이언트의 PURGE 요청으로 URL 하나나 경로 끝이 '*'면 그 접두사 아래를 캐시에서 지움
  * - parse_uri: 클라이언트 요청의 URI를 host, port, path로 분해
  * - clienterror: 클라이언트에게 HTTP 에러 응답 생성 및 전송
- * - forward_request_headers: 클라이언트 요청 헤더를 서버로 전달하면서 필수 헤더를 정규화
- * - relay_response: 원서버의 응답을 클라이언트로 스트리밍 중계
+ * - request_header / strip_request_header: 보관한 요청 헤더에서 값을 찾거나 줄을 뺌
+ * - build_request / forward_request_headers: 보관한 요청 헤더를 필수 헤더를 정규화한
+ *   요청으로 만들어 (서버로 전달)
+ * - relay_*: 원서버의 응답을 클라이언트로 스트리밍 중계하는 상태 기계 (필요하면 캐시용으로 수집)
+ *   relay_response는 이를 블로킹 소켓으로 끝까지 돌림
+ *   재검증 요청에 304가 오면, 또는 대신 보낼 사본이 있는데 5xx가 오면 클라이언트로 보내지 않음
  */
-void doit(int fd);
+void doit(int fd, request_t *rq);
+int serve_from_cache(int clientfd, const cache_key_t *key, int is_get, const char *hdrs,
+                     cache_validators_t *stale, const upstream_t *up);
+int send_ranges(int clientfd, const cache_entry_t *entry, const char *hdrs, const upstream_t *up);
+int send_entry(int clientfd, const cache_entry_t *entry, const char *extra, int is_get);
+void send_segmented(int clientfd, const cache_entry_t *entry, const char *hdrs, const upstream_t *up);
+int serve_from_flight(int clientfd, cache_flight_t *flight, int is_get);
+int serve_stale_on_error(int clientfd, const cache_key_t *key, int is_get);
+void set_origin_deadline(int serverfd);
+void origin_error(int clientfd, char *hostname, const cache_key_t *key, int is_get,
+                  cache_flight_t *flight, int timed_out);
+void purge(int clientfd, char *uri);
 int parse_uri(char *uri, char *hostname, char *path, char *port);
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
-void forward_request_headers(rio_t *client_rio, int serverfd, const char *hostname, const char *port, const char *method, const char *path);
-void relay_response(int serverfd, int clientfd);
+int request_header(const char *hdrs, const char *name, char *buf, size_t size);
+void strip_request_header(char *hdrs, const char *name);
+size_t build_request(char *out, const char *hdrs, const char *hostname, const char *port, const char *method, const char *path, const cache_validators_t *val);
+void forward_request_headers(const char *hdrs, int serverfd, const char *hostname, const char *port, const char *method, const char *path, const cache_validators_t *val);
+void relay_init(relay_t *r, cache_fill_t *fill, int flags, void (*emit)(void *arg, const void *p, size_t n), void *arg);
+void relay_input(relay_t *r, const char *p, size_t n);
+void relay_end(relay_t *r, int error);
+int relay_response(int serverfd, int clientfd, cache_fill_t *fill, int flags);
+void conn_accept(int clientfd, reactor_t *rx);
+void listen_event(event_handler_t *h, unsigned int events);
+void accept_done(event_op_t *op, int res, char *buf);
+void reactor_run(reactor_t *rx);
+void reactor_wake(event_loop_t *l);
+void *reactor_thread(void *vargp);
+void *resolver_thread(void *vargp);
 void *thread(void *vargp);
+void refresh_enqueue(const cache_key_t *key, const char *hostname, const char *port,
+                     const char *path, const char *hdrs, const cache_validators_t *val);
+void *refresh_thread(void *vargp);
+void *snapshot_thread(void *vargp);
+void sigusr1_handler(int sig);
 
 
 /* Thread pool 함수 */
-void subf_init(sbuf_t *sp, int n);        // 큐 초기화 함수
-void subf_insert(sbuf_t *sp, int item);   // connfd 저장 (enqueue)
-int subf_remove(sbuf_t *sp);              // connfd 꺼내기 (dequeue)
+void subf_init(sbuf_t *sp, int nloops);   // 워커 덱 초기화 함수
+void subf_insert(sbuf_t *sp, conn_t *c);  // 넘긴 연결을 차례 워커 몫에 저장 (push)
+conn_t *subf_remove(sbuf_t *sp, int w);   // 워커 w가 넘긴 연결 꺼내기 (자기 몫, 없으면 훔침)
 
 
 /* 과제에서 제공하는 고정 User-Agent 헤더 문자열
@@ -55,94 +284,250 @@ static const char *user_agent_hdr =
     "Firefox/10.0.3\r\n";
 
 sbuf_t sbuf;
+static reactor_t *reactors;         // 이벤트 루프들 (nloops개)
+static int nloops;                  // -L: 이벤트 루프 수 (기본은 쓸 수 있는 코어 수)
+static int backend = EVENT_EPOLL;   // -b: 이벤트 루프 백엔드 (io_uring을 못 쓰면 epoll로)
+static long stale_if_error = 300;   // -s: 응답에 stale-if-error가 없을 때 만료된 사본을 쓸 구간 (초)
+static long origin_timeout = 10;    // -t: 원 서버가 이 초 동안 아무것도 보내지 않으면 포기
+static cache_validators_t validated;  // serve_from_cache / conn_serve의 stale 자리: 304로 방금 검증했음
+refresh_queue_t rq = { .mutex = PTHREAD_MUTEX_INITIALIZER, .items = PTHREAD_COND_INITIALIZER };
+resolve_queue_t resq = { .mutex = PTHREAD_MUTEX_INITIALIZER, .items = PTHREAD_COND_INITIALIZER };
+static char *snapshot_path;         // -w: 캐시 스냅샷 파일 (없으면 웜 재시작 안 함)
+static long snapshot_interval = SNAPSHOT_DEFAULT_INTERVAL;  // -W: 주기적 스냅샷 간격 (초, 0이면 종료할 때만)
+static char *admin_addrs;           // -A: PURGE를 허용할 클라이언트 주소 (쉼표 구분, 루프백은 항상 허용)
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-e clock|s3fifo] [-a none|tinylfu] [-s stale_if_error_sec] [-t origin_timeout_sec] [-d disk_dir] [-D disk_mb] [-w snapshot_file] [-W snapshot_sec] [-q] [-Q strip_params] [-n dns|connect|error=sec,...] [-A admin_addrs] [-O host=bytes[k|m]|pct%%,...] [-L loops] [-b epoll|uring] <port>\n", prog);
+  exit(1);
+}
+
+/* -n 인자 "종류=초[,종류=초...]"를 읽어 실패 종류별 TTL을 설정
+ * 반환값: 성공 0, 모르는 종류나 잘못된 값이 있으면 -1
+ */
+static int parse_negative_ttl(char *spec)
+{
+  char *item, *save, *eq;
+  long sec;
+
+  for (item = strtok_r(spec, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+    if (!(eq = strchr(item, '=')) || (sec = atol(eq + 1)) < 0) return -1;
+    *eq = '\0';
+    if (!strcmp(item, "dns")) origin_set_ttl(ORIGIN_DNS, sec);
+    else if (!strcmp(item, "connect")) origin_set_ttl(ORIGIN_CONNECT, sec);
+    else if (!strcmp(item, "error")) cache_set_error_ttl(sec);
+    else return -1;
+  }
+  return 0;
+}
+
+/* -O 인자 "호스트=몫[,호스트=몫...]"를 읽어 원 서버별 캐시 몫을 설정
+ * - 몫은 바이트 수(k, m 접미사 가능)나 MAX_CACHE_SIZE에 대한 비율("25%")
+ * 반환값: 성공 0, 형식이 틀리면 -1
+ */
+static int parse_quotas(char *spec)
+{
+  char *item, *save, *eq, *end;
+  double v;
+
+  for (item = strtok_r(spec, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+    if (!(eq = strchr(item, '=')) || eq == item) return -1;
+    *eq = '\0';
+    if ((v = strtod(eq + 1, &end)) < 0 || end == eq + 1) return -1;
+    if (*end == '%') v = v * MAX_CACHE_SIZE / 100, end++;
+    else if (*end == 'k' || *end == 'K') v *= 1024, end++;
+    else if (*end == 'm' || *end == 'M') v *= 1024 * 1024, end++;
+    if (*end || cache_set_quota(item, (size_t)v) < 0) return -1;
+  }
+  return 0;
+}
 
 int main(int argc, char **argv)
 {
-  int listenfd, *clientfd;                        // 수신용 리스닝 소켓, 각 클라이언트 연결용 소켓
-  char hostname[MAXLINE], port[MAXLINE];          // 접속한 클라이언트의 역방향 이름, 포트 문자열
-  socklen_t clientlen;                            // 소켓 주소 구조체 크기
-  struct sockaddr_storage clientaddr;             // 클라이언트 주소를 담을 범용 구조체
+  int opt, policy = CACHE_POLICY_S3FIFO;          // 옵션 문자, 캐시 제거 정책
+  int admission = CACHE_ADMIT_TINYLFU;            // 캐시 승인 정책
+  char *disk_dir = NULL;                          // 디스크 계층 디렉터리 (없으면 RAM만)
+  long disk_mb = DISK_DEFAULT_MB;                 // 디스크 계층 용량
+  sigset_t stop;                                  // 스냅샷 스레드가 받을 종료 시그널
+  int sort_query = 0;                             // 캐시 키의 쿼리 매개변수 정렬
+  char *strip_params = NULL;                      // 캐시 키에서 뺄 쿼리 매개변수
 
   /* 커맨드라인 인자 검사
-   * 사용법: ./proxy <port>
-   * 포트 문자열이 1개 있어야 함
+   * 사용법: ./proxy [-e clock|s3fifo] [-a none|tinylfu] [-s sec] [-t sec] [-d dir] [-D MiB] [-w file] [-W sec] [-q] [-Q names] [-n class=sec,...] [-A addrs] [-O host=quota,...] [-L loops] [-b epoll|uring] <port>
+   * - -e: 캐시 제거 정책 선택 (기본 s3fifo)
+   * - -a: 캐시 승인 정책 선택 (기본 tinylfu)
+   * - -s: 원 서버 오류 시 만료된 사본을 대신 보낼 기본 구간 (기본 300초, 0이면 끔)
+   * - -t: 원 서버 응답 마감 (기본 10초)
+   * - -d: 디스크 계층 세그먼트를 둘 디렉터리 (주면 RAM에서 밀려난 객체와 큰 객체를 디스크에 캐시)
+   * - -D: 디스크 계층 용량 (MiB, 기본 1024)
+   * - -w: 캐시 스냅샷 파일. 시작할 때 있으면 불러오고(웜 재시작), 주기적으로와
+   *       SIGTERM/SIGINT로 종료할 때 다시 씀
+   * - -W: 주기적 스냅샷 간격 (기본 300초, 0이면 종료할 때만)
+   * - -q: 캐시 키에서 쿼리 매개변수를 이름순으로 정렬
+   * - -Q: 캐시 키에서 뺄 쿼리 매개변수 (쉼표 구분, "utm_*"처럼 접두사 가능)
+   * - -n: 실패를 기억하는 TTL (초, 0이면 끔). dns=이름 풀이 실패(기본 30),
+   *       connect=연결 거절/도달 불가(기본 5), error=헤더에 수명이 없는 404/410(기본 60)
+   * - -A: PURGE를 보낼 수 있는 관리 클라이언트 주소 (쉼표 구분, 기본은 루프백만)
+   * - -O: 원 서버별 RAM 캐시 몫. host[:port]=바이트(k, m 접미사) 또는 전체에 대한 비율(%),
+   *       "*=몫"은 따로 정하지 않은 호스트 각각의 몫 (기본은 제한 없음)
+   * - -L: 이벤트 루프 수 (기본은 쓸 수 있는 코어 수, 최대 NLOOPS_MAX)
+   * - -b: 이벤트 루프 백엔드 (기본 epoll). uring은 수락과 원 서버 응답 중계를 io_uring
+   *       완료로 처리하고, 커널이 지원하지 않으면 epoll로 돔
+   * 옵션 뒤에 포트 문자열이 1개 있어야 함
    */
-  if (argc != 2)
-  {
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
-    exit(1);
+  while ((opt = getopt(argc, argv, "e:a:s:t:d:D:w:W:qQ:n:A:O:L:b:")) != -1) {
+    switch (opt) {
+    case 'e':
+      if ((policy = cache_policy_parse(optarg)) < 0) usage(argv[0]);
+      break;
+    case 'a':
+      if ((admission = cache_admission_parse(optarg)) < 0) usage(argv[0]);
+      break;
+    case 's':
+      stale_if_error = atol(optarg);
+      break;
+    case 't':
+      if ((origin_timeout = atol(optarg)) <= 0) usage(argv[0]);
+      break;
+    case 'd':
+      disk_dir = optarg;
+      break;
+    case 'D':
+      if ((disk_mb = atol(optarg)) <= 0) usage(argv[0]);
+      break;
+    case 'w':
+      snapshot_path = optarg;
+      break;
+    case 'W':
+      if ((snapshot_interval = atol(optarg)) < 0) usage(argv[0]);
+      break;
+    case 'q':
+      sort_query = 1;
+      break;
+    case 'Q':
+      strip_params = optarg;
+      break;
+    case 'n':
+      if (parse_negative_ttl(optarg) < 0) usage(argv[0]);
+      break;
+    case 'A':
+      admin_addrs = optarg;
+      break;
+    case 'O':
+      if (parse_quotas(optarg) < 0) usage(argv[0]);
+      break;
+    case 'L':
+      if ((nloops = atoi(optarg)) <= 0 || nloops > NLOOPS_MAX) usage(argv[0]);
+      break;
+    case 'b':
+      if (!strcmp(optarg, "epoll")) backend = EVENT_EPOLL;
+      else if (!strcmp(optarg, "uring")) backend = EVENT_URING;
+      else usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
   }
-
-  subf_init(&sbuf, SBUFSIZE);                     // 작업 큐 초기화
-
-  pthread_t tid;
-  for (int i = 0; i <NTHREADS; i++) {
-    pthread_create(&tid, NULL, thread, NULL);     // 워커 생성
+  if (argc - optind != 1) usage(argv[0]);
+
+  /* 스냅샷을 쓰면 종료 시그널은 스냅샷 스레드만 받도록, 스레드를 만들기 전에 막아 둠 */
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGTERM);
+  sigaddset(&stop, SIGINT);
+  if (snapshot_path) pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+  if (disk_dir && disk_init(disk_dir, (size_t)disk_mb << 20) < 0)  // 디스크 계층은 캐시보다 먼저
+    unix_error("disk_init error");
+  cache_init(policy, admission);                  // 응답 캐시 초기화
+  cache_key_config(sort_query, strip_params);
+  if (snapshot_path) {
+    int n = snapshot_load(snapshot_path);         // 본문은 첫 적중 때 올리므로 바로 끝남
+    if (n >= 0) fprintf(stderr, "PROXY : warm restart, %d entries from %s\n", n, snapshot_path);
   }
-
-  /* 리스닝 소켓 생성
-   * - Open_listenfd는 csapp의 래퍼로, 에러 시 내부에서 처리 후 적절히 종료
-   * - 반환된 listenfd로 accept를 반복
-   * - main thread : 클라이언트 연결 수락 및 큐에 삽입
+  Signal(SIGUSR1, sigusr1_handler);               // kill -USR1 <pid>로 캐시 통계 출력
+  Signal(SIGPIPE, SIG_IGN);                       // 끊긴 소켓에 쓰면 종료 대신 EPIPE
+
+  /* 이벤트 루프와 리스닝 소켓 생성
+   * - 루프마다 SO_REUSEPORT로 같은 포트에 자기 리스닝 소켓을 열어 epoll에 넣음.
+   *   커널이 들어오는 연결을 소켓들에 나눠 주므로 수락, 파싱, 중계가 스레드 사이
+   *   넘김 없이 한 루프 안에서 끝남
+   * - 모든 소켓을 bind한 뒤에 루프를 돌려야 커널이 처음부터 고르게 나눔
+   * - -b uring이면 리스닝 소켓을 링에 등록해 다중 샷 accept로 받음.
+   *   커널이 io_uring을 지원하지 않으면 알리고 epoll로 돔
+   * - Open_listenfd_reuseport는 csapp의 래퍼로, 에러 시 내부에서 처리 후 적절히 종료
    */
-  listenfd = Open_listenfd(argv[1]);
-  while (1)
-  {
-    clientlen = sizeof(clientaddr);
-
-    /* 클라이언트 연결 수락
-     * - Accept는 블로킹 호출
-     * - 연결이 수락되면 통신할 전용 소켓 clientfd를 획득
-     */
-    clientfd = Accept(listenfd, (SA *)&clientaddr, &clientlen); // line:netp:tiny:accept
-
-    /* 접속자의 호스트명과 포트를 문자열로 얻어 로그 출력
-     * - 실패해도 프로그램 진행에는 큰 영향 없음
-     */
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
-    printf("PROXY : Accepted connection from (%s, %s)\n", hostname, port);
-
-    /* 단일 연결 처리
-     * - HTTP 요청 1개를 처리하고 응답 후 소켓을 닫음
-     * - 프록시 과제의 기본 요건에서는 keep-alive 대신 Connection: close로 마무리
-     */
-    // doit(clientfd);
+  if (nloops == 0 && (nloops = event_cpus()) > NLOOPS_MAX) nloops = NLOOPS_MAX;
+  reactors = Calloc(nloops, sizeof(reactor_t));
+  for (int i = 0; i < nloops; i++) {
+    reactor_t *rx = &reactors[i];
+    if (event_loop_init(&rx->loop, backend) < 0) {
+      if (backend == EVENT_EPOLL) unix_error("event_loop_init error");
+      fprintf(stderr, "PROXY : io_uring unavailable (%s), using epoll\n", strerror(errno));
+      backend = EVENT_EPOLL;
+      if (event_loop_init(&rx->loop, backend) < 0) unix_error("event_loop_init error");
+    }
+    pthread_mutex_init(&rx->post_mutex, NULL);
+    if (event_wake_init(&rx->loop, reactor_wake) < 0) unix_error("event_wake_init error");
+    rx->listenfd = Open_listenfd_reuseport(argv[optind]);
+    rx->lev.fn = listen_event;
+    rx->aop.done = accept_done;
+    rx->cpu = i;
+    event_nonblock(rx->listenfd, 1);
+    if (backend == EVENT_URING) {
+      if (event_accept(&rx->loop, rx->listenfd, &rx->aop) < 0) unix_error("event_accept error");
+    } else if (event_add(&rx->loop, rx->listenfd, &rx->lev) < 0) {
+      unix_error("event_add error");
+    }
+  }
 
-    /* 클라이언트 소켓 종료
-     * - 한 요청-응답 트랜잭션 완료 후 닫음
-     */
-    // Close(clientfd); // line:netp:tiny:close
-    subf_insert(&sbuf, clientfd);     // clientfd를 큐에 삽입
+  pthread_t tid;
+  subf_init(&sbuf, nloops);                       // 블로킹 처리 워커 덱 초기화
+  for (long i = 0; i <NTHREADS; i++) {
+    pthread_create(&tid, NULL, thread, (void *)i);  // 블로킹 처리 워커 생성 (인자는 워커 번호)
   }
+  pthread_create(&tid, NULL, refresh_thread, NULL);  // stale-while-revalidate 갱신 전용 스레드
+  for (int i = 0; i < NRESOLVERS; i++)
+    pthread_create(&tid, NULL, resolver_thread, NULL);  // 루프 대신 getaddrinfo를 기다리는 스레드
+  if (snapshot_path)
+    pthread_create(&tid, NULL, snapshot_thread, &stop);  // 주기적 / 종료 시 스냅샷
+
+  /* 루프 스레드 생성 (코어 고정은 각 루프 스레드가 스스로 하므로
+   * 위의 워커들은 고정되지 않은 main의 CPU 집합을 물려받음)
+   * - main thread : 0번 루프를 직접 돌림
+   */
+  for (int i = 1; i < nloops; i++)
+    pthread_create(&tid, NULL, reactor_thread, &reactors[i]);
+  reactor_run(&reactors[0]);
+  return 0;
 }
 
-/* 단일 클라이언트 요청을 처리하는 함수
+/* 단일 클라이언트 요청을 블로킹으로 처리하는 함수
+ * - 요청 라인과 헤더는 이벤트 루프가 이미 읽어 rq에 넣어 둠
+ * - 루프가 끝내지 않는 경로(오류 응답, PURGE, Range, 조각 캐시, follower,
+ *   원 서버 오류 응답)만 여기 오고, clientfd는 블로킹으로 되돌려져 있음
  * 흐름
- * 1) 요청 라인 읽기 및 파싱 (메서드, URI, 버전)
- * 2) 메서드 허용 여부 검사 (GET, HEAD만 허용)
+ * 1) 요청 라인 파싱 (메서드, URI, 버전)
+ * 2) 메서드 허용 여부 검사 (GET, HEAD만 허용, PURGE는 purge로 넘김)
  * 3) URI를 host, port, path로 분해
- * 4) 원 서버와 TCP 연결
- * 5) 요청 헤더를 정규화하여 원 서버로 전달
- * 6) 원 서버의 응답을 읽어 클라이언트로 스트리밍 중계
- * 7) 원 서버 소켓 종료
+ * 4) 캐시에 있으면 원 서버 없이 바로 응답
+ * 5) 원 서버와 TCP 연결
+ * 6) 요청 헤더를 정규화하여 원 서버로 전달
+ * 7) 원 서버의 응답을 읽어 클라이언트로 스트리밍 중계 (GET이면 캐시에 저장)
+ * 8) 원 서버 소켓 종료
  */
-void doit(int clientfd) {
+void doit(int clientfd, request_t *rq) {
     int serverfd;                                     // 원 서버와의 연결 소켓
-    char reqline[MAXLINE], method[MAXLINE],
+    char *reqline = rq->line, method[MAXLINE],
          uri[MAXLINE], version[MAXLINE];              // 요청라인과 각 토큰
     char hostname[MAXLINE], port[16], path[MAXLINE];  // URI 분해 결과 저장
-    rio_t c_rio;                                      // 클라이언트 입력 스트림용 RIO 버퍼
-
-    /* 클라이언트 소켓을 RIO 버퍼에 바인딩
-     * - 버퍼링된 안전한 입출력을 제공
-     */
-    Rio_readinitb(&c_rio, clientfd);
-
-    /* 요청 라인 한 줄 읽기
-     * - 예: "GET http://example.com/index.html HTTP/1.1\r\n"
-     * - 0 이하면 클라이언트가 바로 끊었거나 에러이므로 조용히 반환
-     */
-    if (Rio_readlineb(&c_rio, reqline, MAXLINE) <= 0) return;
+    char *hdrs = rq->hdrs;                            // 클라이언트 요청 헤더 원문
+    char range[MAXLINE];                              // Range 값
+    cache_key_t key;                                  // 정규화한 캐시 키와 해시
+    upstream_t up = { hostname, port, path };         // 조각 캐시의 빈칸을 채울 원 서버
+    cache_fill_t local, *fill = NULL;                 // 캐시에 넣을 응답 수집 버퍼
+    cache_flight_t *flight = NULL;                    // 같은 키로 진행 중인 원 서버 요청
+    cache_validators_t stale;                         // 만료된 엔트리의 검증자 (재검증용)
+    int is_get, role, cached, status, revalidate, served, flags, timed_out;
 
     /* 요청 라인 파싱
      * - 공백 기준 세 토큰 분리: method, uri, version
@@ -154,9 +539,13 @@ void doit(int clientfd) {
     }
 
     /* 메서드 제한
-     * - GET, HEAD만 지원
+     * - GET, HEAD만 지원 (PURGE는 캐시 무효화 요청이라 원 서버로 가지 않음)
      * - 이외 메서드는 501 Not Implemented로 응답
      */
+    if (!strcasecmp(method, "PURGE")) {
+        purge(clientfd, uri);
+        return;
+    }
     if (strcasecmp(method, "GET") && strcasecmp(method, "HEAD")) {
         clienterror(clientfd, method, "501", "Not Implemented", "Proxy does not implement this method");
         return;
@@ -171,27 +560,142 @@ void doit(int clientfd) {
         return;
     }
 
+    /* 캐시 조회
+     * - 신선한 엔트리면 원 서버에 연결하지 않고 저장된 응답을 그대로 전송
+     * - stale-while-revalidate 구간이면 만료된 사본을 바로 보내고 갱신은 뒤로 넘김
+     *   (이 요청은 원 서버 왕복을 기다리지 않음)
+     * - 그보다 오래된 엔트리면 검증자를 stale에 받아 두고 아래에서 조건부 요청
+     *   (served가 -1이면 원 서버 오류 시 대신 보낼 수 있는 사본)
+     */
+    is_get = !strcasecmp(method, "GET");
+    cache_make_key(&key, hostname, port, path);
+    cache_vary_key(&key, hdrs);                       // 원 서버가 Vary를 보낸 키면 변형 키로
+    if (is_get && !rq->recorded) cache_record(&key);  // 승인 정책용 요청 빈도 (루프가 이미 셌으면 생략)
+    stale.etag[0] = stale.last_mod[0] = '\0';
+    if ((served = serve_from_cache(clientfd, &key, is_get, hdrs, &stale, &up)) > 0) {
+        if (served == 2) refresh_enqueue(&key, hostname, port, path, hdrs, &stale);
+        return;
+    }
+
+    /* 미스 합치기 (collapsed forwarding)
+     * - 같은 키를 이미 다른 워커가 가져오는 중이면 leader가 채우는 버퍼를 따라 읽으며
+     *   자기 속도로 스트리밍 (길이를 모르는 응답은 끝날 때까지 기다렸다가 캐시에서 응답)
+     * - leader의 응답이 캐시 불가였으면 직접 원 서버로
+     * - leader가 원 서버 오류를 겪었거나 멈춰 있으면 같은 원 서버로 또 가지 않고
+     *   만료된 사본이나 502로 바로 응답 (오류 폭주와 워커 묶임 방지)
+     * - HEAD는 본문을 받지 않으므로 leader가 되지 않고, 기다리는 쪽으로만 참여
+     */
+    /* "Range: bytes=0-"는 사실상 전체 요청이므로 원 서버에는 Range 없이 보내
+     * 200 전체 응답을 캐시에 채움 (다음 구간 요청부터는 캐시에서 206으로 응답)
+     * 다른 구간 요청은 그대로 전달하며, 206 응답은 캐시하지 않음
+     */
+    if (is_get && request_header(hdrs, "Range:", range, sizeof(range)) &&
+        !strcasecmp(range, "bytes=0-")) {
+        strip_request_header(hdrs, "Range:");
+        strip_request_header(hdrs, "If-Range:");
+    }
+
+    role = cache_flight_begin(&key, &flight);
+    if (role == FLIGHT_HIT && serve_from_cache(clientfd, &key, is_get, hdrs, NULL, &up)) return;
+    if (role == FLIGHT_FOLLOWER) {
+        int state = cache_flight_wait(flight), sent = 0;
+        if (state == FLIGHT_STREAM) sent = serve_from_flight(clientfd, flight, is_get);
+        cache_flight_release(flight);
+        flight = NULL;
+        if (sent) return;
+        if (state == FLIGHT_DONE && serve_from_cache(clientfd, &key, is_get, hdrs, NULL, &up)) return;
+        if (state == FLIGHT_ERROR) {
+            if (!serve_stale_on_error(clientfd, &key, is_get))
+                clienterror(clientfd, hostname, "502", "Bad Gateway", "Origin server unavailable");
+            return;
+        }
+    }
+    if (role == FLIGHT_LEADER && !is_get) {
+        cache_flight_end(flight, FLIGHT_FAILED);
+        flight = NULL;
+    }
+
+    /* 조건부 재검증
+     * - 만료된 엔트리에 검증자가 있으면 If-None-Match / If-Modified-Since를 붙여 요청
+     * - 304면 본문 없이 엔트리 만료 시각만 갱신하고 캐시에서 응답
+     * - 그 사이 엔트리가 쫓겨났으면 조건 없이 다시 요청
+     */
+    revalidate = flight && (stale.etag[0] || stale.last_mod[0]);
+retry:
+
     /* 원 서버와 TCP 연결 시도
      * - hostname, port 사용
-     * - 실패 시 502 Bad Gateway로 응답
+     * - 실패 시 만료된 사본이 있으면 그것으로, 없으면 502 Bad Gateway로 응답
+     * - 연결되면 수신 마감(origin_timeout)을 걸어 느린 원 서버에 워커가 묶이지 않게 함
+     * - 이름 풀이나 연결에 실패한 원 서버는 종류별 TTL 동안 기억해 두고,
+     *   그동안은 다시 시도하지 않고 바로 같은 방식으로 응답
      */
-    if ((serverfd = Open_clientfd(hostname, port)) < 0) {
-        clienterror(clientfd, hostname, "502", "Bad Gateway", "Could not connect to server");
+    if (origin_failed(hostname, port)) {
+        origin_error(clientfd, hostname, &key, is_get, flight, 0);
+        return;
+    }
+    if ((serverfd = open_clientfd(hostname, port)) < 0) {
+        origin_fail(hostname, port, serverfd == -2 ? ORIGIN_DNS : ORIGIN_CONNECT);
+        origin_error(clientfd, hostname, &key, is_get, flight, 0);
         return;
     }
+    origin_ok(hostname, port);
+    set_origin_deadline(serverfd);
 
     /* 요청 헤더 전달
      * - 요청 라인을 HTTP/1.0으로 다운그레이드
      * - Host, User-Agent, Connection, Proxy-Connection을 표준화
      * - 그 외 클라이언트 헤더는 그대로 통과
      */
-    forward_request_headers(&c_rio, serverfd, hostname, port, method, path);
+    forward_request_headers(hdrs, serverfd, hostname, port, method, path,
+                            revalidate ? &stale : NULL);
 
     /* 응답 중계
      * - 상태줄과 헤더를 먼저 클라이언트에 전달
      * - 본문은 Content-Length, chunked, EOF 기반으로 안전하게 스트리밍
+     * - GET 응답은 중계하면서 fill에 모았다가 캐시 가능하면 삽입
+     * - leader면 flight의 fill에 모으므로 follower가 도착하는 대로 따라 읽음
+     *   (버퍼는 마지막 follower가 flight를 놓을 때 해제)
      */
-    relay_response(serverfd, clientfd);
+    if (flight) {
+        fill = &flight->fill;
+    } else if (is_get) {
+        cache_fill_init(&local);
+        fill = &local;
+    }
+    if (fill) {
+        fill->vary = key.vary;
+        fill->key = &key;
+    }
+    flags = (revalidate ? RELAY_REVALIDATE : 0) | (served < 0 ? RELAY_STALE_IF_ERROR : 0);
+    status = relay_response(serverfd, clientfd, fill, flags);
+    timed_out = status == 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    if (status == 0 || (status >= 500 && (flags & RELAY_STALE_IF_ERROR))) {
+        /* 상태줄도 못 받았거나(끊김, 시간 초과) 삼킨 5xx: 클라이언트에는 아직 아무것도 안 감 */
+        Close(serverfd);
+        if (!flight && fill) cache_fill_free(fill);
+        origin_error(clientfd, hostname, &key, is_get, flight, timed_out);
+        return;
+    }
+    if (revalidate && status == 304) {
+        Close(serverfd);
+        if (cache_refresh(&key, &fill->meta) && serve_from_cache(clientfd, &key, is_get, hdrs, &validated, &up)) {
+            cache_flight_end(flight, FLIGHT_DONE);
+            return;
+        }
+        revalidate = 0;
+        cache_fill_reset(fill);
+        goto retry;
+    }
+    /* 응답의 Vary가 키를 만든 명세와 다르면 명세를 바꿔 두고 이번 응답은 캐시하지 않음
+     * (relay_response가 이미 fill->ok를 내림). 다음 요청부터 새 명세로 변형 키를 만듦 */
+    if (fill && cache_status_storable(status) && strcmp(fill->meta.vary, key.vary))
+        cache_vary_learn(&key, fill->meta.vary);
+    cached = fill && fill->ok && fill->hdr_len > 0 &&
+             (fill->seg_total || cache_insert(&key, fill->buf, fill->hdr_len, fill->len, &fill->meta));
+    if (flight)                                     // 기다리던 follower 깨우기
+        cache_flight_end(flight, cached ? FLIGHT_DONE : status >= 500 ? FLIGHT_ERROR : FLIGHT_FAILED);
+    else if (fill) cache_fill_free(fill);
 
     /* 원 서버와의 연결 종료
      * - 클라이언트 소켓은 상위 함수에서 닫힘
@@ -199,6 +703,501 @@ void doit(int clientfd) {
     Close(serverfd);
 }
 
+/* 원 서버에 연결한 소켓에 수신 마감을 검
+ * - 이후 읽기가 origin_timeout초 동안 아무것도 받지 못하면 EAGAIN으로 실패
+ */
+void set_origin_deadline(int serverfd) {
+    struct timeval tv = { origin_timeout, 0 };
+    setsockopt(serverfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+/* 원 서버 오류 처리 (연결 실패, 응답 시간 초과, 삼킨 5xx)
+ * - leader였으면 follower에게 오류를 알려 같은 원 서버로 몰려가지 않게 함
+ * - stale-if-error 구간 안의 사본이 있으면 그것으로, 없으면 502 / 504로 응답
+ */
+void origin_error(int clientfd, char *hostname, const cache_key_t *key, int is_get,
+                  cache_flight_t *flight, int timed_out) {
+    if (flight) cache_flight_end(flight, FLIGHT_ERROR);
+    if (serve_stale_on_error(clientfd, key, is_get)) return;
+    if (timed_out)
+        clienterror(clientfd, hostname, "504", "Gateway Timeout", "Origin server did not respond in time");
+    else
+        clienterror(clientfd, hostname, "502", "Bad Gateway", "Could not connect to server");
+}
+
+/* 연결한 클라이언트가 관리 주소인지 (루프백이거나 -A 목록에 있음) */
+static int admin_client(int clientfd) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    char host[NI_MAXHOST], *p, *end;
+    size_t n;
+
+    if (getpeername(clientfd, (SA *)&addr, &len) < 0 ||
+        getnameinfo((SA *)&addr, len, host, sizeof(host), NULL, 0, NI_NUMERICHOST) != 0)
+        return 0;
+    if (!strncmp(host, "127.", 4) || !strcmp(host, "::1") || !strncmp(host, "::ffff:127.", 11))
+        return 1;
+    n = strlen(host);
+    for (p = admin_addrs; p && *p; p = *end ? end + 1 : end) {
+        if (!(end = strchr(p, ','))) end = p + strlen(p);
+        if ((size_t)(end - p) == n && !strncmp(p, host, n)) return 1;
+    }
+    return 0;
+}
+
+/* PURGE 요청 처리 (배포 뒤 캐시 무효화)
+ * - "PURGE http://host/path"는 그 URL(과 Vary 변형)을,
+ *   경로 끝에 '*'를 붙인 "PURGE http://host/path/..."는 정규화한 키가 '*' 앞부분으로
+ *   시작하는 모든 객체를 지움
+ * - RAM / 디스크 / 스냅샷 계층에서 모두 지우며, 맞은 키 수에만 비례하는 비용으로 끝남
+ * - 관리 클라이언트가 아니면 403, 지운 것이 있으면 200, 없으면 404와 지운 개수
+ */
+void purge(int clientfd, char *uri) {
+    char hostname[MAXLINE], port[16], path[MAXLINE], buf[MAXLINE], body[32];
+    cache_key_t key;
+    size_t len;
+    int prefix, n;
+
+    if (!admin_client(clientfd)) {
+        clienterror(clientfd, "PURGE", "403", "Forbidden", "PURGE is allowed only from admin clients");
+        return;
+    }
+    if (parse_uri(uri, hostname, port, path) != 0) {
+        clienterror(clientfd, uri, "400", "Bad Request", "Cannot parse URI");
+        return;
+    }
+    len = strlen(path);
+    if ((prefix = len > 0 && path[len - 1] == '*') != 0) path[len - 1] = '\0';
+
+    cache_make_key(&key, hostname, port, path);
+    n = cache_purge(&key, prefix);
+    printf("PROXY : purged %d object(s) for %s%s\n", n, key.str, prefix ? "*" : "");
+
+    snprintf(body, sizeof(body), "purged %d\n", n);
+    snprintf(buf, sizeof(buf), "HTTP/1.0 %s\r\nContent-Type: text/plain\r\n"
+             "Content-Length: %zu\r\nConnection: close\r\n\r\n%s",
+             n ? "200 OK" : "404 Not Found", strlen(body), body);
+    rio_writen(clientfd, buf, strlen(buf));
+}
+
+/* 캐시에 키가 있고 신선하면 저장된 응답을 그대로 전송
+ * - HEAD는 헤더 영역까지만 전송
+ * - 엔트리는 상태줄 + 헤더 + 본문을 보낼 모양 그대로 들고 있으므로
+ *   상태줄 / Age 줄 / 나머지 세 조각을 writev 한 번으로 보냄 (Age만 요청마다 만듦)
+ * - 읽기 구간 안에서는 다른 워커가 엔트리를 제거해도 메모리가 유지되므로
+ *   잠금 없이 전송까지 마칠 수 있음
+ * - 조각 캐시에 든 큰 객체면 조각을 이어 붙여 보내고, 빈칸은 up의 원 서버에서 채움
+ *   (원 서버를 기다리는 동안은 읽기 구간을 나감: add_body)
+ * - 만료된 엔트리면 stale(주어졌으면)에 검증자를 복사하고,
+ *   stale-while-revalidate 구간 안이면 그대로 응답, 아니면 미스로 처리
+ * - stale 자리에 &validated를 넘기면 304로 방금 검증한 엔트리라 신선도를 보지 않고 응답
+ *   (no-cache, max-age=0처럼 갱신해도 바로 만료되는 응답을 다시 받지 않도록)
+ * 반환값: 신선한 사본으로 응답했으면 1, 만료된 사본으로 응답했으면 2 (갱신 필요),
+ *         응답하지 않았지만 원 서버 오류 시 쓸 수 있는 사본이 있으면 -1, 그 외 0
+ */
+static int entry_served(const cache_entry_t *entry, cache_validators_t *stale) {
+    if (stale == &validated || cache_fresh(entry)) return 1;
+    if (stale) cache_get_validators(entry, stale);
+    if (!stale || !cache_stale_usable(entry))
+        return cache_stale_if_error(entry, stale_if_error) ? -1 : 0;
+    return 2;
+}
+
+int serve_from_cache(int clientfd, const cache_key_t *key, int is_get, const char *hdrs,
+                     cache_validators_t *stale, const upstream_t *up) {
+    cache_entry_t *entry;
+    int served;
+
+    cache_read_begin();
+    if ((entry = cache_lookup(key)) == NULL) {
+        cache_read_end();
+        return 0;
+    }
+    if ((served = entry_served(entry, stale)) <= 0) {
+        cache_read_end();
+        return served;
+    }
+    if (is_get && send_ranges(clientfd, entry, hdrs, up))
+        ;
+    else if (is_get && entry->seg_total)
+        send_segmented(clientfd, entry, hdrs, up);
+    else
+        send_entry(clientfd, entry, "", is_get);
+    cache_read_end();
+    return served;
+}
+
+/* 모은 조각을 보냄 (클라이언트가 끊겼으면 dead로 표시하고 이후로는 버림) */
+static void resp_write(int fd, resp_iov_t *r) {
+    size_t n = 0;
+
+    for (int i = 0; i < r->n; i++)
+        n += r->v[i].iov_len;
+    if (!r->dead && r->n && rio_writev(fd, r->v, r->n) != (ssize_t)n) r->dead = 1;
+    r->n = 0;
+}
+
+/* 응답 조각 추가 (바로 앞 조각에 이어지는 바이트면 합침, 가득 차면 먼저 보냄) */
+static void resp_add(int fd, resp_iov_t *r, const void *p, size_t len) {
+    struct iovec *last = r->n ? &r->v[r->n - 1] : NULL;
+
+    if (len == 0 || r->dead) return;
+    if (last && (const char *)last->iov_base + last->iov_len == (const char *)p) {
+        last->iov_len += len;
+        return;
+    }
+    if (r->n == RESP_IOV) resp_write(fd, r);
+    r->v[r->n].iov_base = (void *)p;
+    r->v[r->n++].iov_len = len;
+}
+
+/* 반환값: 지금까지 모두 보냈으면 1, 클라이언트가 끊겼으면 0 */
+static int resp_flush(int fd, resp_iov_t *r) {
+    resp_write(fd, r);
+    return !r->dead;
+}
+
+/* 엔트리를 상태줄 뒤에 extra 헤더와 Age를 끼운 세 조각으로 (age는 MAXLINE 바이트)
+ * (저장본에는 Age 줄이 없음: cache_insert가 뺌) */
+static void entry_iov(const cache_entry_t *entry, const char *extra, int is_get, char *age,
+                      struct iovec *iov) {
+    size_t status_len = (char *)memchr(entry->data, '\n', entry->hdr_len) - entry->data + 1;
+    int n = snprintf(age, MAXLINE, "%sAge: %ld\r\n", extra, cache_age(entry));
+
+    iov[0].iov_base = entry->data;
+    iov[0].iov_len = status_len;
+    iov[1].iov_base = age;
+    iov[1].iov_len = n;
+    iov[2].iov_base = entry->data + status_len;
+    iov[2].iov_len = (is_get ? entry->len : entry->hdr_len) - status_len;
+}
+
+/* 엔트리를 writev 한 번으로 전송
+ * 반환값: 성공 0, 클라이언트가 끊겼으면 -1
+ */
+int send_entry(int clientfd, const cache_entry_t *entry, const char *extra, int is_get) {
+    char age[MAXLINE];
+    struct iovec iov[3];
+    size_t n;
+
+    entry_iov(entry, extra, is_get, age, iov);
+    n = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+    return rio_writev(clientfd, iov, 3) == (ssize_t)n ? 0 : -1;
+}
+
+/* 엔트리의 본문 길이 (조각 캐시의 목록이면 조각을 합친 길이) */
+static size_t body_len(const cache_entry_t *entry) {
+    return entry->seg_total ? entry->seg_total : entry->len - entry->hdr_len;
+}
+
+/* 목록 사본 m의 a..b-1번 조각(모두 빈칸)을 원 서버에 Range로 받아
+ * 본문 [first, last]에 드는 바이트를 클라이언트로 보내고 조각으로 다시 채움
+ * - 원 요청 헤더에서 구간 / 조건부 헤더를 빼고 조각 경계에 맞춘 Range를 붙임.
+ *   목록에 검증자가 있으면 If-Range로 같은 표현일 때만 구간을 받음
+ * - 206이면 Content-Range가 요청한 구간, 전체 길이와 맞아야 함
+ * - Range를 모르는 원 서버의 200도 길이와 검증자가 목록과 같으면 앞을 버리고 씀
+ * - 표현이 바뀐 200이면 목록을 내려 다음 요청이 새로 받게 함
+ * - 읽기 구간 밖에서 부름 (엔트리 대신 cache_manifest_get으로 복사한 값만 씀)
+ * 반환값: 성공 1, 실패 0 (클라이언트에는 일부를 이미 보냈을 수 있음, 클라이언트가 끊겨도 0)
+ */
+static int fetch_segments(int clientfd, const cache_manifest_t *m, size_t a, size_t b,
+                          size_t first, size_t last, const char *hdrs, const upstream_t *up) {
+    char req[MAXBUF], buf[MAXLINE], *seg;
+    size_t off = a * CACHE_SEGMENT_SIZE, end = b * CACHE_SEGMENT_SIZE, len, pos, x, y, z;
+    long clen = -1;
+    int serverfd, n, status = 0, chunked = 0, range_ok = 0, ok = 0;
+    cache_meta_t meta;
+    rio_t rio;
+
+    if (end > m->seg_total) end = m->seg_total;
+    if (!up || origin_failed(up->hostname, up->port)) return 0;
+    snprintf(req, sizeof(req), "%s", hdrs ? hdrs : "");
+    strip_request_header(req, "Range:");
+    strip_request_header(req, "If-");
+    len = strlen(req);
+    n = snprintf(req + len, sizeof(req) - len, "Range: bytes=%zu-%zu\r\n", off, end - 1);
+    len += n;
+    if (len < sizeof(req) && m->val.etag[0] && strncmp(m->val.etag, "W/", 2))
+        len += snprintf(req + len, sizeof(req) - len, "If-Range: %s\r\n", m->val.etag);
+    else if (len < sizeof(req) && m->val.last_mod[0])
+        len += snprintf(req + len, sizeof(req) - len, "If-Range: %s\r\n", m->val.last_mod);
+    if (len >= sizeof(req)) return 0;
+
+    if ((serverfd = open_clientfd(up->hostname, up->port)) < 0) {
+        origin_fail(up->hostname, up->port, serverfd == -2 ? ORIGIN_DNS : ORIGIN_CONNECT);
+        return 0;
+    }
+    origin_ok(up->hostname, up->port);
+    set_origin_deadline(serverfd);
+    forward_request_headers(req, serverfd, up->hostname, up->port, "GET", up->path, NULL);
+
+    rio_readinitb(&rio, serverfd);
+    cache_meta_init(&meta);
+    if (rio_readlineb(&rio, buf, MAXLINE) > 0) sscanf(buf, "HTTP/%*d.%*d %d", &status);
+    while ((n = rio_readlineb(&rio, buf, MAXLINE)) > 0 && strcmp(buf, "\r\n")) {
+        if (!strncasecmp(buf, "Content-Range:", 14) &&
+            sscanf(buf + 14, " bytes %zu-%zu/%zu", &x, &y, &z) == 3)
+            range_ok = x == off && y == end - 1 && z == m->seg_total;
+        else if (!strncasecmp(buf, "Content-Length:", 15))
+            clen = strtol(buf + 15, NULL, 10);
+        else if (!strncasecmp(buf, "Transfer-Encoding:", 18) && strstr(buf, "chunked"))
+            chunked = 1;
+        cache_meta_header(&meta, buf);
+    }
+    if (status == 200 && !chunked && clen == (long)m->seg_total &&
+        !strcmp(meta.val.etag, m->val.etag) && !strcmp(meta.val.last_mod, m->val.last_mod)) {
+        range_ok = 1;                                 // Range를 무시한 같은 표현: 앞을 버림
+        pos = 0;
+    } else {
+        if (status == 200) cache_segment_drop(m);
+        pos = off;
+    }
+    if (n <= 0 || chunked || !range_ok || (status != 200 && status != 206)) {
+        Close(serverfd);
+        return 0;
+    }
+
+    seg = Malloc(CACHE_SEGMENT_SIZE);
+    for (; pos < off; pos += len) {
+        len = off - pos > CACHE_SEGMENT_SIZE ? CACHE_SEGMENT_SIZE : off - pos;
+        if (rio_readnb(&rio, seg, len) != (ssize_t)len) goto out;
+    }
+    for (; pos < end; pos += len) {
+        len = end - pos > CACHE_SEGMENT_SIZE ? CACHE_SEGMENT_SIZE : end - pos;
+        if (rio_readnb(&rio, seg, len) != (ssize_t)len) goto out;
+        x = pos > first ? pos : first;
+        y = pos + len - 1 < last ? pos + len - 1 : last;
+        cache_segment_insert(m, pos / CACHE_SEGMENT_SIZE, seg, len);
+        if (x <= y && rio_writen(clientfd, seg + (x - pos), y - x + 1) != (ssize_t)(y - x + 1))
+            goto out;                                 // 받은 조각까지는 캐시에 남김
+    }
+    ok = 1;
+out:
+    Free(seg);
+    Close(serverfd);
+    return ok;
+}
+
+/* 본문 [first, last]를 out에 보탬 (읽기 구간 안에서 부름)
+ * - 보통 엔트리(mf가 NULL)는 본문을 가리키기만 함
+ * - 조각 캐시의 목록이면 목록 사본 mf로 조각을 찾아 있는 조각은 가리키고, 빈칸이 이어진
+ *   구간은 모아 둔 조각을 먼저 보낸 뒤 원 서버에서 받아 바로 보냄 (fetch_segments)
+ * - 원 서버를 기다리는 동안은 읽기 구간을 나갔다가 돌아와서 다음 조각을 다시 찾으므로,
+ *   그 뒤로 부른 쪽은 entry를 더 쓰면 안 됨 (mf만 씀)
+ * 반환값: 다 보탰으면 1, 빈칸을 채우지 못했거나 클라이언트가 끊겼으면 0 (응답이 중간에 끊김)
+ */
+static int add_body(int fd, resp_iov_t *out, const cache_entry_t *entry, const cache_manifest_t *mf,
+                    size_t first, size_t last, const char *hdrs, const upstream_t *up) {
+    size_t i, j, lo, hi, end = last / CACHE_SEGMENT_SIZE;
+    const cache_entry_t *seg;
+    int ok;
+
+    if (!mf) {
+        resp_add(fd, out, entry->data + entry->hdr_len + first, last - first + 1);
+        return 1;
+    }
+    seg = cache_segment(mf, first / CACHE_SEGMENT_SIZE);
+    for (i = first / CACHE_SEGMENT_SIZE; i <= end; ) {
+        if (seg) {
+            lo = i * CACHE_SEGMENT_SIZE > first ? i * CACHE_SEGMENT_SIZE : first;
+            hi = (i + 1) * CACHE_SEGMENT_SIZE - 1 < last ? (i + 1) * CACHE_SEGMENT_SIZE - 1 : last;
+            resp_add(fd, out, seg->data + (lo - i * CACHE_SEGMENT_SIZE), hi - lo + 1);
+            if (++i <= end) seg = cache_segment(mf, i);
+            continue;
+        }
+        for (j = i + 1; j <= end && cache_segment(mf, j) == NULL; j++)
+            ;
+        if (!resp_flush(fd, out)) return 0;           // out이 가리키는 조각을 다 보낸 뒤에 나감
+        cache_read_end();
+        ok = fetch_segments(fd, mf, i, j, first, last, hdrs, up);
+        cache_read_begin();
+        if (!ok) return 0;
+        if ((i = j) <= end) seg = cache_segment(mf, i);
+    }
+    return !out->dead;
+}
+
+/* 조각 캐시에 든 큰 객체 전체 응답: 헤더(목록)를 보내고 본문은 조각을 이어 붙임 */
+void send_segmented(int clientfd, const cache_entry_t *entry, const char *hdrs, const upstream_t *up) {
+    resp_iov_t out = { .n = 0 };
+    cache_manifest_t mf;
+
+    if (send_entry(clientfd, entry, "", 0) < 0) return;
+    cache_manifest_get(entry, &mf);
+    if (add_body(clientfd, &out, entry, &mf, 0, mf.seg_total - 1, hdrs, up))
+        resp_flush(clientfd, &out);
+}
+
+/* Range 값("bytes=0-99,200-,-50")을 본문 길이 total 기준 구간으로 풀이
+ * - 시작이 본문 밖인 구간과 "-0"은 만족할 수 없으므로 빼고, 끝이 넘치면 본문 끝으로 자름
+ * 반환값: 만족 가능한 구간 수 (0이면 416),
+ *         bytes 단위가 아니거나 문법이 틀렸거나 구간이 너무 많으면 -1 (Range 무시)
+ */
+static int parse_ranges(const char *v, size_t total, byte_range_t *r) {
+    unsigned long long a, b;
+    char *end;
+    int n = 0, specs = 0;
+
+    if (strncasecmp(v, "bytes=", 6)) return -1;
+    for (v += 6; *(v += strspn(v, " \t,")); v = end) {
+        if (++specs > RANGE_MAX) return -1;
+        if (*v == '-') {                              // 접미 구간: 마지막 b바이트
+            if (!isdigit((unsigned char)v[1])) return -1;
+            b = strtoull(v + 1, &end, 10);
+            if (b > 0 && total > 0) {
+                r[n].first = b < total ? total - b : 0;
+                r[n++].last = total - 1;
+            }
+        }
+        else {
+            if (!isdigit((unsigned char)*v)) return -1;
+            a = strtoull(v, &end, 10);
+            if (*end++ != '-') return -1;
+            b = isdigit((unsigned char)*end) ? strtoull(end, &end, 10) : ~0ULL;
+            if (b < a) return -1;
+            if (a < total) {
+                r[n].first = a;
+                r[n++].last = b < total ? b : total - 1;
+            }
+        }
+        end += strspn(end, " \t");
+        if (*end && *end != ',') return -1;
+    }
+    return specs ? n : -1;
+}
+
+/* multipart/byteranges 부분 머리 ("--경계" + Content-Type + Content-Range) */
+static int part_header(char *buf, size_t size, const char *boundary, const char *ctype,
+                       const byte_range_t *r, size_t total) {
+    return snprintf(buf, size, "\r\n--%s\r\n%s%s%sContent-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                    boundary, *ctype ? "Content-Type: " : "", ctype, *ctype ? "\r\n" : "",
+                    r->first, r->last, total);
+}
+
+/* 요청에 Range가 있으면 캐시된 본문에서 잘라 응답
+ * - If-Range가 있으면 엔트리의 강한 ETag나 Last-Modified와 같을 때만 구간으로 응답
+ * - 구간 하나면 206 + Content-Range, 여럿이면 multipart/byteranges로 묶음
+ * - 상태줄만 바꾸고 원래 헤더는 길이/구간 관련 줄을 빼고 그대로 보냄
+ *   (여러 구간이면 원래 Content-Type은 각 부분으로 옮김)
+ * - 만족할 수 있는 구간이 없으면 416과 전체 길이만 담은 Content-Range
+ * - 헤더 줄과 본문 조각은 엔트리를 가리키는 iovec으로 모아 writev로 보냄
+ * - 조각 캐시에 든 큰 객체는 구간에 걸친 조각만 보고, 빈칸은 up의 원 서버에서 채움
+ * 반환값: 응답했으면 1, Range를 무시하고 전체를 보내야 하면 0
+ */
+int send_ranges(int clientfd, const cache_entry_t *entry, const char *hdrs, const upstream_t *up) {
+    char range[MAXLINE], cond[MAXLINE], head[MAXLINE], mhead[192], tail[128], ctype[128] = "";
+    char boundary[32];
+    char parts[RANGE_MAX][256];
+    byte_range_t r[RANGE_MAX];
+    resp_iov_t out = { .n = 0 };
+    cache_manifest_t mf, *seg = NULL;
+    const char *line, *eol, *hend = entry->data + entry->hdr_len - 2;   // 마지막 빈 줄 앞
+    size_t total = body_len(entry), clen;
+    int i, n, len, status = 0;
+
+    if (!hdrs || !request_header(hdrs, "Range:", range, sizeof(range))) return 0;
+    sscanf(entry->data, "HTTP/%*d.%*d %d", &status);
+    if (status != 200) return 0;                      // 캐시된 404 / 410은 그대로 보냄
+    if (request_header(hdrs, "If-Range:", cond, sizeof(cond)) &&
+        !(entry->etag && strncmp(entry->etag, "W/", 2) && !strcmp(cond, entry->etag)) &&
+        !(entry->last_mod && !strcmp(cond, entry->last_mod)))
+        return 0;                                     // 표현이 바뀌었으면 전체를 보냄
+    if ((n = parse_ranges(range, total, r)) < 0) return 0;
+    if (n == 0) {
+        len = snprintf(head, sizeof(head), "HTTP/1.0 416 Range Not Satisfiable\r\n"
+                       "Content-Range: bytes */%zu\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                       total);
+        rio_writen(clientfd, head, len);
+        return 1;
+    }
+
+    /* 상태줄을 206으로 바꾸고 원래 헤더 전달 (이어진 줄은 iovec 하나로 합쳐짐) */
+    len = snprintf(head, sizeof(head), "HTTP/1.0 206 Partial Content\r\nAge: %ld\r\n", cache_age(entry));
+    resp_add(clientfd, &out, head, len);
+    for (line = (char *)memchr(entry->data, '\n', entry->hdr_len) + 1; line < hend; line = eol) {
+        eol = memchr(line, '\n', hend - line);
+        eol = eol ? eol + 1 : hend;
+        if (!strncasecmp(line, "Content-Length:", 15) || !strncasecmp(line, "Content-Range:", 14))
+            continue;
+        if (n > 1 && !strncasecmp(line, "Content-Type:", 13)) {
+            const char *v = line + 13 + strspn(line + 13, " \t");
+            size_t vlen = strcspn(v, "\r\n");
+            if (vlen >= sizeof(ctype)) return 0;      // 부분 머리에 못 담으면 전체를 보냄
+            memcpy(ctype, v, vlen);
+            ctype[vlen] = '\0';
+            continue;
+        }
+        resp_add(clientfd, &out, line, eol - line);
+    }
+    if (entry->seg_total) cache_manifest_get(entry, seg = &mf);   // 이 뒤로는 seg로 조각을 찾음
+
+    if (n == 1) {
+        clen = r[0].last - r[0].first + 1;
+        len = snprintf(tail, sizeof(tail), "Content-Range: bytes %zu-%zu/%zu\r\nContent-Length: %zu\r\n\r\n",
+                       r[0].first, r[0].last, total, clen);
+        resp_add(clientfd, &out, tail, len);
+        if (add_body(clientfd, &out, entry, seg, r[0].first, r[0].last, hdrs, up))
+            resp_flush(clientfd, &out);
+        return 1;
+    }
+
+    /* 여러 구간: 부분 머리를 먼저 만들어 본문 길이(Content-Length)를 계산 */
+    snprintf(boundary, sizeof(boundary), "%016lx", entry->hash);
+    clen = snprintf(tail, sizeof(tail), "\r\n--%s--\r\n", boundary);
+    for (i = 0; i < n; i++)
+        clen += part_header(parts[i], sizeof(parts[i]), boundary, ctype, &r[i], total) +
+                r[i].last - r[i].first + 1;
+    len = snprintf(mhead, sizeof(mhead), "Content-Type: multipart/byteranges; boundary=%s\r\n"
+                   "Content-Length: %zu\r\n\r\n", boundary, clen);
+    resp_add(clientfd, &out, mhead, len);
+    for (i = 0; i < n; i++) {
+        resp_add(clientfd, &out, parts[i], strlen(parts[i]));
+        if (!add_body(clientfd, &out, entry, seg, r[i].first, r[i].last, hdrs, up)) return 1;
+    }
+    resp_add(clientfd, &out, tail, strlen(tail));
+    resp_flush(clientfd, &out);
+    return 1;
+}
+
+/* 원 서버 오류 시 stale-if-error 구간 안의 만료된 사본으로 응답
+ * - 상태줄 뒤에 Warning(111)과 Age 헤더를 끼워 만료된 사본임을 알림
+ * - 조각 캐시의 목록은 빈칸을 채울 수 없으므로 쓰지 않음
+ * 반환값: 응답했으면 1, 쓸 수 있는 사본이 없으면 0
+ */
+int serve_stale_on_error(int clientfd, const cache_key_t *key, int is_get) {
+    cache_entry_t *entry;
+
+    cache_read_begin();
+    if ((entry = cache_lookup(key)) == NULL || (is_get && entry->seg_total) ||
+        !cache_stale_if_error(entry, stale_if_error)) {
+        cache_read_end();
+        return 0;
+    }
+    send_entry(clientfd, entry, "Warning: 111 - \"Revalidation Failed\"\r\n", is_get);
+    cache_read_end();
+    return 1;
+}
+
+/* leader가 채우는 중인 응답을 쓰기 경계까지 따라가며 전송
+ * - 헤더가 끝나 전체 길이(fill.total)가 정해진 뒤에만 호출됨
+ * - 쓰기 경계에 도달하면 cache_flight_read 안에서 leader의 다음 append를 기다림
+ * - HEAD는 헤더 영역까지만 전송
+ * - 클라이언트가 끊기면 거기서 그만둠 (leader는 계속 채움)
+ * 반환값: 한 바이트라도 보냈으면 1 (중간에 끊겨도 되돌릴 수 없음), 아니면 0
+ */
+int serve_from_flight(int clientfd, cache_flight_t *flight, int is_get) {
+    size_t off = 0, end = is_get ? flight->fill.total : flight->fill.hdr_len;
+    const char *p;
+    long n;
+
+    while (off < end && (n = cache_flight_read(flight, off, &p)) > 0) {
+        if ((size_t)n > end - off) n = end - off;
+        if (rio_writen(clientfd, (void *)p, n) != n) return 1;
+        off += n;
+    }
+    return off > 0;
+}
+
 /* 에러 응답 생성기
  * - 간단한 HTML 본문을 만들어 HTTP/1.0 상태줄 + 헤더 + 본문을 전송
  * ⚠️ 주의: 현재 구현은 Content-length를 계산한 뒤 body를 두 번 쓰는 오류가 있음
@@ -225,7 +1224,7 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longms
    * - HTTP/1.0 <코드> <사유구절>
    */
   sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
+  if (rio_writen(fd, buf, strlen(buf)) < 0) return;   // 끊긴 클라이언트면 나머지는 보내지 않음
 
   /* 헤더 전송
    * - Content-type: text/html
@@ -237,7 +1236,7 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longms
    *    => 실제 서비스에서는 일부 클라이언트가 응답을 비정상 처리할 수 있음
    */
   sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
+  if (rio_writen(fd, buf, strlen(buf)) < 0) return;
 
   /* 잘못된 Content-length 계산 지점
    * - 여기서 strlen(body)를 사용하면 아직 닫는 태그가 빠진 길이
@@ -245,12 +1244,12 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longms
    *   또다시 body를 확장하여 두 번째로 쓰므로 총 두 번 쓰는 문제가 발생
    */
   sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
+  if (rio_writen(fd, buf, strlen(buf)) < 0) return;
 
   /* 본문 전송
    * - 닫는 태그 없이 전송됨
    */
-  Rio_writen(fd, body, strlen(body));
+  rio_writen(fd, body, strlen(body));
 }
 
 /* URI 파서
@@ -314,80 +1313,168 @@ int parse_uri(char *uri, char *hostname, char *port, char *path) {
     return 0;
 }
 
-/* 클라이언트 요청 헤더를 읽어 원 서버로 전달하는 함수
+/* 보관한 요청 헤더에서 name("Range:" 꼴) 줄의 값을 앞뒤 공백 없이 buf에 복사
+ * 반환값: 있으면 1, 없으면 0
+ */
+int request_header(const char *hdrs, const char *name, char *buf, size_t size) {
+    size_t nlen = strlen(name), vlen;
+    const char *line, *eol, *v;
+
+    for (line = hdrs; *line; line = eol) {
+        eol = strchr(line, '\n');
+        eol = eol ? eol + 1 : line + strlen(line);
+        if (strncasecmp(line, name, nlen)) continue;
+        v = line + nlen + strspn(line + nlen, " \t");
+        for (vlen = strcspn(v, "\r\n"); vlen > 0 && (v[vlen - 1] == ' ' || v[vlen - 1] == '\t'); vlen--)
+            ;
+        if (vlen >= size) vlen = size - 1;
+        memcpy(buf, v, vlen);
+        buf[vlen] = '\0';
+        return 1;
+    }
+    return 0;
+}
+
+/* 보관한 요청 헤더에서 name으로 시작하는 줄을 모두 뺌 */
+void strip_request_header(char *hdrs, const char *name) {
+    size_t nlen = strlen(name), llen;
+    char *line = hdrs;
+
+    while (*line) {
+        llen = strcspn(line, "\n");
+        if (line[llen]) llen++;
+        if (!strncasecmp(line, name, nlen))
+            memmove(line, line + llen, strlen(line + llen) + 1);
+        else
+            line += llen;
+    }
+}
+
+/* 보관해 둔 클라이언트 요청 헤더로 원 서버에 보낼 요청을 out(REQ_MAX 바이트)에 만드는 함수
  * 동작
- * 1) 요청 라인을 HTTP/1.0으로 재작성하여 서버로 전송
- * 2) 클라이언트가 보낸 헤더들을 한 줄씩 읽되, 아래 규칙으로 필터링
+ * 1) 요청 라인을 HTTP/1.0으로 재작성
+ * 2) 클라이언트가 보낸 헤더들을 한 줄씩 꺼내되, 아래 규칙으로 필터링
  *    - Host: 있으면 그대로 전달, 없으면 나중에 추가
  *    - User-Agent:, Connection:, Proxy-Connection: 은 삭제하고 이후 고정값 삽입
  *    - Proxy-Authorization: 은 일반적으로 제거
  *    - 그 외 헤더는 그대로 전달
- * 3) 마지막으로 고정 UA/Connection/Proxy-Connection/Host 보정 후 빈 줄 전송
+ * 3) 마지막으로 고정 UA/Connection/Proxy-Connection/Host 보정 후 빈 줄
+ * 4) val이 주어지면(캐시 재검증) 클라이언트의 조건부 헤더 대신
+ *    캐시 엔트리의 ETag / Last-Modified로 If-None-Match / If-Modified-Since
  * 주의
  * - 이 함수는 요청 바디가 있는 메서드(POST 등)를 고려하지 않음
  *   GET/HEAD만 다루므로 무방
+ * 반환값: 요청 길이
  */
-void forward_request_headers(rio_t *client_rio, int serverfd, 
-                             const char *hostname, const char *port,
-                             const char *method, const char *path) {
-    char buf[MAXLINE], out[MAXLINE];                          // 입력/출력 라인 버퍼
+static void req_put(char *out, size_t *len, const char *p, size_t n) {
+    if (*len + n >= REQ_MAX) n = REQ_MAX - 1 - *len;   // 보관 헤더가 MAXBUF 미만이라 실제로는 안 넘침
+    memcpy(out + *len, p, n);
+    *len += n;
+}
+
+size_t build_request(char *out, const char *hdrs,
+                     const char *hostname, const char *port,
+                     const char *method, const char *path,
+                     const cache_validators_t *val) {
+    char buf[MAXLINE];                                        // 입력/출력 라인 버퍼
     int has_host = 0, has_ua = 0, has_conn = 0, has_pconn = 0; // 존재 여부 플래그
+    const char *line = hdrs, *eol;                            // 보관된 헤더 순회 포인터
+    size_t len = 0;
 
     // 1) 요청 라인 재작성: HTTP/1.0 강제
     //   - 원 요청이 HTTP/1.1이어도 서버에는 1.0으로 보냄
     //   - keep-alive를 피하고 단순화를 위해 1.0 사용
-    int n = snprintf(out, sizeof(out), "%s %s HTTP/1.0\r\n", method, path);
-    Rio_writen(serverfd, out, n);
+    int n = snprintf(buf, sizeof(buf), "%s %s HTTP/1.0\r\n", method, path);
+    req_put(out, &len, buf, n);
 
     // 2) 클라이언트 헤더 필터링 루프
-    //   - 빈 줄(\r\n) 만날 때까지 반복
+    //   - 보관된 헤더를 한 줄씩 꺼내 반복
     //   - 각 헤더의 접두 키를 대소문자 무시 비교로 판별
-    while (Rio_readlineb(client_rio, buf, MAXLINE) > 0) {
-        if (!strcmp(buf, "\r\n")) break;  // 헤더 종료
+    for (; *line; line = eol) {
+        eol = strchr(line, '\n');
+        eol = eol ? eol + 1 : line + strlen(line);
 
-        if (!strncasecmp(buf, "Host:", 5)) {
+        if (!strncasecmp(line, "Host:", 5)) {
             has_host = 1;
-            Rio_writen(serverfd, buf, strlen(buf));   // Host는 그대로 전달
+            req_put(out, &len, line, eol - line);     // Host는 그대로 전달
         }
-        else if (!strncasecmp(buf, "User-Agent:", 11)) {
+        else if (!strncasecmp(line, "User-Agent:", 11)) {
             has_ua = 1;                               // 고정 UA를 쓸 예정이므로 스킵
         }
-        else if (!strncasecmp(buf, "Connection:", 11)) {
+        else if (!strncasecmp(line, "Connection:", 11)) {
             has_conn = 1;                             // close로 덮어쓸 예정이므로 스킵
         }
-        else if (!strncasecmp(buf, "Proxy-Connection:", 17)) {
+        else if (!strncasecmp(line, "Proxy-Connection:", 17)) {
             has_pconn = 1;                            // close로 덮어쓸 예정이므로 스킵
         }
-        else if (!strncasecmp(buf, "Proxy-Authorization:", 20)) {
+        else if (val && (!strncasecmp(line, "If-None-Match:", 14) ||
+                         !strncasecmp(line, "If-Modified-Since:", 18))) {
+            // 재검증 중에는 캐시 엔트리의 검증자를 대신 보냄
+        }
+        else if (!strncasecmp(line, "Proxy-Authorization:", 20)) {
             // 일반적으로 프록시 인증 헤더는 원 서버로 전달하지 않음
             // 이 구현에서는 제거
         }
         else {
             // 그 외 헤더는 변경 없이 전달
-            Rio_writen(serverfd, buf, strlen(buf));
+            req_put(out, &len, line, eol - line);
         }
     }
 
     // 3) Host 헤더가 없으면 추가
     if (!has_host) {
         if (!strcmp(port, "80"))
-            n = snprintf(out, sizeof(out), "Host: %s\r\n", hostname);
+            n = snprintf(buf, sizeof(buf), "Host: %s\r\n", hostname);
         else
-            n = snprintf(out, sizeof(out), "Host: %s:%s\r\n", hostname, port);
-        Rio_writen(serverfd, out, n);
+            n = snprintf(buf, sizeof(buf), "Host: %s:%s\r\n", hostname, port);
+        req_put(out, &len, buf, n);
     }
 
-    n = snprintf(out, sizeof(out), "%s", user_agent_hdr);
-    Rio_writen(serverfd, out, n);
-
-    n = snprintf(out, sizeof(out), "Connection: close\r\n");
-    Rio_writen(serverfd, out, n);
+    // 4) 캐시 재검증용 조건부 헤더
+    if (val && val->etag[0]) {
+        n = snprintf(buf, sizeof(buf), "If-None-Match: %s\r\n", val->etag);
+        req_put(out, &len, buf, n);
+    }
+    if (val && val->last_mod[0]) {
+        n = snprintf(buf, sizeof(buf), "If-Modified-Since: %s\r\n", val->last_mod);
+        req_put(out, &len, buf, n);
+    }
 
-    n = snprintf(out, sizeof(out), "Proxy-Connection: close\r\n");
-    Rio_writen(serverfd, out, n);
+    req_put(out, &len, user_agent_hdr, strlen(user_agent_hdr));
+    req_put(out, &len, "Connection: close\r\n", 19);
+    req_put(out, &len, "Proxy-Connection: close\r\n", 25);
 
     // 헤더 종료 빈 줄
-    Rio_writen(serverfd, "\r\n", 2);
+    req_put(out, &len, "\r\n", 2);
+    return len;
+}
+
+/* 만든 요청을 블로킹 소켓으로 원 서버에 전달
+ * - 원 서버가 끊었으면 쓰기 실패는 무시함 (뒤이은 응답 읽기가 실패로 처리)
+ */
+void forward_request_headers(const char *hdrs, int serverfd,
+                             const char *hostname, const char *port,
+                             const char *method, const char *path,
+                             const cache_validators_t *val) {
+    char *out = Malloc(REQ_MAX);
+
+    rio_writen(serverfd, out, build_request(out, hdrs, hostname, port, method, path, val));
+    Free(out);
+}
+
+/* 줄 하나를 모음 (rio_readlineb와 같은 경계: '\n'까지, 또는 MAXLINE - 1바이트에서 자름)
+ * 반환값: 줄이 완성되면 1 (line은 NUL로 끝남). *used에 p에서 가져간 바이트 수
+ */
+static int line_take(char *line, size_t *llen, const char *p, size_t n, size_t *used) {
+    size_t i = 0;
+
+    while (i < n && *llen < MAXLINE - 1) {
+        line[(*llen)++] = p[i++];
+        if (p[i - 1] == '\n') break;
+    }
+    *used = i;
+    line[*llen] = '\0';
+    return *llen > 0 && (line[*llen - 1] == '\n' || *llen == MAXLINE - 1);
 }
 
 /* 응답 중계기
@@ -399,161 +1486,1585 @@ void forward_request_headers(rio_t *client_rio, int serverfd,
  * 2) Content-Length: N
  * 3) 길이 정보 없음 -> EOF까지
  * 구현 방식
- * - 먼저 상태줄 한 줄을 읽어 바로 전달
- * - 헤더를 한 줄씩 읽어 클라이언트로 전달하면서
+ * - 원 서버에서 받은 바이트를 relay_input에 넣으면 어디까지 왔는지(state)를 기억하며
+ *   한 바이트씩 앞으로 감. 블로킹 중계(relay_response)와 이벤트 루프가 같은 기계를 씀
+ * - 상태줄과 헤더는 줄 단위로 모아 클라이언트로 전달하면서
  *   chunked 여부와 Content-Length를 파악
- * - 본문은 케이스별로 루프를 돌며 안전하게 스트리밍
- */
-void relay_response(int serverfd, int clientfd) {
-    rio_t s_rio;
-    Rio_readinitb(&s_rio, serverfd);              // 원 서버 소켓을 RIO 버퍼에 바인딩
-    char buf[MAXLINE];                            // 라인/청크 버퍼
-
-    int is_chunked = 0;                           // chunked 전송 여부
-    long content_len = -1;                        // Content-Length 값, 없으면 -1
-
-    // 1) 상태줄 읽기 및 전달
-    //    예: "HTTP/1.1 200 OK\r\n"
-    int n = Rio_readlineb(&s_rio, buf, MAXLINE);
-    if (n <= 0) return;                           // 서버가 즉시 끊었거나 오류
-    Rio_writen(clientfd, buf, n);
-
-    // 2) 헤더 읽기 루프
-    //    - 빈 줄까지 각 헤더를 즉시 클라이언트로 흘려보냄
-    //    - Transfer-Encoding, Content-Length를 파악
-    while ((n = Rio_readlineb(&s_rio, buf, MAXLINE)) > 0) {
-        // chunked 인지 검사
-        if (!strncasecmp(buf, "Transfer-Encoding:", 18) &&
-            strstr(buf, "chunked")) is_chunked = 1;
+ * - 본문은 케이스별로 남은 바이트를 세며 그대로 흘려보냄
+ * - fill이 주어지면 중계한 바이트를 같이 모으고 캐시 관련 헤더를 fill->meta에 해석,
+ *   200 응답이 아니거나 chunked이거나 no-store/private이거나 본문이 덜 왔으면 캐시 불가로 표시
+ * - flags에 RELAY_REVALIDATE가 있고 304가 오면, 또는 RELAY_STALE_IF_ERROR가 있고 5xx가 오면
+ *   클라이언트에는 아무것도 보내지 않고 헤더만 해석해서 헤더 끝에서 끝남
+ * - emit이 NULL이면 백그라운드 갱신이라 fill에 모으기만 함
+ * - 원 서버가 끊거나 읽기가 실패하면 relay_end로 마무리 (상태줄도 못 받았으면 상태 0)
+ */
+static void relay_emit(relay_t *r, const void *p, size_t n, int fill) {
+    if (r->emit) r->emit(r->arg, p, n);
+    if (fill) cache_fill_append(r->fill, p, n);
+}
 
-        // Content-Length 파악
-        if (!strncasecmp(buf, "Content-Length:", 15)) {
-            // buf + 15 지점부터 정수 파싱
-            content_len = strtol(buf + 15, NULL, 10);
-        }
+void relay_init(relay_t *r, cache_fill_t *fill, int flags,
+                void (*emit)(void *arg, const void *p, size_t n), void *arg) {
+    r->state = RELAY_STATUS;
+    r->flags = flags;
+    r->status = 0;
+    r->swallow = 0;
+    r->chunked = 0;
+    r->content_len = -1;
+    r->togo = 0;
+    r->fill = fill;
+    r->emit = emit;
+    r->arg = arg;
+    r->llen = 0;
+}
 
-        // 현재 헤더 라인을 그대로 클라이언트로 전달
-        Rio_writen(clientfd, buf, n);
+/* 헤더가 끝남: 캐시 가능 여부를 정하고 본문 방식에 맞는 상태로 */
+static void relay_headers_done(relay_t *r) {
+    cache_fill_t *fill = r->fill;
 
-        // 빈 줄 이면 헤더 종료
-        if (!strcmp(buf, "\r\n")) break;
+    if (r->swallow) {
+        r->state = RELAY_DONE;
+        return;
     }
+    // 헤더가 chunked거나 저장 금지거나 요청 키와 Vary 명세가 다르면
+    // 캐시하지 않음 (본문은 그대로 중계)
+    if (fill) {
+        if (r->chunked || !cache_meta_storable(&fill->meta) ||
+            strcmp(fill->meta.vary, fill->vary ? fill->vary : ""))
+            fill->ok = 0;
+        else cache_fill_headers(fill, r->content_len);
+    }
+    if (r->chunked) {
+        r->state = RELAY_CHUNK_SIZE;
+    } else if (r->content_len >= 0) {
+        r->togo = r->content_len;
+        r->state = r->togo > 0 ? RELAY_LENGTH : RELAY_DONE;
+    } else {
+        r->state = RELAY_EOF;
+    }
+}
 
-    // 3) 본문 전달
-    if (is_chunked) {
+/* 완성된 줄 하나 처리 (상태줄, 헤더, 청크 크기, 트레일러) */
+static void relay_line(relay_t *r) {
+    char *buf = r->line;
+    size_t n = r->llen;
+
+    r->llen = 0;
+    switch (r->state) {
+    case RELAY_STATUS:
+        // 상태줄 전달 (예: "HTTP/1.1 200 OK\r\n")
+        sscanf(buf, "HTTP/%*d.%*d %d", &r->status);
+        r->swallow = ((r->flags & RELAY_REVALIDATE) && r->status == 304) ||
+                     ((r->flags & RELAY_STALE_IF_ERROR) && r->status >= 500);
+        if (!r->swallow) relay_emit(r, buf, n, 1);
+        if (r->fill) {                              // 200과 404 / 410만 캐시
+            r->fill->meta.status = r->status;
+            if (!cache_status_storable(r->status)) r->fill->ok = 0;
+        }
+        r->state = RELAY_HEADERS;
+        break;
+    case RELAY_HEADERS:
+        // chunked 인지 검사
+        if (!strncasecmp(buf, "Transfer-Encoding:", 18) && strstr(buf, "chunked"))
+            r->chunked = 1;
+        // Content-Length 파악
+        if (!strncasecmp(buf, "Content-Length:", 15))
+            r->content_len = strtol(buf + 15, NULL, 10);
+        // 캐시 관련 헤더 (Cache-Control, Expires, Date, Last-Modified, ETag, Age)
+        if (r->fill) cache_meta_header(&r->fill->meta, buf);
+        // 현재 헤더 라인을 그대로 클라이언트로 전달
+        if (!r->swallow) relay_emit(r, buf, n, 1);
+        // 빈 줄 이면 헤더 종료
+        if (!strcmp(buf, "\r\n")) relay_headers_done(r);
+        break;
+    case RELAY_CHUNK_SIZE:
         /* 청크 전송 인코딩
          * - 구조: <hex 길이>\r\n <데이터...> \r\n [0\r\n 트레일러\r\n]\r\n
-         * - 각 청크 크기 줄을 읽어 클라이언트로 전달한 뒤
-         *   해당 크기만큼 데이터 블록을 읽어 그대로 전달
-         * - 마지막 청크 크기는 0
-         * - 마지막에는 선택적 트레일러 헤더들이 오고, 최종 빈 줄까지 전달
+         * - 크기 줄을 그대로 전달하고 그만큼 데이터, 뒤따르는 CRLF 두 바이트를 전달
+         * - 마지막 청크 크기는 0이고, 트레일러 헤더들과 최종 빈 줄까지 전달
          */
-        while ((n = Rio_readlineb(&s_rio, buf, MAXLINE)) > 0) {
-            // 청크 크기 줄 자체를 먼저 그대로 전달
-            Rio_writen(clientfd, buf, n);
-
-            // 16진수 크기 파싱
-            long chunk = strtol(buf, NULL, 16);
-
-            if (chunk == 0) {
-                // 마지막 청크: 뒤따르는 트레일러 헤더와 최종 CRLF까지 전달
-                while ((n = Rio_readlineb(&s_rio, buf, MAXLINE)) > 0) {
-                    Rio_writen(clientfd, buf, n);
-                    if (!strcmp(buf, "\r\n")) break; // 트레일러 종료
-                }
-                break; // 전체 본문 종료
-            }
+        relay_emit(r, buf, n, 0);
+        if ((r->togo = strtol(buf, NULL, 16)) == 0) {
+            r->state = RELAY_TRAILER;
+        } else {
+            r->state = RELAY_CHUNK_DATA;
+        }
+        break;
+    case RELAY_TRAILER:
+        relay_emit(r, buf, n, 0);
+        if (!strcmp(buf, "\r\n")) r->state = RELAY_DONE;   // 트레일러 종료
+        break;
+    }
+}
 
-            // 청크 데이터 본문 전달
-            long togo = chunk;
-            while (togo > 0) {
-                // 남은 크기만큼 읽되 MAXLINE을 넘지 않도록 분할
-                int m = Rio_readnb(&s_rio, buf, (togo > MAXLINE ? MAXLINE : togo));
-                if (m <= 0) return;             // 조기 EOF는 비정상
-                Rio_writen(clientfd, buf, m);
-                togo -= m;
+/* 원 서버에서 받은 바이트 n개를 중계 (끝난 뒤에 온 바이트는 버림) */
+void relay_input(relay_t *r, const char *p, size_t n) {
+    size_t used;
+
+    while (n > 0 && r->state != RELAY_DONE) {
+        switch (r->state) {
+        case RELAY_STATUS:
+        case RELAY_HEADERS:
+        case RELAY_CHUNK_SIZE:
+        case RELAY_TRAILER:
+            if (line_take(r->line, &r->llen, p, n, &used)) relay_line(r);
+            break;
+        case RELAY_LENGTH:                          // 고정 길이 본문: 정확히 그 바이트 수만큼
+        case RELAY_CHUNK_DATA:
+        case RELAY_CHUNK_CRLF:
+            used = (size_t)r->togo < n ? (size_t)r->togo : n;
+            relay_emit(r, p, used, r->state == RELAY_LENGTH);
+            if ((r->togo -= used) == 0) {
+                if (r->state == RELAY_LENGTH) r->state = RELAY_DONE;
+                else if (r->state == RELAY_CHUNK_DATA) r->state = RELAY_CHUNK_CRLF, r->togo = 2;
+                else r->state = RELAY_CHUNK_SIZE;
             }
-
-            // 청크 데이터 뒤에 오는 CRLF 두 바이트를 그대로 중계
-            n = Rio_readnb(&s_rio, buf, 2);
-            if (n <= 0) return;
-            Rio_writen(clientfd, buf, n);
-        }
-    } else if (content_len >= 0) {
-        /* 고정 길이 본문
-         * - Content-Length가 주어진 경우 정확히 그 바이트 수만큼 전달
-         * - readnb는 요청한 크기보다 적게 줄 수 있으므로 누적으로 보냄
-         */
-        long togo = content_len;
-        while (togo > 0) {
-            int m = Rio_readnb(&s_rio, buf, (togo > MAXLINE ? MAXLINE : togo));
-            if (m <= 0) break;                  // 비정상 조기 종료 가능
-            Rio_writen(clientfd, buf, m);
-            togo -= m;
-        }
-    } else {
-        /* 길이 정보 없음
-         * - Connection: close 기반의 HTTP/1.0 스타일 응답
-         * - 서버가 소켓을 닫을 때까지 EOF까지 읽어서 전달
-         */
-        while ((n = Rio_readnb(&s_rio, buf, MAXLINE)) > 0) {
-            Rio_writen(clientfd, buf, n);
+            break;
+        default:                                    // 길이 정보 없음: EOF까지 그대로
+            used = n;
+            relay_emit(r, p, used, 1);
         }
+        p += used;
+        n -= used;
     }
 }
 
-/* 작업 큐 구조체를 초기화하여 버퍼와 동기화 도구(mutex, 조건 변수)를 사용할 준비를 하는 함수 */
-void subf_init(sbuf_t *sp, int n) {
-  sp -> buf = calloc(n, sizeof(int));     // connfd 저장용 배열 할당
-  sp->n = n;                              // 버퍼 크기 저장
-  sp->front = sp->rear = 0;               // 초기 인덱스느 0 (비어 있음)
-  pthread_mutex_init(&sp->mutex, NULL);   // mutex 초기화
-  pthread_cond_init(&sp->slots, NULL);    // 빈 슬록 대기 조건 변수 초기화
-  pthread_cond_init(&sp->items, NULL);    // 아이템 대기 조건 변수 초기화
+/* 원 서버가 끊었거나(error 0) 읽기가 실패함(error 1, 시간 초과 포함)
+ * - 끝에 줄바꿈 없이 온 줄도 rio_readlineb처럼 한 줄로 처리
+ * - 헤더가 끝나지 않았거나 본문이 덜 왔으면 캐시 금지
+ */
+void relay_end(relay_t *r, int error) {
+    if (r->state == RELAY_DONE) return;
+    if (r->llen > 0 && r->state != RELAY_LENGTH && r->state != RELAY_EOF) relay_line(r);
+    if (r->fill && (error || r->state == RELAY_STATUS ||
+                    (r->state == RELAY_HEADERS && !r->swallow) ||
+                    (r->state == RELAY_LENGTH && r->togo > 0)))
+        r->fill->ok = 0;
+    r->state = RELAY_DONE;
 }
 
-/* 작업 큐에 클라이언트 연결(connfd)을 축라하며, 큐가 가득 차 있을 경우 빈 슬롯이 생길 때까지 대기하는 함수 */
-void subf_insert(sbuf_t *sp, int item) {
-  pthread_mutex_lock(&sp->mutex);                   // 큐 접근 mutex 잠금
+/* 블로킹 중계의 emit: 클라이언트가 끊기면 fd를 -1로 바꿔 더 보내지 않음
+ * (캐시에 모으는 중이면 원 서버 응답은 끝까지 받음) */
+static void relay_write(void *arg, const void *buf, size_t n) {
+    int *fd = arg;
 
-  while (((sp->rear + 1) % sp->n) == sp->front) {   // 큐가 가득 찬 경우
-    pthread_cond_wait(&sp->slots,&sp->mutex);       // 빈 슬롯이 생길 때 까지 대기
-  }
+    if (*fd >= 0 && rio_writen(*fd, (void *)buf, n) != (ssize_t)n) *fd = -1;
+}
+
+/* 블로킹 중계: serverfd에서 끝까지 읽어 clientfd로 보냄
+ * - clientfd가 음수면 백그라운드 갱신이라 fill에 모으기만 함
+ * - 원 서버 소켓에는 수신 마감이 걸려 있으므로 읽기 오류는 종료 없이 중단으로 처리
+ *   (시간 초과면 errno가 EAGAIN으로 남음)
+ * 반환값: 상태 코드 (상태줄을 못 읽었으면 0)
+ */
+int relay_response(int serverfd, int clientfd, cache_fill_t *fill, int flags) {
+    relay_t r;
+    char buf[MAXBUF];
+    ssize_t n;
+    int err;
+
+    relay_init(&r, fill, flags, clientfd >= 0 ? relay_write : NULL, &clientfd);
+    while (r.state != RELAY_DONE) {
+        if (r.emit && clientfd < 0 && !fill) break;  // 클라이언트가 끊겼고 모을 것도 없음
+        if ((n = read(serverfd, buf, sizeof(buf))) > 0) {
+            relay_input(&r, buf, n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            err = errno;
+            relay_end(&r, n < 0);
+            errno = err;
+        }
+    }
+    return r.status;
+}
 
-  sp->buf[sp->rear] = item;                         // connfd를 rear 위치에 저장
-  sp->rear = (sp->rear + 1) % sp->n;                // rear 인덱스 증가 (원형 회전)
+/********************************
+ * 이벤트 루프 연결 상태 기계
+ ********************************/
+
+/* 연결 하나의 흐름 (doit과 같은 순서를 소켓이 준비될 때마다 이어서 진행)
+ * 1) REQUEST: 요청 라인과 헤더를 빈 줄까지 모음
+ * 2) 캐시 적중이면 엔트리를 보내고 FLUSH (큰 엔트리를 다 못 보냈으면 붙잡아 두고 이어서)
+ * 3) 미스 / 재검증이면 이름 풀이(RESOLVE) 뒤 원 서버로 논블로킹 connect(CONNECT), 요청 전송(FORWARD),
+ *    응답을 relay_input에 넣어 중계(RELAY). 클라이언트가 못 따라오면 out에 모으고
+ *    CONN_OUT_HIGH를 넘으면 원 서버 읽기를 멈춤
+ * 4) 같은 키를 다른 연결이 가져오는 중이면 follower로 그 fill을 따라 보냄(FOLLOW)
+ * 5) 드문 경로(오류 응답, PURGE, Range, 조각 캐시, 원 서버 오류 응답)는
+ *    클라이언트 소켓을 루프에서 빼서 블로킹 워커에게 넘김
+ * - 이름 풀이(getaddrinfo)는 resolver 스레드가 하고 event_wake로 루프에 돌려보냄.
+ *   그동안 연결은 어느 목록에도 없으며, 마감은 getaddrinfo 자체의 시간 제한을 따름
+ * - 원 서버 쪽 마감은 SO_RCVTIMEO 대신 루프가 1초마다 active를 보고 검사
+ */
+#define SERVE_OFFLOAD 3           // conn_serve: 조각 캐시에 든 GET이나 큰 디스크 사본이라 블로킹 워커가 보내야 함
 
-  pthread_cond_signal(&sp->items);                  // 대기 중인 worker thread에게 작업이 생겼음을 알림
-  pthread_mutex_unlock(&sp->mutex);                 // mutex 잠금 해제
+static conn_t *conn_of(event_handler_t *h, size_t off) {
+    return (conn_t *)((char *)h - off);
 }
 
-/* 작업 큐에서 클라이언트 연결(connfd)을 꺼내어 반환하며, 큐가 비어 있으면 아이템이 들어올 떄까지 대기 */
-int subf_remove(sbuf_t *sp) { 
-  pthread_mutex_lock(&sp->mutex);                   // 큐 접근 잠금
+/* 원 서버를 기다리는 목록 (마감 검사) */
+static void conn_wait(conn_t *c) {
+    reactor_t *rx = c->rx;
 
-  while (sp->front == sp->rear) {                   // 큐가 비어있는 경우
-    pthread_cond_wait(&sp->items, &sp->mutex);      // 아이템이 들어올 때까지 대기
-  }
-  
-  int item = sp->buf[sp->front];                    // front 위치의 connfd 가져오기
-  sp->front = (sp->front + 1) % sp-> n;             // front index 증가 (원형 회전)
-  
-  pthread_cond_signal(&sp->slots);                  // 대기 중인 메인 스레드에게 공간이 생겼음을 알림
-  pthread_mutex_unlock(&sp->mutex);                 // 잠금 해제
+    c->active = time(NULL);
+    c->prev = NULL;
+    if ((c->next = rx->waiting) != NULL) rx->waiting->prev = c;
+    rx->waiting = c;
+}
+
+static void conn_unwait(conn_t *c) {
+    reactor_t *rx = c->rx;
 
-  return item;                                      // connfd 반환
+    if (!c->prev && rx->waiting != c) return;       // 목록에 없음
+    if (c->prev) c->prev->next = c->next;
+    else rx->waiting = c->next;
+    if (c->next) c->next->prev = c->prev;
+    c->next = c->prev = NULL;
 }
 
-/* 
-  클라이언트 연결을 반복적으로 처리하는 worker Thread의 작업 루틴 함수
-  메인 함수에서 스레드 생성 시 이 함수를 루틴으로 등록하여 각 스레드가 요청을 처리하도록 한다.
-*/
-void *thread(void *vargp) {
-  pthread_detach(pthread_self());
+/* 다른 스레드에서 연결을 루프로 돌려보냄 (reactor_wake가 이어서 진행)
+ * - 이미 목록에 있으면 다시 넣지 않고, 목록이 비어 있었을 때만 루프를 깨움
+ */
+static void conn_post(conn_t *c) {
+    reactor_t *rx = c->rx;
+    int wake = 0;
+
+    pthread_mutex_lock(&rx->post_mutex);
+    if (!c->post_pending) {
+        wake = rx->posted == NULL;
+        c->post_pending = 1;
+        c->post_next = rx->posted;
+        rx->posted = c;
+    }
+    pthread_mutex_unlock(&rx->post_mutex);
+    if (wake) event_wake(&rx->loop);
+}
 
-  while (1) {
-    int connfd = subf_remove(&sbuf);                // 작업 꺼냄
-    doit(connfd);                                   // 요청 처리
-    close(connfd);                                  // 소켓 닫기
-  }
-}
\ No newline at end of file
+/* 돌려보낸 목록에서 뺌 (루프 스레드, 더 돌려보낼 쪽이 없어진 뒤에) */
+static void conn_unpost(conn_t *c) {
+    reactor_t *rx = c->rx;
+    conn_t **pp;
+
+    pthread_mutex_lock(&rx->post_mutex);
+    if (c->post_pending) {
+        for (pp = &rx->posted; *pp && *pp != c; pp = &(*pp)->post_next)
+            ;
+        if (*pp) *pp = c->post_next;
+        c->post_pending = 0;
+    }
+    pthread_mutex_unlock(&rx->post_mutex);
+}
+
+/* 원 서버 쪽 정리: 소켓, 주소 목록, 보낼 요청 */
+static void conn_server_close(conn_t *c) {
+    conn_unwait(c);
+    if (c->serverfd >= 0) {
+        event_del(&c->rx->loop, &c->sev);
+        Close(c->serverfd);
+        c->serverfd = -1;
+    }
+    if (c->addrs) freeaddrinfo(c->addrs);
+    c->addrs = c->next_addr = NULL;
+    if (c->req) Free(c->req);
+    c->req = NULL;
+}
+
+/* 묶음 끝에 넘기거나 해제 (같은 묶음의 뒤이은 이벤트가 연결을 가리킬 수 있음) */
+static void conn_defer(conn_t *c, int state) {
+    c->state = state;
+    c->done_next = c->rx->done;
+    c->rx->done = c;
+}
+
+static void conn_unhold(conn_t *c);
+
+static void conn_close(conn_t *c) {
+    conn_unhold(c);
+    conn_server_close(c);
+    event_del(&c->rx->loop, &c->cev);
+    Close(c->clientfd);
+    conn_defer(c, CONN_CLOSED);
+}
+
+/* 블로킹 워커에게 넘김 (클라이언트로는 아직 아무것도 보내지 않았음) */
+static void conn_offload(conn_t *c, int what) {
+    conn_server_close(c);
+    event_del(&c->rx->loop, &c->cev);
+    c->offload = what;
+    conn_defer(c, CONN_OFFLOAD);
+}
+
+static void conn_free(conn_t *c) {
+    if (c->out) Free(c->out);
+    if (c->chunk) Free(c->chunk);
+    Free(c);
+}
+
+/* io_uring: 아직 올 완료가 있음 (그 전에는 구조체를 넘기거나 다시 쓰면 안 됨) */
+static int conn_busy(const conn_t *c) {
+    return c->cev.busy || c->sev.busy || c->rop.busy || c->lrecv.busy || c->lsend.busy;
+}
+
+/* 캐시 적중에서 붙잡은 엔트리를 놓음 */
+static void conn_unhold(conn_t *c) {
+    if (c->hit) cache_release(c->hit);
+    c->hit = NULL;
+    c->hit_len = 0;
+}
+
+/* 클라이언트가 끊김: 밀린 출력을 버리고 더 보내지 않음 */
+static void conn_client_gone(conn_t *c) {
+    c->client_dead = 1;
+    c->out_off = c->out_len = 0;
+    conn_unhold(c);
+}
+
+/* 못 보낸 바이트를 out 뒤에 복사 */
+static void conn_queue(conn_t *c, const char *p, size_t n) {
+    size_t cap;
+
+    if (n == 0) return;
+    if (c->out_len + n > c->out_cap && c->out_off > 0) {   // 보낸 앞부분을 당겨 자리 확보
+        memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+        c->out_len -= c->out_off;
+        c->out_off = 0;
+    }
+    if (c->out_len + n > c->out_cap) {
+        for (cap = c->out_cap ? c->out_cap * 2 : MAXBUF; cap < c->out_len + n; cap *= 2)
+            ;
+        c->out = Realloc(c->out, cap);
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, p, n);
+    c->out_len += n;
+}
+
+/* 밀린 출력이 없으면 바로 보냄
+ * - 끊긴 클라이언트는 SIGPIPE 대신 EPIPE로 알아채고 client_dead로 표시
+ * 반환값: 소켓이 받은 바이트 수 (밀린 출력이 있거나 소켓이 차 있거나 끊겼으면 0)
+ */
+static size_t conn_trysend(conn_t *c, struct iovec *iov, int cnt) {
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = cnt };
+    ssize_t n;
+
+    if (c->client_dead || c->out_off != c->out_len) return 0;
+    while ((n = sendmsg(c->clientfd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) conn_client_gone(c);
+    return n < 0 ? 0 : n;
+}
+
+/* iov에서 앞 n바이트(보낸 만큼)를 건너뛴 나머지를 out에 복사 */
+static void conn_queue_iov(conn_t *c, struct iovec *iov, int cnt, size_t n) {
+    for (int i = 0; i < cnt; i++) {
+        size_t skip = n < iov[i].iov_len ? n : iov[i].iov_len;
+        conn_queue(c, (char *)iov[i].iov_base + skip, iov[i].iov_len - skip);
+        n -= skip;
+    }
+}
+
+/* 클라이언트로 보냄
+ * - 밀린 출력이 없으면 바로 보내고(대부분 한 번에 끝남) 남은 바이트만 out에 복사
+ */
+static void conn_sendv(conn_t *c, struct iovec *iov, int cnt) {
+    size_t n = conn_trysend(c, iov, cnt);
+
+    if (!c->client_dead) conn_queue_iov(c, iov, cnt, n);
+}
+
+/* relay_t의 emit */
+static void conn_send(void *arg, const void *p, size_t n) {
+    struct iovec v = { (void *)p, n };
+
+    conn_sendv(arg, &v, 1);
+}
+
+/* 밀린 출력을 소켓이 받는 만큼 보냄 (out을 다 보내면 붙잡은 엔트리의 본문을 이어서) */
+static void conn_flush(conn_t *c) {
+    ssize_t n;
+
+    while (c->out_off < c->out_len) {
+        n = send(c->clientfd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) conn_client_gone(c);
+            return;
+        }
+        c->out_off += n;
+    }
+    c->out_off = c->out_len = 0;
+    while (c->hit_len > 0) {
+        n = send(c->clientfd, c->hit_p, c->hit_len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) conn_client_gone(c);
+            return;
+        }
+        c->hit_p += n;
+        c->hit_len -= n;
+    }
+    conn_unhold(c);
+}
+
+/* 캐시 적중 응답을 보냄 (읽기 구간 안에서 호출, iov는 entry_iov의 세 조각)
+ * - 못 보낸 나머지는 읽기 구간을 나오기 전에 out에 복사
+ * - 못 보낸 본문이 CONN_HIT_COPY를 넘으면 복사하지 않고 엔트리를 붙잡아 두었다가
+ *   소켓이 빌 때마다 엔트리에서 바로 보냄 (느린 클라이언트마다 큰 응답을 복사하지 않음)
+ */
+static void conn_send_hit(conn_t *c, cache_entry_t *entry, struct iovec *iov) {
+    size_t n = conn_trysend(c, iov, 3), head = iov[0].iov_len + iov[1].iov_len;
+
+    if (c->client_dead) return;
+    if (head + iov[2].iov_len - n <= CONN_HIT_COPY || !cache_hold(entry)) {
+        conn_queue_iov(c, iov, 3, n);
+        return;
+    }
+    conn_queue_iov(c, iov, 2, n);                   // 상태줄과 Age 줄 중 못 보낸 것만 복사
+    n = n > head ? n - head : 0;
+    c->hit = entry;
+    c->hit_p = (char *)iov[2].iov_base + n;
+    c->hit_len = iov[2].iov_len - n;
+}
+
+/* 이벤트 루프의 캐시 적중 (serve_from_cache와 같은 판단)
+ * - 엔트리를 writev 한 번으로 보냄 (conn_send_hit)
+ * - 붙잡을 수 없는 디스크 사본이 CONN_HIT_COPY보다 크면 처음부터 블로킹 워커가 보냄
+ * 반환값: serve_from_cache와 같음, 조각 캐시에 든 GET이나 큰 디스크 사본이면 보내지 않고 SERVE_OFFLOAD
+ */
+static int conn_serve(conn_t *c, cache_validators_t *stale) {
+    cache_entry_t *entry;
+    char age[MAXLINE];
+    struct iovec iov[3];
+    int served;
+
+    cache_read_begin();
+    if ((entry = cache_lookup(&c->key)) == NULL) {
+        cache_read_end();
+        return 0;
+    }
+    if ((served = entry_served(entry, stale)) > 0) {
+        entry_iov(entry, "", c->is_get, age, iov);
+        if ((c->is_get && entry->seg_total) || (entry->slot < 0 && iov[2].iov_len > CONN_HIT_COPY))
+            served = SERVE_OFFLOAD;
+        else
+            conn_send_hit(c, entry, iov);
+    }
+    cache_read_end();
+    return served;
+}
+
+static void conn_relay(conn_t *c);
+static void conn_follow(conn_t *c);
+
+/* 클라이언트 쪽이 진행함 (출력이 빠졌거나 끊김): 상태에 맞게 이어서 */
+static void conn_client_ready(conn_t *c) {
+    switch (c->state) {
+    case CONN_FLUSH:
+        if (c->out_off == c->out_len && !c->hit) conn_close(c);
+        break;
+    case CONN_CONNECT:
+    case CONN_FORWARD:
+        if (c->client_dead && !c->flight) conn_close(c);    // leader는 follower를 위해 계속
+        break;
+    case CONN_RELAY:
+        conn_relay(c);                              // 멈췄던 원 서버 읽기를 다시
+        break;
+    case CONN_FOLLOW:
+        conn_follow(c);                             // 멈췄던 전송을 다시 (끊겼으면 닫음)
+        break;
+    }
+}
+
+/* 응답을 다 만들었음: 밀린 출력을 보내고 닫음 */
+static void conn_finish(conn_t *c) {
+    c->state = CONN_FLUSH;
+    conn_client_ready(c);
+}
+
+/* 원 서버 오류 (연결 실패, 시간 초과, 삼킨 5xx): follower는 바로 깨우고 응답은 워커가 */
+static void conn_origin_error(conn_t *c, int timed_out) {
+    conn_server_close(c);
+    if (c->flight) cache_flight_end(c->flight, FLIGHT_ERROR);
+    c->flight = NULL;
+    c->timed_out = timed_out;
+    if (c->client_dead) conn_close(c);
+    else conn_offload(c, OFFLOAD_ORIGIN_ERROR);
+}
+
+/* 다음 주소로 논블로킹 connect 시작 (다 실패하면 원 서버 오류) */
+static void conn_connect(conn_t *c) {
+    struct addrinfo *p;
+    int fd;
+
+    while ((p = c->next_addr) != NULL) {
+        c->next_addr = p->ai_next;
+        if ((fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, p->ai_protocol)) < 0)
+            continue;
+        if ((connect(fd, p->ai_addr, p->ai_addrlen) == 0 || errno == EINPROGRESS) &&
+            event_add(&c->rx->loop, fd, &c->sev) == 0) {
+            c->serverfd = fd;
+            c->state = CONN_CONNECT;
+            return;                                 // 연결되면 EPOLLOUT
+        }
+        Close(fd);
+    }
+    origin_fail(c->hostname, c->port, ORIGIN_CONNECT);
+    conn_origin_error(c, 0);
+}
+
+/* 원 서버로 가는 경로 시작 (doit의 retry부터)
+ * - 실패를 기억하는 원 서버면 바로 오류 응답
+ * - 아니면 이름 풀이를 resolver 스레드에 맡기고 RESOLVE에서 기다림 (conn_resolved로 이어짐)
+ */
+static void conn_origin(conn_t *c) {
+    if (origin_failed(c->hostname, c->port)) {
+        conn_origin_error(c, 0);
+        return;
+    }
+    c->state = CONN_RESOLVE;
+    c->post_next = NULL;
+    pthread_mutex_lock(&resq.mutex);
+    if (resq.tail) resq.tail->post_next = c; else resq.head = c;
+    resq.tail = c;
+    pthread_cond_signal(&resq.items);
+    pthread_mutex_unlock(&resq.mutex);
+}
+
+/* 이름 풀이가 끝남 (루프 스레드, c->addrs가 결과이고 실패면 NULL)
+ * - 기다리는 사이 클라이언트가 끊겼으면 닫음 (leader는 follower를 위해 계속)
+ * - 요청을 미리 만들어 두고 주소 목록의 첫 주소부터 연결
+ */
+static void conn_resolved(conn_t *c) {
+    if (c->client_dead && !c->flight) {
+        conn_close(c);
+        return;
+    }
+    if (!c->addrs) {
+        origin_fail(c->hostname, c->port, ORIGIN_DNS);
+        conn_origin_error(c, 0);
+        return;
+    }
+    c->next_addr = c->addrs;
+    c->req = Malloc(REQ_MAX);
+    c->req_len = build_request(c->req, c->rq.hdrs, c->hostname, c->port, c->method, c->path,
+                               c->revalidate ? &c->stale : NULL);
+    c->req_off = 0;
+    conn_wait(c);
+    conn_connect(c);
+}
+
+/* 중계 시작: 캐시에 모을 버퍼를 정하고(doit과 같음) 응답을 읽기 시작 */
+static void conn_relay_start(conn_t *c) {
+    int flags = (c->revalidate ? RELAY_REVALIDATE : 0) | (c->served < 0 ? RELAY_STALE_IF_ERROR : 0);
+
+    if (!c->fill) {                                 // 304 뒤 다시 요청할 때는 비운 버퍼를 그대로
+        if (c->flight) {
+            c->fill = &c->flight->fill;
+        } else if (c->is_get) {
+            cache_fill_init(&c->local);
+            c->fill = &c->local;
+        }
+        if (c->fill) {
+            c->fill->vary = c->key.vary;
+            c->fill->key = &c->key;
+        }
+    }
+    relay_init(&c->relay, c->fill, flags, conn_send, c);
+    c->timed_out = 0;
+    c->state = CONN_RELAY;
+    if (c->rx->loop.backend == EVENT_URING) {      // 응답은 완료 기반 recv로 받으므로 poll은 그만
+        event_del(&c->rx->loop, &c->sev);
+        c->burst = c->nobufs = 0;
+    }
+    conn_relay(c);
+}
+
+/* 요청을 소켓이 받는 만큼 보냄 */
+static void conn_forward(conn_t *c) {
+    ssize_t n;
+
+    while (c->req_off < c->req_len) {
+        n = send(c->serverfd, c->req + c->req_off, c->req_len - c->req_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) conn_origin_error(c, 0);
+            return;
+        }
+        c->req_off += n;
+        c->active = time(NULL);
+    }
+    Free(c->req);
+    c->req = NULL;
+    conn_relay_start(c);
+}
+
+/* 중계가 끝남 (doit의 relay_response 뒤와 같음) */
+static void conn_relay_done(conn_t *c) {
+    cache_fill_t *fill = c->fill;
+    int status = c->relay.status, cached, served;
+
+    conn_server_close(c);
+    if (status == 0 || (status >= 500 && (c->relay.flags & RELAY_STALE_IF_ERROR))) {
+        if (!c->flight && fill) cache_fill_free(fill);
+        c->fill = NULL;
+        conn_origin_error(c, c->timed_out);
+        return;
+    }
+    if (c->revalidate && status == 304) {
+        if (cache_refresh(&c->key, &fill->meta) && (served = conn_serve(c, &validated)) > 0) {
+            cache_flight_end(c->flight, FLIGHT_DONE);
+            c->flight = NULL;
+            c->fill = NULL;
+            if (served == SERVE_OFFLOAD) conn_offload(c, OFFLOAD_REQUEST);
+            else conn_finish(c);
+            return;
+        }
+        c->revalidate = 0;
+        cache_fill_reset(fill);
+        conn_origin(c);
+        return;
+    }
+    if (fill && cache_status_storable(status) && strcmp(fill->meta.vary, c->key.vary))
+        cache_vary_learn(&c->key, fill->meta.vary);
+    cached = fill && fill->ok && fill->hdr_len > 0 &&
+             (fill->seg_total || cache_insert(&c->key, fill->buf, fill->hdr_len, fill->len, &fill->meta));
+    if (c->flight)
+        cache_flight_end(c->flight, cached ? FLIGHT_DONE : status >= 500 ? FLIGHT_ERROR : FLIGHT_FAILED);
+    else if (fill) cache_fill_free(fill);
+    c->flight = NULL;
+    c->fill = NULL;
+    conn_finish(c);
+}
+
+/* io_uring 중계: 완료 하나마다 다음 recv를 하나 제출
+ * - 완료를 기다리는 중이면 아무것도 안 함 (완료가 다시 부름). 그래서 클라이언트로 가는
+ *   바이트는 항상 한 곳에서만 나가고, 중계는 걸린 작업이 없을 때만 끝남
+ * - 지난 recv가 버퍼를 채웠고 고정 길이 본문이면 recv→send 한 쌍으로 본문을 옮김.
+ *   send를 따로 부를 일이 없으므로 묶음마다 enter 한 번으로 끝남. 한 쌍은 조각을 다
+ *   받아야 끝나므로(그동안은 진행이 안 보임) 원 서버가 밀어 넣고 있을 때만 씀
+ * - 그 밖에는 제공 버퍼 recv (버퍼가 다 나가 있으면 chunk로)
+ */
+static void conn_relay_ring(conn_t *c) {
+    relay_t *r = &c->relay;
+    event_loop_t *l = &c->rx->loop;
+
+    if (c->rop.busy || c->lrecv.busy || c->lsend.busy) return;
+    if (c->client_dead && (!c->fill || !c->fill->ok)) relay_end(r, 1);
+    if (r->state == RELAY_DONE) {
+        conn_relay_done(c);
+        return;
+    }
+    if (c->out_len - c->out_off > CONN_OUT_HIGH) return;
+    if (c->burst && r->state == RELAY_LENGTH && c->out_off == c->out_len && !c->client_dead) {
+        if (!c->chunk) c->chunk = Malloc(RING_CHUNK);
+        c->chunk_len = r->togo < RING_CHUNK ? r->togo : RING_CHUNK;
+        event_recv_send(l, c->serverfd, c->clientfd, c->chunk, c->chunk_len, &c->lrecv, &c->lsend);
+    } else if (c->nobufs) {
+        if (!c->chunk) c->chunk = Malloc(RING_CHUNK);
+        event_recv_into(l, c->serverfd, c->chunk, RING_CHUNK, &c->rop);
+    } else {
+        event_recv(l, c->serverfd, &c->rop);
+    }
+}
+
+/* 원 서버 recv 완료 (buf가 NULL이면 chunk로 받음) */
+static void conn_ring_recv(event_op_t *op, int res, char *buf) {
+    conn_t *c = (conn_t *)((char *)op - offsetof(conn_t, rop));
+
+    if (c->state != CONN_RELAY) return;
+    if (res == -ENOBUFS) {
+        c->nobufs = 1;
+    } else if (res > 0) {
+        c->active = time(NULL);
+        c->burst = res == (buf ? EVENT_RING_BUF : RING_CHUNK);
+        c->nobufs = 0;
+        relay_input(&c->relay, buf ? buf : c->chunk, res);
+    } else {
+        relay_end(&c->relay, res < 0);
+    }
+    conn_relay(c);
+}
+
+/* recv→send 한 쌍의 recv 완료
+ * - 다 받았으면 send가 그대로 보내므로 캐시에만 모음 (emit을 잠시 뗌)
+ * - 짧게 끝났으면(끊김, 오류, 시간 초과로 취소) send는 취소되므로 받은 만큼 직접 보내고 끝냄
+ */
+static void conn_ring_linked(event_op_t *op, int res, char *buf) {
+    conn_t *c = (conn_t *)((char *)op - offsetof(conn_t, lrecv));
+    void (*emit)(void *arg, const void *p, size_t n) = c->relay.emit;
+
+    if (c->state != CONN_RELAY) return;
+    if (res > 0) c->active = time(NULL);
+    if (res == (int)c->chunk_len) {
+        c->relay.emit = NULL;
+        relay_input(&c->relay, c->chunk, res);
+        c->relay.emit = emit;
+    } else {
+        c->burst = 0;
+        if (res > 0) relay_input(&c->relay, c->chunk, res);
+        relay_end(&c->relay, res < 0);
+    }
+    conn_relay(c);
+}
+
+/* recv→send 한 쌍의 send 완료 (실패면 클라이언트가 끊김) */
+static void conn_ring_sent(event_op_t *op, int res, char *buf) {
+    conn_t *c = (conn_t *)((char *)op - offsetof(conn_t, lsend));
+
+    if (c->state != CONN_RELAY) return;
+    if (res < 0 && res != -ECANCELED) conn_client_gone(c);
+    conn_relay(c);
+}
+
+/* 원 서버 응답을 EAGAIN까지 읽어 중계
+ * - 클라이언트로 못 보낸 바이트가 CONN_OUT_HIGH를 넘으면 멈춤 (출력이 빠지면 다시 불림)
+ * - 클라이언트가 끊겼으면 캐시에 모을 것이 있을 때만 끝까지 받음
+ * - io_uring 루프면 conn_relay_ring으로
+ */
+static void conn_relay(conn_t *c) {
+    char *buf = c->rx->buf;
+    ssize_t n;
+
+    if (c->rx->loop.backend == EVENT_URING) {
+        if (c->state == CONN_RELAY) conn_relay_ring(c);
+        return;
+    }
+    while (c->state == CONN_RELAY) {
+        if (c->client_dead && (!c->fill || !c->fill->ok)) {
+            relay_end(&c->relay, 1);
+        } else if (c->out_len - c->out_off > CONN_OUT_HIGH) {
+            return;
+        } else if ((n = read(c->serverfd, buf, REACTOR_BUF)) > 0) {
+            c->active = time(NULL);
+            relay_input(&c->relay, buf, n);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        } else {
+            relay_end(&c->relay, n < 0);
+        }
+        if (c->relay.state == RELAY_DONE) conn_relay_done(c);
+    }
+}
+
+/* leader의 진행 알림 (leader 스레드에서 flight mutex 아래) */
+static void conn_flight_notify(cache_flight_watch_t *w) {
+    conn_post((conn_t *)((char *)w - offsetof(conn_t, fw)));
+}
+
+/* follower를 flight에서 뗌: 알림을 끊고 참조를 놓음 */
+static void conn_unfollow(conn_t *c) {
+    cache_flight_unwatch(c->flight, &c->fw);
+    conn_unpost(c);
+    conn_unwait(c);
+    cache_flight_release(c->flight);
+    c->flight = NULL;
+}
+
+/* 따라 보낼 수 없는 leader의 결과 (doit의 follower 분기와 같음)
+ * - DONE: 캐시에서, ERROR: 만료된 사본이나 502 (워커가), 그 밖에는 직접 원 서버로
+ */
+static void conn_follow_done(conn_t *c, int state) {
+    int served;
+
+    conn_unfollow(c);
+    if (state == FLIGHT_DONE && (served = conn_serve(c, NULL)) > 0) {
+        if (served == SERVE_OFFLOAD) conn_offload(c, OFFLOAD_REQUEST);
+        else conn_finish(c);
+        return;
+    }
+    if (state == FLIGHT_ERROR) {
+        conn_offload(c, OFFLOAD_ORIGIN_ERROR);
+        return;
+    }
+    c->revalidate = 0;
+    conn_origin(c);
+}
+
+/* follower: leader가 채우는 fill을 기다리지 않고 따라가며 전송 (serve_from_flight와 같음)
+ * - leader가 진행할 때마다 conn_flight_notify가 연결을 루프로 돌려보내 다시 불림
+ * - fill.buf는 total이 정해진 뒤로 옮겨지지 않으므로 out에 복사하지 않고 바로 보냄.
+ *   소켓이 차면 멈췄다가 클라이언트 쪽이 진행할 때 이어서
+ * - 한 바이트도 못 보내고 leader가 실패하면 직접 원 서버로, 보낸 뒤면 거기서 닫음
+ */
+static void conn_follow(conn_t *c) {
+    cache_flight_t *f = c->flight;
+    struct iovec v;
+    const char *p;
+    size_t sent;
+    long n;
+    int state;
+
+    if (c->client_dead) {
+        conn_unfollow(c);
+        conn_close(c);
+        return;
+    }
+    if (c->follow_end == 0) {
+        if ((state = cache_flight_poll(f)) == FLIGHT_PENDING) return;
+        if (state != FLIGHT_STREAM) {
+            conn_follow_done(c, state);
+            return;
+        }
+        c->follow_end = c->is_get ? f->fill.total : f->fill.hdr_len;
+    }
+    c->follow_full = 0;
+    while (c->follow_off < c->follow_end) {
+        if ((n = cache_flight_peek(f, c->follow_off, &p)) == CACHE_FLIGHT_AGAIN) return;
+        if (n <= 0) break;                          // leader 실패
+        if ((size_t)n > c->follow_end - c->follow_off) n = c->follow_end - c->follow_off;
+        c->active = time(NULL);
+        v.iov_base = (void *)p;
+        v.iov_len = n;
+        sent = conn_trysend(c, &v, 1);
+        c->follow_off += sent;
+        if (c->client_dead) {
+            conn_unfollow(c);
+            conn_close(c);
+            return;
+        }
+        if (sent < (size_t)n) {                     // 소켓이 참: EPOLLOUT을 기다림
+            c->follow_full = 1;
+            return;
+        }
+    }
+    if (c->follow_off == 0) {
+        conn_follow_done(c, FLIGHT_FAILED);
+        return;
+    }
+    conn_unfollow(c);
+    conn_finish(c);
+}
+
+/* 원 서버 마감이 지남 (doit의 SO_RCVTIMEO와 같은 처리)
+ * - io_uring에서 recv가 걸려 있으면 취소만 하고, 취소 완료가 중계를 끝냄
+ * - follower는 leader가 CACHE_FLIGHT_TIMEOUT초 동안 멈춘 것 (cache_flight_wait / read와 같음)
+ */
+static void conn_timeout(conn_t *c) {
+    if (c->state == CONN_FOLLOW && c->follow_off > 0) {
+        conn_unfollow(c);
+        conn_close(c);
+    } else if (c->state == CONN_FOLLOW) {
+        conn_follow_done(c, FLIGHT_ERROR);
+    } else if (c->state == CONN_RELAY && (c->rop.busy || c->lrecv.busy)) {
+        c->timed_out = 1;
+        event_cancel(&c->rx->loop, c->rop.busy ? &c->rop : &c->lrecv);
+    } else if (c->state == CONN_RELAY) {
+        relay_end(&c->relay, 1);
+        c->timed_out = 1;
+        conn_relay_done(c);
+    } else {
+        conn_origin_error(c, 1);
+    }
+}
+
+/* 읽어 둔 요청 처리 (doit의 앞부분)
+ * - GET / HEAD가 아니거나 파싱이 안 되거나 Range가 있으면 블로킹 워커로
+ */
+static void conn_dispatch(conn_t *c) {
+    char method[MAXLINE], uri[MAXLINE], version[MAXLINE], range[MAXLINE];
+    int role;
+
+    if (sscanf(c->rq.line, "%s %s %s", method, uri, version) != 3 ||
+        (strcasecmp(method, "GET") && strcasecmp(method, "HEAD")) ||
+        parse_uri(uri, c->hostname, c->port, c->path) != 0 ||
+        request_header(c->rq.hdrs, "Range:", range, sizeof(range))) {
+        conn_offload(c, OFFLOAD_REQUEST);
+        return;
+    }
+    strcpy(c->method, method);
+    c->is_get = !strcasecmp(method, "GET");
+    cache_make_key(&c->key, c->hostname, c->port, c->path);
+    cache_vary_key(&c->key, c->rq.hdrs);
+    if (c->is_get) cache_record(&c->key);
+    c->rq.recorded = 1;
+    c->stale.etag[0] = c->stale.last_mod[0] = '\0';
+    if ((c->served = conn_serve(c, &c->stale)) > 0) {
+        if (c->served == SERVE_OFFLOAD) {
+            conn_offload(c, OFFLOAD_REQUEST);
+            return;
+        }
+        if (c->served == 2)
+            refresh_enqueue(&c->key, c->hostname, c->port, c->path, c->rq.hdrs, &c->stale);
+        conn_finish(c);
+        return;
+    }
+
+    role = cache_flight_begin(&c->key, &c->flight);
+    if (role == FLIGHT_HIT && (role = conn_serve(c, NULL)) > 0) {
+        if (role == SERVE_OFFLOAD) conn_offload(c, OFFLOAD_REQUEST);
+        else conn_finish(c);
+        return;
+    }
+    if (role == FLIGHT_FOLLOWER) {                  // leader가 진행할 때마다 알림을 받아 따라 보냄
+        c->state = CONN_FOLLOW;
+        c->fw.fn = conn_flight_notify;
+        cache_flight_watch(c->flight, &c->fw);
+        conn_wait(c);
+        conn_follow(c);
+        return;
+    }
+    if (c->flight && !c->is_get) {
+        cache_flight_end(c->flight, FLIGHT_FAILED);
+        c->flight = NULL;
+    }
+    c->revalidate = c->flight && (c->stale.etag[0] || c->stale.last_mod[0]);
+    conn_origin(c);
+}
+
+/* 요청 라인이나 헤더 한 줄이 완성됨 (relay.line에 모음)
+ * 반환값: 요청을 다 읽었으면 1
+ */
+static int conn_request_line(conn_t *c) {
+    char *line = c->relay.line;
+    size_t n = c->relay.llen;
+    char method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+
+    c->relay.llen = 0;
+    if (!c->got_line) {
+        c->got_line = 1;
+        memcpy(c->rq.line, line, n + 1);
+        // 요청 라인이 잘못됐으면 헤더를 기다리지 않고 바로 400 (doit과 같음)
+        return sscanf(line, "%s %s %s", method, uri, version) != 3;
+    }
+    if (!strcmp(line, "\r\n")) return 1;            // 헤더 종료
+    if (c->hlen + n < sizeof(c->rq.hdrs)) {
+        memcpy(c->rq.hdrs + c->hlen, line, n + 1);
+        c->hlen += n;
+    }
+    return 0;
+}
+
+/* 클라이언트 요청을 EAGAIN까지 읽어 줄 단위로 모음
+ * - 요청 라인 전에 끊기면 조용히 닫고, 헤더 중간에 끊기면 받은 데까지로 처리
+ */
+static void conn_read_request(conn_t *c) {
+    char *buf = c->rx->buf;
+    ssize_t n;
+    size_t off, used;
+
+    while (1) {
+        if ((n = read(c->clientfd, buf, REACTOR_BUF)) < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) conn_close(c);
+            return;
+        }
+        if (n == 0) {
+            if (c->relay.llen > 0 && conn_request_line(c)) {
+                conn_dispatch(c);
+            } else if (!c->got_line) {
+                conn_close(c);
+            } else {
+                conn_dispatch(c);
+            }
+            return;
+        }
+        for (off = 0; off < (size_t)n; off += used) {
+            if (line_take(c->relay.line, &c->relay.llen, buf + off, n - off, &used) &&
+                conn_request_line(c)) {
+                conn_dispatch(c);
+                return;
+            }
+        }
+    }
+}
+
+static void client_event(event_handler_t *h, unsigned int events) {
+    conn_t *c = conn_of(h, offsetof(conn_t, cev));
+
+    if (c->state == CONN_REQUEST) {
+        conn_read_request(c);
+        return;
+    }
+    if (c->state >= CONN_OFFLOAD) return;
+    if (events & (EPOLLERR | EPOLLHUP)) conn_client_gone(c);
+    else if (events & EPOLLOUT) conn_flush(c);
+    conn_client_ready(c);
+}
+
+static void server_event(event_handler_t *h, unsigned int events) {
+    conn_t *c = conn_of(h, offsetof(conn_t, sev));
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    switch (c->state) {
+    case CONN_CONNECT:
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return;
+        if (getsockopt(c->serverfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+            event_del(&c->rx->loop, &c->sev);       // 이 주소는 실패, 다음 주소로
+            Close(c->serverfd);
+            c->serverfd = -1;
+            conn_connect(c);
+            return;
+        }
+        origin_ok(c->hostname, c->port);
+        c->active = time(NULL);
+        c->state = CONN_FORWARD;
+        conn_forward(c);
+        break;
+    case CONN_FORWARD:
+        conn_forward(c);
+        break;
+    case CONN_RELAY:
+        conn_relay(c);
+        break;
+    }
+}
+
+/* 연결 구조체 (루프의 여분이 있으면 다시 씀) */
+static conn_t *conn_new(reactor_t *rx) {
+    conn_t *c;
+
+    if ((c = rx->spare) != NULL) {
+        rx->spare = c->done_next;
+        rx->nspare--;
+    } else {
+        c = Malloc(sizeof(conn_t));
+        c->out = NULL;
+        c->out_cap = 0;
+        c->chunk = NULL;
+    }
+    memset(c, 0, offsetof(conn_t, state) + sizeof(c->state));
+    c->rq.hdrs[0] = '\0';
+    c->rq.recorded = 0;
+    c->relay.llen = 0;
+    return c;
+}
+
+/* 수락한 연결을 루프에 등록 (읽을 것이 이미 있으면 등록하자마자 이벤트) */
+void conn_accept(int clientfd, reactor_t *rx) {
+    conn_t *c = conn_new(rx);
+
+    c->rx = rx;
+    c->clientfd = clientfd;
+    c->serverfd = -1;
+    c->state = CONN_REQUEST;
+    c->cev.fn = client_event;
+    c->sev.fn = server_event;
+    c->sev.fd = -1;
+    c->rop.done = conn_ring_recv;
+    c->lrecv.done = conn_ring_linked;
+    c->lsend.done = conn_ring_sent;
+    if (event_add(&rx->loop, clientfd, &c->cev) < 0) {
+        Close(clientfd);
+        conn_free(c);
+    }
+}
+
+/* 리스닝 소켓에 연결이 옴: 밀린 연결을 EAGAIN까지 수락
+ * - fd가 모자라면(EMFILE 등) 이번 묶음은 그만두고, 남은 연결은 다음 연결이 올 때 받음
+ */
+void listen_event(event_handler_t *h, unsigned int events) {
+    reactor_t *rx = (reactor_t *)((char *)h - offsetof(reactor_t, lev));
+    struct sockaddr_storage addr;
+    socklen_t len;
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    int fd;
+
+    while (1) {
+        len = sizeof(addr);
+        if ((fd = accept(rx->listenfd, (SA *)&addr, &len)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return;
+        }
+        event_nonblock(fd, 1);
+
+        /* 접속자의 주소와 포트를 문자열로 얻어 로그 출력 (루프 안이라 역방향 조회는 안 함) */
+        if (getnameinfo((SA *)&addr, len, host, sizeof(host), port, sizeof(port),
+                        NI_NUMERICHOST | NI_NUMERICSERV) == 0)
+            printf("PROXY : Accepted connection from (%s, %s)\n", host, port);
+        conn_accept(fd, rx);
+    }
+}
+
+/* io_uring 다중 샷 accept 완료 (res는 이미 논블로킹인 새 fd)
+ * - 커널이 다중 샷을 끝냈으면 다시 검. 실패로 끝났으면(EMFILE 등) 바로 다시 걸면
+ *   곧장 또 실패하므로 다음 마감 검사 때
+ */
+void accept_done(event_op_t *op, int res, char *buf) {
+    reactor_t *rx = (reactor_t *)((char *)op - offsetof(reactor_t, aop));
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+
+    if (res >= 0) {
+        if (getpeername(res, (SA *)&addr, &len) == 0 &&
+            getnameinfo((SA *)&addr, len, host, sizeof(host), port, sizeof(port),
+                        NI_NUMERICHOST | NI_NUMERICSERV) == 0)
+            printf("PROXY : Accepted connection from (%s, %s)\n", host, port);
+        conn_accept(res, rx);
+    }
+    if (op->busy == 0) {
+        if (res >= 0) event_accept(&rx->loop, rx->listenfd, op);
+        else rx->accept_retry = 1;
+    }
+}
+
+/* 묶음 처리 뒤: 1초마다 원 서버 마감 검사, 넘길 연결은 워커 큐로, 닫은 연결은 해제
+ * - 클라이언트가 못 따라와 읽기를 멈춘 연결은 원 서버 탓이 아니므로 마감을 미룸
+ *   (io_uring에서 send가 걸려 있는 것도 같음)
+ * - io_uring에서 아직 올 완료가 남은 연결은 draining에 두었다가 다 오면 넘기거나 해제
+ */
+static void reactor_after(event_loop_t *l, time_t now) {
+    reactor_t *rx = l->arg;
+    conn_t *c, *next, **pp;
+
+    if (now != rx->swept) {
+        rx->swept = now;
+        for (c = rx->waiting; c; c = next) {
+            next = c->next;
+            if ((c->state == CONN_RELAY && (c->out_len - c->out_off > CONN_OUT_HIGH || c->lsend.busy)) ||
+                (c->state == CONN_FOLLOW && c->follow_full))
+                c->active = now;
+            else if (now - c->active >= (c->state == CONN_FOLLOW ? CACHE_FLIGHT_TIMEOUT : origin_timeout))
+                conn_timeout(c);
+        }
+        if (rx->accept_retry) {
+            rx->accept_retry = 0;
+            event_accept(l, rx->listenfd, &rx->aop);
+        }
+    }
+    for (pp = &rx->draining; (c = *pp) != NULL; ) {
+        if (conn_busy(c)) {
+            pp = &c->done_next;
+        } else {
+            *pp = c->done_next;
+            c->done_next = rx->done;
+            rx->done = c;
+        }
+    }
+    while ((c = rx->done) != NULL) {
+        rx->done = c->done_next;
+        if (conn_busy(c)) {
+            c->done_next = rx->draining;
+            rx->draining = c;
+        } else if (c->state == CONN_OFFLOAD) {
+            subf_insert(&sbuf, c);
+        } else if (rx->nspare < REACTOR_SPARE) {
+            if (c->out_cap > 2 * CONN_OUT_HIGH) {   // 큰 캐시 적중으로 커진 출력 버퍼는 돌려줌
+                Free(c->out);
+                c->out = NULL;
+                c->out_cap = 0;
+            }
+            c->done_next = rx->spare;
+            rx->spare = c;
+            rx->nspare++;
+        } else {
+            conn_free(c);
+        }
+    }
+}
+
+/* 루프를 코어에 고정하고 돌림 (돌아오지 않음) */
+void reactor_run(reactor_t *rx) {
+    event_pin(rx->cpu);
+    rx->loop.after = reactor_after;
+    rx->loop.arg = rx;
+    event_loop_run(&rx->loop);
+}
+
+/* event_wake 훅: 다른 스레드가 돌려보낸 연결을 이어서 진행
+ * - 목록을 통째로 가져오되 post_pending은 하나씩 처리할 때 내림. 그 전에는 알림이
+ *   와도 다시 엮지 않으므로, 처리하는 동안 새로 돌려보낸 연결은 다음 깨움으로 감
+ */
+void reactor_wake(event_loop_t *l) {
+    reactor_t *rx = l->arg;
+    conn_t *c, *next;
+
+    pthread_mutex_lock(&rx->post_mutex);
+    c = rx->posted;
+    rx->posted = NULL;
+    pthread_mutex_unlock(&rx->post_mutex);
+    for (; c; c = next) {
+        pthread_mutex_lock(&rx->post_mutex);
+        next = c->post_next;
+        c->post_pending = 0;
+        pthread_mutex_unlock(&rx->post_mutex);
+        if (c->state == CONN_RESOLVE) conn_resolved(c);
+        else if (c->state == CONN_FOLLOW) conn_follow(c);
+    }
+}
+
+/* 이름 풀이 스레드: 대기열에서 연결을 꺼내 getaddrinfo 한 뒤 그 연결의 루프로 돌려보냄
+ * - 느린 DNS는 몇 초씩 걸리므로 루프 대신 여기서 기다림
+ * - 기다리는 동안 연결은 루프가 건드리지 않으므로(RESOLVE) 잠금 없이 결과를 씀
+ */
+void *resolver_thread(void *vargp) {
+    struct addrinfo hints;
+    conn_t *c;
+
+    pthread_detach(pthread_self());
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+    while (1) {
+        pthread_mutex_lock(&resq.mutex);
+        while (!resq.head) pthread_cond_wait(&resq.items, &resq.mutex);
+        c = resq.head;
+        if ((resq.head = c->post_next) == NULL) resq.tail = NULL;
+        pthread_mutex_unlock(&resq.mutex);
+
+        if (getaddrinfo(c->hostname, c->port, &hints, &c->addrs) != 0) c->addrs = NULL;
+
+        conn_post(c);
+    }
+    return NULL;
+}
+
+/* 이벤트 루프 스레드 */
+void *reactor_thread(void *vargp) {
+    pthread_detach(pthread_self());
+    reactor_run(vargp);
+    return NULL;
+}
+
+/* 워커 덱 초기화 (덱은 차면 커지므로 크기 제한이 없음) */
+void subf_init(sbuf_t *sp, int nloops) {
+  sp->nloops = nloops;
+  sp->q = Calloc(NTHREADS * nloops, sizeof(work_queue_t));
+  for (int i = 0; i < NTHREADS * nloops; i++)
+    deque_init(&sp->q[i].dq, WORK_DEQUE);
+  atomic_init(&sp->idle, 0);
+  pthread_mutex_init(&sp->mutex, NULL);   // mutex 초기화
+  pthread_cond_init(&sp->items, NULL);    // 잠든 워커를 깨울 조건 변수 초기화
+}
+
+/* 넘긴 연결을 루프의 다음 차례 워커 몫에 추가 (이벤트 루프가 부르므로 기다리지 않음)
+ * - 덱에 넣은 뒤 잠든 워커 수를 읽음. 잠들려는 워커는 수를 올린 뒤 덱을 다시 보므로
+ *   (둘 다 seq_cst) 넣은 연결을 워커가 보거나 루프가 잠든 워커를 보거나 둘 중 하나는 일어남
+ */
+void subf_insert(sbuf_t *sp, conn_t *c) {
+  reactor_t *rx = c->rx;
+  work_queue_t *q = &sp->q[rx->next_worker * sp->nloops + (rx - reactors)];
+  long depth;
+
+  rx->next_worker = (rx->next_worker + 1) % NTHREADS;
+  deque_push(&q->dq, c);
+  q->pushed++;
+  if ((depth = deque_size(&q->dq)) > q->max_depth) q->max_depth = depth;
+
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load(&sp->idle) > 0) {
+    pthread_mutex_lock(&sp->mutex);
+    pthread_cond_signal(&sp->items);                // 잠든 worker thread에게 작업이 생겼음을 알림
+    pthread_mutex_unlock(&sp->mutex);
+  }
+}
+
+/* 워커 w의 몫부터, 비었으면 다음 워커들의 몫에서 하나 꺼냄
+ * - 경쟁에서 지면(DEQUE_ABORT) 남은 연결이 있을 수 있으므로 같은 덱을 다시 봄
+ * 반환값: 꺼낸 연결, 모든 덱이 비어 있었으면 NULL (그때만 잠들어도 됨)
+ */
+static conn_t *subf_take(sbuf_t *sp, int w) {
+  conn_t *c;
+
+  for (int i = 0; i < NTHREADS; i++) {
+    work_queue_t *q = &sp->q[((w + i) % NTHREADS) * sp->nloops];
+    for (int r = 0; r < sp->nloops; r++) {
+      while ((c = deque_steal(&q[r].dq)) == DEQUE_ABORT)
+        ;                                           // 진 만큼 다른 워커가 가져갔으니 곧 끝남
+      if (c != NULL) {
+        sp->stat[w].ran++;
+        if (i > 0) sp->stat[w].stolen++;
+        return c;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* 워커 w가 넘긴 연결을 꺼내어 반환하며, 모든 덱이 비어 있으면 연결이 들어올 때까지 대기 */
+conn_t *subf_remove(sbuf_t *sp, int w) {
+  conn_t *c;
+
+  if ((c = subf_take(sp, w)) != NULL) return c;   // 바쁠 때는 잠금 없이 끝남
+
+  pthread_mutex_lock(&sp->mutex);
+  atomic_fetch_add(&sp->idle, 1);                   // 잠들 것을 알린 뒤 다시 확인
+  while ((c = subf_take(sp, w)) == NULL) {
+    pthread_cond_wait(&sp->items, &sp->mutex);      // 연결이 들어올 때까지 대기
+  }
+  atomic_fetch_sub(&sp->idle, 1);
+  pthread_mutex_unlock(&sp->mutex);
+
+  return c;
+}
+
+/* 
+  이벤트 루프가 넘긴 연결을 블로킹으로 처리하는 worker Thread의 작업 루틴 함수
+  메인 함수에서 스레드 생성 시 이 함수를 루틴으로 등록하여 각 스레드가 요청을 처리하도록 한다.
+  인자는 워커 번호 (자기 몫 덱과 통계 자리)
+*/
+void *thread(void *vargp) {
+  int w = (int)(long)vargp;
+
+  pthread_detach(pthread_self());
+
+  while (1) {
+    conn_t *c = subf_remove(&sbuf, w);              // 작업 꺼냄
+    event_nonblock(c->clientfd, 0);                 // 워커는 블로킹 입출력
+    if (c->offload == OFFLOAD_REQUEST)
+      doit(c->clientfd, &c->rq);                    // 요청 처리
+    else                                            // 원 서버 오류 응답 (flight는 루프가 이미 끝냄)
+      origin_error(c->clientfd, c->hostname, &c->key, c->is_get, NULL, c->timed_out);
+    close(c->clientfd);                             // 소켓 닫기
+    conn_free(c);
+  }
+}
+
+/* 요청 헤더에서 Vary 명세(spec)에 든 헤더 줄만 골라 out에 모음 */
+static void vary_request_headers(const char *spec, const char *hdrs, char *out, size_t size) {
+    const char *line, *eol, *name;
+    size_t len = 0, nlen, tlen;
+
+    out[0] = '\0';
+    for (line = hdrs; *line; line = eol) {
+        eol = strchr(line, '\n');
+        eol = eol ? eol + 1 : line + strlen(line);
+        nlen = strcspn(line, ":\n");
+        for (name = spec; *name; name += tlen + (name[tlen] == ',')) {
+            tlen = strcspn(name, ",");
+            if (tlen == nlen && !strncasecmp(line, name, nlen) && len + (eol - line) < size) {
+                memcpy(out + len, line, eol - line);
+                len += eol - line;
+                out[len] = '\0';
+                break;
+            }
+        }
+    }
+}
+
+/* 만료된 사본을 보낸 뒤 갱신 작업을 대기열에 넣음
+ * - 같은 키가 이미 대기 중이거나 처리 중이면 넣지 않음 (키당 원 서버 요청 하나)
+ * - 대기열이 가득 차면 버림. 다음 요청이 다시 시도함
+ * - 변형 키면 Vary에 든 요청 헤더만 같이 보관해 같은 변형을 다시 받아 옴
+ */
+void refresh_enqueue(const cache_key_t *key, const char *hostname, const char *port,
+                     const char *path, const char *hdrs, const cache_validators_t *val) {
+  refresh_job_t *j;
+
+  pthread_mutex_lock(&rq.mutex);
+  if (rq.n >= REFRESH_QMAX || (rq.busy && !strcmp(rq.busy->key.str, key->str))) {
+    pthread_mutex_unlock(&rq.mutex);
+    return;
+  }
+  for (j = rq.head; j; j = j->next) {
+    if (!strcmp(j->key.str, key->str)) {
+      pthread_mutex_unlock(&rq.mutex);
+      return;
+    }
+  }
+  j = Malloc(sizeof(*j));
+  j->next = NULL;
+  j->key = *key;
+  vary_request_headers(key->vary, hdrs, j->hdrs, sizeof(j->hdrs));
+  strcpy(j->hostname, hostname);
+  strcpy(j->port, port);
+  strcpy(j->path, path);
+  j->val = *val;
+  if (rq.tail) rq.tail->next = j; else rq.head = j;
+  rq.tail = j;
+  rq.n++;
+  pthread_cond_signal(&rq.items);
+  pthread_mutex_unlock(&rq.mutex);
+}
+
+/* 갱신 작업 하나 처리: 클라이언트 없이 doit의 재검증 경로를 그대로 밟음
+ * - flight leader가 되어야만 진행 (이미 누가 가져오는 중이거나 그새 신선해졌으면 생략)
+ * - 검증자가 있으면 조건부 요청, 304면 만료 시각만 갱신, 200이면 새 응답으로 교체
+ * - 연결 실패 등은 조용히 포기하고 만료된 사본을 그대로 둠 (실패는 doit과 같이 기억)
+ */
+static void refresh_one(refresh_job_t *j) {
+  cache_flight_t *flight;
+  int serverfd, status, cached = 0, revalidate;
+  int role = cache_flight_begin(&j->key, &flight);
+
+  if (role != FLIGHT_LEADER) {
+    if (role == FLIGHT_FOLLOWER) cache_flight_release(flight);
+    return;
+  }
+  if (origin_failed(j->hostname, j->port)) {
+    cache_flight_end(flight, FLIGHT_ERROR);
+    return;
+  }
+  if ((serverfd = open_clientfd(j->hostname, j->port)) < 0) {
+    origin_fail(j->hostname, j->port, serverfd == -2 ? ORIGIN_DNS : ORIGIN_CONNECT);
+    cache_flight_end(flight, FLIGHT_ERROR);
+    return;
+  }
+  origin_ok(j->hostname, j->port);
+  set_origin_deadline(serverfd);
+  revalidate = j->val.etag[0] || j->val.last_mod[0];
+  forward_request_headers(j->hdrs, serverfd, j->hostname, j->port, "GET", j->path,
+                          revalidate ? &j->val : NULL);
+  flight->fill.vary = j->key.vary;
+  flight->fill.key = &j->key;
+  status = relay_response(serverfd, -1, &flight->fill, revalidate ? RELAY_REVALIDATE : 0);
+  if (cache_status_storable(status) && strcmp(flight->fill.meta.vary, j->key.vary))
+    cache_vary_learn(&j->key, flight->fill.meta.vary);
+  if (revalidate && status == 304)
+    cached = cache_refresh(&j->key, &flight->fill.meta);
+  else if (flight->fill.ok && flight->fill.hdr_len > 0)
+    cached = flight->fill.seg_total ||
+             cache_insert(&j->key, flight->fill.buf, flight->fill.hdr_len,
+                          flight->fill.len, &flight->fill.meta);
+  cache_flight_end(flight, cached ? FLIGHT_DONE : (status == 0 || status >= 500) ? FLIGHT_ERROR : FLIGHT_FAILED);
+  Close(serverfd);
+}
+
+/* stale-while-revalidate 갱신 전용 스레드: 대기열에서 하나씩 꺼내 처리 */
+void *refresh_thread(void *vargp) {
+  refresh_job_t *j;
+
+  pthread_detach(pthread_self());
+  while (1) {
+    pthread_mutex_lock(&rq.mutex);
+    while (rq.head == NULL)
+      pthread_cond_wait(&rq.items, &rq.mutex);
+    j = rq.head;
+    if ((rq.head = j->next) == NULL) rq.tail = NULL;
+    rq.n--;
+    rq.busy = j;
+    pthread_mutex_unlock(&rq.mutex);
+
+    refresh_one(j);
+
+    pthread_mutex_lock(&rq.mutex);
+    rq.busy = NULL;
+    pthread_mutex_unlock(&rq.mutex);
+    Free(j);
+  }
+  return NULL;
+}
+
+/* 스냅샷 스레드: snapshot_interval마다, 그리고 SIGTERM/SIGINT를 받으면 스냅샷을 쓰고 종료
+ * - 다른 스레드는 모두 이 시그널을 막아 두었으므로 sigtimedwait로 동기적으로 받음
+ * - 쓰기는 fork한 자식이 하므로 워커는 그동안에도 요청을 처리
+ */
+void *snapshot_thread(void *vargp) {
+  sigset_t *stop = vargp;
+  struct timespec ts = { snapshot_interval, 0 };
+  int sig;
+
+  pthread_detach(pthread_self());
+  while (1) {
+    if (snapshot_interval > 0) sig = sigtimedwait(stop, NULL, &ts);
+    else sigwait(stop, &sig);
+    if (sig < 0 && errno != EAGAIN) continue;    // EINTR
+    if (snapshot_save(snapshot_path) < 0)
+      fprintf(stderr, "snapshot to %s failed\n", snapshot_path);
+    if (sig > 0) exit(0);
+  }
+  return NULL;
+}
+
+/* SIGUSR1 핸들러: 캐시 통계와 워커별 대기열 통계를 표준출력으로 출력
+ * - 정책별 적중률을 같은 트래픽에서 비교할 때 사용
+ * - 스레드별 카운터를 읽기만 하고 sio로 출력하므로 시그널 안전
+ */
+void sigusr1_handler(int sig) {
+  int olderrno = errno;
+  cache_stats_t st;
+  unsigned long lookups;
+
+  cache_get_stats(&st);
+  lookups = st.hits + st.misses + st.stale;
+  Sio_puts("PROXY : cache policy=");
+  Sio_puts((char *)cache_policy_name());
+  Sio_puts(" hits=");
+  Sio_putl(st.hits);
+  Sio_puts(" misses=");
+  Sio_putl(st.misses);
+  Sio_puts(" stale=");
+  Sio_putl(st.stale);
+  Sio_puts(" hit%=");
+  Sio_putl(lookups ? (long)(st.hits * 100 / lookups) : 0);
+  Sio_puts(" revalidated=");
+  Sio_putl(st.revalidated);
+  Sio_puts(" inserts=");
+  Sio_putl(st.inserts);
+  Sio_puts(" evictions=");
+  Sio_putl(st.evictions);
+  Sio_puts(" collapsed=");
+  Sio_putl(st.collapsed);
+  Sio_puts(" admission=");
+  Sio_puts((char *)cache_admission_name());
+  Sio_puts(" admitted=");
+  Sio_putl(st.admitted);
+  Sio_puts(" rejected=");
+  Sio_putl(st.rejected);
+  Sio_puts(" purged=");
+  Sio_putl(st.purged);
+  Sio_puts(" bytes=");
+  Sio_putl(cache_bytes());
+  Sio_puts("\n");
+  if (st.seg_hits || st.seg_fills) {
+    Sio_puts("PROXY : segment hits=");
+    Sio_putl(st.seg_hits);
+    Sio_puts(" fills=");
+    Sio_putl(st.seg_fills);
+    Sio_puts("\n");
+  }
+  if (st.warm_hits) {
+    Sio_puts("PROXY : warm hits=");
+    Sio_putl(st.warm_hits);
+    Sio_puts("\n");
+  }
+  if (disk_enabled()) {
+    disk_stats_t ds;
+    disk_get_stats(&ds);
+    Sio_puts("PROXY : disk hits=");
+    Sio_putl(st.disk_hits);
+    Sio_puts(" demotions=");
+    Sio_putl(st.demotions);
+    Sio_puts(" objects=");
+    Sio_putl(ds.objects);
+    Sio_puts(" segments=");
+    Sio_putl(ds.segments);
+    Sio_puts(" used=");
+    Sio_putl(ds.used);
+    Sio_puts(" live=");
+    Sio_putl(ds.live);
+    Sio_puts(" compactions=");
+    Sio_putl(ds.compactions);
+    Sio_puts(" dropped=");
+    Sio_putl(ds.dropped);
+    Sio_puts("\n");
+  }
+  for (int i = 0; i < CACHE_ORIGINS; i++) {
+    const char *host;
+    size_t used, quota;
+    if (!cache_origin_stat(i, &host, &used, &quota) || (i == 0 && !used)) continue;
+    Sio_puts("PROXY : origin ");
+    Sio_puts((char *)host);
+    Sio_puts(" used=");
+    Sio_putl(used);
+    Sio_puts(" quota=");
+    Sio_putl(quota);
+    Sio_puts("\n");
+  }
+  for (int w = 0; sbuf.q && w < NTHREADS; w++) {  // 워커별 부하: 몫으로 들어온 수, 대기 깊이, 처리 / 훔친 수
+    long pushed = 0, depth = 0, max_depth = 0;
+    for (int r = 0; r < sbuf.nloops; r++) {
+      work_queue_t *q = &sbuf.q[w * sbuf.nloops + r];
+      pushed += q->pushed;
+      depth += deque_size(&q->dq);
+      if (q->max_depth > max_depth) max_depth = q->max_depth;
+    }
+    Sio_puts("PROXY : worker ");
+    Sio_putl(w);
+    Sio_puts(" pushed=");
+    Sio_putl(pushed);
+    Sio_puts(" depth=");
+    Sio_putl(depth);
+    Sio_puts(" max_depth=");
+    Sio_putl(max_depth);
+    Sio_puts(" ran=");
+    Sio_putl(sbuf.stat[w].ran);
+    Sio_puts(" stolen=");
+    Sio_putl(sbuf.stat[w].stolen);
+    Sio_puts("\n");
+  }
+  errno = olderrno;
+}
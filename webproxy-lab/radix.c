@@ -0,0 +1,238 @@
+/*
+ * radix.c - 캐시 키 radix tree 구현
+ *
+ * 노드는 [노드 | 간선 문자열] 한 블록. 형제는 단일 연결 리스트로 잇는다
+ * (키 글자 종류가 적고 삽입/삭제만 트리를 만지므로 배열 대신 리스트).
+ * 루트는 노드가 아니라 샤드의 최상위 리스트(top)이고, 루트가 아닌 중간 노드는
+ * 잎이 아니면 자식이 둘 이상이다. 삭제로 이 조건이 깨지면 자식과 합친다.
+ */
+#include "csapp.h"
+#include "radix.h"
+
+typedef struct radix_node {
+  struct radix_node *child;         // 첫 자식
+  struct radix_node *sibling;       // 다음 형제
+  unsigned long hash;               // 잎이면 키 해시
+  unsigned char tiers;              // 키를 들고 있는 계층 비트, 0이면 잎이 아님
+  unsigned short len;               // 간선 문자열 길이 (키는 MAXLINE 미만)
+  char label[];
+} radix_node_t;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  radix_node_t *top;                // 최상위 노드 리스트
+  unsigned long keys;               // 잎 수
+} __attribute__((aligned(64))) radix_shard_t;
+
+static radix_shard_t shards[RADIX_NSHARDS] = {
+  [0 ... RADIX_NSHARDS - 1] = { .mutex = PTHREAD_MUTEX_INITIALIZER }
+};
+
+/* 키의 호스트 부분(첫 '/' 앞)으로 샤드를 고름 */
+static radix_shard_t *shard_of(const char *key) {
+  unsigned long h = 1469598103934665603UL;
+
+  for (; *key && *key != '/'; key++) h = (h ^ (unsigned char)*key) * 1099511628211UL;
+  return &shards[h % RADIX_NSHARDS];
+}
+
+/* 간선 문자열이 a[0..an) + b[0..bn)인 노드 */
+static radix_node_t *node_new(const char *a, size_t an, const char *b, size_t bn) {
+  radix_node_t *n = Malloc(sizeof(*n) + an + bn + 1);
+
+  n->child = n->sibling = NULL;
+  n->hash = 0;
+  n->tiers = 0;
+  n->len = (unsigned short)(an + bn);
+  memcpy(n->label, a, an);
+  memcpy(n->label + an, b, bn);
+  n->label[an + bn] = '\0';
+  return n;
+}
+
+/* 리스트 *pp에서 첫 글자가 c인 노드를 가리키는 칸 (없으면 끝 칸) */
+static radix_node_t **find_child(radix_node_t **pp, char c) {
+  while (*pp && (*pp)->label[0] != c) pp = &(*pp)->sibling;
+  return pp;
+}
+
+/* 간선 문자열과 s가 앞에서부터 같은 길이 */
+static size_t common(const radix_node_t *n, const char *s) {
+  size_t m = 0;
+  while (m < n->len && s[m] == n->label[m]) m++;
+  return m;
+}
+
+/* *pp 노드가 잎이 아니고 자식이 하나뿐이면 자식과 합침 */
+static void merge(radix_node_t **pp) {
+  radix_node_t *p = *pp, *c, *q;
+
+  if (!p || p->tiers || !(c = p->child) || c->sibling) return;
+  q = node_new(p->label, p->len, c->label, c->len);
+  q->child = c->child;
+  q->sibling = p->sibling;
+  q->hash = c->hash;
+  q->tiers = c->tiers;
+  *pp = q;
+  Free(p);
+  Free(c);
+}
+
+/* key를 tier 계층이 들고 있다고 기록 (이미 있으면 비트만 더함) */
+void radix_add(const char *key, unsigned long hash, int tier) {
+  radix_shard_t *sh = shard_of(key);
+  radix_node_t **pp = &sh->top, *n, *mid;
+  size_t m;
+
+  if (!*key) return;
+  pthread_mutex_lock(&sh->mutex);
+  while (1) {
+    pp = find_child(pp, *key);
+    if ((n = *pp) == NULL) {
+      n = node_new(key, strlen(key), "", 0);
+      *pp = n;
+      break;
+    }
+    if ((m = common(n, key)) < n->len) {
+      /* 간선 중간에서 갈라짐: 앞부분을 새 중간 노드로 떼어 냄 */
+      mid = node_new(n->label, m, "", 0);
+      mid->sibling = n->sibling;
+      mid->child = n;
+      n->sibling = NULL;
+      memmove(n->label, n->label + m, n->len - m + 1);
+      n->len -= m;
+      *pp = n = mid;
+    }
+    if (!*(key += m)) break;
+    pp = &n->child;
+  }
+  if (!n->tiers) sh->keys++;
+  n->tiers |= tier;
+  n->hash = hash;
+  pthread_mutex_unlock(&sh->mutex);
+}
+
+/* key를 tier 계층이 더 이상 들고 있지 않다고 기록 (비트가 모두 빠지면 잎을 지움) */
+void radix_del(const char *key, int tier) {
+  radix_shard_t *sh = shard_of(key);
+  radix_node_t **pp = &sh->top, **parent = NULL, *n;
+
+  if (!*key) return;
+  pthread_mutex_lock(&sh->mutex);
+  while (1) {
+    pp = find_child(pp, *key);
+    if ((n = *pp) == NULL || strncmp(n->label, key, n->len)) goto out;
+    if (!*(key += n->len)) break;
+    parent = pp;
+    pp = &n->child;
+  }
+  if (!(n->tiers & tier)) goto out;
+  if ((n->tiers &= ~tier) != 0) goto out;
+  sh->keys--;
+  if (n->child) {
+    merge(pp);                              // 자식이 하나면 합치고, 둘 이상이면 중간 노드로 남김
+  } else {
+    *pp = n->sibling;
+    Free(n);
+    if (parent) merge(parent);              // 부모가 자식 하나짜리 중간 노드가 되었을 수 있음
+  }
+out:
+  pthread_mutex_unlock(&sh->mutex);
+}
+
+/* 결과 배열에 키 하나를 덧붙임 */
+static void push(radix_match_t **out, int *n, int *cap, const char *key, size_t len,
+                 unsigned long hash) {
+  if (*n == *cap) {
+    *cap = *cap ? *cap * 2 : 16;
+    *out = Realloc(*out, *cap * sizeof(**out));
+  }
+  (*out)[*n].key = Malloc(len + 1);
+  memcpy((*out)[*n].key, key, len);
+  (*out)[*n].key[len] = '\0';
+  (*out)[*n].hash = hash;
+  (*n)++;
+}
+
+/* n과 그 아래의 잎을 모두 모음 (buf[0..len)은 n 앞까지의 키) */
+static void collect(const radix_node_t *n, char *buf, size_t len,
+                    radix_match_t **out, int *cnt, int *cap) {
+  memcpy(buf + len, n->label, n->len);
+  if (n->tiers) push(out, cnt, cap, buf, len + n->len, n->hash);
+  for (const radix_node_t *c = n->child; c; c = c->sibling)
+    collect(c, buf, len + n->len, out, cnt, cap);
+}
+
+/* 샤드 하나에서 prefix에 맞는 키를 모음 (샤드 mutex를 잡은 상태에서 호출) */
+static void match_shard(radix_shard_t *sh, const char *prefix, int exact,
+                        radix_match_t **out, int *cnt, int *cap) {
+  char buf[MAXLINE];
+  const char *rest = prefix;
+  radix_node_t *n, *c;
+  size_t m;
+
+  if (!*rest) {
+    if (!exact)
+      for (n = sh->top; n; n = n->sibling) collect(n, buf, 0, out, cnt, cap);
+    return;
+  }
+  for (n = *find_child(&sh->top, *rest); n; n = *find_child(&n->child, *rest)) {
+    m = common(n, rest);
+    if (!rest[m]) break;                    // 접두사가 이 간선 안(또는 끝)에서 끝남
+    if (m < n->len) return;
+    rest += m;
+  }
+  if (!n) return;
+  memcpy(buf, prefix, rest - prefix);
+  if (!exact) {
+    collect(n, buf, rest - prefix, out, cnt, cap);    // 간선 전체가 접두사로 시작하므로 n 아래 전부
+    return;
+  }
+  /* Vary 변형 키("키\n값...")도 같은 URL이므로 함께 */
+  if (m < n->len) {
+    if (n->label[m] == '\n') collect(n, buf, rest - prefix, out, cnt, cap);
+    return;
+  }
+  memcpy(buf + (rest - prefix), n->label, n->len);
+  if (n->tiers) push(out, cnt, cap, buf, (rest - prefix) + n->len, n->hash);
+  if ((c = *find_child(&n->child, '\n')) != NULL)
+    collect(c, buf, (rest - prefix) + n->len, out, cnt, cap);
+}
+
+/* prefix로 시작하는 키(exact면 prefix와 같은 키와 그 Vary 변형)를 모음
+ * - *out에 키 사본 배열을 돌려주며 radix_match_free로 해제
+ * - 호스트가 들어 있는 접두사('/'가 있음)면 그 호스트의 샤드 하나만 봄
+ * 반환값: 모은 키 수
+ */
+int radix_match(const char *prefix, int exact, radix_match_t **out) {
+  int cnt = 0, cap = 0;
+
+  *out = NULL;
+  for (int i = 0; i < RADIX_NSHARDS; i++) {
+    radix_shard_t *sh = strchr(prefix, '/') ? shard_of(prefix) : &shards[i];
+    pthread_mutex_lock(&sh->mutex);
+    match_shard(sh, prefix, exact, out, &cnt, &cap);
+    pthread_mutex_unlock(&sh->mutex);
+    if (strchr(prefix, '/')) break;
+  }
+  return cnt;
+}
+
+void radix_match_free(radix_match_t *m, int n) {
+  for (int i = 0; i < n; i++) Free(m[i].key);
+  Free(m);
+}
+
+/* 트리에 든 키 수 (비동기 시그널 안전: 잠금 없이 읽기만 함) */
+unsigned long radix_keys(void) {
+  unsigned long n = 0;
+  for (int i = 0; i < RADIX_NSHARDS; i++) n += shards[i].keys;
+  return n;
+}
+
+/* 키 하나가 트리에 더할 수 있는 최대 바이트
+ * 삽입은 잎 하나와 (간선이 갈라지면) 중간 노드 하나를 만들고, 두 간선 문자열은
+ * 키의 서로 다른 부분이므로 합쳐도 키 길이를 넘지 않음 */
+size_t radix_footprint(size_t klen) {
+  return 2 * (sizeof(radix_node_t) + 1 + RADIX_MALLOC_OVERHEAD) + klen;
+}
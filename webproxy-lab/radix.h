@@ -0,0 +1,43 @@
+/*
+ * radix.h - 캐시 키 radix tree (접두사 무효화용 색인)
+ *
+ * PURGE가 "host/img/" 같은 접두사로 시작하는 키를 지울 때 캐시 전체를 훑지 않도록,
+ * 어느 계층에든 들어 있는 정규화된 키를 압축 radix tree(간선에 문자열)로 모아 둔다.
+ *
+ * - 잎마다 키를 들고 있는 계층(RAM, 디스크, 스냅샷)을 비트로 기억하고,
+ *   마지막 비트가 빠지면 잎을 지운다 (자식 하나뿐인 중간 노드는 합쳐 압축 유지)
+ * - 각 계층은 자기 잠금(샤드 mutex, 디스크 색인 mutex) 안에서 비트를 켜고 끄므로
+ *   같은 키에 대한 켜고 끄기 순서가 계층 안에서 어긋나지 않는다
+ * - 트리는 호스트(키의 첫 '/' 앞) 해시로 RADIX_NSHARDS개로 나누고 샤드마다 mutex 하나.
+ *   캐시 조회는 트리를 전혀 보지 않으므로 적중 경로에는 비용이 없다
+ * - radix_match는 접두사 노드까지 내려간 뒤 그 아래만 모으므로 비용이
+ *   (접두사 길이 + 맞은 키 수)에 비례한다. 호스트가 없는 접두사만 모든 샤드를 본다
+ * - 모은 키는 사본으로 돌려주고, 실제 제거는 호출한 쪽이 트리 잠금 밖에서 한다
+ */
+#ifndef __RADIX_H__
+#define __RADIX_H__
+
+#include <stddef.h>
+
+#define RADIX_NSHARDS 16          // 호스트별로 나눈 트리 수
+#define RADIX_MALLOC_OVERHEAD 24  // 노드 하나의 malloc 청크 헤더와 정렬 여유 (glibc 64비트 상한)
+
+/* 키를 들고 있는 계층 (잎의 비트) */
+#define RADIX_RAM 1
+#define RADIX_DISK 2
+#define RADIX_SNAP 4
+
+/* radix_match 결과 한 개 */
+typedef struct {
+  char *key;
+  unsigned long hash;
+} radix_match_t;
+
+void radix_add(const char *key, unsigned long hash, int tier);
+void radix_del(const char *key, int tier);
+int radix_match(const char *prefix, int exact, radix_match_t **out);
+void radix_match_free(radix_match_t *m, int n);
+unsigned long radix_keys(void);
+size_t radix_footprint(size_t klen);
+
+#endif /* __RADIX_H__ */
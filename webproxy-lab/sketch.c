@@ -0,0 +1,106 @@
+/*
+ * sketch.c - TinyLFU 빈도 추정기 구현
+ *
+ * 배치
+ * - 줄마다 64비트 워드 SKETCH_WIDTH/16개, 워드 하나에 4비트 카운터 16개
+ * - doorkeeper는 SKETCH_WIDTH * 4비트짜리 Bloom 필터, sketch와 같은 줄 해시를 씀
+ * - 기록 수는 스레드별로 모았다가 64번마다 전역 카운터에 더함 (공유 라인 RMW를 줄임)
+ */
+#include <stdint.h>
+#include <stdatomic.h>
+#include "sketch.h"
+
+#define WORDS (SKETCH_WIDTH / 16)
+#define DOOR_BITS (SKETCH_WIDTH * 4)
+#define SAMPLE ((unsigned long)SKETCH_WIDTH * SKETCH_SAMPLE_FACTOR)
+#define LOCAL_BATCH 64
+
+static atomic_ulong rows[SKETCH_DEPTH][WORDS];
+static atomic_ulong door[DOOR_BITS / 64];
+static atomic_ulong recorded;               // 마지막 aging 뒤 기록 수 (LOCAL_BATCH 단위)
+static atomic_int resetting;
+static __thread unsigned long local_recorded;
+
+/* 줄 i에서 쓸 카운터 번호 (키 해시를 줄마다 다른 씨앗으로 섞음, splitmix64) */
+static unsigned long row_index(unsigned long hash, int i, unsigned long range) {
+  uint64_t x = hash + (uint64_t)(i + 1) * 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x & (range - 1);
+}
+
+static int door_test_and_set(unsigned long hash) {
+  int present = 1;
+  for (int i = 0; i < SKETCH_DEPTH; i++) {
+    unsigned long b = row_index(hash, i, DOOR_BITS);
+    unsigned long bit = 1UL << (b & 63);
+    if (!(atomic_fetch_or_explicit(&door[b >> 6], bit, memory_order_relaxed) & bit)) present = 0;
+  }
+  return present;
+}
+
+static int door_test(unsigned long hash) {
+  for (int i = 0; i < SKETCH_DEPTH; i++) {
+    unsigned long b = row_index(hash, i, DOOR_BITS);
+    if (!(atomic_load_explicit(&door[b >> 6], memory_order_relaxed) & (1UL << (b & 63))))
+      return 0;
+  }
+  return 1;
+}
+
+/* 카운터 하나를 올림 (상한이면 그대로) */
+static void counter_inc(atomic_ulong *w, int shift) {
+  unsigned long old = atomic_load_explicit(w, memory_order_relaxed);
+  while (((old >> shift) & 0xf) < SKETCH_COUNTER_MAX &&
+         !atomic_compare_exchange_weak_explicit(w, &old, old + (1UL << shift),
+                                                memory_order_relaxed, memory_order_relaxed))
+    ;
+}
+
+/* aging: 모든 카운터를 반으로, doorkeeper는 비움 (한 스레드만 수행) */
+static void sketch_reset(void) {
+  int expected = 0;
+
+  if (!atomic_compare_exchange_strong(&resetting, &expected, 1)) return;
+  for (int i = 0; i < SKETCH_DEPTH; i++) {
+    for (int j = 0; j < WORDS; j++) {
+      unsigned long old = atomic_load_explicit(&rows[i][j], memory_order_relaxed);
+      while (!atomic_compare_exchange_weak_explicit(&rows[i][j], &old,
+                                                    (old >> 1) & 0x7777777777777777UL,
+                                                    memory_order_relaxed, memory_order_relaxed))
+        ;
+    }
+  }
+  for (int j = 0; j < DOOR_BITS / 64; j++)
+    atomic_store_explicit(&door[j], 0, memory_order_relaxed);
+  atomic_store(&recorded, 0);
+  atomic_store(&resetting, 0);
+}
+
+/* 요청 한 번을 기록: 처음 보는 키는 doorkeeper에만, 두 번째부터 sketch에 */
+void sketch_record(unsigned long hash) {
+  if (door_test_and_set(hash)) {
+    for (int i = 0; i < SKETCH_DEPTH; i++) {
+      unsigned long c = row_index(hash, i, SKETCH_WIDTH);
+      counter_inc(&rows[i][c >> 4], (int)(c & 15) * 4);
+    }
+  }
+  if (++local_recorded == LOCAL_BATCH) {
+    local_recorded = 0;
+    if (atomic_fetch_add_explicit(&recorded, LOCAL_BATCH, memory_order_relaxed) + LOCAL_BATCH >= SAMPLE)
+      sketch_reset();
+  }
+}
+
+/* 빈도 추정값: sketch 최솟값 + doorkeeper에 있으면 1 */
+int sketch_estimate(unsigned long hash) {
+  int min = SKETCH_COUNTER_MAX;
+
+  for (int i = 0; i < SKETCH_DEPTH; i++) {
+    unsigned long c = row_index(hash, i, SKETCH_WIDTH);
+    int v = (int)((atomic_load_explicit(&rows[i][c >> 4], memory_order_relaxed) >> ((c & 15) * 4)) & 0xf);
+    if (v < min) min = v;
+  }
+  return min + door_test(hash);
+}
@@ -0,0 +1,23 @@
+/*
+ * sketch.h - TinyLFU 빈도 추정기 (count-min sketch + doorkeeper)
+ *
+ * - 4비트 카운터 SKETCH_DEPTH줄짜리 count-min sketch. 키 해시마다 줄별로 칸 하나씩을
+ *   올리고, 추정값은 그 칸들의 최솟값
+ * - doorkeeper: 한 번만 본 키는 sketch 대신 Bloom 필터에만 남김.
+ *   크롤러가 훑고 가는 한 번짜리 URL이 sketch 카운터를 채우지 않으므로 sketch가 작아도 됨
+ * - 기록이 SKETCH_SAMPLE_FACTOR * 폭만큼 쌓이면 모든 카운터를 반으로 줄이고
+ *   doorkeeper를 비움 (aging): 예전에 뜨거웠던 키가 영원히 이기지 않게 함
+ * - 모든 갱신은 원자 연산이고 잠금이 없음 (동시 갱신에서 한두 번 빠지는 것은 허용)
+ */
+#ifndef __SKETCH_H__
+#define __SKETCH_H__
+
+#define SKETCH_WIDTH 16384          // 줄당 카운터 수 (2의 거듭제곱, 캐시 엔트리 수 정도)
+#define SKETCH_DEPTH 4              // 줄 수 (해시 함수 수)
+#define SKETCH_SAMPLE_FACTOR 10     // 폭의 이 배수만큼 기록하면 aging
+#define SKETCH_COUNTER_MAX 15       // 4비트 카운터 상한
+
+void sketch_record(unsigned long hash);
+int sketch_estimate(unsigned long hash);
+
+#endif /* __SKETCH_H__ */
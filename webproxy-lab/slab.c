@@ -0,0 +1,281 @@
+/*
+ * slab.c - 캐시 페이로드 전용 size-class 슬랩 할당기 구현
+ *
+ * 구성
+ * - span: SLAB_SPAN_SIZE로 정렬된 mmap 영역. 앞부분에 span_t 헤더가 있고
+ *   나머지를 한 클래스 크기의 블록으로 나눠 씀. 블록 주소를 span 크기로
+ *   내림하면 헤더가 나오므로 블록마다 헤더가 필요 없음
+ * - 클래스: mutex 하나와 빈 블록이 남은 span들의 partial 리스트
+ * - magazine: 스레드별, 클래스별 작은 블록 스택. 비거나 넘칠 때만
+ *   클래스 mutex를 잡고 절반씩 주고받음 (큰 클래스는 magazine 없이 바로 클래스로)
+ * - span의 블록이 모두 돌아오면 블록 영역을 madvise(MADV_DONTNEED)로 OS에 반납하고
+ *   빈 span 풀에 보관, 풀이 넘치면 munmap
+ */
+#include <stdatomic.h>
+#include "csapp.h"
+#include "slab.h"
+
+#define SLAB_HDR_SIZE 128                   // span 헤더 자리 (블록 시작 오프셋)
+#define SLAB_MAG_MAX 16                     // magazine 최대 블록 수
+#define SLAB_MAG_BYTES 8192                 // 클래스당 magazine이 쥘 수 있는 최대 바이트
+#define SLAB_POOL_MAX 16                    // 보관할 빈 span 개수
+
+typedef struct span {
+  struct span *prev, *next;                 // partial 리스트 또는 빈 span 풀
+  int cls;                                  // 소속 클래스
+  int nfree;                                // 사용 가능한 블록 수 (freelist + 미사용)
+  int bump;                                 // 한 번도 나가지 않은 첫 블록 인덱스
+  int on_partial;                           // partial 리스트에 있는지
+  void *freelist;                           // 돌아온 블록들 (블록 첫 8바이트로 연결)
+} span_t;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  span_t *partial;                          // 빈 블록이 남은 span
+  size_t size;                              // 블록 크기
+  int nblocks;                              // span당 블록 수
+  int mag_cap;                              // magazine 용량 (0이면 magazine 미사용)
+} slab_class_t;
+
+typedef struct {
+  int n;
+  void *blk[SLAB_MAG_MAX];
+} magazine_t;
+
+static slab_class_t classes[SLAB_NCLASSES];
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_key_t mag_key;               // 스레드 종료 시 magazine 반납용
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static span_t *pool;                        // madvise된 빈 span
+static int npool;
+static atomic_size_t resident;              // 페이지가 살아 있을 수 있는 span 바이트
+
+static __thread magazine_t mags[SLAB_NCLASSES];
+static __thread int mags_registered;
+
+/* 요청 크기 -> 클래스 번호
+ * - 2^k < n <= 2^(k+1) 구간을 2^(k-2) 간격 4칸으로 나눔
+ */
+static int size_class(size_t n) {
+  if (n <= SLAB_MIN_SIZE) return 0;
+  int k = 63 - __builtin_clzl(n - 1);
+  size_t step = (size_t)1 << (k - 2);
+  int sub = (int)((n - 1 - ((size_t)1 << k)) / step);
+  return (k - 6) * 4 + sub + 1;
+}
+
+static size_t class_size(int cls) {
+  if (cls == 0) return SLAB_MIN_SIZE;
+  int k = 6 + (cls - 1) / 4, sub = (cls - 1) % 4;
+  return ((size_t)1 << k) + ((size_t)1 << (k - 2)) * (sub + 1);
+}
+
+static span_t *span_of(void *p) {
+  return (span_t *)((unsigned long)p & ~((unsigned long)SLAB_SPAN_SIZE - 1));
+}
+
+static void mags_flush(void *arg);
+
+static void slab_init(void) {
+  for (int i = 0; i < SLAB_NCLASSES; i++) {
+    slab_class_t *c = &classes[i];
+    pthread_mutex_init(&c->mutex, NULL);
+    c->partial = NULL;
+    c->size = class_size(i);
+    c->nblocks = (int)((SLAB_SPAN_SIZE - SLAB_HDR_SIZE) / c->size);
+    c->mag_cap = (int)(SLAB_MAG_BYTES / c->size);
+    if (c->mag_cap > SLAB_MAG_MAX) c->mag_cap = SLAB_MAG_MAX;
+  }
+  pthread_key_create(&mag_key, mags_flush);
+}
+
+/* SLAB_SPAN_SIZE로 정렬된 span 하나 확보 (풀 우선) */
+static span_t *span_get(void) {
+  span_t *s;
+  char *raw, *aligned;
+
+  pthread_mutex_lock(&pool_mutex);
+  if ((s = pool) != NULL) {
+    pool = s->next;
+    npool--;
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  if (!s) {
+    raw = mmap(NULL, 2 * SLAB_SPAN_SIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    aligned = (char *)(((unsigned long)raw + SLAB_SPAN_SIZE - 1) &
+                       ~((unsigned long)SLAB_SPAN_SIZE - 1));
+    if (aligned > raw) munmap(raw, aligned - raw);
+    munmap(aligned + SLAB_SPAN_SIZE, raw + SLAB_SPAN_SIZE - aligned);
+    s = (span_t *)aligned;
+  }
+  atomic_fetch_add(&resident, SLAB_SPAN_SIZE);
+  return s;
+}
+
+/* 빈 span의 블록 페이지를 OS에 반납하고 풀로 (넘치면 munmap) */
+static void span_put(span_t *s) {
+  char *base = (char *)s;
+  long page = sysconf(_SC_PAGESIZE);
+
+  madvise(base + page, SLAB_SPAN_SIZE - page, MADV_DONTNEED);
+  atomic_fetch_sub(&resident, SLAB_SPAN_SIZE);
+
+  pthread_mutex_lock(&pool_mutex);
+  if (npool < SLAB_POOL_MAX) {
+    s->next = pool;
+    pool = s;
+    npool++;
+    s = NULL;
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  if (s) munmap(base, SLAB_SPAN_SIZE);
+}
+
+/* partial 리스트 조작 (클래스 mutex를 잡은 상태에서 호출) */
+static void partial_push(slab_class_t *c, span_t *s) {
+  s->prev = NULL;
+  s->next = c->partial;
+  if (c->partial) c->partial->prev = s;
+  c->partial = s;
+  s->on_partial = 1;
+}
+
+static void partial_unlink(slab_class_t *c, span_t *s) {
+  if (s->prev) s->prev->next = s->next; else c->partial = s->next;
+  if (s->next) s->next->prev = s->prev;
+  s->prev = s->next = NULL;
+  s->on_partial = 0;
+}
+
+/* 클래스에서 블록을 최대 want개 꺼내 out에 채움
+ * 반환값: 꺼낸 개수 (span 확보 실패 시 want보다 적을 수 있음)
+ */
+static int class_take(int cls, void **out, int want) {
+  slab_class_t *c = &classes[cls];
+  int got = 0;
+
+  pthread_mutex_lock(&c->mutex);
+  while (got < want) {
+    span_t *s = c->partial;
+    if (!s) {
+      if ((s = span_get()) == NULL) break;
+      s->cls = cls;
+      s->nfree = c->nblocks;
+      s->bump = 0;
+      s->freelist = NULL;
+      partial_push(c, s);
+    }
+    if (s->freelist) {
+      out[got] = s->freelist;
+      s->freelist = *(void **)s->freelist;
+    } else {
+      out[got] = (char *)s + SLAB_HDR_SIZE + (size_t)s->bump++ * c->size;
+    }
+    got++;
+    if (--s->nfree == 0) partial_unlink(c, s);
+  }
+  pthread_mutex_unlock(&c->mutex);
+  return got;
+}
+
+/* 블록 n개를 클래스로 돌려줌, 통째로 빈 span은 OS에 반납 */
+static void class_give(int cls, void **blk, int n) {
+  slab_class_t *c = &classes[cls];
+  span_t *empty[SLAB_MAG_MAX];
+  int nempty = 0;
+
+  pthread_mutex_lock(&c->mutex);
+  for (int i = 0; i < n; i++) {
+    span_t *s = span_of(blk[i]);
+    *(void **)blk[i] = s->freelist;
+    s->freelist = blk[i];
+    if (!s->on_partial) partial_push(c, s);
+    if (++s->nfree == c->nblocks) {
+      partial_unlink(c, s);
+      empty[nempty++] = s;
+    }
+  }
+  pthread_mutex_unlock(&c->mutex);
+
+  for (int i = 0; i < nempty; i++) span_put(empty[i]);
+}
+
+/* 스레드 종료 시 magazine에 남은 블록을 클래스로 반납 */
+static void mags_flush(void *arg) {
+  magazine_t *m = arg;
+  for (int i = 0; i < SLAB_NCLASSES; i++) {
+    if (m[i].n > 0) class_give(i, m[i].blk, m[i].n);
+    m[i].n = 0;
+  }
+}
+
+/* size 바이트 이상을 담을 블록 할당, 실패 시 NULL */
+void *slab_alloc(size_t size) {
+  pthread_once(&init_once, slab_init);
+
+  if (size > SLAB_MAX_SIZE) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+  }
+
+  int cls = size_class(size);
+  slab_class_t *c = &classes[cls];
+  void *p;
+
+  if (c->mag_cap == 0)
+    return class_take(cls, &p, 1) ? p : NULL;
+
+  magazine_t *m = &mags[cls];
+  if (m->n == 0) {
+    if (!mags_registered) {
+      pthread_setspecific(mag_key, mags);
+      mags_registered = 1;
+    }
+    m->n = class_take(cls, m->blk, (c->mag_cap + 1) / 2);
+    if (m->n == 0) return NULL;
+  }
+  return m->blk[--m->n];
+}
+
+/* slab_alloc(size)로 받은 블록 반납 (size는 할당 때와 같아야 함) */
+void slab_free(void *p, size_t size) {
+  if (!p) return;
+  if (size > SLAB_MAX_SIZE) {
+    munmap(p, size);
+    return;
+  }
+
+  int cls = size_class(size);
+  slab_class_t *c = &classes[cls];
+
+  if (c->mag_cap == 0) {
+    class_give(cls, &p, 1);
+    return;
+  }
+
+  magazine_t *m = &mags[cls];
+  if (m->n == c->mag_cap) {                 // 가득 차면 위쪽 절반을 클래스로
+    int keep = c->mag_cap / 2;
+    class_give(cls, m->blk + keep, m->n - keep);
+    m->n = keep;
+  }
+  m->blk[m->n++] = p;
+}
+
+/* size 바이트 할당이 실제로 차지하는 바이트 (캐시 예산 계산용) */
+size_t slab_usable(size_t size) {
+  long page;
+  if (size > SLAB_MAX_SIZE) {
+    page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+  }
+  return class_size(size_class(size));
+}
+
+/* 블록이 하나라도 살아 있는 span의 총 바이트 */
+size_t slab_resident_bytes(void) {
+  return atomic_load(&resident);
+}
@@ -0,0 +1,26 @@
+/*
+ * slab.h - 캐시 페이로드 전용 size-class 슬랩 할당기
+ *
+ * - jemalloc과 비슷하게 2의 거듭제곱 구간마다 4개의 크기 클래스
+ *   (64, 80, 96, 112, 128, 160, ... 128 KiB)
+ * - 같은 클래스의 블록은 1 MiB 정렬된 span에서 잘라 쓰고,
+ *   span이 통째로 비면 madvise로 페이지를 OS에 돌려준다
+ * - 작은 클래스는 스레드별 magazine에서 잠금 없이 할당/해제
+ * - 크기를 알고 해제하는 방식(sized free)이라 블록 헤더가 없음
+ */
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+
+#define SLAB_MIN_SIZE 64                    // 가장 작은 클래스
+#define SLAB_MAX_SIZE (128 * 1024)          // 가장 큰 클래스, 넘으면 mmap 직접 사용
+#define SLAB_NCLASSES 45                    // 64 B ~ 128 KiB, 구간당 4개
+#define SLAB_SPAN_SIZE (1 << 20)            // span 크기이자 정렬 단위
+
+void *slab_alloc(size_t size);
+void slab_free(void *p, size_t size);
+size_t slab_usable(size_t size);
+size_t slab_resident_bytes(void);
+
+#endif /* __SLAB_H__ */
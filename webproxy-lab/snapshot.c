@@ -0,0 +1,152 @@
+/*
+ * snapshot.c - 캐시 스냅샷 쓰기와 웜 재시작 구현
+ *
+ * 불러온 스냅샷은 프로세스가 끝날 때까지 매핑해 둔다 (크기는 RAM 캐시 한도 정도).
+ * 표는 시작할 때 한 번 만들고 그 뒤로는 칸의 오프셋만 0으로 지우므로(forget)
+ * 조회는 잠금 없이 한다. RAM으로 올라간 키나 새로 삽입된 키는 표에서 잊혀
+ * 옛 사본이 다시 보이지 않는다.
+ */
+#include <stdatomic.h>
+#include "csapp.h"
+#include "cache.h"
+#include "snapshot.h"
+#include "radix.h"
+
+typedef struct {
+  uint64_t magic;
+  int64_t written;                          // 쓴 시각
+} snapshot_hdr_t;
+
+/* 해시 -> 레코드 오프셋 (열린 주소법)
+ * - hash가 0이면 빈 칸 (해시가 0인 레코드는 올리지 않음)
+ * - off가 0이면 잊힌 키. 칸은 그대로 두어 탐색이 이어지게 함
+ *   (레코드는 파일 헤더 뒤부터 있으므로 오프셋 0은 쓰이지 않음)
+ */
+typedef struct {
+  unsigned long hash;
+  atomic_size_t off;
+} snap_slot_t;
+
+typedef struct {
+  int fd;
+  int err;
+} snap_writer_t;
+
+static char *map;
+static size_t map_len;
+static snap_slot_t *table;
+static size_t mask;
+
+/* 자식 프로세스: 엔트리 하나를 레코드로 씀 (cache_foreach 콜백) */
+static void save_one(const disk_obj_t *o, void *arg) {
+  snap_writer_t *w = arg;
+  disk_rec_t rec;
+  struct iovec iov[DISK_REC_IOV];
+
+  if (w->err || !disk_rec_iov(o, &rec, iov)) return;
+  if (writev(w->fd, iov, DISK_REC_IOV) != (ssize_t)rec.size) w->err = 1;
+}
+
+/* 지금 캐시 내용을 path에 스냅샷으로 씀 (끝날 때까지 기다림)
+ * 반환값: 성공 0, 실패 -1
+ */
+int snapshot_save(const char *path) {
+  char tmp[MAXLINE];
+  pid_t pid;
+  int status;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if ((pid = fork()) < 0) return -1;
+  if (pid == 0) {
+    /* 자식: 다른 스레드가 없으므로 캐시를 잠금 없이 훑어도 아무것도 바뀌지 않음 */
+    snapshot_hdr_t hdr = { SNAPSHOT_MAGIC, time(NULL) };
+    snap_writer_t w = { open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644), 0 };
+
+    if (w.fd < 0) _exit(1);
+    if (write(w.fd, &hdr, sizeof(hdr)) != sizeof(hdr)) w.err = 1;
+    cache_foreach(save_one, &w);
+    if (w.err || fsync(w.fd) < 0 || close(w.fd) < 0 || rename(tmp, path) < 0) {
+      unlink(tmp);
+      _exit(1);
+    }
+    _exit(0);
+  }
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR) return -1;
+  return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+/* 웜 재시작: 스냅샷을 매핑하고 표를 만듦 (워커를 만들기 전에 한 번 호출)
+ * - must-revalidate인데 검증자가 없고 이미 만료된 레코드는 쓸 데가 없어 건너뜀
+ * - 올린 키는 PURGE가 찾을 수 있게 키 색인(radix.h)에 스냅샷 비트로 올림
+ *   (표처럼 불러올 때만 커지고, 비트는 PURGE만 뺌)
+ * 반환값: 올린 레코드 수, 파일이 없거나 형식이 다르면 -1
+ */
+int snapshot_load(const char *path) {
+  struct stat st;
+  disk_obj_t o;
+  size_t off, size, cap;
+  time_t now = time(NULL);
+  int fd, n = 0;
+
+  if ((fd = open(path, O_RDONLY)) < 0) return -1;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(snapshot_hdr_t) ||
+      (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    map = NULL;
+    return -1;
+  }
+  close(fd);
+  map_len = st.st_size;
+  if (((snapshot_hdr_t *)map)->magic != SNAPSHOT_MAGIC) {
+    munmap(map, map_len);
+    map = NULL;
+    return -1;
+  }
+
+  /* 레코드 수로 표 크기를 정하고 (채움률 1/2 이하), 다시 훑으며 채움
+   * 파일 끝이 잘렸거나 손상된 레코드를 만나면 거기까지만 씀 */
+  for (off = sizeof(snapshot_hdr_t); (size = disk_rec_decode(map + off, map_len - off, &o)) > 0; off += size)
+    n++;
+  for (cap = 16; cap < (size_t)n * 2; cap <<= 1)
+    ;
+  table = Calloc(cap, sizeof(*table));
+  mask = cap - 1;
+
+  n = 0;
+  for (off = sizeof(snapshot_hdr_t); (size = disk_rec_decode(map + off, map_len - off, &o)) > 0; off += size) {
+    size_t i;
+    if (!o.hash || (o.must_revalidate && !o.etag && !o.last_mod && now >= o.expires)) continue;
+    for (i = o.hash & mask; table[i].hash; i = (i + 1) & mask)
+      ;
+    table[i].hash = o.hash;
+    atomic_store(&table[i].off, off);
+    radix_add(o.key, o.hash, RADIX_SNAP);
+    n++;
+  }
+  return n;
+}
+
+/* 스냅샷에서 키 조회 (o의 포인터는 매핑 안을 가리키며 프로세스가 끝날 때까지 유효)
+ * 반환값: 적중 1, 미스 0
+ */
+int snapshot_get(unsigned long hash, const char *key, disk_obj_t *o) {
+  size_t i, off;
+
+  if (!table) return 0;
+  for (i = hash & mask; table[i].hash; i = (i + 1) & mask) {
+    if (table[i].hash != hash || (off = atomic_load(&table[i].off)) == 0) continue;
+    if (disk_rec_decode(map + off, map_len - off, o) && !strcmp(o->key, key)) return 1;
+  }
+  return 0;
+}
+
+/* 키를 표에서 잊음 (RAM에 올렸거나 더 새 응답이 들어왔을 때) */
+void snapshot_forget(unsigned long hash) {
+  size_t i;
+
+  if (!table) return;
+  for (i = hash & mask; table[i].hash; i = (i + 1) & mask) {
+    if (table[i].hash == hash) atomic_store(&table[i].off, 0);
+  }
+}
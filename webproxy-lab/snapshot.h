@@ -0,0 +1,26 @@
+/*
+ * snapshot.h - 캐시 스냅샷과 웜 재시작
+ *
+ * - snapshot_save: fork한 자식이 copy-on-write로 멈춰 있는 캐시 이미지를 훑어 파일로 쓴다.
+ *   워커는 그동안 멈추지 않고, 자식은 잠금도 malloc도 쓰지 않는다.
+ *   path.tmp에 다 쓴 뒤 rename하므로 읽는 쪽은 항상 완성된 파일만 본다
+ * - snapshot_load: 시작할 때 파일을 mmap 하고 레코드 헤더만 훑어 해시 -> 오프셋 표를 만든다.
+ *   본문은 첫 적중 때 RAM 캐시로 올리므로 시작 비용은 레코드 수에만 비례한다
+ * - 파일 형식은 헤더 뒤에 디스크 계층과 같은 레코드(disk_rec_t)를 이어 붙인 것
+ * - 신선도는 절대 시각(expires, born)으로 저장하므로, 꺼져 있던 동안 만료된 엔트리는
+ *   다시 켜졌을 때 만료로 보여 재검증 / stale 규칙을 그대로 따르고 Age에도 꺼져 있던 시간이 들어간다
+ */
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "disk.h"
+
+#define SNAPSHOT_MAGIC 0x31504e5358505250UL   // 파일 시작 표시 ("PRPXSNP1")
+#define SNAPSHOT_DEFAULT_INTERVAL 300         // 주기적 스냅샷 간격 기본값 (초)
+
+int snapshot_save(const char *path);
+int snapshot_load(const char *path);
+int snapshot_get(unsigned long hash, const char *key, disk_obj_t *o);
+void snapshot_forget(unsigned long hash);
+
+#endif /* __SNAPSHOT_H__ */
@@ -0,0 +1,129 @@
+/*
+ * swiss.c - Swiss table 쓰기 쪽 구현 (조회는 swiss.h의 인라인 함수)
+ *
+ * 칸 번호 = 그룹 * SWISS_GROUP + 그룹 안 위치. 제어 바이트 배열은 16바이트로 정렬해
+ * 조회가 그룹을 정렬된 SSE2 로드 한 번으로 읽게 한다.
+ */
+#include "csapp.h"
+#include "swiss.h"
+
+/* slots 이상인 2의 거듭제곱 칸 수(그룹 하나 이상)로 빈 표를 만듦 */
+swiss_table_t *swiss_new(size_t slots) {
+  swiss_table_t *t = Malloc(sizeof(*t));
+  size_t groups = 1, n;
+
+  while (groups * SWISS_GROUP < slots) groups <<= 1;
+  n = groups * SWISS_GROUP;
+  t->groups = groups;
+  t->used = t->tombs = 0;
+  if (posix_memalign((void **)&t->ctrl, SWISS_GROUP, n) != 0) unix_error("swiss_new error");
+  t->items = Malloc(n * sizeof(*t->items));
+  for (size_t i = 0; i < n; i++) {
+    atomic_init(&t->ctrl[i], SWISS_EMPTY);
+    atomic_init(&t->items[i], NULL);
+  }
+  return t;
+}
+
+void swiss_free(swiss_table_t *t) {
+  free(t->ctrl);
+  Free(t->items);
+  Free(t);
+}
+
+static void retire_free(epoch_node_t *node) {
+  swiss_free((swiss_table_t *)((char *)node - offsetof(swiss_table_t, retire)));
+}
+
+/* 항목을 넣을 칸: 탐색 순서에서 처음 만나는 빈칸이나 지운 칸 */
+static size_t free_slot(const swiss_table_t *t, unsigned long hash) {
+  size_t g = hash & (t->groups - 1), step = 0;
+  unsigned int free;
+
+  while (1) {
+    free = 0;
+    for (int i = 0; i < SWISS_GROUP; i++) {
+      unsigned char c = atomic_load_explicit(&t->ctrl[g * SWISS_GROUP + i], memory_order_relaxed);
+      if (c == SWISS_EMPTY || c == SWISS_DELETED) free |= 1u << i;
+    }
+    if (free) return g * SWISS_GROUP + __builtin_ctz(free);
+    g = (g + ++step) & (t->groups - 1);
+  }
+}
+
+/* 항목을 넣고 칸 번호를 돌려줌 (같은 키가 없음을 호출한 쪽이 보장, 쓰기 잠금 아래)
+ * 항목을 먼저 쓰고 태그를 release로 게시 */
+size_t swiss_insert(swiss_table_t *t, unsigned long hash, void *item) {
+  size_t pos = free_slot(t, hash);
+
+  if (atomic_load_explicit(&t->ctrl[pos], memory_order_relaxed) == SWISS_DELETED) t->tombs--;
+  t->used++;
+  atomic_store_explicit(&t->items[pos], item, memory_order_release);
+  atomic_store_explicit(&t->ctrl[pos], swiss_tag(hash), memory_order_release);
+  return pos;
+}
+
+/* 같은 키의 새 항목으로 교체 (태그는 그대로) */
+void swiss_set(swiss_table_t *t, size_t pos, void *item) {
+  atomic_store_explicit(&t->items[pos], item, memory_order_release);
+}
+
+/* 칸을 비움
+ * - 그룹에 빈칸이 이미 있으면 탐색이 이 그룹에서 멈추므로 빈칸으로 되돌리고,
+ *   아니면 뒤 그룹으로 이어지는 탐색이 끊기지 않게 지운 칸으로 표시
+ */
+void swiss_erase(swiss_table_t *t, size_t pos) {
+  size_t g = pos / SWISS_GROUP;
+  int empty = 0;
+
+  for (int i = 0; i < SWISS_GROUP; i++)
+    if (atomic_load_explicit(&t->ctrl[g * SWISS_GROUP + i], memory_order_relaxed) == SWISS_EMPTY)
+      empty = 1;
+  atomic_store_explicit(&t->ctrl[pos], empty ? SWISS_EMPTY : SWISS_DELETED, memory_order_release);
+  atomic_store_explicit(&t->items[pos], NULL, memory_order_release);
+  t->used--;
+  if (!empty) t->tombs++;
+}
+
+/* 항목 포인터가 든 칸을 찾음 (쓰기 잠금 아래, 지울 칸 찾기)
+ * 반환값: 찾았으면 1 */
+int swiss_find_item(const swiss_table_t *t, unsigned long hash, const void *item, size_t *pos) {
+  swiss_probe_t p;
+  void *cur;
+
+  swiss_probe(t, hash, &p);
+  while ((cur = swiss_next(&p)) != NULL) {
+    if (cur == item) {
+      *pos = p.pos;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* pos번 칸의 항목 (없으면 NULL): 표 전체를 훑을 때 */
+void *swiss_at(const swiss_table_t *t, size_t pos) {
+  return atomic_load_explicit(&t->items[pos], memory_order_acquire);
+}
+
+size_t swiss_slots(const swiss_table_t *t) {
+  return t->groups * SWISS_GROUP;
+}
+
+/* 지운 칸이 SWISS_MAX_LOAD를 넘게 쌓였으면 살아 있는 항목만으로 새 표를 만듦
+ * - 항목이 칸 수의 절반을 넘으면 두 배로 키움
+ * - 새 표는 호출한 쪽이 release로 게시하고, 옛 표는 여기서 epoch_retire로 넘김
+ * 반환값: 새 표, 그대로 써도 되면 t
+ */
+swiss_table_t *swiss_compact(swiss_table_t *t, unsigned long (*hash_of)(const void *item)) {
+  size_t n = swiss_slots(t);
+  swiss_table_t *nt;
+  void *item;
+
+  if ((t->used + t->tombs) * 8 <= n * SWISS_MAX_LOAD) return t;
+  nt = swiss_new(t->used * 2 > n ? n * 2 : n);
+  for (size_t i = 0; i < n; i++)
+    if ((item = swiss_at(t, i)) != NULL) swiss_insert(nt, hash_of(item), item);
+  epoch_retire(&t->retire, retire_free);
+  return nt;
+}
@@ -0,0 +1,117 @@
+/*
+ * swiss.h - 캐시 인덱스용 열린 주소법 해시 표 (Swiss table 방식)
+ *
+ * 칸마다 1바이트 제어 바이트를 따로 모아 두고, 16칸을 한 그룹으로 묶는다.
+ * - 제어 바이트: 빈칸(SWISS_EMPTY), 지운 칸(SWISS_DELETED), 아니면 해시에서 뽑은 7비트 태그
+ * - 조회는 그룹 하나(16바이트, 캐시 라인의 1/4)를 SSE2 비교 한 번으로 태그와 맞춰 보고,
+ *   태그가 같은 칸의 항목만 꺼내 키를 비교한다. 빈칸이 있는 그룹에서 멈춤
+ * - 그룹은 삼각수 간격으로 탐색하므로 그룹 수가 2의 거듭제곱이면 모든 그룹을 돈다
+ * - 항목은 포인터만 둔다. 캐시 엔트리는 키를 엔트리 블록 안에 함께 두므로(슬랩)
+ *   태그가 맞은 뒤 키 비교는 엔트리 한 곳만 읽는다
+ *
+ * 동시성
+ * - 쓰기(삽입, 교체, 지움, 재구성)는 호출한 쪽이 잠금으로 직렬화한다
+ * - 읽기는 잠금 없이 한다. 삽입은 항목을 먼저 release로 쓰고 태그를 나중에 쓰므로
+ *   태그를 본 조회는 항목을 본다(그새 지워졌으면 NULL을 보고 건너뜀)
+ * - 지운 칸이 쌓이면 같은 크기의 새 표를 만들어 게시하고 옛 표는 epoch_retire로 넘긴다
+ *   (잠금 없이 옛 표를 보던 조회는 유예 기간 동안 그대로 읽음)
+ * - 항목의 수명은 호출한 쪽이 에포크로 지킨다 (태그가 맞은 항목은 키로 다시 확인)
+ */
+#ifndef __SWISS_H__
+#define __SWISS_H__
+
+#include <stddef.h>
+#include <stdatomic.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "epoch.h"
+
+#define SWISS_GROUP 16            // 그룹 하나의 칸 수 (SSE2 레지스터 하나)
+#define SWISS_EMPTY 0x80          // 한 번도 쓰지 않은 칸
+#define SWISS_DELETED 0xfe        // 지운 칸 (탐색은 지나감)
+#define SWISS_MAX_LOAD 7          // (쓰는 칸 + 지운 칸)이 칸 수의 8분의 이만큼을 넘으면 재구성
+
+typedef struct swiss_table {
+  size_t groups;                    // 그룹 수 (2의 거듭제곱)
+  size_t used;                      // 항목이 든 칸 수 (쓰는 쪽만)
+  size_t tombs;                     // 지운 칸 수 (쓰는 쪽만)
+  epoch_node_t retire;              // 재구성 뒤 옛 표 회수용
+  atomic_uchar *ctrl;               // 제어 바이트 (groups * SWISS_GROUP, 16바이트 정렬)
+  _Atomic(void *) *items;           // 칸별 항목
+} swiss_table_t;
+
+/* 조회 진행 상태 (swiss_probe로 시작해 swiss_next로 후보를 하나씩 받음) */
+typedef struct {
+  const swiss_table_t *t;
+  size_t group;                     // 지금 그룹
+  size_t step;                      // 지나온 그룹 수
+  unsigned int match;               // 지금 그룹에서 아직 돌려주지 않은 태그 일치 칸 (비트)
+  unsigned int stop;                // 지금 그룹에 빈칸이 있으면 0이 아님 (다음 그룹으로 가지 않음)
+  unsigned char tag;
+  size_t pos;                       // 마지막으로 돌려준 칸 번호
+} swiss_probe_t;
+
+/* 해시에서 태그(7비트)와 첫 그룹을 뽑음
+ * 캐시 샤드는 해시 상위 비트로 고르므로, 태그는 해시 전체를 곱해 섞은 상위 비트에서 뽑음 */
+static inline unsigned char swiss_tag(unsigned long hash) {
+  return (unsigned char)((hash * 0x9e3779b97f4a7c15UL) >> 57);
+}
+
+/* 그룹 g에서 태그 tag와 같은 칸 / 빈칸을 비트로 (비트 i = 그룹의 i번 칸) */
+static inline void swiss_group_match(const swiss_table_t *t, size_t g, unsigned char tag,
+                                     unsigned int *match, unsigned int *empty) {
+  const unsigned char *c = (const unsigned char *)&t->ctrl[g * SWISS_GROUP];
+#ifdef __SSE2__
+  __m128i v = _mm_load_si128((const __m128i *)c);
+  *match = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)tag)));
+  *empty = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)SWISS_EMPTY)));
+#else
+  *match = *empty = 0;
+  for (int i = 0; i < SWISS_GROUP; i++) {
+    if (c[i] == tag) *match |= 1u << i;
+    if (c[i] == SWISS_EMPTY) *empty |= 1u << i;
+  }
+#endif
+  atomic_thread_fence(memory_order_acquire);    // 태그를 본 뒤에 항목을 읽음
+}
+
+/* hash로 조회 시작 (캐시 적중 경로라 헤더에 둠) */
+static inline void swiss_probe(const swiss_table_t *t, unsigned long hash, swiss_probe_t *p) {
+  p->t = t;
+  p->tag = swiss_tag(hash);
+  p->group = hash & (t->groups - 1);
+  p->step = 0;
+  swiss_group_match(t, p->group, p->tag, &p->match, &p->stop);
+}
+
+/* 태그가 같은 다음 후보 항목 (p->pos가 그 칸), 더 없으면 NULL
+ * 호출한 쪽이 항목의 키를 비교하고, 다르면 다시 부름 */
+static inline void *swiss_next(swiss_probe_t *p) {
+  void *item;
+
+  while (1) {
+    while (p->match) {
+      int i = __builtin_ctz(p->match);
+      p->match &= p->match - 1;
+      p->pos = p->group * SWISS_GROUP + i;
+      if ((item = atomic_load_explicit(&p->t->items[p->pos], memory_order_acquire)) != NULL)
+        return item;
+    }
+    if (p->stop || ++p->step >= p->t->groups) return NULL;
+    p->group = (p->group + p->step) & (p->t->groups - 1);
+    swiss_group_match(p->t, p->group, p->tag, &p->match, &p->stop);
+  }
+}
+
+swiss_table_t *swiss_new(size_t slots);
+void swiss_free(swiss_table_t *t);
+size_t swiss_insert(swiss_table_t *t, unsigned long hash, void *item);
+void swiss_set(swiss_table_t *t, size_t pos, void *item);
+void swiss_erase(swiss_table_t *t, size_t pos);
+int swiss_find_item(const swiss_table_t *t, unsigned long hash, const void *item, size_t *pos);
+void *swiss_at(const swiss_table_t *t, size_t pos);
+size_t swiss_slots(const swiss_table_t *t);
+swiss_table_t *swiss_compact(swiss_table_t *t, unsigned long (*hash_of)(const void *item));
+
+#endif /* __SWISS_H__ */
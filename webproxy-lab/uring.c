@@ -0,0 +1,183 @@
+/*
+ * uring.c - io_uring 링 최소 래퍼 구현
+ *
+ * 반환값은 csapp의 소문자 함수들처럼 실패 시 -1과 errno
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+#define URING_CQ_ENTRIES 4096       // 다중 샷 poll / accept가 몰려도 넘치지 않을 만큼
+
+static void uring_unmap(uring_t *r) {
+  if (r->sqes && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_len);
+  if (r->cq_map && r->cq_map != MAP_FAILED && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_len);
+  if (r->sq_map && r->sq_map != MAP_FAILED) munmap(r->sq_map, r->sq_map_len);
+}
+
+/* 링을 만들고 세 영역을 매핑
+ * - 확장 인자(시간 제한 있는 대기)와 CQ 넘침 보존을 못 하는 커널이면 ENOSYS로 실패
+ */
+int uring_init(uring_t *r, unsigned entries) {
+  struct io_uring_params p;
+  char *sq, *cq;
+
+  memset(r, 0, sizeof(*r));
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+  p.cq_entries = URING_CQ_ENTRIES;
+  if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0 && errno == EINVAL) {
+    memset(&p, 0, sizeof(p));                     // 오래된 커널: 기본 설정으로
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+  }
+  if (r->fd < 0) return -1;
+  if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+    close(r->fd);
+    errno = ENOSYS;
+    return -1;
+  }
+
+  r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cq_map_len > r->sq_map_len) r->sq_map_len = r->cq_map_len;
+    r->cq_map_len = r->sq_map_len;
+  }
+  r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQ_RING);
+  r->cq_map = (p.features & IORING_FEAT_SINGLE_MMAP) ? r->sq_map :
+              mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_CQ_RING);
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 r->fd, IORING_OFF_SQES);
+  if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+    uring_unmap(r);
+    close(r->fd);
+    return -1;
+  }
+
+  sq = r->sq_map;
+  cq = r->cq_map;
+  r->sq_head = (unsigned *)(sq + p.sq_off.head);
+  r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  r->sq_array = (unsigned *)(sq + p.sq_off.array);
+  r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+  r->sq_entries = p.sq_entries;
+  r->cq_head = (unsigned *)(cq + p.cq_off.head);
+  r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  for (unsigned i = 0; i < p.sq_entries; i++)     // SQ 슬롯 i는 항상 SQE i
+    r->sq_array[i] = i;
+  r->sq_local = *r->sq_tail;
+  r->enter_fd = r->fd;
+  return 0;
+}
+
+/* 링 fd를 부르는 스레드에 등록 (되면 enter마다 fd 조회를 건너뜀, 못 해도 그대로 씀)
+ * - 등록은 스레드별이라 링을 돌릴 스레드가 불러야 함
+ */
+void uring_register_ring(uring_t *r) {
+  struct io_uring_rsrc_update up;
+
+  memset(&up, 0, sizeof(up));
+  up.offset = -1U;
+  up.data = r->fd;
+  if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_RING_FDS, &up, 1) == 1) {
+    r->enter_fd = up.offset;
+    r->enter_flags = IORING_ENTER_REGISTERED_RING;
+  }
+}
+
+void uring_free(uring_t *r) {
+  uring_unmap(r);
+  close(r->fd);
+  free(r->br);
+  free(r->bufs);
+}
+
+/* 빈 SQE 하나 (SQ가 차 있으면 먼저 제출해 자리를 만듦) */
+struct io_uring_sqe *uring_sqe(uring_t *r) {
+  struct io_uring_sqe *sqe;
+
+  uring_reserve(r, 1);
+  sqe = &r->sqes[r->sq_local & r->sq_mask];
+  r->sq_local++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+/* 이어지는 SQE n개가 한 번에 제출되도록 자리를 확보 (연결된 요청이 나뉘면 안 됨) */
+void uring_reserve(uring_t *r, unsigned n) {
+  if (r->sq_local - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) + n > r->sq_entries)
+    uring_enter(r, 0, 0);
+}
+
+/* 채워 둔 SQE를 모두 제출하고, wait이면 완료가 하나라도 올 때까지 최대 timeout_ms 대기
+ * 반환값: 제출한 SQE 수, 실패 -1 (시간이 다 되면 ETIME)
+ */
+int uring_enter(uring_t *r, int wait, int timeout_ms) {
+  struct __kernel_timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+  struct io_uring_getevents_arg arg;
+  unsigned submit = r->sq_local - *r->sq_tail;
+  unsigned flags = r->enter_flags;
+
+  __atomic_store_n(r->sq_tail, r->sq_local, __ATOMIC_RELEASE);
+  if (!wait) {
+    if (submit == 0) return 0;
+    return syscall(__NR_io_uring_enter, r->enter_fd, submit, 0, flags, NULL, 0);
+  }
+  memset(&arg, 0, sizeof(arg));
+  arg.ts = (unsigned long)&ts;
+  flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+  return syscall(__NR_io_uring_enter, r->enter_fd, submit, 1, flags, &arg, sizeof(arg));
+}
+
+/* 크기 size인 버퍼 n개(2의 거듭제곱)를 제공 버퍼 그룹 URING_BGID로 등록 */
+int uring_bufs_init(uring_t *r, unsigned n, size_t size) {
+  struct io_uring_buf_reg reg;
+  long page = sysconf(_SC_PAGESIZE);
+  void *ring;
+
+  if (posix_memalign(&ring, page, n * sizeof(struct io_uring_buf)) != 0) return -1;
+  memset(ring, 0, n * sizeof(struct io_uring_buf));
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (unsigned long)ring;
+  reg.ring_entries = n;
+  reg.bgid = URING_BGID;
+  if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0 ||
+      (r->bufs = malloc(n * size)) == NULL) {
+    free(ring);
+    return -1;
+  }
+  r->br = ring;
+  r->nbufs = n;
+  r->buf_size = size;
+  r->br_tail = 0;
+  for (unsigned i = 0; i < n; i++)
+    uring_buf_put(r, i);
+  return 0;
+}
+
+/* 다 쓴 제공 버퍼를 커널에 돌려줌 */
+void uring_buf_put(uring_t *r, unsigned bid) {
+  struct io_uring_buf *b = &r->br->bufs[r->br_tail & (r->nbufs - 1)];
+
+  b->addr = (unsigned long)(r->bufs + (size_t)bid * r->buf_size);
+  b->len = r->buf_size;
+  b->bid = bid;
+  r->br_tail++;
+  __atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+}
+
+/* fds를 고정 파일 0..n-1번으로 등록 (SQE에서 IOSQE_FIXED_FILE과 함께 번호로 씀) */
+int uring_register_files(uring_t *r, const int *fds, unsigned n) {
+  if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES, fds, n) < 0) return -1;
+  r->nfiles = n;
+  return 0;
+}
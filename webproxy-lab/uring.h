@@ -0,0 +1,66 @@
+/*
+ * uring.h - io_uring 링 최소 래퍼 (liburing 없이 시스템 호출 세 개로)
+ *
+ * - 제출 큐(SQ)에 SQE를 채워 두면 uring_enter 한 번이 제출과 완료 대기를 같이 한다
+ * - 완료 큐(CQ)는 커널과 공유하는 메모리라 시스템 호출 없이 읽는다
+ * - 제공 버퍼 링: 수신 버퍼를 미리 커널에 맡겨 두면 데이터가 온 시점에 커널이 하나를
+ *   골라 채우므로, 기다리기만 하는 소켓마다 버퍼를 잡아 둘 필요가 없다
+ * - 링 fd와 리스닝 소켓을 등록해 두면 enter / accept 때마다 fd 조회를 건너뛴다
+ * 링 하나는 스레드 하나(이벤트 루프)만 쓴다
+ */
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#define URING_BGID 0                // 제공 버퍼 그룹 번호 (링마다 하나)
+
+typedef struct uring {
+  int fd;
+  int enter_fd;                     // enter에 넘기는 fd (링 fd를 등록했으면 등록 번호)
+  unsigned enter_flags;
+  unsigned *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries;
+  unsigned sq_local;                // 채웠지만 아직 커널에 알리지 않은 tail
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head, *cq_tail, cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_map, *cq_map;
+  size_t sq_map_len, cq_map_len, sqes_len;
+  struct io_uring_buf_ring *br;     // 제공 버퍼 링 (없으면 NULL)
+  char *bufs;                       // 제공 버퍼 본체 (nbufs * buf_size)
+  unsigned nbufs;
+  size_t buf_size;
+  unsigned short br_tail;
+  unsigned nfiles;                  // 등록한 고정 파일 수
+} uring_t;
+
+int uring_init(uring_t *r, unsigned entries);
+void uring_free(uring_t *r);
+void uring_register_ring(uring_t *r);
+struct io_uring_sqe *uring_sqe(uring_t *r);
+void uring_reserve(uring_t *r, unsigned n);
+int uring_enter(uring_t *r, int wait, int timeout_ms);
+int uring_bufs_init(uring_t *r, unsigned n, size_t size);
+void uring_buf_put(uring_t *r, unsigned bid);
+int uring_register_files(uring_t *r, const int *fds, unsigned n);
+
+/* 다음 완료 (없으면 NULL), 다 본 뒤 uring_cqe_seen으로 자리를 돌려줌 */
+static inline struct io_uring_cqe *uring_cqe(uring_t *r) {
+  unsigned head = *r->cq_head;
+
+  if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+  return &r->cqes[head & r->cq_mask];
+}
+
+static inline void uring_cqe_seen(uring_t *r) {
+  __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* 완료가 고른 제공 버퍼 (CQE에 버퍼가 없으면 NULL) */
+static inline char *uring_buf(uring_t *r, unsigned flags) {
+  if (!(flags & IORING_CQE_F_BUFFER)) return NULL;
+  return r->bufs + (size_t)(flags >> IORING_CQE_BUFFER_SHIFT) * r->buf_size;
+}
+
+#endif /* __URING_H__ */